@@ -41,6 +41,10 @@ import <cmath>;
 import <array>;
 import <concepts>;
 import <optional>;
+import <cstring>;
+import <utility>;
+import <bit>;
+import <chrono>;
 
 namespace pe{
 
@@ -115,6 +119,11 @@ inline constinit auto s_size_classes{[]() constexpr{
 
 inline std::size_t s_page_size = 4096;
 
+inline std::size_t round_to_pages(std::size_t bytes)
+{
+    return ((bytes + s_page_size - 1) / s_page_size) * s_page_size;
+}
+
 /*****************************************************************************/
 /* SUPERBLOCK STATE                                                          */
 /*****************************************************************************/
@@ -157,6 +166,8 @@ struct alignas(16) SuperblockDescriptor
     std::size_t            m_blocksize;  /* size of each block in superblock */
     std::size_t            m_maxcount;   /* number of blocks */
     std::size_t            m_sizeclass;  /* size class of blocks in superblock */
+    std::size_t            m_mapsize;    /* size of the mapping backing a large block */
+    uint64_t               m_cached_at;  /* time a large mapping was cached, in ns */
 };
 
 static_assert(std::is_standard_layout_v<SuperblockDescriptor>);
@@ -214,6 +225,62 @@ public:
     void                  Retire(SuperblockDescriptor& desc);
 };
 
+/*****************************************************************************/
+/* LARGE MAPPING CACHE                                                       */
+/*****************************************************************************/
+/*
+ * Large blocks are backed by dedicated mappings. Rather than returning
+ * a mapping to the OS as soon as its' block is freed, it is retained in 
+ * a cache bucketed by size, so that a similarly sized block allocated 
+ * soon after (i.e. on the next frame) can reuse it without any system 
+ * calls or page faults. Every power-of-two range of sizes is split into
+ * kSubBuckets buckets and mappings are rounded up to the bucket size, 
+ * wasting at most a fraction of 1/kSubBuckets of the mapping. The total 
+ * size of the retained mappings is bounded, and mappings which have not 
+ * been reused for kDecayTime are returned to the OS.
+ */
+
+class LargeMappingCache
+{
+private:
+
+    static constexpr std::size_t kSubBuckets = 4;
+    static constexpr std::size_t kMinOctave = std::bit_width(kMaxBlockSize) - 1;
+    static constexpr std::size_t kMaxCachedSize = 32 * 1024 * 1024;
+    static constexpr std::size_t kMaxOctave = std::bit_width(kMaxCachedSize - 1) - 1;
+    static constexpr std::size_t kNumBuckets = (kMaxOctave - kMinOctave + 1) * kSubBuckets;
+    static constexpr std::size_t kMaxRetainedBytes = 64 * 1024 * 1024;
+    static constexpr uint64_t    kDecayTime = 1'000'000'000;
+    static constexpr uint64_t    kDecayInterval = 100'000'000;
+
+    DescriptorFreelist&                                  m_desclist;
+    std::array<DescriptorNode::AtomicPointer, kNumBuckets> m_buckets;
+    std::atomic_size_t                                   m_retained_bytes;
+    std::atomic_uint64_t                                 m_next_decay;
+
+    static std::size_t bucket_index(std::size_t size);
+    static std::size_t bucket_size(std::size_t idx);
+    static uint64_t    now();
+
+    SuperblockDescriptor *pop(std::size_t bucket);
+    void                  push(std::size_t bucket, DescriptorNode *first, DescriptorNode *last);
+    void                  release(SuperblockDescriptor *desc);
+    void                  decay();
+
+public:
+
+    LargeMappingCache(DescriptorFreelist& desclist);
+
+    /* The size of the mapping that will back a large block 
+     * of the specified size.
+     */
+    static std::size_t MappingSize(std::size_t size);
+
+    SuperblockDescriptor *Get(std::size_t mapsize, std::size_t alignment);
+    void                  Put(SuperblockDescriptor *desc);
+    std::size_t           GetRetainedBytes();
+};
+
 /*****************************************************************************/
 /* HEAP                                                                      */
 /*****************************************************************************/
@@ -224,6 +291,7 @@ private:
 
     DescriptorFreelist                                             m_desclist;
     std::array<DescriptorNode::AtomicPointer, kNumSizeClasses + 1> m_partial_superblocks;
+    LargeMappingCache                                              m_large_mappings;
 
 public:
 
@@ -237,6 +305,10 @@ public:
 
     SuperblockDescriptor *AllocateDescriptor();
     void                  RetireDescriptor(SuperblockDescriptor *desc); 
+
+    SuperblockDescriptor *AllocateLargeMapping(std::size_t size, std::size_t alignment);
+    void                  RetireLargeMapping(SuperblockDescriptor *desc);
+    std::size_t           GetRetainedLargeBytes();
 };
 
 /*****************************************************************************/
@@ -267,38 +339,74 @@ public:
 };
 
 /*****************************************************************************/
-/* STATIC STACK                                                              */
+/* DYNAMIC STACK                                                             */
 /*****************************************************************************/
-
-template <typename T, std::size_t Capacity>
-requires (std::is_default_constructible_v<T>)
-class StaticStack
+/*
+ * A stack of trivially copyable values, backed by anonymous
+ * pages that are only mapped once they are needed. As it is
+ * used to implement the allocator itself, it cannot rely on
+ * operator new for its' storage.
+ */
+template <typename T>
+requires (std::is_trivially_copyable_v<T>)
+class DynamicStack
 {
 private:
 
-    std::array<T, Capacity> m_array{};
-    std::size_t             m_size{};
-    std::size_t             m_capacity;
+    T           *m_array{};
+    std::size_t  m_size{};
+    std::size_t  m_capacity{};
+
+    void remap(std::size_t capacity)
+    {
+        const std::size_t old_bytes = m_capacity * sizeof(T);
+        const std::size_t new_bytes = round_to_pages(capacity * sizeof(T));
+        if(new_bytes == old_bytes)
+            return;
+
+        void *ret;
+        if(new_bytes == 0) {
+            munmap(m_array, old_bytes);
+            ret = nullptr;
+        }else if(!m_array) {
+            ret = mmap(0, new_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        }else{
+            ret = mremap(m_array, old_bytes, new_bytes, MREMAP_MAYMOVE);
+        }
+        if(ret == MAP_FAILED) [[unlikely]]
+            throw std::bad_alloc{};
+
+        m_array = reinterpret_cast<T*>(ret);
+        m_capacity = new_bytes / sizeof(T);
+    }
 
 public:
 
-    StaticStack() 
-        : m_capacity{Capacity} 
+    DynamicStack() = default;
+
+    DynamicStack(DynamicStack&& other) noexcept
+        : m_array{std::exchange(other.m_array, nullptr)}
+        , m_size{std::exchange(other.m_size, 0)}
+        , m_capacity{std::exchange(other.m_capacity, 0)}
     {}
 
-    StaticStack(std::size_t reduced_capacity)
-        : m_capacity{reduced_capacity} 
+    DynamicStack(const DynamicStack&) = delete;
+    DynamicStack& operator=(const DynamicStack&) = delete;
+
+    ~DynamicStack()
     {
-        assert(reduced_capacity <= Capacity);
+        if(m_array)
+            munmap(m_array, m_capacity * sizeof(T));
+        m_array = nullptr;
+        m_size = 0;
+        m_capacity = 0;
     }
 
-    template <typename U = T>
-    bool Push(U&& value)
+    void Push(T value)
     {
-        if(m_size == m_capacity)
-            return false;
-        m_array[m_size++] = std::forward<U>(value);
-        return true;
+        if(m_size == m_capacity) [[unlikely]]
+            remap(std::max<std::size_t>(m_capacity * 2, 1));
+        m_array[m_size++] = value;
     }
 
     std::optional<T> Pop()
@@ -315,10 +423,33 @@ public:
         return m_array[m_size - 1];
     }
 
-    std::size_t GetSize()       { return m_size;                 }
-    std::size_t GetCapacity()   { return m_capacity;             }
-    bool        Empty()         { return (m_size == 0);          }
-    bool        Full()          { return (m_size == m_capacity); }
+    T& operator[](std::size_t idx)
+    {
+        pe::assert(idx < m_size);
+        return m_array[idx];
+    }
+
+    /* Remove the 'count' elements at the bottom of the stack.
+     */
+    void EraseBottom(std::size_t count)
+    {
+        pe::assert(count <= m_size);
+        std::memmove(m_array, m_array + count, (m_size - count) * sizeof(T));
+        m_size -= count;
+    }
+
+    /* Give back the pages that are not needed to hold 
+     * 'capacity' elements.
+     */
+    void ShrinkTo(std::size_t capacity)
+    {
+        remap(std::max(capacity, m_size));
+    }
+
+    std::size_t GetSize()       { return m_size;                  }
+    std::size_t GetCapacity()   { return m_capacity;              }
+    std::size_t GetBytes()      { return m_capacity * sizeof(T);  }
+    bool        Empty()         { return (m_size == 0);           }
 };
 
 /*****************************************************************************/
@@ -326,34 +457,61 @@ public:
 /*****************************************************************************/
 /*
  * A freelist of blocks for a specific size class.
+ *
+ * The number of blocks the freelist may hold before it starts
+ * returning them to their superblocks is governed by a byte 
+ * budget which adapts to the observed demand, similar to the 
+ * 'slow start' of tcmalloc's thread caches. The budget starts 
+ * out at a single superblock's worth of blocks and grows by 
+ * another superblock every time the freelist runs dry, up to a 
+ * fixed limit. When the freelist keeps overflowing, the budget 
+ * is decreased again. On overflow, only the older half of the 
+ * cached blocks is returned, so that a thread allocating and 
+ * freeing around the boundary does not thrash between flushing 
+ * the entire freelist and filling it back up.
  */
 class BlockFreelist
 {
 private:
 
-    static constexpr std::size_t kMaxStackSize = kSuperblockSize / kMinBlockSize;
+    static constexpr std::size_t kMinBudget = kSuperblockSize;
+    static constexpr std::size_t kMaxBudget = 4 * kSuperblockSize;
+    static constexpr std::size_t kMaxOverflows = 3;
 
-    Heap&                                  m_heap;
-    Pagemap&                               m_pagemap;
-    const std::size_t                      m_sizeclass;
-    StaticStack<std::byte*, kMaxStackSize> m_blocks;
+    Heap&                    m_heap;
+    Pagemap&                 m_pagemap;
+    const std::size_t        m_sizeclass;
+    DynamicStack<std::byte*> m_blocks;
+    std::byte               *m_bump;
+    std::byte               *m_bump_end;
+    std::size_t              m_budget;
+    std::size_t              m_max_count;
+    std::size_t              m_overflows;
 
     std::size_t compute_idx(std::byte *superblock, 
         std::byte *ptr, std::size_t size_class) const;
 
     bool FillFromPartialSB();
     void FillFromNewSB();
+    void set_budget(std::size_t budget);
 
 public:
 
     BlockFreelist(Heap&, Pagemap&, std::size_t);
 
-    void       Fill();
-    void       Flush();
-    bool       IsEmpty();
-    bool       IsFull();
-    std::byte *PopBlock();
-    void       PushBlock(std::byte *block);
+    void        Fill();
+    void        Flush(std::size_t count);
+    void        Overflow();
+    void        Release();
+    bool        IsEmpty();
+    bool        IsFull();
+    std::byte  *PopBlock();
+    void        PushBlock(std::byte *block);
+
+    std::size_t GetCachedBytes();
+    std::size_t GetUncarvedBytes();
+    std::size_t GetBudgetBytes();
+    std::size_t GetOverheadBytes();
 };
 
 /*****************************************************************************/
@@ -408,24 +566,67 @@ public:
  * transfer blocks to and from the thread caches.
  */
 
+export
+struct ThreadCacheStats
+{
+    std::size_t m_cached_bytes;   /* bytes of free blocks held by the cache */
+    std::size_t m_uncarved_bytes; /* bytes of fresh superblocks not yet handed out */
+    std::size_t m_budget_bytes;   /* sum of the current per-size-class budgets */
+    std::size_t m_overhead_bytes; /* bookkeeping memory of the cache itself */
+};
+
+/* Set once the calling thread's cache has been destroyed. Any
+ * allocations and frees made by the thread from then on, such as 
+ * from the destructors of other thread-local objects, bypass it.
+ */
+inline thread_local bool t_thread_cache_destroyed = false;
+
 class ThreadCache
 {
 private:
 
     SimpleSegregatedStorage m_blocklists;
+    pthread_key_t           m_key;
 
 public:
 
-    ThreadCache(Heap& heap, Pagemap& pagemap)
+    ThreadCache(Heap& heap, Pagemap& pagemap, pthread_key_t key)
         : m_blocklists{heap, pagemap}
+        , m_key{key}
     {}
 
+    ThreadCache(const ThreadCache&) = delete;
+    ThreadCache& operator=(const ThreadCache&) = delete;
+
+    ~ThreadCache()
+    {
+        for(std::size_t sc = 1; sc <= kNumSizeClasses; sc++) {
+            m_blocklists.GetForSizeClass(sc).Release();
+        }
+        pthread_setspecific(m_key, nullptr);
+        t_thread_cache_destroyed = true;
+    }
+
     BlockFreelist& GetBlocksForSizeClass(std::size_t sc)
     {
         if(sc > kNumSizeClasses)
             throw std::out_of_range{"Invalid size class."};
         return m_blocklists.GetForSizeClass(sc);
     }
+
+    ThreadCacheStats GetStats()
+    {
+        ThreadCacheStats ret{};
+        ret.m_overhead_bytes = sizeof(ThreadCache);
+        for(std::size_t sc = 1; sc <= kNumSizeClasses; sc++) {
+            auto& blocks = m_blocklists.GetForSizeClass(sc);
+            ret.m_cached_bytes += blocks.GetCachedBytes();
+            ret.m_uncarved_bytes += blocks.GetUncarvedBytes();
+            ret.m_budget_bytes += blocks.GetBudgetBytes();
+            ret.m_overhead_bytes += blocks.GetOverheadBytes();
+        }
+        return ret;
+    }
 };
 
 /*****************************************************************************/
@@ -445,10 +646,14 @@ private:
     Pagemap&      m_pagemap;
     pthread_key_t m_thread_cache_key;
 
-    void        *allocate_large_block(std::size_t size);
+    void        *allocate_large_block(std::size_t size, std::size_t alignment = 0);
     void         deallocate_large_block(void *ptr);
+    void        *reallocate_large_block(void *ptr, std::size_t size);
     std::size_t  compute_size_class(std::size_t size);
-    ThreadCache& get_thread_cache() const;
+    ThreadCache *get_thread_cache() const;
+    void         free_block(std::byte *block, std::size_t sc);
+    void        *allocate_uncached(std::size_t sc);
+    void         free_uncached(std::byte *block, std::size_t sc);
 
     Allocator(Heap& heap, Pagemap& pagemap);
     ~Allocator();
@@ -458,13 +663,24 @@ public:
     static inline Allocator& Instance();
 
     void  *Allocate(std::size_t size);
+    void  *Reallocate(void *ptr, std::size_t size);
     void   Free(void *ptr);
 
+    /* Free a block, the size of which is known to the caller. This
+     * saves us looking up the size class in the pagemap. The size
+     * must be the one which the block was allocated with.
+     */
+    void   Free(void *ptr, std::size_t size);
+
     void  *AllocateAligned(std::size_t size, std::align_val_t align);
     void   FreeAligned(void *ptr, std::align_val_t align);
+    void   FreeAligned(void *ptr, std::size_t size, std::align_val_t align);
 
     std::size_t NextAlignedBlockSize(std::size_t size, std::size_t align);
     std::size_t AllocationSize(void *ptr);
+
+    ThreadCacheStats GetThreadCacheStats();
+    std::size_t      GetRetainedLargeBytes();
 };
 
 /*****************************************************************************/
@@ -623,6 +839,12 @@ void Pagemap::UnregisterDescriptor(SuperblockDescriptor *desc)
     std::byte *base = reinterpret_cast<std::byte*>(desc->m_superblock);
     for(int i = 0; i < npages; i++) {
         m_metadata[addr_to_key(base + (i * s_page_size))] = 0;
+
+        /* Large allocations only have their first page registered.
+         * The following pages may belong to different mappings.
+         */
+        if(desc->m_sizeclass == 0)
+            break;
     }
 }
 
@@ -632,9 +854,172 @@ std::size_t Pagemap::GetSizeClass(std::byte *block)
     return (meta >> kAddressUsedBits);
 }
 
+LargeMappingCache::LargeMappingCache(DescriptorFreelist& desclist)
+    : m_desclist{desclist}
+    , m_buckets{DescriptorNode::Pointer{nullptr, 0}}
+    , m_retained_bytes{0}
+    , m_next_decay{0}
+{}
+
+std::size_t LargeMappingCache::bucket_index(std::size_t size)
+{
+    /* The octave is such that 2^octave < size <= 2^(octave+1)
+     */
+    std::size_t octave = std::bit_width(size - 1) - 1;
+    std::size_t base = std::size_t{1} << octave;
+    std::size_t step = base / kSubBuckets;
+    std::size_t sub = (size - base + step - 1) / step;
+    pe::assert(octave >= kMinOctave && octave <= kMaxOctave);
+    pe::assert(sub >= 1 && sub <= kSubBuckets);
+    return (octave - kMinOctave) * kSubBuckets + (sub - 1);
+}
+
+std::size_t LargeMappingCache::bucket_size(std::size_t idx)
+{
+    std::size_t base = std::size_t{1} << (kMinOctave + idx / kSubBuckets);
+    return base + (idx % kSubBuckets + 1) * (base / kSubBuckets);
+}
+
+uint64_t LargeMappingCache::now()
+{
+    auto time = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+}
+
+std::size_t LargeMappingCache::MappingSize(std::size_t size)
+{
+    size = std::max<std::size_t>(size, kMaxBlockSize + 1);
+    if(size > kMaxCachedSize)
+        return round_to_pages(size);
+    return bucket_size(bucket_index(size));
+}
+
+SuperblockDescriptor *LargeMappingCache::pop(std::size_t bucket)
+{
+    DescriptorNode::Pointer head = m_buckets[bucket].Load(std::memory_order_acquire);
+    DescriptorNode *next;
+    do{
+        if(!head.m_ptr)
+            return nullptr;
+        next = head.m_ptr->m_next_partial.load(std::memory_order_relaxed);
+
+    }while(!m_buckets[bucket].CompareExchange(head, {next, head.m_count + 1},
+        std::memory_order_release, std::memory_order_acquire));
+
+    return &head.m_ptr->m_desc;
+}
+
+void LargeMappingCache::push(std::size_t bucket, DescriptorNode *first, DescriptorNode *last)
+{
+    DescriptorNode::Pointer head = m_buckets[bucket].Load(std::memory_order_acquire);
+    do{
+        last->m_next_partial.store(head.m_ptr, std::memory_order_relaxed);
+
+    }while(!m_buckets[bucket].CompareExchange(head, {first, head.m_count + 1},
+        std::memory_order_release, std::memory_order_acquire));
+}
+
+void LargeMappingCache::release(SuperblockDescriptor *desc)
+{
+    munmap(reinterpret_cast<void*>(desc->m_superblock), desc->m_mapsize);
+    m_desclist.Retire(*desc);
+}
+
+void LargeMappingCache::decay()
+{
+    /* Only a single thread at a time gets to return the
+     * stale mappings, at most once every kDecayInterval.
+     */
+    uint64_t curr = now();
+    uint64_t next = m_next_decay.load(std::memory_order_relaxed);
+    if(curr < next)
+        return;
+    if(!m_next_decay.compare_exchange_strong(next, curr + kDecayInterval,
+        std::memory_order_relaxed, std::memory_order_relaxed))
+        return;
+
+    for(std::size_t i = 0; i < kNumBuckets; i++) {
+
+        /* Detach the entire bucket and put back the mappings 
+         * that are still fresh, preserving their order.
+         */
+        DescriptorNode::Pointer head = m_buckets[i].Load(std::memory_order_acquire);
+        while(head.m_ptr && !m_buckets[i].CompareExchange(head, {nullptr, head.m_count + 1},
+            std::memory_order_release, std::memory_order_acquire));
+
+        DescriptorNode *first = nullptr, *last = nullptr;
+        DescriptorNode *node = head.m_ptr;
+        while(node) {
+            DescriptorNode *next = node->m_next_partial.load(std::memory_order_relaxed);
+            if(curr - std::min(curr, node->m_desc.m_cached_at) > kDecayTime) {
+                m_retained_bytes.fetch_sub(node->m_desc.m_mapsize, std::memory_order_relaxed);
+                release(&node->m_desc);
+            }else{
+                if(last)
+                    last->m_next_partial.store(node, std::memory_order_relaxed);
+                else
+                    first = node;
+                last = node;
+            }
+            node = next;
+        }
+        if(first)
+            push(i, first, last);
+    }
+}
+
+SuperblockDescriptor *LargeMappingCache::Get(std::size_t mapsize, std::size_t alignment)
+{
+    if(mapsize > kMaxCachedSize)
+        return nullptr;
+
+    std::size_t bucket = bucket_index(mapsize);
+    SuperblockDescriptor *ret = pop(bucket);
+    if(!ret)
+        return nullptr;
+    m_retained_bytes.fetch_sub(ret->m_mapsize, std::memory_order_relaxed);
+
+    /* Don't go looking for a suitably aligned mapping. Put
+     * back the one we got and let the caller map a new one.
+     */
+    if(ret->m_superblock % alignment) {
+        Put(ret);
+        return nullptr;
+    }
+    return ret;
+}
+
+void LargeMappingCache::Put(SuperblockDescriptor *desc)
+{
+    std::size_t mapsize = desc->m_mapsize;
+    if(mapsize > kMaxCachedSize) {
+        release(desc);
+        return;
+    }
+
+    std::size_t retained = m_retained_bytes.fetch_add(mapsize, std::memory_order_relaxed);
+    if(retained + mapsize > kMaxRetainedBytes) {
+        m_retained_bytes.fetch_sub(mapsize, std::memory_order_relaxed);
+        release(desc);
+        return;
+    }
+
+    static_assert(offsetof(DescriptorNode, m_desc) == 0);
+    DescriptorNode *node = reinterpret_cast<DescriptorNode*>(desc);
+    desc->m_cached_at = now();
+    push(bucket_index(mapsize), node, node);
+    decay();
+}
+
+std::size_t LargeMappingCache::GetRetainedBytes()
+{
+    return m_retained_bytes.load(std::memory_order_relaxed);
+}
+
 Heap::Heap()
     : m_desclist{}
     , m_partial_superblocks{DescriptorNode::Pointer{nullptr, 0}}
+    , m_large_mappings{m_desclist}
 {}
 
 SuperblockDescriptor* Heap::GetPartialSB(std::size_t size_class)
@@ -682,22 +1067,14 @@ SuperblockDescriptor* Heap::AllocateSuperblock(std::size_t size_class)
     ret->m_maxcount = kSuperblockSize / ret->m_blocksize;
     ret->m_sizeclass = size_class;
 
-    /* Form an ad-hoc freelist of blocks inside the superblock.
-     */
-    size_t nblocks = ret->m_maxcount;
-    for(int i = 0; i < nblocks; i++) {
-        std::byte *block = reinterpret_cast<std::byte*>(superblock) + (i * ret->m_blocksize);
-        std::byte *next = reinterpret_cast<std::byte*>(superblock) + ((i + 1) * ret->m_blocksize);
-        if(i == nblocks - 1)
-            next = nullptr;
-        *reinterpret_cast<std::byte**>(block) = next;
-    }
-
-    /* Because all the blocks in a newly allocated superblock
-     * are immediately given to a thread cache, a superblock
-     * that was just allocated from the OS is full and will only
-     * become partial/empty as blocks are flushed from thread
-     * caches.
+    /* The blocks of a fresh superblock are not threaded into
+     * a freelist up-front. Instead, the thread cache receiving
+     * the superblock carves blocks out of it lazily, so that
+     * only the pages that are actually used get touched. A
+     * superblock that was just allocated from the OS is full,
+     * as all its' blocks belong to that thread cache, and will 
+     * only become partial/empty as blocks are flushed from 
+     * thread caches.
      */
     ret->m_anchor.store({static_cast<uint64_t>(SuperblockState::eFull), ret->m_maxcount, 0},
         std::memory_order_release);
@@ -720,13 +1097,72 @@ void Heap::RetireDescriptor(SuperblockDescriptor *desc)
     m_desclist.Retire(*desc);
 }
 
+SuperblockDescriptor *Heap::AllocateLargeMapping(std::size_t size, std::size_t alignment)
+{
+    alignment = std::max(alignment, s_page_size);
+    const std::size_t mapsize = LargeMappingCache::MappingSize(size);
+
+    SuperblockDescriptor *desc = m_large_mappings.Get(mapsize, alignment);
+    if(!desc) {
+        /* Over-map by the alignment and trim off the excess 
+         * pages at both ends, so that the mapping is aligned.
+         */
+        const std::size_t span = mapsize + alignment - s_page_size;
+        void *mapping = mmap(0, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mapping == MAP_FAILED)
+            throw std::bad_alloc{};
+
+        uintptr_t start = reinterpret_cast<uintptr_t>(mapping);
+        uintptr_t aligned = (start + alignment - 1) & ~(alignment - 1);
+        std::size_t head = aligned - start;
+        std::size_t tail = span - head - mapsize;
+        if(head)
+            munmap(mapping, head);
+        if(tail)
+            munmap(reinterpret_cast<void*>(aligned + mapsize), tail);
+
+        desc = &m_desclist.Allocate();
+        desc->m_superblock = aligned;
+        desc->m_mapsize = mapsize;
+        desc->m_maxcount = 1;
+        desc->m_sizeclass = 0;
+        desc->m_anchor.store({static_cast<uint64_t>(SuperblockState::eFull), desc->m_maxcount, 0},
+            std::memory_order_release);
+    }
+    desc->m_blocksize = size;
+    return desc;
+}
+
+void Heap::RetireLargeMapping(SuperblockDescriptor *desc)
+{
+    m_large_mappings.Put(desc);
+}
+
+std::size_t Heap::GetRetainedLargeBytes()
+{
+    return m_large_mappings.GetRetainedBytes();
+}
+
 BlockFreelist::BlockFreelist(Heap& heap, Pagemap& pagemap, std::size_t sc)
     : m_heap{heap}
     , m_pagemap{pagemap}
     , m_sizeclass{sc}
-    , m_blocks{s_size_classes[sc] > 0 ? (kSuperblockSize / s_size_classes[sc]) : 0}
+    , m_blocks{}
+    , m_bump{}
+    , m_bump_end{}
+    , m_budget{}
+    , m_max_count{}
+    , m_overflows{}
 {
     pe::assert(sc <= kNumSizeClasses);
+    set_budget(kMinBudget);
+}
+
+void BlockFreelist::set_budget(std::size_t budget)
+{
+    m_budget = std::clamp(budget, kMinBudget, kMaxBudget);
+    m_max_count = (s_size_classes[m_sizeclass] > 0) 
+                ? (m_budget / s_size_classes[m_sizeclass]) : 0;
 }
 
 std::size_t BlockFreelist::compute_idx(std::byte *superblock, 
@@ -780,16 +1216,23 @@ void BlockFreelist::FillFromNewSB()
     pe::assert(desc->m_anchor.load(std::memory_order_relaxed).m_state 
         == static_cast<uint64_t>(SuperblockState::eFull));
 
-    for(int i = 0; i < desc->m_maxcount; i++) {
-        std::byte *block = reinterpret_cast<std::byte*>(desc->m_superblock)
-                         + (i * desc->m_blocksize);
-        PushBlock(block);
-    }
+    /* Blocks which have not yet been carved out are still owned
+     * by this cache and are not accounted for in the anchor. As
+     * such, the superblock cannot become empty while carving.
+     */
+    m_bump = reinterpret_cast<std::byte*>(desc->m_superblock);
+    m_bump_end = m_bump + (desc->m_maxcount * desc->m_blocksize);
     m_pagemap.RegisterDescriptor(desc);
 }
 
 void BlockFreelist::Fill()
 {
+    /* Running out of blocks is a sign of demand for this
+     * size class, so allow the freelist to hold more.
+     */
+    set_budget(m_budget + kSuperblockSize);
+    m_overflows = 0;
+
     /* Try to fill the cache from a single partial superblock
      */
     bool result = FillFromPartialSB();
@@ -799,24 +1242,31 @@ void BlockFreelist::Fill()
         FillFromNewSB();
 }
 
-void BlockFreelist::Flush()
+void BlockFreelist::Flush(std::size_t count)
 {
-    while(!m_blocks.Empty()) {
+    /* Return the blocks at the bottom of the stack, as these
+     * have been in the cache the longest and are the least 
+     * likely to still be hot. 
+     */
+    count = std::min(count, m_blocks.GetSize());
+    std::size_t i = 0;
+
+    while(i < count) {
         /* Form a list of blocks to return to a common superblock.
          */
         std::byte *head, *tail;
-        head = tail = m_blocks.Pop().value();
+        head = tail = m_blocks[i++];
         SuperblockDescriptor *desc = m_pagemap.GetDescriptor(head);
         [[maybe_unused]] SuperblockAnchor anchor = desc->m_anchor.load(std::memory_order_relaxed);
         pe::assert(anchor.m_state != static_cast<uint64_t>(SuperblockState::eEmpty));
         pe::assert(desc->m_sizeclass != 0);
         std::size_t block_count = 1;
 
-        while(!m_blocks.Empty()) {
-            std::byte *block = m_blocks.Peek().value();
+        while(i < count) {
+            std::byte *block = m_blocks[i];
             if(m_pagemap.GetDescriptor(block) != desc)
                 break;
-            m_blocks.Pop();
+            ++i;
             ++block_count;
             *reinterpret_cast<std::byte**>(tail) = block;
             tail = block;
@@ -860,16 +1310,50 @@ void BlockFreelist::Flush()
             m_heap.PutPartialSB(desc);
         }
     }
+    m_blocks.EraseBottom(count);
+}
+
+void BlockFreelist::Overflow()
+{
+    /* A freelist that keeps overflowing holds on to more
+     * blocks than the thread needs.
+     */
+    if(++m_overflows > kMaxOverflows) {
+        set_budget(m_budget - kSuperblockSize);
+        m_overflows = 0;
+    }
+    Flush(m_blocks.GetSize() - m_max_count / 2);
+
+    /* Give back the stack pages which are no longer
+     * needed after the budget was lowered.
+     */
+    if(m_blocks.GetCapacity() > 2 * m_max_count)
+        m_blocks.ShrinkTo(m_max_count);
+}
+
+void BlockFreelist::Release()
+{
+    /* Carve out what is left of the current superblock, such that
+     * it can be returned along with the rest of the blocks.
+     */
+    while(m_bump != m_bump_end) {
+        PushBlock(m_bump);
+        m_bump += s_size_classes[m_sizeclass];
+    }
+    m_bump = m_bump_end = nullptr;
+    Flush(m_blocks.GetSize());
+    m_blocks.ShrinkTo(0);
+    set_budget(kMinBudget);
 }
 
 bool BlockFreelist::IsEmpty()
 {
-    return m_blocks.Empty();
+    return m_blocks.Empty() && (m_bump == m_bump_end);
 }
 
 bool BlockFreelist::IsFull()
 {
-    return m_blocks.Full();
+    return (m_blocks.GetSize() >= m_max_count);
 }
 
 void BlockFreelist::PushBlock(std::byte *block)
@@ -879,8 +1363,37 @@ void BlockFreelist::PushBlock(std::byte *block)
 
 std::byte *BlockFreelist::PopBlock()
 {
+    /* Prefer recycled blocks, which are more likely to 
+     * still be cache-hot, over carving out fresh ones.
+     */
     auto ret = m_blocks.Pop();
-    return ret.value_or(nullptr);
+    if(ret.has_value()) [[likely]]
+        return ret.value();
+    if(m_bump == m_bump_end)
+        return nullptr;
+    std::byte *block = m_bump;
+    m_bump += s_size_classes[m_sizeclass];
+    return block;
+}
+
+std::size_t BlockFreelist::GetCachedBytes()
+{
+    return m_blocks.GetSize() * s_size_classes[m_sizeclass];
+}
+
+std::size_t BlockFreelist::GetUncarvedBytes()
+{
+    return (m_bump_end - m_bump);
+}
+
+std::size_t BlockFreelist::GetBudgetBytes()
+{
+    return m_budget;
+}
+
+std::size_t BlockFreelist::GetOverheadBytes()
+{
+    return m_blocks.GetBytes();
 }
 
 std::size_t Allocator::compute_size_class(std::size_t size)
@@ -891,41 +1404,86 @@ std::size_t Allocator::compute_size_class(std::size_t size)
         std::lower_bound(std::begin(s_size_classes), std::end(s_size_classes), size));
 }
 
-ThreadCache& Allocator::get_thread_cache() const
+ThreadCache *Allocator::get_thread_cache() const
 {
-    static thread_local ThreadCache t_thread_cache{m_heap, m_pagemap};
+    static thread_local ThreadCache t_thread_cache{m_heap, m_pagemap, m_thread_cache_key};
     void *raw = pthread_getspecific(m_thread_cache_key);
     if(!raw) {
+        if(t_thread_cache_destroyed) [[unlikely]]
+            return nullptr;
         raw = reinterpret_cast<void*>(&t_thread_cache);
         if(pthread_setspecific(m_thread_cache_key, raw)) [[unlikely]]
             throw std::runtime_error{"Failed to set Thread-Local Storage."};
     }
-    return *reinterpret_cast<ThreadCache*>(raw);
+    return reinterpret_cast<ThreadCache*>(raw);
 }
 
-void *Allocator::allocate_large_block(std::size_t size)
+/* Once the thread cache is gone, every block is taken from and
+ * given back to the heap right away, by way of a freelist that
+ * only lives for the duration of the call.
+ */
+void *Allocator::allocate_uncached(std::size_t sc)
 {
-    void *ret = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if(ret == reinterpret_cast<void*>(-1ull))
-        throw std::bad_alloc{};
+    BlockFreelist blocks{m_heap, m_pagemap, sc};
+    blocks.Fill();
+    std::byte *ret = blocks.PopBlock();
+    blocks.Release();
+    return ret;
+}
 
-    SuperblockDescriptor *desc = m_heap.AllocateDescriptor();
-    desc->m_superblock = reinterpret_cast<uintptr_t>(ret);
-    desc->m_blocksize = size;
-    desc->m_maxcount = 1;
-    desc->m_sizeclass = 0;
-    desc->m_anchor.store({static_cast<uint64_t>(SuperblockState::eFull), desc->m_maxcount, 0},
-        std::memory_order_release);
-    m_pagemap.RegisterDescriptor(desc);
+void Allocator::free_uncached(std::byte *block, std::size_t sc)
+{
+    BlockFreelist blocks{m_heap, m_pagemap, sc};
+    blocks.PushBlock(block);
+    blocks.Release();
+}
 
-    return ret;
+void *Allocator::allocate_large_block(std::size_t size, std::size_t alignment)
+{
+    SuperblockDescriptor *desc = m_heap.AllocateLargeMapping(size, alignment);
+    m_pagemap.RegisterDescriptor(desc);
+    return reinterpret_cast<void*>(desc->m_superblock);
 }
 
 void Allocator::deallocate_large_block(void *ptr)
 {
     auto desc = m_pagemap.GetDescriptor(reinterpret_cast<std::byte*>(ptr));
-    munmap(ptr, desc->m_blocksize);
-    m_heap.RetireDescriptor(desc);
+    m_heap.RetireLargeMapping(desc);
+}
+
+void *Allocator::reallocate_large_block(void *ptr, std::size_t size)
+{
+    auto desc = m_pagemap.GetDescriptor(reinterpret_cast<std::byte*>(ptr));
+    pe::assert(desc->m_sizeclass == 0);
+
+    const std::size_t old_mapped = desc->m_mapsize;
+    const std::size_t new_mapped = LargeMappingCache::MappingSize(size);
+
+    /* The existing mapping already spans enough pages.
+     */
+    if(old_mapped == new_mapped) {
+        desc->m_blocksize = size;
+        return ptr;
+    }
+
+    /* Unregister the mapping before it is remapped, as once
+     * it is moved, the old address range may be immediately
+     * handed out to a different thread and registered anew.
+     */
+    m_pagemap.UnregisterDescriptor(desc);
+
+    void *ret = mremap(ptr, old_mapped, new_mapped, MREMAP_MAYMOVE);
+    if(ret == MAP_FAILED) {
+        m_pagemap.RegisterDescriptor(desc);
+        throw std::bad_alloc{};
+    }
+
+    desc->m_superblock = reinterpret_cast<uintptr_t>(ret);
+    desc->m_blocksize = size;
+    desc->m_mapsize = new_mapped;
+    m_pagemap.RegisterDescriptor(desc);
+
+    return ret;
 }
 
 Allocator::Allocator(Heap& heap, Pagemap& pagemap)
@@ -961,64 +1519,113 @@ void *Allocator::Allocate(std::size_t size)
     std::size_t sc = compute_size_class(size);
     if(sc == 0)
         return allocate_large_block(size);
-    auto& cache = get_thread_cache().GetBlocksForSizeClass(sc);
+    ThreadCache *thread_cache = get_thread_cache();
+    if(!thread_cache) [[unlikely]]
+        return allocate_uncached(sc);
+    auto& cache = thread_cache->GetBlocksForSizeClass(sc);
     if(cache.IsEmpty())
         cache.Fill();
     return cache.PopBlock();
 }
 
-void Allocator::Free(void *ptr)
+void *Allocator::Reallocate(void *ptr, std::size_t size)
 {
     std::byte *block = reinterpret_cast<std::byte*>(ptr);
     if(!block) [[unlikely]]
-        return;
-    size_t sc = m_pagemap.GetSizeClass(block);
+        return Allocate(size);
+
+    std::size_t sc = m_pagemap.GetSizeClass(block);
+    std::size_t new_sc = compute_size_class(size);
+
+    /* Large blocks are grown and shrunk in-place by
+     * remapping their pages instead of copying them.
+     */
+    if(sc == 0 && new_sc == 0)
+        return reallocate_large_block(block, size);
+
+    /* Keep the existing block when the new size still
+     * fits and not more than half of the block is wasted.
+     */
+    if(sc != 0) {
+        std::size_t blocksize = s_size_classes[sc];
+        if(new_sc == sc || (size <= blocksize && size >= blocksize / 2))
+            return ptr;
+    }
+
+    void *ret = Allocate(size);
+    std::size_t copy_size = std::min(size, AllocationSize(ptr));
+    std::memcpy(ret, ptr, copy_size);
+    Free(ptr);
+    return ret;
+}
+
+void Allocator::free_block(std::byte *block, std::size_t sc)
+{
     if(sc == 0)
         return deallocate_large_block(block);
-    auto& cache = get_thread_cache().GetBlocksForSizeClass(sc);
+    ThreadCache *thread_cache = get_thread_cache();
+    if(!thread_cache) [[unlikely]]
+        return free_uncached(block, sc);
+    auto& cache = thread_cache->GetBlocksForSizeClass(sc);
     if(cache.IsFull())
-        cache.Flush();
+        cache.Overflow();
     cache.PushBlock(block);
 }
 
+void Allocator::Free(void *ptr)
+{
+    std::byte *block = reinterpret_cast<std::byte*>(ptr);
+    if(!block) [[unlikely]]
+        return;
+    free_block(block, m_pagemap.GetSizeClass(block));
+}
+
+void Allocator::Free(void *ptr, std::size_t size)
+{
+    std::byte *block = reinterpret_cast<std::byte*>(ptr);
+    if(!block) [[unlikely]]
+        return;
+    std::size_t sc = compute_size_class(size);
+    if constexpr(kDebug) {
+        pe::assert(m_pagemap.GetSizeClass(block) == sc, 
+            "Block freed with a size different from its' allocation size.");
+    }
+    free_block(block, sc);
+}
+
 void *Allocator::AllocateAligned(std::size_t size, std::align_val_t align)
 {
+    /* Superblocks are only page-aligned, so blocks carved out
+     * of them can only satisfy alignments of up to a page.
+     */
     std::size_t alignment = static_cast<std::size_t>(align);
-    if(alignment <= kMaxBlockSize) {
+    pe::assert(std::has_single_bit(alignment));
+    if(alignment <= s_page_size && size <= kMaxBlockSize) {
         size = NextAlignedBlockSize(size, alignment);
         return Allocate(size);
     }
 
-    std::size_t extra_bytes = size + alignment - 1 + sizeof(void*);
-    void *allocation = Allocate(size + extra_bytes);
-    if(!allocation)
-        return allocation;
-
-    /* round up to a multiple of alignment 
-     */
-    uintptr_t uptr = reinterpret_cast<uintptr_t>(allocation);
-    uptr = (uptr + extra_bytes) & ~(alignment - 1);
-    void *ret = reinterpret_cast<void*>(uptr);
-
-    /* store the original pointer in the allocation 
+    /* Anything else gets a dedicated mapping, which is 
+     * natively aligned.
      */
-    reinterpret_cast<void**>(ret)[-1] = allocation;
-    return ret;
+    return allocate_large_block(size, alignment);
 }
 
-void Allocator::FreeAligned(void *ptr, std::align_val_t align)
+void Allocator::FreeAligned(void *ptr, std::align_val_t)
 {
-    if(!ptr)
-        return;
+    Free(ptr);
+}
 
+void Allocator::FreeAligned(void *ptr, std::size_t size, std::align_val_t align)
+{
+    /* Mirror the choice made in AllocateAligned.
+     */
     std::size_t alignment = static_cast<std::size_t>(align);
-    if(alignment <= kMaxBlockSize) {
-        Free(ptr);
+    if(alignment <= s_page_size && size <= kMaxBlockSize) {
+        Free(ptr, NextAlignedBlockSize(size, alignment));
         return;
     }
-
-    void *allocation = reinterpret_cast<void**>(ptr)[-1];
-    Free(allocation);
+    Free(ptr);
 }
 
 std::size_t Allocator::NextAlignedBlockSize(std::size_t size, std::size_t align)
@@ -1038,5 +1645,18 @@ std::size_t Allocator::AllocationSize(void *ptr)
     return m_pagemap.GetDescriptor(reinterpret_cast<std::byte*>(ptr))->m_blocksize;
 }
 
+ThreadCacheStats Allocator::GetThreadCacheStats()
+{
+    ThreadCache *thread_cache = get_thread_cache();
+    if(!thread_cache) [[unlikely]]
+        return {};
+    return thread_cache->GetStats();
+}
+
+std::size_t Allocator::GetRetainedLargeBytes()
+{
+    return m_heap.GetRetainedLargeBytes();
+}
+
 } // namespace pe
 
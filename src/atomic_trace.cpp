@@ -73,6 +73,7 @@
 module;
 
 extern "C" [[maybe_unused]] void dump_atomic_trace(int n);
+extern "C" [[maybe_unused]] void dump_atomic_trace_file(const char *path);
 
 export module atomic_trace;
 
@@ -80,6 +81,7 @@ import tls;
 import logger;
 import platform;
 import shared_ptr;
+import unistd;
 
 import <cstdlib>;
 import <atomic>;
@@ -90,11 +92,20 @@ import <unordered_map>;
 import <sstream>;
 import <thread>;
 import <vector>;
+import <string>;
+import <cstring>;
+import <fstream>;
+import <algorithm>;
+import <stdexcept>;
+import <csignal>;
+import <cerrno>;
+import <limits>;
 
 namespace pe{
 
 constexpr int kTraceBufferSize = 32768;
 
+export
 enum class AtomicOp : uint32_t
 {
     eLoad,
@@ -466,6 +477,8 @@ struct AtomicOpDescHeader
     uint32_t             m_cpuid_end;
     uint64_t             m_tsc_start;
     uint64_t             m_tsc_end;
+    const char          *m_type_name;
+    bool                 m_cas_succeeded;
 };
 
 struct AtomicOpDesc
@@ -626,6 +639,16 @@ public:
         m_ring.Push(header, std::forward<Desc>(desc));
     }
 
+    const std::string& ThreadName() const
+    {
+        return m_thread_name;
+    }
+
+    std::thread::id ThreadID() const
+    {
+        return m_thread;
+    }
+
     void ReadLast(std::size_t n, std::ranges::output_range<ThreadTaggedAtomicOpDesc> auto&& out)
     {
         std::vector<AtomicOpDesc> descs;
@@ -743,6 +766,12 @@ private:
     std::atomic<T> m_atomic;
     const char    *m_name;
 
+    static const char *type_name()
+    {
+        static const std::string s_type_name = typestring<T>();
+        return s_type_name.c_str();
+    }
+
 public:
 
     constexpr TracedAtomic(const char *name) noexcept(std::is_nothrow_default_constructible_v<T>)
@@ -771,7 +800,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             StoreOpDesc<T>{std::memory_order_seq_cst, desired}
         );
@@ -791,7 +821,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             StoreOpDesc<T>{std::memory_order_seq_cst, desired}
         );
@@ -814,7 +845,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             StoreOpDesc<T>{order, desired}
         );
@@ -834,7 +866,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             StoreOpDesc<T>{order, desired}
         );
@@ -854,7 +887,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             LoadOpDesc<T>{order, ret}
         );
@@ -875,7 +909,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             LoadOpDesc<T>{order, ret}
         );
@@ -896,7 +931,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             ExchangeOpDesc<T>{order, desired, ret}
         );
@@ -917,7 +953,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             ExchangeOpDesc<T>{order, desired, ret}
         );
@@ -942,7 +979,9 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name(),
+                .m_cas_succeeded = ret
             },
             CompareExchangeOpDesc<T>{success, failure, expected_before, 
                 desired, expected_after, ret}
@@ -968,7 +1007,9 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name(),
+                .m_cas_succeeded = ret
             },
             CompareExchangeOpDesc<T>{success, failure, expected_before, 
                 desired, expected_after, ret}
@@ -993,7 +1034,9 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name(),
+                .m_cas_succeeded = ret
             },
             CompareExchangeOpDesc<T>{order, order, expected_before, 
                 desired, expected_after, ret}
@@ -1018,7 +1061,9 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name(),
+                .m_cas_succeeded = ret
             },
             CompareExchangeOpDesc<T>{order, order, expected_before, 
                 desired, expected_after, ret}
@@ -1044,7 +1089,9 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name(),
+                .m_cas_succeeded = ret
             },
             CompareExchangeOpDesc<T>{success, failure, expected_before, 
                 desired, expected_after, ret}
@@ -1070,7 +1117,9 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name(),
+                .m_cas_succeeded = ret
             },
             CompareExchangeOpDesc<T>{success, failure, expected_before, 
                 desired, expected_after, ret}
@@ -1095,7 +1144,9 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name(),
+                .m_cas_succeeded = ret
             },
             CompareExchangeOpDesc<T>{order, order, expected_before, 
                 desired, expected_after, ret}
@@ -1120,7 +1171,9 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name(),
+                .m_cas_succeeded = ret
             },
             CompareExchangeOpDesc<T>{order, order, expected_before, 
                 desired, expected_after, ret}
@@ -1145,7 +1198,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             FetchAddOpDesc<U>{order, arg, ret}
         );
@@ -1169,7 +1223,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             FetchAddOpDesc<U>{order, arg, ret}
         );
@@ -1193,7 +1248,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             FetchAddOpDesc<U>{order, arg, ret}
         );
@@ -1217,7 +1273,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             FetchAddOpDesc<U>{order, arg, ret}
         );
@@ -1241,7 +1298,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             FetchSubOpDesc<U>{order, arg, ret}
         );
@@ -1265,7 +1323,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             FetchSubOpDesc<U>{order, arg, ret}
         );
@@ -1289,7 +1348,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             FetchSubOpDesc<U>{order, arg, ret}
         );
@@ -1313,7 +1373,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             FetchSubOpDesc<U>{order, arg, ret}
         );
@@ -1337,7 +1398,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             FetchAndOpDesc<U>{order, arg, ret}
         );
@@ -1361,7 +1423,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             FetchAndOpDesc<U>{order, arg, ret}
         );
@@ -1385,7 +1448,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             FetchAndOpDesc<U>{order, arg, ret}
         );
@@ -1409,7 +1473,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             FetchOrOpDesc<U>{order, arg, ret}
         );
@@ -1433,7 +1498,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             FetchXorOpDesc<U>{order, arg, ret}
         );
@@ -1457,7 +1523,8 @@ public:
                 .m_cpuid_start = cpu_before,
                 .m_cpuid_end = cpu_after,
                 .m_tsc_start = before,
-                .m_tsc_end = after
+                .m_tsc_end = after,
+                .m_type_name = type_name()
             },
             FetchXorOpDesc<U>{order, arg, ret}
         );
@@ -1619,9 +1686,228 @@ public:
     }
 };
 
+/*****************************************************************************/
+/* BINARY DUMP                                                               */
+/*****************************************************************************/
+/*
+ * For offline analysis, the rings of all threads can be written
+ * out to a file in a flat binary format, which does not depend
+ * on the address space of the traced process. The dump can be
+ * triggered programmatically, from GDB:
+ *
+ *  (gdb) set scheduler-locking on
+ *  (gdb) call (void)dump_atomic_trace_file("trace.bin")
+ *
+ * or by sending a signal to the process after installing a
+ * handler with 'InstallAtomicTraceDumpHandler'. The dump can
+ * then be processed by the 'atomic_trace_analyzer' tool.
+ */
+
+constexpr char     kAtomicTraceMagic[8] = {'P', 'E', 'A', 'T', 'R', 'A', 'C', 'E'};
+constexpr uint32_t kAtomicTraceVersion = 1;
+
+struct AtomicTraceFileHeader
+{
+    char     m_magic[8];
+    uint32_t m_version;
+    uint32_t m_num_threads;
+    uint32_t m_tsc_mhz;
+    uint32_t m_invariant_tsc;
+};
+
+struct AtomicTraceThreadHeader
+{
+    char     m_thread_name[32];
+    uint64_t m_thread_id;
+    uint64_t m_num_records;
+};
+
+export
+struct AtomicTraceRecord
+{
+    uint64_t m_addr;
+    uint64_t m_tsc_start;
+    uint64_t m_tsc_end;
+    uint32_t m_cpuid_start;
+    uint32_t m_cpuid_end;
+    AtomicOp m_op;
+    uint32_t m_cas_succeeded;
+    char     m_name[32];
+    char     m_type_name[96];
+};
+
+export
+struct AtomicTraceThread
+{
+    std::string                    m_thread_name;
+    uint64_t                       m_thread_id;
+    std::vector<AtomicTraceRecord> m_records;
+};
+
+export
+struct AtomicTraceDump
+{
+    uint32_t                       m_tsc_mhz;
+    bool                           m_invariant_tsc;
+    std::vector<AtomicTraceThread> m_threads;
+};
+
+template <std::size_t N>
+void copy_truncated(char (&dst)[N], const char *src)
+{
+    std::size_t len = src ? std::min(std::strlen(src), N - 1) : 0;
+    std::memcpy(dst, src, len);
+    std::memset(dst + len, 0, N - len);
+}
+
+/* Write out the rings of all the threads. The records of every
+ * thread are written in the order in which they were traced.
+ */
+export
+void DumpAtomicTrace(const std::string& path)
+{
+    std::ofstream out{path, std::ios::out | std::ios::binary | std::ios::trunc};
+    if(!out)
+        throw std::runtime_error{"Failed to open atomic trace file: " + path};
+
+    auto ptrs = GetTLS().GetThreadPtrsSnapshot();
+
+    AtomicTraceFileHeader header{};
+    std::memcpy(header.m_magic, kAtomicTraceMagic, sizeof(header.m_magic));
+    header.m_version = kAtomicTraceVersion;
+    header.m_num_threads = std::size(ptrs);
+    header.m_tsc_mhz = tscfreq_mhz();
+    header.m_invariant_tsc = invariant_tsc_supported();
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for(const auto& ptr : ptrs) {
+
+        std::vector<ThreadTaggedAtomicOpDesc> descs;
+        ptr->ReadLast(std::numeric_limits<std::size_t>::max(), descs);
+        std::reverse(std::begin(descs), std::end(descs));
+
+        AtomicTraceThreadHeader thread_header{};
+        copy_truncated(thread_header.m_thread_name, ptr->ThreadName().c_str());
+        thread_header.m_thread_id = std::hash<std::thread::id>{}(ptr->ThreadID());
+        thread_header.m_num_records = std::size(descs);
+        out.write(reinterpret_cast<const char*>(&thread_header), sizeof(thread_header));
+
+        for(const auto& desc : descs) {
+            const auto& hdr = desc.m_desc.m_header;
+            AtomicTraceRecord record{};
+            record.m_addr = reinterpret_cast<uint64_t>(const_cast<void*>(hdr.m_addr));
+            record.m_tsc_start = hdr.m_tsc_start;
+            record.m_tsc_end = hdr.m_tsc_end;
+            record.m_cpuid_start = hdr.m_cpuid_start;
+            record.m_cpuid_end = hdr.m_cpuid_end;
+            record.m_op = hdr.m_type;
+            record.m_cas_succeeded = hdr.m_cas_succeeded;
+            copy_truncated(record.m_name, hdr.m_name);
+            copy_truncated(record.m_type_name, hdr.m_type_name);
+            out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+        }
+    }
+    if(!out)
+        throw std::runtime_error{"Failed to write atomic trace file: " + path};
+}
+
+export
+AtomicTraceDump ReadAtomicTraceDump(const std::string& path)
+{
+    std::ifstream in{path, std::ios::in | std::ios::binary};
+    if(!in)
+        throw std::runtime_error{"Failed to open atomic trace file: " + path};
+
+    AtomicTraceFileHeader header{};
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if(!in || std::memcmp(header.m_magic, kAtomicTraceMagic, sizeof(header.m_magic)))
+        throw std::runtime_error{"Not an atomic trace file: " + path};
+    if(header.m_version != kAtomicTraceVersion)
+        throw std::runtime_error{"Unsupported atomic trace version: "
+            + std::to_string(header.m_version)};
+
+    AtomicTraceDump ret{header.m_tsc_mhz, !!header.m_invariant_tsc, {}};
+    for(int i = 0; i < header.m_num_threads; i++) {
+
+        AtomicTraceThreadHeader thread_header{};
+        in.read(reinterpret_cast<char*>(&thread_header), sizeof(thread_header));
+        if(!in)
+            throw std::runtime_error{"Truncated atomic trace file: " + path};
+
+        AtomicTraceThread thread{
+            std::string{thread_header.m_thread_name,
+                strnlen(thread_header.m_thread_name, sizeof(thread_header.m_thread_name))},
+            thread_header.m_thread_id,
+            std::vector<AtomicTraceRecord>(thread_header.m_num_records)
+        };
+        in.read(reinterpret_cast<char*>(thread.m_records.data()),
+            thread_header.m_num_records * sizeof(AtomicTraceRecord));
+        if(!in)
+            throw std::runtime_error{"Truncated atomic trace file: " + path};
+        ret.m_threads.push_back(std::move(thread));
+    }
+    return ret;
+}
+
+char s_dump_path[256];
+int  s_dump_pipe[2] = {-1, -1};
+
+/* Writing out the trace allocates and does file IO, neither of 
+ * which is async-signal safe. The handler only pokes a dedicated 
+ * thread through a pipe, and the dump is taken from there.
+ */
+void dump_signal_handler(int)
+{
+    int saved_errno = errno;
+    char byte = 0;
+    [[maybe_unused]] auto ret = write(s_dump_pipe[1], &byte, 1);
+    errno = saved_errno;
+}
+
+void dump_thread_main()
+{
+    while(true) {
+        char byte;
+        auto ret = read(s_dump_pipe[0], &byte, 1);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0)
+            return;
+        try{
+            DumpAtomicTrace(s_dump_path);
+        }catch(std::exception& e){
+            pe::ioprint(pe::LogLevel::eError, "Failed to dump atomic trace:", e.what());
+        }
+    }
+}
+
+export
+void InstallAtomicTraceDumpHandler(int signum, const std::string& path)
+{
+    copy_truncated(s_dump_path, path.c_str());
+    if(s_dump_pipe[0] == -1) {
+        if(pipe(s_dump_pipe) == -1)
+            throw std::runtime_error{"Failed to create atomic trace dump pipe"};
+        std::thread{dump_thread_main}.detach();
+    }
+    if(std::signal(signum, dump_signal_handler) == SIG_ERR)
+        throw std::runtime_error{"Failed to install atomic trace dump handler"};
+}
+
 } //namespace pe
 
 export using ::dump_atomic_trace;
+export using ::dump_atomic_trace_file;
+
+extern "C" [[maybe_unused]] void dump_atomic_trace_file(const char *path)
+{
+    try{
+        pe::DumpAtomicTrace(path);
+    }catch(std::exception& e){
+        pe::ioprint_unlocked(pe::TextColor::eRed, "", false, true,
+            "Failed to dump atomic trace:", e.what());
+    }
+}
 
 extern "C" [[maybe_unused]] void dump_atomic_trace(int n)
 {
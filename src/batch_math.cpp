@@ -0,0 +1,807 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+export module batch_math;
+
+import nvector;
+import nmatrix;
+
+import <immintrin.h>;
+import <cstddef>;
+import <cstdint>;
+import <cmath>;
+import <array>;
+import <bit>;
+import <algorithm>;
+import <span>;
+import <stdexcept>;
+
+/* Kernels for transforming large arrays of points and matrices
+ * at once. The widest instruction set supported by the CPU is
+ * selected at runtime, so that the engine does not need to be
+ * compiled for a specific target:
+ *
+ *  AVX2  8 points or 2 matrix rows per instruction, using FMA
+ *  SSE   4 lanes per instruction (always available on x86-64)
+ *  Scalar
+ *
+ * A lower level can be requested explicitly, which is mostly
+ * useful for testing the paths against each other. Points are
+ * transformed as positions (w = 1), and the bottom row of the
+ * matrix is assumed to be (0, 0, 0, 1).
+ */
+
+namespace pe{
+
+static_assert(sizeof(Vec3f) == 3 * sizeof(float));
+static_assert(sizeof(Mat4f) == 16 * sizeof(float));
+static_assert(sizeof(Vec4f) == 4 * sizeof(float));
+
+export inline constexpr std::size_t kMaxCullPlanes = 16;
+
+/*****************************************************************************/
+/* CPU DISPATCH                                                              */
+/*****************************************************************************/
+
+export
+enum class SIMDLevel
+{
+    eScalar,
+    eSSE,
+    eAVX2,
+};
+
+SIMDLevel detect_simd_level()
+{
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return SIMDLevel::eAVX2;
+    return SIMDLevel::eSSE;
+}
+
+export
+SIMDLevel SupportedSIMDLevel()
+{
+    static const SIMDLevel s_level = detect_simd_level();
+    return s_level;
+}
+
+inline SIMDLevel select_simd_level(SIMDLevel requested)
+{
+    return std::min(requested, SupportedSIMDLevel());
+}
+
+/*****************************************************************************/
+/* SOA POINTS                                                                */
+/*****************************************************************************/
+
+export
+struct ConstPointsSoA
+{
+    std::span<const float> m_x;
+    std::span<const float> m_y;
+    std::span<const float> m_z;
+
+    std::size_t size() const { return m_x.size(); }
+};
+
+export
+struct PointsSoA
+{
+    std::span<float> m_x;
+    std::span<float> m_y;
+    std::span<float> m_z;
+
+    std::size_t size() const { return m_x.size(); }
+
+    operator ConstPointsSoA() const
+    {
+        return {m_x, m_y, m_z};
+    }
+};
+
+/*****************************************************************************/
+/* SOA BOUNDING VOLUMES                                                      */
+/*****************************************************************************/
+
+export
+struct ConstSpheresSoA
+{
+    std::span<const float> m_x;
+    std::span<const float> m_y;
+    std::span<const float> m_z;
+    std::span<const float> m_radius;
+
+    std::size_t size() const { return m_x.size(); }
+};
+
+/* Axis-aligned boxes, given by their centers and half-extents.
+ */
+export
+struct ConstBoxesSoA
+{
+    std::span<const float> m_x;
+    std::span<const float> m_y;
+    std::span<const float> m_z;
+    std::span<const float> m_extent_x;
+    std::span<const float> m_extent_y;
+    std::span<const float> m_extent_z;
+
+    std::size_t size() const { return m_x.size(); }
+};
+
+/*****************************************************************************/
+/* SCALAR KERNELS                                                            */
+/*****************************************************************************/
+
+void transform_points_scalar(const float *m, const float *in, float *out, std::size_t count)
+{
+    for(std::size_t i = 0; i < count; i++) {
+        float x = in[i * 3 + 0];
+        float y = in[i * 3 + 1];
+        float z = in[i * 3 + 2];
+        out[i * 3 + 0] = m[0] * x + m[1] * y + m[2]  * z + m[3];
+        out[i * 3 + 1] = m[4] * x + m[5] * y + m[6]  * z + m[7];
+        out[i * 3 + 2] = m[8] * x + m[9] * y + m[10] * z + m[11];
+    }
+}
+
+void transform_points_soa_scalar(const float *m, const float *xs, const float *ys,
+    const float *zs, float *ox, float *oy, float *oz, std::size_t count)
+{
+    for(std::size_t i = 0; i < count; i++) {
+        float x = xs[i], y = ys[i], z = zs[i];
+        ox[i] = m[0] * x + m[1] * y + m[2]  * z + m[3];
+        oy[i] = m[4] * x + m[5] * y + m[6]  * z + m[7];
+        oz[i] = m[8] * x + m[9] * y + m[10] * z + m[11];
+    }
+}
+
+void mat_mult_scalar(const float *a, const float *b, float *out)
+{
+    float ret[16];
+    for(std::size_t i = 0; i < 4; i++) {
+    for(std::size_t j = 0; j < 4; j++) {
+        ret[i * 4 + j] = a[i * 4 + 0] * b[0 * 4 + j]
+                       + a[i * 4 + 1] * b[1 * 4 + j]
+                       + a[i * 4 + 2] * b[2 * 4 + j]
+                       + a[i * 4 + 3] * b[3 * 4 + j];
+    }}
+    std::copy(std::begin(ret), std::end(ret), out);
+}
+
+/* Culling kernels test the volumes in [begin, end) against
+ * every plane and set bit i of the mask for every volume that
+ * is not entirely behind any one of them. The bits of visible
+ * volumes are OR-ed in, so the mask must be cleared first.
+ */
+
+void cull_spheres_scalar(const float *planes, std::size_t nplanes, const float *xs,
+    const float *ys, const float *zs, const float *rs, uint64_t *mask,
+    std::size_t begin, std::size_t end)
+{
+    for(std::size_t i = begin; i < end; i++) {
+        bool inside = true;
+        for(std::size_t p = 0; p < nplanes; p++) {
+            const float *plane = planes + p * 4;
+            float d = plane[0] * xs[i] + plane[1] * ys[i] + plane[2] * zs[i] + plane[3];
+            inside &= (d >= -rs[i]);
+        }
+        mask[i / 64] |= uint64_t{inside} << (i % 64);
+    }
+}
+
+void cull_boxes_scalar(const float *planes, std::size_t nplanes, const float *xs,
+    const float *ys, const float *zs, const float *exs, const float *eys,
+    const float *ezs, uint64_t *mask, std::size_t begin, std::size_t end)
+{
+    for(std::size_t i = begin; i < end; i++) {
+        bool inside = true;
+        for(std::size_t p = 0; p < nplanes; p++) {
+            const float *plane = planes + p * 4;
+            float d = plane[0] * xs[i] + plane[1] * ys[i] + plane[2] * zs[i] + plane[3];
+            float r = std::fabs(plane[0]) * exs[i] + std::fabs(plane[1]) * eys[i]
+                    + std::fabs(plane[2]) * ezs[i];
+            inside &= (d >= -r);
+        }
+        mask[i / 64] |= uint64_t{inside} << (i % 64);
+    }
+}
+
+/*****************************************************************************/
+/* SSE KERNELS                                                               */
+/*****************************************************************************/
+
+void transform_points_sse(const float *m, const float *in, float *out, std::size_t count)
+{
+    /* Columns of the upper 3x4 part of the matrix.
+     */
+    const __m128 c0 = _mm_setr_ps(m[0], m[4], m[8],  0.0f);
+    const __m128 c1 = _mm_setr_ps(m[1], m[5], m[9],  0.0f);
+    const __m128 c2 = _mm_setr_ps(m[2], m[6], m[10], 0.0f);
+    const __m128 c3 = _mm_setr_ps(m[3], m[7], m[11], 0.0f);
+
+    for(std::size_t i = 0; i < count; i++) {
+        const float *src = in + i * 3;
+        float *dst = out + i * 3;
+
+        __m128 r = _mm_add_ps(c3, _mm_mul_ps(c0, _mm_set1_ps(src[0])));
+        r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(src[1])));
+        r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(src[2])));
+
+        /* Don't write past the end of the point.
+         */
+        _mm_storel_pi(reinterpret_cast<__m64*>(dst), r);
+        _mm_store_ss(dst + 2, _mm_movehl_ps(r, r));
+    }
+}
+
+void transform_points_soa_sse(const float *m, const float *xs, const float *ys,
+    const float *zs, float *ox, float *oy, float *oz, std::size_t count)
+{
+    std::size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(xs + i);
+        __m128 y = _mm_loadu_ps(ys + i);
+        __m128 z = _mm_loadu_ps(zs + i);
+
+        __m128 rx = _mm_add_ps(_mm_set1_ps(m[3]), _mm_mul_ps(_mm_set1_ps(m[0]), x));
+        rx = _mm_add_ps(rx, _mm_mul_ps(_mm_set1_ps(m[1]), y));
+        rx = _mm_add_ps(rx, _mm_mul_ps(_mm_set1_ps(m[2]), z));
+
+        __m128 ry = _mm_add_ps(_mm_set1_ps(m[7]), _mm_mul_ps(_mm_set1_ps(m[4]), x));
+        ry = _mm_add_ps(ry, _mm_mul_ps(_mm_set1_ps(m[5]), y));
+        ry = _mm_add_ps(ry, _mm_mul_ps(_mm_set1_ps(m[6]), z));
+
+        __m128 rz = _mm_add_ps(_mm_set1_ps(m[11]), _mm_mul_ps(_mm_set1_ps(m[8]), x));
+        rz = _mm_add_ps(rz, _mm_mul_ps(_mm_set1_ps(m[9]), y));
+        rz = _mm_add_ps(rz, _mm_mul_ps(_mm_set1_ps(m[10]), z));
+
+        _mm_storeu_ps(ox + i, rx);
+        _mm_storeu_ps(oy + i, ry);
+        _mm_storeu_ps(oz + i, rz);
+    }
+    transform_points_soa_scalar(m, xs + i, ys + i, zs + i, ox + i, oy + i, oz + i, count - i);
+}
+
+void mat_mult_sse(const float *a, const float *b, float *out)
+{
+    const __m128 b0 = _mm_loadu_ps(b + 0);
+    const __m128 b1 = _mm_loadu_ps(b + 4);
+    const __m128 b2 = _mm_loadu_ps(b + 8);
+    const __m128 b3 = _mm_loadu_ps(b + 12);
+
+    /* Compute all the rows before storing any of them,
+     * in case the output aliases one of the inputs.
+     */
+    __m128 rows[4];
+    for(std::size_t i = 0; i < 4; i++) {
+        __m128 r = _mm_mul_ps(_mm_set1_ps(a[i * 4 + 0]), b0);
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[i * 4 + 1]), b1));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[i * 4 + 2]), b2));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[i * 4 + 3]), b3));
+        rows[i] = r;
+    }
+    for(std::size_t i = 0; i < 4; i++) {
+        _mm_storeu_ps(out + i * 4, rows[i]);
+    }
+}
+
+void cull_spheres_sse(const float *planes, std::size_t nplanes, const float *xs,
+    const float *ys, const float *zs, const float *rs, uint64_t *mask, std::size_t count)
+{
+    std::size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(xs + i);
+        __m128 y = _mm_loadu_ps(ys + i);
+        __m128 z = _mm_loadu_ps(zs + i);
+        __m128 nr = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(rs + i));
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for(std::size_t p = 0; p < nplanes; p++) {
+            const float *plane = planes + p * 4;
+            __m128 d = _mm_add_ps(_mm_set1_ps(plane[3]), _mm_mul_ps(_mm_set1_ps(plane[0]), x));
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane[1]), y));
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane[2]), z));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(d, nr));
+        }
+        mask[i / 64] |= uint64_t(_mm_movemask_ps(inside)) << (i % 64);
+    }
+    cull_spheres_scalar(planes, nplanes, xs, ys, zs, rs, mask, i, count);
+}
+
+void cull_boxes_sse(const float *planes, std::size_t nplanes, const float *xs,
+    const float *ys, const float *zs, const float *exs, const float *eys,
+    const float *ezs, uint64_t *mask, std::size_t count)
+{
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+    std::size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(xs + i);
+        __m128 y = _mm_loadu_ps(ys + i);
+        __m128 z = _mm_loadu_ps(zs + i);
+        __m128 ex = _mm_loadu_ps(exs + i);
+        __m128 ey = _mm_loadu_ps(eys + i);
+        __m128 ez = _mm_loadu_ps(ezs + i);
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for(std::size_t p = 0; p < nplanes; p++) {
+            const float *plane = planes + p * 4;
+            __m128 nx = _mm_set1_ps(plane[0]);
+            __m128 ny = _mm_set1_ps(plane[1]);
+            __m128 nz = _mm_set1_ps(plane[2]);
+
+            __m128 d = _mm_add_ps(_mm_set1_ps(plane[3]), _mm_mul_ps(nx, x));
+            d = _mm_add_ps(d, _mm_mul_ps(ny, y));
+            d = _mm_add_ps(d, _mm_mul_ps(nz, z));
+
+            /* Projected half-extent of the box onto the normal */
+            __m128 r = _mm_mul_ps(_mm_and_ps(nx, abs_mask), ex);
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_and_ps(ny, abs_mask), ey));
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_and_ps(nz, abs_mask), ez));
+
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+        }
+        mask[i / 64] |= uint64_t(_mm_movemask_ps(inside)) << (i % 64);
+    }
+    cull_boxes_scalar(planes, nplanes, xs, ys, zs, exs, eys, ezs, mask, i, count);
+}
+
+/*****************************************************************************/
+/* AVX2 KERNELS                                                              */
+/*****************************************************************************/
+
+__attribute__((target("avx2,fma")))
+void transform_points_avx2(const float *m, const float *in, float *out, std::size_t count)
+{
+    const __m256 m00 = _mm256_set1_ps(m[0]),  m01 = _mm256_set1_ps(m[1]);
+    const __m256 m02 = _mm256_set1_ps(m[2]),  m03 = _mm256_set1_ps(m[3]);
+    const __m256 m10 = _mm256_set1_ps(m[4]),  m11 = _mm256_set1_ps(m[5]);
+    const __m256 m12 = _mm256_set1_ps(m[6]),  m13 = _mm256_set1_ps(m[7]);
+    const __m256 m20 = _mm256_set1_ps(m[8]),  m21 = _mm256_set1_ps(m[9]);
+    const __m256 m22 = _mm256_set1_ps(m[10]), m23 = _mm256_set1_ps(m[11]);
+
+    std::size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        const float *src = in + i * 3;
+        float *dst = out + i * 3;
+
+        /* Transpose 8 packed xyz points into x, y and z vectors.
+         * Each 128-bit half holds 4 of the points, so the lane
+         * order is shuffled, but identically for x, y and z, and
+         * it is restored by the inverse transpose on the way out.
+         */
+        __m256 p03 = _mm256_castps128_ps256(_mm_loadu_ps(src + 0));
+        __m256 p14 = _mm256_castps128_ps256(_mm_loadu_ps(src + 4));
+        __m256 p25 = _mm256_castps128_ps256(_mm_loadu_ps(src + 8));
+        p03 = _mm256_insertf128_ps(p03, _mm_loadu_ps(src + 12), 1);
+        p14 = _mm256_insertf128_ps(p14, _mm_loadu_ps(src + 16), 1);
+        p25 = _mm256_insertf128_ps(p25, _mm_loadu_ps(src + 20), 1);
+
+        __m256 xy = _mm256_shuffle_ps(p14, p25, _MM_SHUFFLE(2, 1, 3, 2));
+        __m256 yz = _mm256_shuffle_ps(p03, p14, _MM_SHUFFLE(1, 0, 2, 1));
+        __m256 x  = _mm256_shuffle_ps(p03, xy,  _MM_SHUFFLE(2, 0, 3, 0));
+        __m256 y  = _mm256_shuffle_ps(yz,  xy,  _MM_SHUFFLE(3, 1, 2, 0));
+        __m256 z  = _mm256_shuffle_ps(yz,  p25, _MM_SHUFFLE(3, 0, 3, 1));
+
+        __m256 rx = _mm256_fmadd_ps(m00, x, _mm256_fmadd_ps(m01, y, _mm256_fmadd_ps(m02, z, m03)));
+        __m256 ry = _mm256_fmadd_ps(m10, x, _mm256_fmadd_ps(m11, y, _mm256_fmadd_ps(m12, z, m13)));
+        __m256 rz = _mm256_fmadd_ps(m20, x, _mm256_fmadd_ps(m21, y, _mm256_fmadd_ps(m22, z, m23)));
+
+        __m256 rxy = _mm256_shuffle_ps(rx, ry, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 ryz = _mm256_shuffle_ps(ry, rz, _MM_SHUFFLE(3, 1, 3, 1));
+        __m256 rzx = _mm256_shuffle_ps(rz, rx, _MM_SHUFFLE(3, 1, 2, 0));
+
+        __m256 r03 = _mm256_shuffle_ps(rxy, rzx, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 r14 = _mm256_shuffle_ps(ryz, rxy, _MM_SHUFFLE(3, 1, 2, 0));
+        __m256 r25 = _mm256_shuffle_ps(rzx, ryz, _MM_SHUFFLE(3, 1, 3, 1));
+
+        _mm_storeu_ps(dst + 0,  _mm256_castps256_ps128(r03));
+        _mm_storeu_ps(dst + 4,  _mm256_castps256_ps128(r14));
+        _mm_storeu_ps(dst + 8,  _mm256_castps256_ps128(r25));
+        _mm_storeu_ps(dst + 12, _mm256_extractf128_ps(r03, 1));
+        _mm_storeu_ps(dst + 16, _mm256_extractf128_ps(r14, 1));
+        _mm_storeu_ps(dst + 20, _mm256_extractf128_ps(r25, 1));
+    }
+    transform_points_scalar(m, in + i * 3, out + i * 3, count - i);
+}
+
+__attribute__((target("avx2,fma")))
+void transform_points_soa_avx2(const float *m, const float *xs, const float *ys,
+    const float *zs, float *ox, float *oy, float *oz, std::size_t count)
+{
+    const __m256 m00 = _mm256_set1_ps(m[0]),  m01 = _mm256_set1_ps(m[1]);
+    const __m256 m02 = _mm256_set1_ps(m[2]),  m03 = _mm256_set1_ps(m[3]);
+    const __m256 m10 = _mm256_set1_ps(m[4]),  m11 = _mm256_set1_ps(m[5]);
+    const __m256 m12 = _mm256_set1_ps(m[6]),  m13 = _mm256_set1_ps(m[7]);
+    const __m256 m20 = _mm256_set1_ps(m[8]),  m21 = _mm256_set1_ps(m[9]);
+    const __m256 m22 = _mm256_set1_ps(m[10]), m23 = _mm256_set1_ps(m[11]);
+
+    std::size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_loadu_ps(xs + i);
+        __m256 y = _mm256_loadu_ps(ys + i);
+        __m256 z = _mm256_loadu_ps(zs + i);
+
+        __m256 rx = _mm256_fmadd_ps(m00, x, _mm256_fmadd_ps(m01, y, _mm256_fmadd_ps(m02, z, m03)));
+        __m256 ry = _mm256_fmadd_ps(m10, x, _mm256_fmadd_ps(m11, y, _mm256_fmadd_ps(m12, z, m13)));
+        __m256 rz = _mm256_fmadd_ps(m20, x, _mm256_fmadd_ps(m21, y, _mm256_fmadd_ps(m22, z, m23)));
+
+        _mm256_storeu_ps(ox + i, rx);
+        _mm256_storeu_ps(oy + i, ry);
+        _mm256_storeu_ps(oz + i, rz);
+    }
+    transform_points_soa_scalar(m, xs + i, ys + i, zs + i, ox + i, oy + i, oz + i, count - i);
+}
+
+/* Computes two rows of the product at a time. Within each 128-bit
+ * lane, 'permute' broadcasts the k-th element of that lane's row
+ * of 'a', which is multiplied by the k-th row of 'b' (duplicated
+ * in both lanes).
+ */
+__attribute__((target("avx2,fma")))
+inline void mat_mult_avx2_rows(__m256 a01, __m256 a23, const float *b, float *out)
+{
+    const __m256 b0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(b + 0));
+    const __m256 b1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(b + 4));
+    const __m256 b2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(b + 8));
+    const __m256 b3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(b + 12));
+
+    __m256 r01 = _mm256_mul_ps(_mm256_permute_ps(a01, 0x00), b0);
+    r01 = _mm256_fmadd_ps(_mm256_permute_ps(a01, 0x55), b1, r01);
+    r01 = _mm256_fmadd_ps(_mm256_permute_ps(a01, 0xAA), b2, r01);
+    r01 = _mm256_fmadd_ps(_mm256_permute_ps(a01, 0xFF), b3, r01);
+
+    __m256 r23 = _mm256_mul_ps(_mm256_permute_ps(a23, 0x00), b0);
+    r23 = _mm256_fmadd_ps(_mm256_permute_ps(a23, 0x55), b1, r23);
+    r23 = _mm256_fmadd_ps(_mm256_permute_ps(a23, 0xAA), b2, r23);
+    r23 = _mm256_fmadd_ps(_mm256_permute_ps(a23, 0xFF), b3, r23);
+
+    _mm256_storeu_ps(out + 0, r01);
+    _mm256_storeu_ps(out + 8, r23);
+}
+
+__attribute__((target("avx2,fma")))
+void mat_mult_many_avx2(const float *a, const float *b, float *out, std::size_t count)
+{
+    for(std::size_t i = 0; i < count; i++) {
+        __m256 a01 = _mm256_loadu_ps(a + i * 16 + 0);
+        __m256 a23 = _mm256_loadu_ps(a + i * 16 + 8);
+        mat_mult_avx2_rows(a01, a23, b + i * 16, out + i * 16);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+void mat_mult_one_many_avx2(const float *a, const float *b, float *out, std::size_t count)
+{
+    const __m256 a01 = _mm256_loadu_ps(a + 0);
+    const __m256 a23 = _mm256_loadu_ps(a + 8);
+    for(std::size_t i = 0; i < count; i++) {
+        mat_mult_avx2_rows(a01, a23, b + i * 16, out + i * 16);
+    }
+}
+
+/* The plane coefficients are broadcast once up front, as the
+ * compiler cannot keep an unbounded number of them in registers.
+ */
+__attribute__((target("avx2,fma")))
+void cull_spheres_avx2(const float *planes, std::size_t nplanes, const float *xs,
+    const float *ys, const float *zs, const float *rs, uint64_t *mask, std::size_t count)
+{
+    __m256 coeffs[kMaxCullPlanes][4];
+    for(std::size_t p = 0; p < nplanes; p++) {
+        for(std::size_t k = 0; k < 4; k++) {
+            coeffs[p][k] = _mm256_set1_ps(planes[p * 4 + k]);
+        }
+    }
+
+    std::size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_loadu_ps(xs + i);
+        __m256 y = _mm256_loadu_ps(ys + i);
+        __m256 z = _mm256_loadu_ps(zs + i);
+        __m256 nr = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(rs + i));
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for(std::size_t p = 0; p < nplanes; p++) {
+            __m256 d = _mm256_fmadd_ps(coeffs[p][0], x, _mm256_fmadd_ps(coeffs[p][1], y,
+                _mm256_fmadd_ps(coeffs[p][2], z, coeffs[p][3])));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, nr, _CMP_GE_OQ));
+        }
+        mask[i / 64] |= uint64_t(_mm256_movemask_ps(inside)) << (i % 64);
+    }
+    cull_spheres_scalar(planes, nplanes, xs, ys, zs, rs, mask, i, count);
+}
+
+__attribute__((target("avx2,fma")))
+void cull_boxes_avx2(const float *planes, std::size_t nplanes, const float *xs,
+    const float *ys, const float *zs, const float *exs, const float *eys,
+    const float *ezs, uint64_t *mask, std::size_t count)
+{
+    /* Normal, absolute value of the normal and distance */
+    __m256 coeffs[kMaxCullPlanes][7];
+    for(std::size_t p = 0; p < nplanes; p++) {
+        for(std::size_t k = 0; k < 3; k++) {
+            coeffs[p][k] = _mm256_set1_ps(planes[p * 4 + k]);
+            coeffs[p][k + 3] = _mm256_set1_ps(std::fabs(planes[p * 4 + k]));
+        }
+        coeffs[p][6] = _mm256_set1_ps(planes[p * 4 + 3]);
+    }
+
+    std::size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_loadu_ps(xs + i);
+        __m256 y = _mm256_loadu_ps(ys + i);
+        __m256 z = _mm256_loadu_ps(zs + i);
+        __m256 ex = _mm256_loadu_ps(exs + i);
+        __m256 ey = _mm256_loadu_ps(eys + i);
+        __m256 ez = _mm256_loadu_ps(ezs + i);
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for(std::size_t p = 0; p < nplanes; p++) {
+            __m256 d = _mm256_fmadd_ps(coeffs[p][0], x, _mm256_fmadd_ps(coeffs[p][1], y,
+                _mm256_fmadd_ps(coeffs[p][2], z, coeffs[p][6])));
+            __m256 r = _mm256_fmadd_ps(coeffs[p][3], ex, _mm256_fmadd_ps(coeffs[p][4], ey,
+                _mm256_mul_ps(coeffs[p][5], ez)));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(d, r),
+                _mm256_setzero_ps(), _CMP_GE_OQ));
+        }
+        mask[i / 64] |= uint64_t(_mm256_movemask_ps(inside)) << (i % 64);
+    }
+    cull_boxes_scalar(planes, nplanes, xs, ys, zs, exs, eys, ezs, mask, i, count);
+}
+
+/*****************************************************************************/
+/* MODULE INTERFACE                                                          */
+/*****************************************************************************/
+
+/* Transforms every point in 'in' by 'mat', writing the result
+ * to 'out'. The two spans may be the same.
+ */
+export
+void TransformPoints(const Mat4f& mat, std::span<const Vec3f> in, std::span<Vec3f> out,
+    SIMDLevel level = SIMDLevel::eAVX2)
+{
+    if(out.size() < in.size()) [[unlikely]]
+        throw std::length_error{"Output span is smaller than the input span"};
+
+    const float *m = mat.cbegin();
+    const float *src = reinterpret_cast<const float*>(in.data());
+    float *dst = reinterpret_cast<float*>(out.data());
+
+    switch(select_simd_level(level)) {
+    case SIMDLevel::eAVX2:
+        transform_points_avx2(m, src, dst, in.size());
+        break;
+    case SIMDLevel::eSSE:
+        transform_points_sse(m, src, dst, in.size());
+        break;
+    case SIMDLevel::eScalar:
+        transform_points_scalar(m, src, dst, in.size());
+        break;
+    }
+}
+
+export
+void TransformPoints(const Mat4f& mat, ConstPointsSoA in, PointsSoA out,
+    SIMDLevel level = SIMDLevel::eAVX2)
+{
+    if(in.m_y.size() != in.size() || in.m_z.size() != in.size()
+    || out.m_y.size() != out.size() || out.m_z.size() != out.size()) [[unlikely]]
+        throw std::length_error{"Mismatched lengths of the coordinate arrays"};
+    if(out.size() < in.size()) [[unlikely]]
+        throw std::length_error{"Output span is smaller than the input span"};
+
+    const float *m = mat.cbegin();
+    switch(select_simd_level(level)) {
+    case SIMDLevel::eAVX2:
+        transform_points_soa_avx2(m, in.m_x.data(), in.m_y.data(), in.m_z.data(),
+            out.m_x.data(), out.m_y.data(), out.m_z.data(), in.size());
+        break;
+    case SIMDLevel::eSSE:
+        transform_points_soa_sse(m, in.m_x.data(), in.m_y.data(), in.m_z.data(),
+            out.m_x.data(), out.m_y.data(), out.m_z.data(), in.size());
+        break;
+    case SIMDLevel::eScalar:
+        transform_points_soa_scalar(m, in.m_x.data(), in.m_y.data(), in.m_z.data(),
+            out.m_x.data(), out.m_y.data(), out.m_z.data(), in.size());
+        break;
+    }
+}
+
+/* out[i] = lhs[i] * rhs[i]. The output may alias either input.
+ */
+export
+void MultiplyMatrices(std::span<const Mat4f> lhs, std::span<const Mat4f> rhs,
+    std::span<Mat4f> out, SIMDLevel level = SIMDLevel::eAVX2)
+{
+    if(lhs.size() != rhs.size()) [[unlikely]]
+        throw std::length_error{"Mismatched lengths of the input spans"};
+    if(out.size() < lhs.size()) [[unlikely]]
+        throw std::length_error{"Output span is smaller than the input span"};
+
+    switch(select_simd_level(level)) {
+    case SIMDLevel::eAVX2:
+        mat_mult_many_avx2(reinterpret_cast<const float*>(lhs.data()),
+            reinterpret_cast<const float*>(rhs.data()),
+            reinterpret_cast<float*>(out.data()), lhs.size());
+        break;
+    case SIMDLevel::eSSE:
+        for(std::size_t i = 0; i < lhs.size(); i++) {
+            mat_mult_sse(lhs[i].cbegin(), rhs[i].cbegin(), out[i].begin());
+        }
+        break;
+    case SIMDLevel::eScalar:
+        for(std::size_t i = 0; i < lhs.size(); i++) {
+            mat_mult_scalar(lhs[i].cbegin(), rhs[i].cbegin(), out[i].begin());
+        }
+        break;
+    }
+}
+
+/* out[i] = lhs * rhs[i], i.e. concatenating a parent transform
+ * with the local transforms of all its children. The output may
+ * alias the input.
+ */
+export
+void MultiplyMatrices(const Mat4f& lhs, std::span<const Mat4f> rhs,
+    std::span<Mat4f> out, SIMDLevel level = SIMDLevel::eAVX2)
+{
+    if(out.size() < rhs.size()) [[unlikely]]
+        throw std::length_error{"Output span is smaller than the input span"};
+
+    switch(select_simd_level(level)) {
+    case SIMDLevel::eAVX2:
+        mat_mult_one_many_avx2(lhs.cbegin(), reinterpret_cast<const float*>(rhs.data()),
+            reinterpret_cast<float*>(out.data()), rhs.size());
+        break;
+    case SIMDLevel::eSSE:
+        for(std::size_t i = 0; i < rhs.size(); i++) {
+            mat_mult_sse(lhs.cbegin(), rhs[i].cbegin(), out[i].begin());
+        }
+        break;
+    case SIMDLevel::eScalar:
+        for(std::size_t i = 0; i < rhs.size(); i++) {
+            mat_mult_scalar(lhs.cbegin(), rhs[i].cbegin(), out[i].begin());
+        }
+        break;
+    }
+}
+
+/* Extracts the planes of the view frustum of a view-projection
+ * matrix produced by Perspective or Orthographic, in the order
+ * left, right, bottom, top, near, far. The normals point into
+ * the frustum and are normalized, so that the planes give the
+ * signed distance of a point: dot(xyz, p) + w.
+ */
+export
+std::array<Vec4f, 6> FrustumPlanes(const Mat4f& view_proj)
+{
+    const float *m = view_proj.cbegin();
+    auto row = [m](std::size_t r, float sign){
+        return Vec4f{m[12] + sign * m[r * 4 + 0], m[13] + sign * m[r * 4 + 1],
+                     m[14] + sign * m[r * 4 + 2], m[15] + sign * m[r * 4 + 3]};
+    };
+    std::array<Vec4f, 6> ret{
+        row(0, 1.0f), row(0, -1.0f),
+        row(1, 1.0f), row(1, -1.0f),
+        /* The depth range is [0, 1] */
+        Vec4f{m[8], m[9], m[10], m[11]},
+        row(2, -1.0f)
+    };
+    for(auto& plane : ret) {
+        float len = std::sqrt(plane.x() * plane.x() + plane.y() * plane.y()
+                            + plane.z() * plane.z());
+        plane = plane / len;
+    }
+    return ret;
+}
+
+/* Sets bit i of 'mask' if sphere i is at least partially in
+ * front of every one of the planes, and clears it otherwise.
+ */
+export
+void CullSpheres(std::span<const Vec4f> planes, ConstSpheresSoA spheres,
+    std::span<uint64_t> mask, SIMDLevel level = SIMDLevel::eAVX2)
+{
+    const std::size_t count = spheres.size();
+    if(planes.size() > kMaxCullPlanes) [[unlikely]]
+        throw std::length_error{"Too many culling planes"};
+    if(spheres.m_y.size() != count || spheres.m_z.size() != count
+    || spheres.m_radius.size() != count) [[unlikely]]
+        throw std::length_error{"Mismatched lengths of the sphere arrays"};
+    if(mask.size() * 64 < count) [[unlikely]]
+        throw std::length_error{"Mask is too small for the number of spheres"};
+
+    std::fill_n(mask.begin(), (count + 63) / 64, 0);
+    const float *p = reinterpret_cast<const float*>(planes.data());
+
+    switch(select_simd_level(level)) {
+    case SIMDLevel::eAVX2:
+        cull_spheres_avx2(p, planes.size(), spheres.m_x.data(), spheres.m_y.data(),
+            spheres.m_z.data(), spheres.m_radius.data(), mask.data(), count);
+        break;
+    case SIMDLevel::eSSE:
+        cull_spheres_sse(p, planes.size(), spheres.m_x.data(), spheres.m_y.data(),
+            spheres.m_z.data(), spheres.m_radius.data(), mask.data(), count);
+        break;
+    case SIMDLevel::eScalar:
+        cull_spheres_scalar(p, planes.size(), spheres.m_x.data(), spheres.m_y.data(),
+            spheres.m_z.data(), spheres.m_radius.data(), mask.data(), 0, count);
+        break;
+    }
+}
+
+export
+void CullBoxes(std::span<const Vec4f> planes, ConstBoxesSoA boxes,
+    std::span<uint64_t> mask, SIMDLevel level = SIMDLevel::eAVX2)
+{
+    const std::size_t count = boxes.size();
+    if(planes.size() > kMaxCullPlanes) [[unlikely]]
+        throw std::length_error{"Too many culling planes"};
+    if(boxes.m_y.size() != count || boxes.m_z.size() != count
+    || boxes.m_extent_x.size() != count || boxes.m_extent_y.size() != count
+    || boxes.m_extent_z.size() != count) [[unlikely]]
+        throw std::length_error{"Mismatched lengths of the box arrays"};
+    if(mask.size() * 64 < count) [[unlikely]]
+        throw std::length_error{"Mask is too small for the number of boxes"};
+
+    std::fill_n(mask.begin(), (count + 63) / 64, 0);
+    const float *p = reinterpret_cast<const float*>(planes.data());
+
+    switch(select_simd_level(level)) {
+    case SIMDLevel::eAVX2:
+        cull_boxes_avx2(p, planes.size(), boxes.m_x.data(), boxes.m_y.data(),
+            boxes.m_z.data(), boxes.m_extent_x.data(), boxes.m_extent_y.data(),
+            boxes.m_extent_z.data(), mask.data(), count);
+        break;
+    case SIMDLevel::eSSE:
+        cull_boxes_sse(p, planes.size(), boxes.m_x.data(), boxes.m_y.data(),
+            boxes.m_z.data(), boxes.m_extent_x.data(), boxes.m_extent_y.data(),
+            boxes.m_extent_z.data(), mask.data(), count);
+        break;
+    case SIMDLevel::eScalar:
+        cull_boxes_scalar(p, planes.size(), boxes.m_x.data(), boxes.m_y.data(),
+            boxes.m_z.data(), boxes.m_extent_x.data(), boxes.m_extent_y.data(),
+            boxes.m_extent_z.data(), mask.data(), 0, count);
+        break;
+    }
+}
+
+/* Writes the positions of the set bits of 'mask' to 'indices'
+ * in increasing order, returning their number.
+ */
+export
+std::size_t CompactVisible(std::span<const uint64_t> mask, std::span<uint32_t> indices)
+{
+    std::size_t count = 0;
+    for(std::size_t word = 0; word < mask.size(); word++) {
+        uint64_t bits = mask[word];
+        if(count + std::popcount(bits) > indices.size()) [[unlikely]]
+            throw std::length_error{"Index span is too small for the visible set"};
+        while(bits) {
+            indices[count++] = static_cast<uint32_t>(word * 64 + std::countr_zero(bits));
+            bits &= bits - 1;
+        }
+    }
+    return count;
+}
+
+} // namespace pe
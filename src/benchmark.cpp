@@ -0,0 +1,1182 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+module;
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+export module benchmark;
+
+import logger;
+import platform;
+
+import <cstdint>;
+import <cstdlib>;
+import <cmath>;
+import <cctype>;
+import <array>;
+import <atomic>;
+import <string>;
+import <string_view>;
+import <vector>;
+import <variant>;
+import <utility>;
+import <chrono>;
+import <thread>;
+import <fstream>;
+import <sstream>;
+import <ostream>;
+import <algorithm>;
+import <numeric>;
+import <stdexcept>;
+import <optional>;
+import <concepts>;
+
+/* A small framework shared by all the benchmarks. Every benchmark
+ * case is run for a number of warmup iterations, which are discarded,
+ * followed by a number of measured repetitions. The median and spread
+ * of the repetitions is reported, together with hardware counters
+ * when the kernel allows us to use 'perf_event_open'. The results
+ * of a suite can be written to a JSON file, and two such files can
+ * be compared with the 'bench_compare' tool to flag regressions.
+ *
+ *  pe::BenchmarkSuite suite{"containers", argc, argv};
+ *  for(auto nthreads : suite.Threads({1, 2, 4, 8})) {
+ *      suite.RunParallel("queue", {{"threads", std::to_string(nthreads)}}, nthreads,
+ *          [&](std::size_t idx){ ...; return nops; });
+ *  }
+ *  suite.Finish();
+ *
+ * The per-operation latency distribution can be measured by taking
+ * a 'LatencySampler' as the second argument of the parallel function
+ * and wrapping the operations in 'Measure'. Only every n-th operation
+ * is timed, to keep the overhead of reading the TSC low:
+ *
+ *  suite.RunParallel("queue", params, nthreads,
+ *      [&](std::size_t idx, pe::LatencySampler& sampler){
+ *          sampler.Measure([&]{ queue.Enqueue(idx); });
+ *          ...
+ *      });
+ *
+ * Benchmarks which cannot be expressed as a callable (for example,
+ * because they must 'co_await' inside a task), can drive a case by
+ * hand:
+ *
+ *  auto bench = suite.Case("messages", {{"pairs", n}});
+ *  while(bench.Next()) {
+ *      bench.Start();
+ *      auto nmsgs = co_await master;
+ *      bench.Stop(nmsgs);
+ *  }
+ *
+ * All suites accept the following command-line options:
+ *
+ *  --reps <n>           number of measured repetitions (default: 5)
+ *  --warmup <n>         number of discarded warmup iterations (default: 1)
+ *  --threads <a,b,...>  override the thread counts swept by the suite
+ *  --filter <substr>    only run the cases whose ID contains the string
+ *  --json <path>        write the results to a JSON file
+ *
+ * As the hardware counters are inherited by child threads only when
+ * they are created after the counters have been opened, the suite
+ * should be created before any threads (or the scheduler) are.
+ */
+
+namespace pe{
+
+/*****************************************************************************/
+/* PERF COUNTERS                                                             */
+/*****************************************************************************/
+
+export
+struct PerfCounterValues
+{
+    bool     m_valid;
+    uint64_t m_cycles;
+    uint64_t m_instructions;
+    uint64_t m_cache_misses;
+    uint64_t m_context_switches;
+};
+
+class PerfCounters
+{
+private:
+
+    enum Counter
+    {
+        eCycles,
+        eInstructions,
+        eCacheMisses,
+        eContextSwitches,
+        eNumCounters
+    };
+
+    std::array<int, eNumCounters> m_fds;
+
+    static int open_counter(uint32_t type, uint64_t config)
+    {
+#ifdef __linux__
+        /* Fall back to counting only the user-space events
+         * in case the kernel's 'perf_event_paranoid' setting
+         * doesn't permit profiling the kernel.
+         */
+        for(bool exclude_kernel : {false, true}) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = type;
+            attr.config = config;
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_hv = 1;
+            attr.exclude_kernel = exclude_kernel;
+
+            int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+            if(fd >= 0)
+                return fd;
+        }
+#endif
+        return -1;
+    }
+
+    template <typename Op>
+    void for_each_fd(Op op)
+    {
+        for(int fd : m_fds) {
+            if(fd >= 0)
+                op(fd);
+        }
+    }
+
+public:
+
+    PerfCounters()
+        : m_fds{}
+    {
+#ifdef __linux__
+        m_fds[eCycles] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        m_fds[eInstructions] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        m_fds[eCacheMisses] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        m_fds[eContextSwitches] = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES);
+#else
+        m_fds.fill(-1);
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters()
+    {
+#ifdef __linux__
+        for_each_fd([](int fd){ close(fd); });
+#endif
+    }
+
+    bool Available() const
+    {
+        return std::any_of(std::begin(m_fds), std::end(m_fds), [](int fd){
+            return fd >= 0;
+        });
+    }
+
+    void Start()
+    {
+#ifdef __linux__
+        for_each_fd([](int fd){
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        });
+#endif
+    }
+
+    PerfCounterValues Stop()
+    {
+        PerfCounterValues ret{};
+#ifdef __linux__
+        for_each_fd([](int fd){
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        });
+
+        auto read_counter = [this](Counter counter) -> uint64_t {
+            uint64_t value = 0;
+            if(m_fds[counter] < 0)
+                return 0;
+            if(read(m_fds[counter], &value, sizeof(value)) != sizeof(value))
+                return 0;
+            return value;
+        };
+        ret.m_valid = Available();
+        ret.m_cycles = read_counter(eCycles);
+        ret.m_instructions = read_counter(eInstructions);
+        ret.m_cache_misses = read_counter(eCacheMisses);
+        ret.m_context_switches = read_counter(eContextSwitches);
+#endif
+        return ret;
+    }
+};
+
+/*****************************************************************************/
+/* STATISTICS                                                                */
+/*****************************************************************************/
+
+export
+struct SummaryStats
+{
+    double m_min;
+    double m_p10;
+    double m_median;
+    double m_p90;
+    double m_max;
+    double m_mean;
+};
+
+/* Percentile with linear interpolation between the closest ranks.
+ */
+double percentile(const std::vector<double>& sorted, double pct)
+{
+    if(sorted.empty())
+        return 0.0;
+    double rank = (pct / 100.0) * (std::size(sorted) - 1);
+    std::size_t lo = static_cast<std::size_t>(std::floor(rank));
+    std::size_t hi = static_cast<std::size_t>(std::ceil(rank));
+    double frac = rank - lo;
+    return sorted[lo] + (sorted[hi] - sorted[lo]) * frac;
+}
+
+export
+SummaryStats Summarize(std::vector<double> values)
+{
+    if(values.empty())
+        return {};
+    std::sort(std::begin(values), std::end(values));
+    double sum = std::accumulate(std::begin(values), std::end(values), 0.0);
+    return {
+        values.front(),
+        percentile(values, 10.0),
+        percentile(values, 50.0),
+        percentile(values, 90.0),
+        values.back(),
+        sum / std::size(values)
+    };
+}
+
+/*****************************************************************************/
+/* BENCHMARK RESULT                                                          */
+/*****************************************************************************/
+
+export
+struct LatencyStats
+{
+    double m_p50;
+    double m_p99;
+    double m_p999;
+    double m_max;
+};
+
+export
+struct BenchmarkSample
+{
+    double                      m_seconds;
+    double                      m_items;
+    PerfCounterValues           m_counters;
+    std::optional<LatencyStats> m_latency;
+};
+
+export
+using BenchmarkParams = std::vector<std::pair<std::string, std::string>>;
+
+export
+struct BenchmarkResult
+{
+    std::string                  m_name;
+    BenchmarkParams              m_params;
+    std::size_t                  m_warmup;
+    std::vector<BenchmarkSample> m_samples;
+
+    std::string ID() const
+    {
+        std::string ret = m_name;
+        for(const auto& [key, value] : m_params) {
+            ret += "/" + key + "=" + value;
+        }
+        return ret;
+    }
+
+    SummaryStats Seconds() const
+    {
+        std::vector<double> values;
+        for(const auto& sample : m_samples) {
+            values.push_back(sample.m_seconds);
+        }
+        return Summarize(values);
+    }
+
+    SummaryStats ItemsPerSecond() const
+    {
+        std::vector<double> values;
+        for(const auto& sample : m_samples) {
+            if(sample.m_seconds > 0)
+                values.push_back(sample.m_items / sample.m_seconds);
+        }
+        return Summarize(values);
+    }
+
+    template <typename Getter>
+    std::optional<double> MedianCounter(Getter getter) const
+    {
+        std::vector<double> values;
+        for(const auto& sample : m_samples) {
+            if(sample.m_counters.m_valid)
+                values.push_back(getter(sample.m_counters));
+        }
+        if(values.empty())
+            return std::nullopt;
+        return Summarize(values).m_median;
+    }
+
+    /* The median of every latency percentile over
+     * all the repetitions.
+     */
+    std::optional<LatencyStats> MedianLatency() const
+    {
+        std::vector<double> p50, p99, p999, max;
+        for(const auto& sample : m_samples) {
+            if(!sample.m_latency)
+                continue;
+            p50.push_back(sample.m_latency->m_p50);
+            p99.push_back(sample.m_latency->m_p99);
+            p999.push_back(sample.m_latency->m_p999);
+            max.push_back(sample.m_latency->m_max);
+        }
+        if(p50.empty())
+            return std::nullopt;
+        return LatencyStats{
+            Summarize(p50).m_median,
+            Summarize(p99).m_median,
+            Summarize(p999).m_median,
+            Summarize(max).m_median
+        };
+    }
+
+    double MedianItems() const
+    {
+        std::vector<double> values;
+        for(const auto& sample : m_samples) {
+            values.push_back(sample.m_items);
+        }
+        return Summarize(values).m_median;
+    }
+};
+
+/*****************************************************************************/
+/* JSON                                                                      */
+/*****************************************************************************/
+/*
+ * Just enough JSON to read back the result files written out
+ * by the suites.
+ */
+export
+struct JsonValue
+{
+    using Array = std::vector<JsonValue>;
+    using Object = std::vector<std::pair<std::string, JsonValue>>;
+
+    std::variant<std::monostate, bool, double, std::string, Array, Object> m_value;
+
+    const JsonValue *Find(std::string_view key) const
+    {
+        if(!std::holds_alternative<Object>(m_value))
+            return nullptr;
+        for(const auto& [k, v] : std::get<Object>(m_value)) {
+            if(k == key)
+                return &v;
+        }
+        return nullptr;
+    }
+
+    double Number(double fallback = 0.0) const
+    {
+        if(!std::holds_alternative<double>(m_value))
+            return fallback;
+        return std::get<double>(m_value);
+    }
+
+    std::string String() const
+    {
+        if(!std::holds_alternative<std::string>(m_value))
+            return {};
+        return std::get<std::string>(m_value);
+    }
+
+    const Array& Elements() const
+    {
+        static const Array s_empty{};
+        if(!std::holds_alternative<Array>(m_value))
+            return s_empty;
+        return std::get<Array>(m_value);
+    }
+};
+
+class JsonParser
+{
+private:
+
+    std::string_view m_text;
+    std::size_t      m_pos;
+
+    [[noreturn]] void error(const char *what) const
+    {
+        throw std::runtime_error{"JSON parse error at offset "
+            + std::to_string(m_pos) + ": " + what};
+    }
+
+    void skip_whitespace()
+    {
+        while(m_pos < std::size(m_text) && std::isspace(static_cast<unsigned char>(m_text[m_pos])))
+            m_pos++;
+    }
+
+    char peek()
+    {
+        skip_whitespace();
+        if(m_pos >= std::size(m_text))
+            error("unexpected end of input");
+        return m_text[m_pos];
+    }
+
+    void expect(char c)
+    {
+        if(peek() != c)
+            error("unexpected character");
+        m_pos++;
+    }
+
+    bool consume_literal(std::string_view literal)
+    {
+        if(m_text.substr(m_pos, std::size(literal)) != literal)
+            return false;
+        m_pos += std::size(literal);
+        return true;
+    }
+
+    std::string parse_string()
+    {
+        expect('"');
+        std::string ret;
+        while(true) {
+            if(m_pos >= std::size(m_text))
+                error("unterminated string");
+            char c = m_text[m_pos++];
+            if(c == '"')
+                break;
+            if(c == '\\') {
+                if(m_pos >= std::size(m_text))
+                    error("unterminated string");
+                char esc = m_text[m_pos++];
+                switch(esc) {
+                case 'n': ret += '\n'; break;
+                case 't': ret += '\t'; break;
+                case 'r': ret += '\r'; break;
+                case 'b': ret += '\b'; break;
+                case 'f': ret += '\f'; break;
+                case 'u':
+                    /* Not emitted by us; keep the code point as-is */
+                    ret += "\\u";
+                    break;
+                default:  ret += esc; break;
+                }
+                continue;
+            }
+            ret += c;
+        }
+        return ret;
+    }
+
+    double parse_number()
+    {
+        std::size_t begin = m_pos;
+        while(m_pos < std::size(m_text)
+           && (std::isdigit(static_cast<unsigned char>(m_text[m_pos]))
+           || std::string_view{"+-.eE"}.find(m_text[m_pos]) != std::string_view::npos)) {
+            m_pos++;
+        }
+        if(begin == m_pos)
+            error("expected a value");
+        return std::strtod(std::string{m_text.substr(begin, m_pos - begin)}.c_str(), nullptr);
+    }
+
+public:
+
+    JsonParser(std::string_view text)
+        : m_text{text}
+        , m_pos{0}
+    {}
+
+    JsonValue Parse()
+    {
+        char c = peek();
+        if(c == '{') {
+            m_pos++;
+            JsonValue::Object object;
+            if(peek() == '}') {
+                m_pos++;
+                return {object};
+            }
+            while(true) {
+                std::string key = parse_string();
+                expect(':');
+                object.emplace_back(std::move(key), Parse());
+                if(peek() == ',') {
+                    m_pos++;
+                    continue;
+                }
+                expect('}');
+                return {object};
+            }
+        }
+        if(c == '[') {
+            m_pos++;
+            JsonValue::Array array;
+            if(peek() == ']') {
+                m_pos++;
+                return {array};
+            }
+            while(true) {
+                array.push_back(Parse());
+                if(peek() == ',') {
+                    m_pos++;
+                    continue;
+                }
+                expect(']');
+                return {array};
+            }
+        }
+        if(c == '"')
+            return {parse_string()};
+        if(consume_literal("true"))
+            return {true};
+        if(consume_literal("false"))
+            return {false};
+        if(consume_literal("null"))
+            return {std::monostate{}};
+        return {parse_number()};
+    }
+};
+
+export
+JsonValue ReadJsonFile(const std::string& path)
+{
+    std::ifstream in{path};
+    if(!in)
+        throw std::runtime_error{"Failed to open file: " + path};
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string text = ss.str();
+    return JsonParser{text}.Parse();
+}
+
+void write_json_string(std::ostream& out, std::string_view str)
+{
+    out << '"';
+    for(char c : str) {
+        switch(c) {
+        case '"':  out << "\\\""; break;
+        case '\\': out << "\\\\"; break;
+        case '\n': out << "\\n";  break;
+        default:
+            if(static_cast<unsigned char>(c) < 0x20)
+                out << ' ';
+            else
+                out << c;
+        }
+    }
+    out << '"';
+}
+
+void write_json_stats(std::ostream& out, const SummaryStats& stats)
+{
+    out << "{\"min\":" << stats.m_min
+        << ",\"p10\":" << stats.m_p10
+        << ",\"median\":" << stats.m_median
+        << ",\"p90\":" << stats.m_p90
+        << ",\"max\":" << stats.m_max
+        << ",\"mean\":" << stats.m_mean << "}";
+}
+
+/*****************************************************************************/
+/* BENCHMARK OPTIONS                                                         */
+/*****************************************************************************/
+
+export
+struct BenchmarkOptions
+{
+    std::size_t              m_warmup = 1;
+    std::size_t              m_repetitions = 5;
+    std::vector<std::size_t> m_threads{};
+    std::string              m_filter{};
+    std::string              m_json_path{};
+};
+
+export
+BenchmarkOptions ParseBenchmarkOptions(int argc, char **argv)
+{
+    BenchmarkOptions ret{};
+    auto next_arg = [&](int& i) -> std::string {
+        if(i + 1 >= argc)
+            throw std::invalid_argument{std::string{"Missing value for "} + argv[i]};
+        return argv[++i];
+    };
+
+    for(int i = 1; i < argc; i++) {
+        std::string_view arg{argv[i]};
+        if(arg == "--reps") {
+            ret.m_repetitions = std::max<std::size_t>(1, std::stoul(next_arg(i)));
+        }else if(arg == "--warmup") {
+            ret.m_warmup = std::stoul(next_arg(i));
+        }else if(arg == "--filter") {
+            ret.m_filter = next_arg(i);
+        }else if(arg == "--json") {
+            ret.m_json_path = next_arg(i);
+        }else if(arg == "--threads") {
+            std::stringstream ss{next_arg(i)};
+            std::string token;
+            while(std::getline(ss, token, ',')) {
+                ret.m_threads.push_back(std::stoul(token));
+            }
+        }else{
+            throw std::invalid_argument{"Unknown benchmark option: " + std::string{arg}};
+        }
+    }
+    return ret;
+}
+
+/*****************************************************************************/
+/* LATENCY SAMPLER                                                           */
+/*****************************************************************************/
+/*
+ * Records the duration (in TSC ticks) of every n-th measured
+ * operation of a single thread.
+ */
+export
+class LatencySampler
+{
+private:
+
+    std::vector<uint64_t> m_samples;
+    uint32_t              m_period;
+    uint32_t              m_counter;
+
+public:
+
+    static constexpr uint32_t kDefaultPeriod = 8;
+
+    LatencySampler(uint32_t period = kDefaultPeriod)
+        : m_samples{}
+        , m_period{std::max<uint32_t>(period, 1)}
+        , m_counter{0}
+    {}
+
+    template <typename Op>
+    void Measure(Op&& op)
+    {
+        if(++m_counter < m_period) {
+            op();
+            return;
+        }
+        m_counter = 0;
+        uint64_t before = rdtsc_before();
+        op();
+        uint64_t after = rdtsc_after();
+        m_samples.push_back(after - before);
+    }
+
+    std::vector<uint64_t>& Samples()
+    {
+        return m_samples;
+    }
+};
+
+/*****************************************************************************/
+/* BENCHMARK SUITE                                                           */
+/*****************************************************************************/
+
+export class BenchmarkSuite;
+
+export
+class BenchmarkCase
+{
+private:
+
+    using TimestampType = std::chrono::time_point<std::chrono::steady_clock>;
+
+    BenchmarkSuite *m_suite;
+    BenchmarkResult m_result;
+    std::size_t     m_iteration;
+    std::size_t     m_repetitions;
+    bool            m_enabled;
+    TimestampType   m_start;
+
+public:
+
+    BenchmarkCase(BenchmarkSuite& suite, BenchmarkResult result,
+        std::size_t repetitions, bool enabled)
+        : m_suite{&suite}
+        , m_result{std::move(result)}
+        , m_iteration{0}
+        , m_repetitions{repetitions}
+        , m_enabled{enabled}
+        , m_start{}
+    {}
+
+    /* Advance to the next iteration. Returns false once all the
+     * warmup iterations and repetitions have been performed, at
+     * which point the result is reported to the suite.
+     */
+    bool Next();
+
+    bool Warmup() const
+    {
+        return (m_iteration <= m_result.m_warmup);
+    }
+
+    void Start();
+    void Stop(double items = 0, std::vector<uint64_t> latency_ticks = {});
+
+    /* For benchmarks that do their own timing.
+     */
+    void Record(std::chrono::microseconds elapsed, double items = 0);
+};
+
+export
+class BenchmarkSuite
+{
+private:
+
+    std::string                  m_name;
+    BenchmarkOptions             m_options;
+    PerfCounters                 m_counters;
+    double                       m_ticks_per_nsec;
+    std::vector<BenchmarkResult> m_results;
+
+    friend class BenchmarkCase;
+
+    /* CPUID does not report the TSC frequency on all
+     * processors, so measure it.
+     */
+    static double calibrate_tsc()
+    {
+        constexpr std::chrono::milliseconds kCalibrationTime{20};
+        auto start_time = std::chrono::steady_clock::now();
+        uint64_t start_tsc = rdtsc_before();
+        std::this_thread::sleep_for(kCalibrationTime);
+        uint64_t end_tsc = rdtsc_after();
+        auto end_time = std::chrono::steady_clock::now();
+        auto nsecs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            end_time - start_time).count();
+        if(nsecs <= 0 || end_tsc <= start_tsc)
+            return 1.0;
+        return static_cast<double>(end_tsc - start_tsc) / nsecs;
+    }
+
+    void report(BenchmarkResult result)
+    {
+        auto seconds = result.Seconds();
+        auto throughput = result.ItemsPerSecond();
+
+        std::stringstream ss;
+        ss.precision(4);
+        if(throughput.m_median > 0) {
+            ss << throughput.m_median << " items/sec"
+               << " [p10: " << throughput.m_p10 << ", p90: " << throughput.m_p90 << "]";
+        }else{
+            ss << seconds.m_median << " secs"
+               << " [p10: " << seconds.m_p10 << ", p90: " << seconds.m_p90 << "]";
+        }
+
+        auto cycles = result.MedianCounter([](const auto& c){ return c.m_cycles; });
+        auto instructions = result.MedianCounter([](const auto& c){ return c.m_instructions; });
+        auto misses = result.MedianCounter([](const auto& c){ return c.m_cache_misses; });
+        auto switches = result.MedianCounter([](const auto& c){ return c.m_context_switches; });
+        if(cycles && instructions && *cycles > 0) {
+            ss << " IPC: " << *instructions / *cycles;
+        }
+        double items = result.MedianItems();
+        if(misses && items > 0) {
+            ss << " misses/item: " << *misses / items;
+        }
+        if(switches) {
+            ss << " ctx switches: " << *switches;
+        }
+        if(auto latency = result.MedianLatency()) {
+            ss << " latency ns [p50: " << latency->m_p50
+               << ", p99: " << latency->m_p99
+               << ", p999: " << latency->m_p999 << "]";
+        }
+
+        pe::dbgprint(result.ID(), pe::fmt::cat{}, ":", ss.str());
+        m_results.push_back(std::move(result));
+    }
+
+    void write_json(std::ostream& out) const
+    {
+        out << "{\"suite\":";
+        write_json_string(out, m_name);
+        out << ",\"perf_counters\":" << (m_counters.Available() ? "true" : "false");
+        out << ",\"results\":[";
+
+        for(int i = 0; i < std::size(m_results); i++) {
+            const auto& result = m_results[i];
+            if(i > 0)
+                out << ",";
+            out << "{\"id\":";
+            write_json_string(out, result.ID());
+            out << ",\"name\":";
+            write_json_string(out, result.m_name);
+            out << ",\"params\":{";
+            for(int j = 0; j < std::size(result.m_params); j++) {
+                if(j > 0)
+                    out << ",";
+                write_json_string(out, result.m_params[j].first);
+                out << ":";
+                write_json_string(out, result.m_params[j].second);
+            }
+            out << "},\"warmup\":" << result.m_warmup;
+            out << ",\"repetitions\":" << std::size(result.m_samples);
+            out << ",\"seconds\":";
+            write_json_stats(out, result.Seconds());
+            out << ",\"items\":" << result.MedianItems();
+            out << ",\"items_per_sec\":";
+            write_json_stats(out, result.ItemsPerSecond());
+
+            auto write_counter = [&](const char *name, std::optional<double> value){
+                out << ",";
+                write_json_string(out, name);
+                out << ":";
+                if(value)
+                    out << *value;
+                else
+                    out << "null";
+            };
+            out << ",\"counters\":{\"valid\":"
+                << (result.MedianCounter([](const auto& c){ return c.m_cycles; }) ? "true" : "false");
+            write_counter("cycles", result.MedianCounter([](const auto& c){ return c.m_cycles; }));
+            write_counter("instructions",
+                result.MedianCounter([](const auto& c){ return c.m_instructions; }));
+            write_counter("cache_misses",
+                result.MedianCounter([](const auto& c){ return c.m_cache_misses; }));
+            write_counter("context_switches",
+                result.MedianCounter([](const auto& c){ return c.m_context_switches; }));
+            out << "},\"latency_ns\":";
+            if(auto latency = result.MedianLatency()) {
+                out << "{\"p50\":" << latency->m_p50
+                    << ",\"p99\":" << latency->m_p99
+                    << ",\"p999\":" << latency->m_p999
+                    << ",\"max\":" << latency->m_max << "}";
+            }else{
+                out << "null";
+            }
+            out << "}";
+        }
+        out << "]}";
+    }
+
+public:
+
+    BenchmarkSuite(std::string name, int argc, char **argv)
+        : m_name{name}
+        , m_options{ParseBenchmarkOptions(argc, argv)}
+        , m_counters{}
+        , m_ticks_per_nsec{calibrate_tsc()}
+        , m_results{}
+    {
+        if(!m_counters.Available()) {
+            pe::ioprint(pe::LogLevel::eWarning,
+                "Hardware counters are not available (check 'perf_event_paranoid').");
+        }
+    }
+
+    const BenchmarkOptions& Options() const
+    {
+        return m_options;
+    }
+
+    /* The thread counts to sweep over, unless overridden
+     * on the command line.
+     */
+    std::vector<std::size_t> Threads(std::vector<std::size_t> defaults) const
+    {
+        if(!m_options.m_threads.empty())
+            return m_options.m_threads;
+        return defaults;
+    }
+
+    BenchmarkCase Case(std::string name, BenchmarkParams params = {})
+    {
+        BenchmarkResult result{name, params, m_options.m_warmup, {}};
+        bool enabled = m_options.m_filter.empty()
+                    || (result.ID().find(m_options.m_filter) != std::string::npos);
+        return BenchmarkCase{*this, std::move(result), m_options.m_repetitions, enabled};
+    }
+
+    template <typename Func>
+    requires requires (Func func) {
+        {func()} -> std::convertible_to<double>;
+    }
+    void Run(std::string name, BenchmarkParams params, Func&& func)
+    {
+        auto bench = Case(name, params);
+        while(bench.Next()) {
+            bench.Start();
+            double items = func();
+            bench.Stop(items);
+        }
+    }
+
+    /* Run 'func' concurrently on 'nthreads' threads, passing every
+     * thread its' index. The threads are created up-front and are
+     * released together, so that thread creation is not timed. The
+     * function returns the number of items it has processed.
+     */
+    template <typename Func>
+    requires requires (Func func, std::size_t idx) {
+        {func(idx)} -> std::convertible_to<double>;
+    }
+    void RunParallel(std::string name, BenchmarkParams params, std::size_t nthreads, Func&& func)
+    {
+        auto bench = Case(name, params);
+        while(bench.Next()) {
+
+            std::atomic_size_t nready{0};
+            std::atomic_flag go{};
+            std::vector<double> items(nthreads);
+            std::vector<std::thread> threads;
+
+            for(std::size_t i = 0; i < nthreads; i++) {
+                threads.emplace_back([&, i]{
+                    nready.fetch_add(1, std::memory_order_release);
+                    while(!go.test(std::memory_order_acquire));
+                    items[i] = func(i);
+                });
+            }
+            while(nready.load(std::memory_order_acquire) < nthreads);
+
+            bench.Start();
+            go.test_and_set(std::memory_order_release);
+            for(auto& thread : threads) {
+                thread.join();
+            }
+            bench.Stop(std::accumulate(std::begin(items), std::end(items), 0.0));
+        }
+    }
+
+    /* As above, but additionally record the latency distribution
+     * of the operations measured with the sampler.
+     */
+    template <typename Func>
+    requires requires (Func func, std::size_t idx, LatencySampler& sampler) {
+        {func(idx, sampler)} -> std::convertible_to<double>;
+    }
+    void RunParallel(std::string name, BenchmarkParams params, std::size_t nthreads, Func&& func)
+    {
+        auto bench = Case(name, params);
+        while(bench.Next()) {
+
+            std::atomic_size_t nready{0};
+            std::atomic_flag go{};
+            std::vector<double> items(nthreads);
+            std::vector<LatencySampler> samplers(nthreads);
+            std::vector<std::thread> threads;
+
+            for(std::size_t i = 0; i < nthreads; i++) {
+                threads.emplace_back([&, i]{
+                    nready.fetch_add(1, std::memory_order_release);
+                    while(!go.test(std::memory_order_acquire));
+                    items[i] = func(i, samplers[i]);
+                });
+            }
+            while(nready.load(std::memory_order_acquire) < nthreads);
+
+            bench.Start();
+            go.test_and_set(std::memory_order_release);
+            for(auto& thread : threads) {
+                thread.join();
+            }
+
+            std::vector<uint64_t> latencies;
+            for(auto& sampler : samplers) {
+                latencies.insert(std::end(latencies), std::begin(sampler.Samples()),
+                    std::end(sampler.Samples()));
+            }
+            bench.Stop(std::accumulate(std::begin(items), std::end(items), 0.0),
+                std::move(latencies));
+        }
+    }
+
+    /* Write out the results file, if one was requested.
+     */
+    void Finish() const
+    {
+        if(m_options.m_json_path.empty())
+            return;
+        std::ofstream out{m_options.m_json_path, std::ios::out | std::ios::trunc};
+        if(!out)
+            throw std::runtime_error{"Failed to open results file: " + m_options.m_json_path};
+        write_json(out);
+        pe::ioprint(pe::TextColor::eGreen, "Wrote results to", m_options.m_json_path);
+    }
+};
+
+bool BenchmarkCase::Next()
+{
+    if(!m_enabled)
+        return false;
+    if(m_iteration == m_result.m_warmup + m_repetitions) {
+        m_enabled = false;
+        m_suite->report(std::move(m_result));
+        return false;
+    }
+    m_iteration++;
+    return true;
+}
+
+void BenchmarkCase::Start()
+{
+    m_suite->m_counters.Start();
+    m_start = std::chrono::steady_clock::now();
+}
+
+void BenchmarkCase::Stop(double items, std::vector<uint64_t> latency_ticks)
+{
+    auto end = std::chrono::steady_clock::now();
+    auto counters = m_suite->m_counters.Stop();
+    if(Warmup())
+        return;
+
+    std::optional<LatencyStats> latency{};
+    if(!latency_ticks.empty()) {
+        std::vector<double> nsecs(std::size(latency_ticks));
+        std::transform(std::begin(latency_ticks), std::end(latency_ticks), std::begin(nsecs),
+            [this](uint64_t ticks){ return ticks / m_suite->m_ticks_per_nsec; });
+        std::sort(std::begin(nsecs), std::end(nsecs));
+        latency = LatencyStats{
+            percentile(nsecs, 50.0),
+            percentile(nsecs, 99.0),
+            percentile(nsecs, 99.9),
+            nsecs.back()
+        };
+    }
+
+    std::chrono::duration<double> elapsed = end - m_start;
+    m_result.m_samples.push_back({elapsed.count(), items, counters, latency});
+}
+
+void BenchmarkCase::Record(std::chrono::microseconds elapsed, double items)
+{
+    if(Warmup())
+        return;
+    m_result.m_samples.push_back({elapsed.count() / 1'000'000.0, items, {}, std::nullopt});
+}
+
+/*****************************************************************************/
+/* COMPARISON                                                                */
+/*****************************************************************************/
+
+/* Compare the medians of two result files. Where the cases have
+ * a throughput, a drop in throughput is a regression, otherwise
+ * an increase in the run time is. A change only counts when it
+ * exceeds the threshold, given in percent. Returns the number of
+ * regressions.
+ */
+export
+std::size_t CompareBenchmarkResults(const std::string& base_path, const std::string& curr_path,
+    double threshold_pct)
+{
+    auto base = ReadJsonFile(base_path);
+    auto curr = ReadJsonFile(curr_path);
+
+    const JsonValue *base_results = base.Find("results");
+    const JsonValue *curr_results = curr.Find("results");
+    if(!base_results || !curr_results)
+        throw std::runtime_error{"Not a benchmark results file"};
+
+    auto median = [](const JsonValue& result, const char *metric){
+        if(auto stats = result.Find(metric)) {
+            if(auto median = stats->Find("median"))
+                return median->Number();
+        }
+        return 0.0;
+    };
+
+    std::size_t nregressions = 0;
+    for(const auto& result : curr_results->Elements()) {
+
+        std::string id = result.Find("id") ? result.Find("id")->String() : "";
+        auto it = std::find_if(std::begin(base_results->Elements()),
+            std::end(base_results->Elements()), [&](const JsonValue& other){
+                return other.Find("id") && other.Find("id")->String() == id;
+        });
+        if(it == std::end(base_results->Elements())) {
+            pe::ioprint(pe::TextColor::eWhite, pe::fmt::justified{id, 48, pe::fmt::Justify::eLeft},
+                "(new)");
+            continue;
+        }
+
+        /* Express the change so that a positive value is always
+         * an improvement.
+         */
+        double before = median(*it, "items_per_sec");
+        double after = median(result, "items_per_sec");
+        bool throughput = (before > 0 && after > 0);
+        if(!throughput) {
+            before = median(*it, "seconds");
+            after = median(result, "seconds");
+        }
+        if(before <= 0 || after <= 0)
+            continue;
+
+        double change = throughput ? (after - before) / before * 100.0
+                                   : (before - after) / before * 100.0;
+
+        TextColor color = TextColor::eWhite;
+        const char *verdict = "";
+        if(change < -threshold_pct) {
+            color = TextColor::eRed;
+            verdict = "REGRESSION";
+            nregressions++;
+        }else if(change > threshold_pct) {
+            color = TextColor::eGreen;
+            verdict = "improvement";
+        }
+
+        std::stringstream ss;
+        ss.precision(4);
+        ss << before << " -> " << after << (throughput ? " items/sec" : " secs");
+        pe::ioprint(color, pe::fmt::justified{id, 48, pe::fmt::Justify::eLeft},
+            pe::fmt::justified{ss.str(), 40, pe::fmt::Justify::eLeft},
+            pe::fmt::justified{change, 8}, pe::fmt::cat{}, "%", verdict);
+    }
+    return nregressions;
+}
+
+} // namespace pe
@@ -0,0 +1,344 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+export module chase_lev_deque;
+
+import platform;
+import hazard_ptr;
+import assert;
+
+import <atomic>;
+import <bit>;
+import <concepts>;
+import <optional>;
+import <memory>;
+import <cstring>;
+import <cstdint>;
+import <type_traits>;
+import <new>;
+
+namespace pe{
+
+export
+template <typename T>
+concept ChaseLevDequeItem = requires{
+    requires (std::is_copy_constructible_v<T>
+           || std::is_move_constructible_v<T>);
+};
+
+/* A type is trivially relocatable when an object can be moved to
+ * a new address by copying its' bytes and then forgetting about 
+ * the original, without running its' destructor. This holds for
+ * all trivially copyable types, and for types that only hold 
+ * pointers to the resources they own, which can opt in by 
+ * declaring a 'trivially_relocatable' member type.
+ */
+export
+template <typename T>
+concept TriviallyRelocatable = std::is_trivially_copyable_v<T> 
+                            || requires{ typename T::trivially_relocatable; };
+
+/* Based on the papers "Dynamic Circular Work-Stealing Deque"
+ * by David Chase and Yossi Lev and "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" by Nhat Minh Le et al.
+ *
+ * The deque has a single owner, which is the only thread
+ * allowed to call 'Push' and 'Pop'. Both operate on the
+ * bottom end of the deque and only need a CAS when racing
+ * with the thieves for the very last element. Any number
+ * of threads may concurrently 'Steal' from the top end.
+ *
+ * The elements are kept in a growable circular array of
+ * slots made of atomic words. Since a thief copies a slot 
+ * out before it has won the element, and the slot may be
+ * overwritten once another thread has won it, the copy is 
+ * only treated as an object once the element was won - 
+ * otherwise it is simply dropped. Trivially relocatable 
+ * values are stored directly in the slots. Any other values 
+ * are boxed, so that only the pointer is copied around. Arrays 
+ * which have been outgrown are reclaimed with hazard pointers, 
+ * as a thief may still be reading from them.
+ */
+export
+template <ChaseLevDequeItem T>
+class ChaseLevDeque
+{
+    static constexpr std::size_t kInitialCapacity = 64;
+    static constexpr bool kInline = TriviallyRelocatable<T>;
+
+    using stored_type = std::conditional_t<kInline, T, T*>;
+
+    static constexpr std::size_t kSlotWords = 
+        (sizeof(stored_type) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    /* The bytes of a stored value, which only hold a live
+     * object between it being won and it being taken out.
+     */
+    struct alignas(stored_type) alignas(uint64_t) Relocated
+    {
+        std::byte m_bytes[kSlotWords * sizeof(uint64_t)];
+
+        template <typename U>
+        void Emplace(U&& value)
+        {
+            if constexpr (kInline) {
+                new (m_bytes) T{std::forward<U>(value)};
+            }else{
+                new (m_bytes) stored_type{new T{std::forward<U>(value)}};
+            }
+        }
+
+        T Take()
+        {
+            auto stored = std::launder(reinterpret_cast<stored_type*>(m_bytes));
+            if constexpr (kInline) {
+                T ret{std::move(*stored)};
+                stored->~T();
+                return ret;
+            }else{
+                T ret{std::move(**stored)};
+                delete *stored;
+                return ret;
+            }
+        }
+    };
+
+    struct Slot
+    {
+        std::atomic<uint64_t> m_words[kSlotWords];
+    };
+
+    struct Buffer
+    {
+        std::size_t                 m_mask;
+        std::unique_ptr<Slot[]>     m_slots;
+
+        Buffer(std::size_t capacity)
+            : m_mask{capacity - 1}
+            , m_slots{std::make_unique<Slot[]>(capacity)}
+        {
+            pe::assert(std::has_single_bit(capacity));
+        }
+
+        std::size_t Capacity() const
+        {
+            return m_mask + 1;
+        }
+
+        void Get(int64_t index, Relocated& out) const
+        {
+            const Slot& slot = m_slots[index & m_mask];
+            for(std::size_t i = 0; i < kSlotWords; i++) {
+                uint64_t word = slot.m_words[i].load(std::memory_order_relaxed);
+                std::memcpy(out.m_bytes + i * sizeof(uint64_t), &word, sizeof(word));
+            }
+        }
+
+        void Put(int64_t index, const Relocated& value)
+        {
+            Slot& slot = m_slots[index & m_mask];
+            for(std::size_t i = 0; i < kSlotWords; i++) {
+                uint64_t word;
+                std::memcpy(&word, value.m_bytes + i * sizeof(uint64_t), sizeof(word));
+                slot.m_words[i].store(word, std::memory_order_relaxed);
+            }
+        }
+
+        void Copy(int64_t index, const Buffer& from)
+        {
+            Slot& slot = m_slots[index & m_mask];
+            const Slot& src = from.m_slots[index & from.m_mask];
+            for(std::size_t i = 0; i < kSlotWords; i++) {
+                slot.m_words[i].store(src.m_words[i].load(std::memory_order_relaxed),
+                    std::memory_order_relaxed);
+            }
+        }
+    };
+
+    alignas(kCacheLineSize) std::atomic<int64_t> m_top;
+    alignas(kCacheLineSize) std::atomic<int64_t> m_bottom;
+    alignas(kCacheLineSize) std::atomic<Buffer*> m_buffer;
+    mutable HPContext<Buffer, 1, 1>              m_hp;
+
+    static_assert(decltype(m_top)::is_always_lock_free);
+    static_assert(decltype(m_buffer)::is_always_lock_free);
+    static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+    ChaseLevDeque(ChaseLevDeque&&) = delete;
+    ChaseLevDeque(ChaseLevDeque const&) = delete;
+    ChaseLevDeque& operator=(ChaseLevDeque&&) = delete;
+    ChaseLevDeque& operator=(ChaseLevDeque const&) = delete;
+
+    Buffer *grow(Buffer *old, int64_t top, int64_t bottom);
+
+public:
+
+    ChaseLevDeque();
+    ~ChaseLevDeque();
+
+    /* May only be called by the owner */
+    template <typename U = T>
+    void Push(U&& value);
+    std::optional<T> Pop();
+
+    /* May be called by any thread */
+    std::optional<T> Steal();
+
+    /* Only a snapshot, as the deque may be concurrently modified */
+    std::size_t Size() const;
+    bool Empty() const;
+};
+
+template <ChaseLevDequeItem T>
+ChaseLevDeque<T>::ChaseLevDeque()
+    : m_top{0}
+    , m_bottom{0}
+    , m_buffer{new Buffer{kInitialCapacity}}
+    , m_hp{}
+{}
+
+template <ChaseLevDequeItem T>
+ChaseLevDeque<T>::~ChaseLevDeque()
+{
+    Buffer *buffer = m_buffer.load(std::memory_order_relaxed);
+    int64_t top = m_top.load(std::memory_order_relaxed);
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+    for(int64_t i = top; i < bottom; i++) {
+        Relocated value;
+        buffer->Get(i, value);
+        value.Take();
+    }
+    delete buffer;
+}
+
+template <ChaseLevDequeItem T>
+typename ChaseLevDeque<T>::Buffer *
+ChaseLevDeque<T>::grow(Buffer *old, int64_t top, int64_t bottom)
+{
+    Buffer *buffer = new Buffer{old->Capacity() * 2};
+    for(int64_t i = top; i < bottom; i++) {
+        buffer->Copy(i, *old);
+    }
+    m_buffer.store(buffer, std::memory_order_release);
+
+    /* Thieves which are still reading from the old buffer
+     * have pinned it with a hazard pointer.
+     */
+    m_hp.RetireHazard(old);
+    return buffer;
+}
+
+template <ChaseLevDequeItem T>
+template <typename U>
+void ChaseLevDeque<T>::Push(U&& value)
+{
+    Relocated relocated;
+    relocated.Emplace(std::forward<U>(value));
+
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+    int64_t top = m_top.load(std::memory_order_acquire);
+    Buffer *buffer = m_buffer.load(std::memory_order_relaxed);
+
+    if(bottom - top > static_cast<int64_t>(buffer->Capacity()) - 1) {
+        buffer = grow(buffer, top, bottom);
+    }
+    buffer->Put(bottom, relocated);
+
+    /* Publish the value to the thieves */
+    m_bottom.store(bottom + 1, std::memory_order_release);
+}
+
+template <ChaseLevDequeItem T>
+std::optional<T> ChaseLevDeque<T>::Pop()
+{
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+    Buffer *buffer = m_buffer.load(std::memory_order_relaxed);
+    m_bottom.store(bottom, std::memory_order_relaxed);
+
+    /* Order the reservation of the bottom element against
+     * the load of 'top', pairing with the fence in 'Steal'.
+     */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = m_top.load(std::memory_order_relaxed);
+
+    if(top > bottom) {
+        /* Empty */
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+
+    Relocated relocated;
+    buffer->Get(bottom, relocated);
+    if(top == bottom) {
+        /* This is the last element. Race the thieves for it. */
+        bool won = m_top.compare_exchange_strong(top, top + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed);
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        if(!won)
+            return std::nullopt;
+    }
+    return {relocated.Take()};
+}
+
+template <ChaseLevDequeItem T>
+std::optional<T> ChaseLevDeque<T>::Steal()
+{
+    while(true) {
+
+        int64_t top = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t bottom = m_bottom.load(std::memory_order_acquire);
+
+        if(top >= bottom)
+            return std::nullopt;
+
+        /* Pin the buffer so that the owner does not free it
+         * from under us if it grows the deque concurrently.
+         */
+        Buffer *buffer = m_buffer.load(std::memory_order_acquire);
+        auto hazard = m_hp.AddHazard(0, buffer);
+        if(m_buffer.load(std::memory_order_acquire) != buffer)
+            continue;
+
+        Relocated relocated;
+        buffer->Get(top, relocated);
+        if(!m_top.compare_exchange_strong(top, top + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            /* Lost the race to another thief or the owner */
+            continue;
+        }
+        return {relocated.Take()};
+    }
+}
+
+template <ChaseLevDequeItem T>
+std::size_t ChaseLevDeque<T>::Size() const
+{
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+    int64_t top = m_top.load(std::memory_order_relaxed);
+    return (bottom > top) ? static_cast<std::size_t>(bottom - top) : 0;
+}
+
+template <ChaseLevDequeItem T>
+bool ChaseLevDeque<T>::Empty() const
+{
+    return (Size() == 0);
+}
+
+} // namespace pe
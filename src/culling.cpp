@@ -0,0 +1,354 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+export module culling;
+
+import ecs;
+import sync;
+import nvector;
+import batch_math;
+
+import <cstdint>;
+import <vector>;
+import <span>;
+import <thread>;
+import <algorithm>;
+import <stdexcept>;
+
+/* Visibility queries of bounding volumes against any number of
+ * views at once. The volumes are gathered from the ECS into
+ * flat coordinate arrays, which are split into fixed-size
+ * chunks. Every chunk is tested against all the views while
+ * it is hot in the cache, and the chunks are spread across
+ * the worker pool. The result for each view is a bitmask with
+ * one bit per volume, which can be compacted into a list of
+ * visible entities on demand.
+ */
+
+namespace pe{
+
+/*****************************************************************************/
+/* COMPONENTS                                                                */
+/*****************************************************************************/
+/*
+ * Bounding volumes are given in world space. An entity should
+ * have at most one of them, as every volume is reported on its
+ * own.
+ */
+
+export
+struct BoundingSphere
+{
+    Vec3f m_center{};
+    float m_radius{};
+};
+
+export
+struct BoundingBox
+{
+    Vec3f m_center{};
+    Vec3f m_extents{};
+};
+
+/*****************************************************************************/
+/* VISIBILITY QUERY                                                          */
+/*****************************************************************************/
+
+export
+template <typename World = pe::World<>>
+class CullVisible;
+
+template <typename World>
+class CullVisibleBatch;
+
+export
+template <typename World = pe::World<>>
+class VisibilityQuery
+{
+private:
+
+    /* A multiple of the mask word size, so that the chunks
+     * never write to the same words of a mask.
+     */
+    static constexpr std::size_t kChunkSize = 8192;
+
+    struct SphereColumns
+    {
+        std::vector<entity_t> m_entities;
+        std::vector<float>    m_x, m_y, m_z;
+        std::vector<float>    m_radius;
+    };
+
+    struct BoxColumns
+    {
+        std::vector<entity_t> m_entities;
+        std::vector<float>    m_x, m_y, m_z;
+        std::vector<float>    m_extent_x, m_extent_y, m_extent_z;
+    };
+
+    std::vector<std::vector<Vec4f>>    m_views;
+    SphereColumns                      m_spheres;
+    BoxColumns                         m_boxes;
+    std::vector<std::vector<uint64_t>> m_sphere_masks;
+    std::vector<std::vector<uint64_t>> m_box_masks;
+
+    template <typename OtherWorld>
+    friend class CullVisible;
+
+    template <typename OtherWorld>
+    friend class CullVisibleBatch;
+
+    void        gather();
+    std::size_t num_chunks() const;
+    void        cull(std::size_t first_chunk, std::size_t last_chunk);
+
+public:
+
+    VisibilityQuery() = default;
+
+    std::size_t AddView(std::span<const Vec4f> planes);
+    void        ClearViews();
+    std::size_t NumViews() const   { return m_views.size(); }
+    std::size_t NumSpheres() const { return m_spheres.m_entities.size(); }
+    std::size_t NumBoxes() const   { return m_boxes.m_entities.size(); }
+
+    /* Run the query on the calling thread. Use the CullVisible
+     * task to spread the work across the worker pool.
+     */
+    void Update();
+
+    std::span<const uint64_t> SphereMask(std::size_t view) const;
+    std::span<const uint64_t> BoxMask(std::size_t view) const;
+    std::vector<entity_t>     Visible(std::size_t view) const;
+};
+
+/*****************************************************************************/
+/* CULL VISIBLE                                                              */
+/*****************************************************************************/
+
+template <typename World>
+class CullVisibleBatch : public Task<void, CullVisibleBatch<World>,
+                                     VisibilityQuery<World>&, std::size_t, std::size_t>
+{
+    using base = Task<void, CullVisibleBatch<World>,
+                      VisibilityQuery<World>&, std::size_t, std::size_t>;
+    using base::base;
+
+    /* Number of chunks culled between checks of the worker's
+     * execution budget.
+     */
+    static constexpr std::size_t kChunksPerSlice = 64;
+
+    virtual base::handle_type Run(VisibilityQuery<World>& query,
+        std::size_t first_chunk, std::size_t last_chunk)
+    {
+        while(first_chunk < last_chunk) {
+            std::size_t end = std::min(first_chunk + kChunksPerSlice, last_chunk);
+            query.cull(first_chunk, end);
+            first_chunk = end;
+            co_await this->MaybeYield();
+        }
+        co_return;
+    }
+};
+
+export
+template <typename World>
+class CullVisible : public Task<void, CullVisible<World>, VisibilityQuery<World>&>
+{
+    using base = Task<void, CullVisible<World>, VisibilityQuery<World>&>;
+    using base::base;
+
+    virtual base::handle_type Run(VisibilityQuery<World>& query)
+    {
+        query.gather();
+
+        std::size_t nchunks = query.num_chunks();
+        std::size_t nthreads = std::max(1u, std::thread::hardware_concurrency());
+        std::size_t per_batch = std::max<std::size_t>(1, (nchunks + nthreads - 1) / nthreads);
+
+        /* Hand off all but the last batch of chunks to the
+         * workers and process the last one on this task.
+         */
+        std::vector<pe::shared_ptr<CullVisibleBatch<World>>> batches;
+        std::size_t first = 0;
+        while(nchunks - first > per_batch) {
+            batches.push_back(CullVisibleBatch<World>::Create(
+                this->Scheduler(), this->Priority(), pe::CreateMode::eLaunchAsync,
+                pe::Affinity::eAny, query, first, first + per_batch));
+            first += per_batch;
+        }
+        query.cull(first, nchunks);
+
+        for(auto& batch : batches) {
+            co_await batch;
+        }
+        co_return;
+    }
+};
+
+/*****************************************************************************/
+/* MODULE IMPLEMENTATION                                                     */
+/*****************************************************************************/
+
+template <typename World>
+std::size_t VisibilityQuery<World>::AddView(std::span<const Vec4f> planes)
+{
+    if(planes.size() > kMaxCullPlanes) [[unlikely]]
+        throw std::length_error{"Too many culling planes"};
+    m_views.emplace_back(planes.begin(), planes.end());
+    m_sphere_masks.emplace_back();
+    m_box_masks.emplace_back();
+    return m_views.size() - 1;
+}
+
+template <typename World>
+void VisibilityQuery<World>::ClearViews()
+{
+    m_views.clear();
+    m_sphere_masks.clear();
+    m_box_masks.clear();
+}
+
+template <typename World>
+void VisibilityQuery<World>::gather()
+{
+    auto& spheres = m_spheres;
+    spheres.m_entities.clear();
+    spheres.m_x.clear();
+    spheres.m_y.clear();
+    spheres.m_z.clear();
+    spheres.m_radius.clear();
+    for(auto [eid, sphere] : components_view<World, BoundingSphere>()) {
+        spheres.m_entities.push_back(eid);
+        spheres.m_x.push_back(sphere.m_center.x());
+        spheres.m_y.push_back(sphere.m_center.y());
+        spheres.m_z.push_back(sphere.m_center.z());
+        spheres.m_radius.push_back(sphere.m_radius);
+    }
+
+    auto& boxes = m_boxes;
+    boxes.m_entities.clear();
+    boxes.m_x.clear();
+    boxes.m_y.clear();
+    boxes.m_z.clear();
+    boxes.m_extent_x.clear();
+    boxes.m_extent_y.clear();
+    boxes.m_extent_z.clear();
+    for(auto [eid, box] : components_view<World, BoundingBox>()) {
+        boxes.m_entities.push_back(eid);
+        boxes.m_x.push_back(box.m_center.x());
+        boxes.m_y.push_back(box.m_center.y());
+        boxes.m_z.push_back(box.m_center.z());
+        boxes.m_extent_x.push_back(box.m_extents.x());
+        boxes.m_extent_y.push_back(box.m_extents.y());
+        boxes.m_extent_z.push_back(box.m_extents.z());
+    }
+
+    for(std::size_t view = 0; view < m_views.size(); view++) {
+        m_sphere_masks[view].resize((NumSpheres() + 63) / 64);
+        m_box_masks[view].resize((NumBoxes() + 63) / 64);
+    }
+}
+
+template <typename World>
+std::size_t VisibilityQuery<World>::num_chunks() const
+{
+    return (NumSpheres() + kChunkSize - 1) / kChunkSize
+         + (NumBoxes() + kChunkSize - 1) / kChunkSize;
+}
+
+template <typename World>
+void VisibilityQuery<World>::cull(std::size_t first_chunk, std::size_t last_chunk)
+{
+    const std::size_t nsphere_chunks = (NumSpheres() + kChunkSize - 1) / kChunkSize;
+
+    for(std::size_t chunk = first_chunk; chunk < last_chunk; chunk++) {
+
+        if(chunk < nsphere_chunks) {
+
+            std::size_t begin = chunk * kChunkSize;
+            std::size_t count = std::min(kChunkSize, NumSpheres() - begin);
+            ConstSpheresSoA spheres{
+                std::span{m_spheres.m_x}.subspan(begin, count),
+                std::span{m_spheres.m_y}.subspan(begin, count),
+                std::span{m_spheres.m_z}.subspan(begin, count),
+                std::span{m_spheres.m_radius}.subspan(begin, count)
+            };
+            for(std::size_t view = 0; view < m_views.size(); view++) {
+                CullSpheres(m_views[view], spheres,
+                    std::span{m_sphere_masks[view]}.subspan(begin / 64));
+            }
+        }else{
+
+            std::size_t begin = (chunk - nsphere_chunks) * kChunkSize;
+            std::size_t count = std::min(kChunkSize, NumBoxes() - begin);
+            ConstBoxesSoA boxes{
+                std::span{m_boxes.m_x}.subspan(begin, count),
+                std::span{m_boxes.m_y}.subspan(begin, count),
+                std::span{m_boxes.m_z}.subspan(begin, count),
+                std::span{m_boxes.m_extent_x}.subspan(begin, count),
+                std::span{m_boxes.m_extent_y}.subspan(begin, count),
+                std::span{m_boxes.m_extent_z}.subspan(begin, count)
+            };
+            for(std::size_t view = 0; view < m_views.size(); view++) {
+                CullBoxes(m_views[view], boxes,
+                    std::span{m_box_masks[view]}.subspan(begin / 64));
+            }
+        }
+    }
+}
+
+template <typename World>
+void VisibilityQuery<World>::Update()
+{
+    gather();
+    cull(0, num_chunks());
+}
+
+template <typename World>
+std::span<const uint64_t> VisibilityQuery<World>::SphereMask(std::size_t view) const
+{
+    return m_sphere_masks.at(view);
+}
+
+template <typename World>
+std::span<const uint64_t> VisibilityQuery<World>::BoxMask(std::size_t view) const
+{
+    return m_box_masks.at(view);
+}
+
+template <typename World>
+std::vector<entity_t> VisibilityQuery<World>::Visible(std::size_t view) const
+{
+    std::vector<uint32_t> indices(std::max(NumSpheres(), NumBoxes()));
+    std::vector<entity_t> ret{};
+
+    std::size_t nspheres = CompactVisible(SphereMask(view), indices);
+    for(std::size_t i = 0; i < nspheres; i++) {
+        ret.push_back(m_spheres.m_entities[indices[i]]);
+    }
+    std::size_t nboxes = CompactVisible(BoxMask(view), indices);
+    for(std::size_t i = 0; i < nboxes; i++) {
+        ret.push_back(m_boxes.m_entities[indices[i]]);
+    }
+    return ret;
+}
+
+} // namespace pe
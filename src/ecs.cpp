@@ -566,6 +566,7 @@ private:
     using EntityArchetypeMap = FlatHashMap<entity_t, component_bitfield_t>;
 
     static inline std::atomic_uint64_t s_next_entity_id{0};
+    static inline std::atomic_uint64_t s_generation{0};
     static inline ComponentTrieType    s_component_trie{};
     static inline ArchetypeMapType     s_component_archetype_map{};
     static inline EntityArchetypeMap   s_entity_archetype_map{};
@@ -583,6 +584,15 @@ public:
         return s_next_entity_id.fetch_add(1, std::memory_order_relaxed); 
     };
 
+    /* Incremented every time an entity is added to or removed
+     * from the world, allowing systems to cache data derived
+     * from the component layout.
+     */
+    static uint64_t Generation()
+    {
+        return s_generation.load(std::memory_order_relaxed);
+    }
+
     static void Register(const CEntity auto& entity, component_bitfield_t components);
     static void Unregister(const CEntity auto& entity);
 };
@@ -828,6 +838,7 @@ void World<Tag>::Register(const CEntity auto& entity, component_bitfield_t compo
 
     s_entity_archetype_map.insert(std::make_pair(entity.m_id, components));
     add_row<entity_type, components_type>{}(s_component_archetype_map[components], entity.m_id);
+    s_generation.fetch_add(1, std::memory_order_relaxed);
 }
 
 template <typename Tag>
@@ -841,6 +852,7 @@ void World<Tag>::Unregister(const CEntity auto& entity)
     auto& archetype = s_component_archetype_map[components];
     entity_t eid = entity.m_id;
     drop_row<components_type>{}(archetype, eid);
+    s_generation.fetch_add(1, std::memory_order_relaxed);
 }
 
 export
@@ -25,6 +25,7 @@ import event_pumper;
 import logger;
 import SDL2;
 import window;
+import frame_arena;
 
 import <string>;
 import <chrono>;
@@ -81,6 +82,7 @@ class Engine : public Task<void, Engine>
             CreateMode::eLaunchSync, Affinity::eMainThread, kWindowTitle, 640, 480);
 
         while(true) {
+            FrameArena::NewFrame();
             Broadcast<EventType::eNewFrame>(m_frame_idx++);
             update_latency(prev);
             co_await window->SetTitle(CallToken<Window>(), 
@@ -0,0 +1,351 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+module;
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+export module frame_arena;
+
+import assert;
+import mman;
+import unistd;
+
+import <cstddef>;
+import <cstdint>;
+import <array>;
+import <atomic>;
+import <new>;
+import <limits>;
+import <bit>;
+
+namespace pe{
+
+/*****************************************************************************/
+/* LINEAR ARENA                                                              */
+/*****************************************************************************/
+/*
+ * A bump allocator over a list of chunks mapped from the OS. Blocks
+ * cannot be freed individually - rather, the entire arena is reset 
+ * at once. The chunks are kept around across resets, with the exception
+ * of the ones that went unused since the last reset and the ones 
+ * that were mapped to hold a single oversized block.
+ */
+
+struct ArenaChunk
+{
+    ArenaChunk  *m_next;
+    std::size_t  m_size;
+    bool         m_oversized;
+};
+
+class LinearArena
+{
+private:
+
+    static constexpr std::size_t kChunkSize = 256 * 1024;
+    static constexpr std::size_t kMaxBlockSize = kChunkSize / 4;
+
+    ArenaChunk  *m_head;
+    ArenaChunk  *m_curr;
+    std::byte   *m_bump;
+    std::byte   *m_end;
+    std::size_t  m_allocated;
+
+    static ArenaChunk *map_chunk(std::size_t size, bool oversized)
+    {
+        void *ret = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(ret == MAP_FAILED)
+            throw std::bad_alloc{};
+        return new (ret) ArenaChunk{nullptr, size, oversized};
+    }
+
+    static void unmap_chunk(ArenaChunk *chunk)
+    {
+        munmap(chunk, chunk->m_size);
+    }
+
+    static std::byte *chunk_begin(ArenaChunk *chunk)
+    {
+        return reinterpret_cast<std::byte*>(chunk + 1);
+    }
+
+    static std::byte *chunk_end(ArenaChunk *chunk)
+    {
+        return reinterpret_cast<std::byte*>(chunk) + chunk->m_size;
+    }
+
+    static std::byte *align_up(std::byte *ptr, std::size_t alignment)
+    {
+        uintptr_t uptr = reinterpret_cast<uintptr_t>(ptr);
+        return ptr + (((uptr + alignment - 1) & ~(alignment - 1)) - uptr);
+    }
+
+    void *allocate_slow(std::size_t size, std::size_t alignment)
+    {
+        /* Blocks that would waste a large part of a chunk get 
+         * their own chunk, which is linked in after the current
+         * one so that the remaining space is not abandoned.
+         */
+        const std::size_t page = getpagesize();
+        if(size > std::numeric_limits<std::size_t>::max() - alignment - sizeof(ArenaChunk) - page)
+            throw std::bad_alloc{};
+
+        if(size + alignment > kMaxBlockSize) {
+            std::size_t chunk_size = sizeof(ArenaChunk) + size + alignment;
+            chunk_size = ((chunk_size + page - 1) / page) * page;
+
+            ArenaChunk *chunk = map_chunk(chunk_size, true);
+            if(m_curr) {
+                chunk->m_next = m_curr->m_next;
+                m_curr->m_next = chunk;
+            }else{
+                chunk->m_next = m_head;
+                m_head = chunk;
+            }
+            m_allocated += size;
+            return align_up(chunk_begin(chunk), alignment);
+        }
+
+        /* Move on to the next chunk, skipping over any oversized
+         * ones, and map a new one when we run out.
+         */
+        ArenaChunk *prev = m_curr;
+        ArenaChunk *next = m_curr ? m_curr->m_next : m_head;
+        while(next && next->m_oversized) {
+            prev = next;
+            next = next->m_next;
+        }
+        if(!next) {
+            next = map_chunk(kChunkSize, false);
+            if(prev)
+                prev->m_next = next;
+            else
+                m_head = next;
+        }
+
+        m_curr = next;
+        m_bump = chunk_begin(next);
+        m_end = chunk_end(next);
+        return Allocate(size, alignment);
+    }
+
+public:
+
+    LinearArena()
+        : m_head{nullptr}
+        , m_curr{nullptr}
+        , m_bump{nullptr}
+        , m_end{nullptr}
+        , m_allocated{0}
+    {}
+
+    LinearArena(const LinearArena&) = delete;
+    LinearArena& operator=(const LinearArena&) = delete;
+
+    ~LinearArena()
+    {
+        ArenaChunk *chunk = m_head;
+        while(chunk) {
+            ArenaChunk *next = chunk->m_next;
+            unmap_chunk(chunk);
+            chunk = next;
+        }
+    }
+
+    void *Allocate(std::size_t size, std::size_t alignment)
+    {
+        uintptr_t ret = reinterpret_cast<uintptr_t>(m_bump);
+        uintptr_t end = reinterpret_cast<uintptr_t>(m_end);
+        ret = (ret + alignment - 1) & ~(alignment - 1);
+        if(!m_bump || (ret > end) || (size > end - ret)) [[unlikely]]
+            return allocate_slow(size, alignment);
+        m_bump = reinterpret_cast<std::byte*>(ret + size);
+        m_allocated += size;
+        return m_bump - size;
+    }
+
+    void Reset()
+    {
+        /* Keep the chunks which were used since the last reset, 
+         * give back the rest.
+         */
+        ArenaChunk **link = &m_head;
+        bool in_use = (m_curr != nullptr);
+        while(*link) {
+            ArenaChunk *chunk = *link;
+            bool keep = in_use && !chunk->m_oversized;
+            if(chunk == m_curr)
+                in_use = false;
+            if(keep) {
+                link = &chunk->m_next;
+                continue;
+            }
+            *link = chunk->m_next;
+            unmap_chunk(chunk);
+        }
+        m_curr = nullptr;
+        m_bump = nullptr;
+        m_end = nullptr;
+        m_allocated = 0;
+    }
+
+    std::size_t GetAllocatedBytes() const
+    {
+        return m_allocated;
+    }
+
+    std::size_t GetMappedBytes() const
+    {
+        std::size_t ret = 0;
+        for(ArenaChunk *chunk = m_head; chunk; chunk = chunk->m_next) {
+            ret += chunk->m_size;
+        }
+        return ret;
+    }
+};
+
+/*****************************************************************************/
+/* FRAME ARENA                                                               */
+/*****************************************************************************/
+/*
+ * Scratch memory for data which does not outlive the frame following 
+ * the one in which it was allocated. Every thread allocates from its'
+ * own pair of linear arenas without any synchronization. The arenas 
+ * are double-buffered: once a new frame begins, the arena holding the
+ * data of the frame before the previous one is reset in bulk and it
+ * becomes the current one. Thus, data allocated during frame N remains
+ * valid until the end of frame N+1. A thread notices the start of a 
+ * new frame lazily, on its' first allocation during that frame.
+ */
+
+export
+struct FrameArenaStats
+{
+    std::size_t m_allocated_bytes; /* bytes handed out during the current frame */
+    std::size_t m_mapped_bytes;    /* bytes mapped by both of the thread's arenas */
+};
+
+export
+class FrameArena
+{
+private:
+
+    static inline std::atomic_uint64_t s_frame{0};
+
+    std::array<LinearArena, 2> m_arenas;
+    std::size_t                m_current;
+    uint64_t                   m_frame;
+
+    FrameArena()
+        : m_arenas{}
+        , m_current{0}
+        , m_frame{s_frame.load(std::memory_order_relaxed)}
+    {}
+
+    static FrameArena& thread_arena()
+    {
+        static thread_local FrameArena t_arena{};
+        return t_arena;
+    }
+
+    void advance(uint64_t frame)
+    {
+        /* The data of the previous frame is also stale 
+         * if we missed a frame altogether.
+         */
+        if(frame - m_frame > 1)
+            m_arenas[m_current].Reset();
+        m_current = (m_current + 1) % 2;
+        m_arenas[m_current].Reset();
+        m_frame = frame;
+    }
+
+public:
+
+    /* Called by the engine whenever it broadcasts eNewFrame.
+     */
+    static void NewFrame()
+    {
+        s_frame.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void *Allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t))
+    {
+        pe::assert(std::has_single_bit(alignment));
+        auto& arena = thread_arena();
+        uint64_t frame = s_frame.load(std::memory_order_relaxed);
+        if(frame != arena.m_frame) [[unlikely]]
+            arena.advance(frame);
+        return arena.m_arenas[arena.m_current].Allocate(size, alignment);
+    }
+
+    static FrameArenaStats GetStats()
+    {
+        auto& arena = thread_arena();
+        return {
+            arena.m_arenas[arena.m_current].GetAllocatedBytes(),
+            arena.m_arenas[0].GetMappedBytes() + arena.m_arenas[1].GetMappedBytes()
+        };
+    }
+};
+
+/*****************************************************************************/
+/* FRAME ALLOCATOR                                                           */
+/*****************************************************************************/
+/*
+ * An STL-compatible allocator on top of the frame arena, allowing
+ * containers holding per-frame scratch data to opt in. Deallocation
+ * is a no-op, so the container must not be used past the end of the
+ * frame following the one in which it last allocated.
+ */
+
+export
+template <typename T>
+struct FrameAllocator
+{
+    using value_type = T;
+
+    FrameAllocator() noexcept = default;
+
+    template <typename U>
+    FrameAllocator(const FrameAllocator<U>&) noexcept
+    {}
+
+    T *allocate(std::size_t n)
+    {
+        if(n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            throw std::bad_array_new_length{};
+        return static_cast<T*>(FrameArena::Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, std::size_t) noexcept
+    {}
+
+    template <typename U>
+    bool operator==(const FrameAllocator<U>&) const noexcept
+    {
+        return true;
+    }
+};
+
+} // namespace pe
+
@@ -36,6 +36,7 @@ import logger;
 import assert;
 import futex;
 import concurrency;
+import sched_trace;
 
 import <any>;
 import <optional>;
@@ -243,6 +244,7 @@ private:
     pe::shared_ptr<AtomicQueueSize>        m_work_size;
     std::atomic_flag                       m_quit;
     std::atomic_uint32_t                   m_num_exited;
+    std::atomic_uint32_t                   m_num_busy;
 
     static bool seqnum_passed(uint32_t a, uint32_t b);
 
@@ -257,6 +259,16 @@ public:
 
     void EnqueueWork(IOWork work);
     void Quiesce();
+
+    /* Long-running work can poll this to exit early,
+     * instead of holding up the shutdown.
+     */
+    bool Quitting() const;
+
+    /* Approximate values, for reporting purposes only.
+     */
+    uint32_t QueueSize() const;
+    uint32_t BusyThreads() const;
 };
 
 /*****************************************************************************/
@@ -276,6 +288,7 @@ IOPool::IOPool()
     , m_work_size{pe::make_shared<AtomicQueueSize>()}
     , m_quit{}
     , m_num_exited{}
+    , m_num_busy{}
 {
     for(int i = 0; i < kNumIOThreads; i++) {
         m_io_workers[i] = std::thread{&IOPool::work, this};
@@ -298,6 +311,10 @@ void IOPool::EnqueueWork(IOWork work)
         return true;
     }, m_work_size, work);
 
+    if(TracingEnabled()) [[unlikely]] {
+        TraceInstant(TraceEventType::eIOEnqueue);
+    }
+
     std::byte *base = reinterpret_cast<std::byte*>(m_work_size.get());
     uint32_t *size_addr = reinterpret_cast<uint32_t*>(base + offsetof(QueueSize, m_size));
     signal_work(size_addr);
@@ -316,6 +333,23 @@ void IOPool::Quiesce()
     }
 }
 
+bool IOPool::Quitting() const
+{
+    return m_quit.test(std::memory_order_relaxed);
+}
+
+uint32_t IOPool::QueueSize() const
+{
+    if(m_quit.test(std::memory_order_relaxed))
+        return 0;
+    return m_work_size->load(std::memory_order_relaxed).m_size;
+}
+
+uint32_t IOPool::BusyThreads() const
+{
+    return m_num_busy.load(std::memory_order_relaxed);
+}
+
 bool IOPool::seqnum_passed(uint32_t a, uint32_t b)
 {
     return (static_cast<int32_t>((b) - (a)) < 0);
@@ -430,7 +464,33 @@ void IOPool::work()
         }
 
         auto work = ret.first.value();
-        work.Complete();
+
+        /* Keep the busy count balanced even if the work throws */
+        struct BusyGuard
+        {
+            std::atomic_uint32_t& m_num_busy;
+
+            BusyGuard(std::atomic_uint32_t& num_busy)
+                : m_num_busy{num_busy}
+            {
+                m_num_busy.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            ~BusyGuard()
+            {
+                m_num_busy.fetch_sub(1, std::memory_order_relaxed);
+            }
+        };
+        BusyGuard busy{m_num_busy};
+
+        if(TracingEnabled()) [[unlikely]] {
+            uint64_t before = rdtsc_before();
+            work.Complete();
+            uint64_t after = rdtsc_after();
+            TraceSlice(TraceEventType::eIOWork, before, after);
+        }else{
+            work.Complete();
+        }
     }
 }
 
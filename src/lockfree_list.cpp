@@ -31,6 +31,7 @@ import <utility>;
 import <iostream>;
 import <iomanip>;
 import <optional>;
+import <vector>;
 
 namespace pe{
 
@@ -114,6 +115,7 @@ public:
     bool Delete(const T& value);
     bool Find(const T& value);
     std::optional<T> PeekHead();
+    std::vector<T> PeekHead(std::size_t max);
     [[maybe_unused]] void PrintUnsafe();
 };
 
@@ -204,6 +206,17 @@ public:
         return {std::pair<uint64_t, T>{head.value().m_key, head.value().m_value}};
     }
 
+    std::vector<std::pair<uint64_t, T>> PeekHead(std::size_t max)
+    {
+        std::vector<KeyValuePair<T>> head = base::PeekHead(max);
+        std::vector<std::pair<uint64_t, T>> ret{};
+        ret.reserve(head.size());
+        for(auto& pair : head) {
+            ret.emplace_back(pair.m_key, std::move(pair.m_value));
+        }
+        return ret;
+    }
+
     [[maybe_unused]] void PrintUnsafe()
     {
         base::PrintUnsafe();
@@ -383,6 +396,58 @@ std::optional<T> LockfreeList<T>::PeekHead()
     }while(true);
 }
 
+/* Returns up to 'max' of the first values in the list, unlinking
+ * any marked nodes on the way, just like 'search'.
+ */
+template <LockfreeListItem T>
+std::vector<T> LockfreeList<T>::PeekHead(std::size_t max)
+{
+    std::vector<T> ret{};
+
+retry:
+
+    ret.clear();
+    Node *prev = m_head;
+    Node *curr = prev->m_next.load(std::memory_order_acquire);
+
+    auto prev_hazard = m_hp.AddHazard(0, prev);
+    auto curr_hazard = m_hp.AddHazard(1, curr);
+    if(curr != prev->m_next.load(std::memory_order_relaxed))
+        goto retry;
+
+    while(curr != m_tail && ret.size() < max) {
+
+        Node *next = curr->m_next.load(std::memory_order_acquire);
+        if(is_marked_reference(next)) {
+            if(!prev->m_next.compare_exchange_strong(curr, get_unmarked_reference(next),
+                std::memory_order_release, std::memory_order_relaxed)) {
+                goto retry;
+            }
+
+            curr_hazard = m_hp.AddHazard(1, get_unmarked_reference(next));
+            if(next != curr->m_next.load(std::memory_order_relaxed))
+                goto retry;
+
+            m_hp.RetireHazard(curr);
+            curr = get_unmarked_reference(next);
+
+        }else{
+            if(curr != prev->m_next.load(std::memory_order_acquire))
+                goto retry;
+            ret.push_back(curr->m_value);
+
+            prev_hazard = m_hp.AddHazard(0, curr);
+            curr_hazard = m_hp.AddHazard(1, next);
+            if(next != curr->m_next.load(std::memory_order_relaxed))
+                goto retry;
+
+            prev = curr;
+            curr = next;
+        }
+    }
+    return ret;
+}
+
 template <LockfreeListItem T>
 void LockfreeList<T>::PrintUnsafe()
 {
@@ -34,6 +34,8 @@ import <optional>;
 import <any>;
 import <memory>;
 import <ranges>;
+import <vector>;
+import <algorithm>;
 
 namespace pe{
 
@@ -90,6 +92,36 @@ private:
         AtomicParallelWork<NodeResultCommitRequest, NodeProcessingResult, LockfreeSequencedQueue<T>>
     >;
 
+    struct NodeBatchProcessRequest
+    {
+        std::size_t           m_max;
+        std::any              m_processor_func;
+        std::any              m_fallback_func;
+        pe::shared_ptr<void>  m_shared_state;
+        void                (*m_processor)(std::any, pe::shared_ptr<void>, uint64_t);
+        void                (*m_fallback)(std::any, pe::shared_ptr<void>, uint64_t);
+    };
+
+    struct NodeBatchCommitRequest
+    {
+        std::vector<T> m_nodes;
+        uint64_t       m_last_seqnum;
+    };
+
+    struct NodeBatchResult
+    {
+        std::vector<T> m_nodes;
+        uint64_t       m_seqnum;
+    };
+
+    using HeadBatchProcessingPipeline = AtomicWorkPipeline<
+        LockfreeSequencedQueue<T>,
+        /* Stage 1: Read up to 'max' nodes from the head */
+        AtomicParallelWork<NodeBatchProcessRequest, NodeBatchCommitRequest, LockfreeSequencedQueue<T>>,
+        /* Stage 2: Mark all of them as dequeued at once */
+        AtomicParallelWork<NodeBatchCommitRequest, NodeBatchResult, LockfreeSequencedQueue<T>>
+    >;
+
     struct ProcessHeadRequest
     {
         std::unique_ptr<HeadProcessingPipeline>                     m_pipeline;
@@ -104,6 +136,20 @@ private:
         {}
     };
 
+    struct ProcessHeadBatchRequest
+    {
+        std::unique_ptr<HeadBatchProcessingPipeline>           m_pipeline;
+        pe::shared_ptr<void>                                   m_state_ptr;
+        pe::shared_ptr<pe::atomic_shared_ptr<NodeBatchResult>> m_out;
+
+        ProcessHeadBatchRequest(std::unique_ptr<HeadBatchProcessingPipeline>&& pipeline, 
+            pe::shared_ptr<void> state_ptr, decltype(m_out) out)
+            : m_pipeline{std::move(pipeline)}
+            , m_state_ptr{state_ptr}
+            , m_out{out}
+        {}
+    };
+
     struct ConditionalEnqueueRequest
     {
         std::any                         m_func;
@@ -131,10 +177,12 @@ private:
         enum class Type
         {
             eConditionalEnqueue,
-            eProcessHead
+            eProcessHead,
+            eProcessHeadBatch
         };
 
-        using arg_type = std::variant<ConditionalEnqueueRequest, ProcessHeadRequest>;
+        using arg_type = std::variant<ConditionalEnqueueRequest, ProcessHeadRequest, 
+            ProcessHeadBatchRequest>;
 
         static inline std::atomic_uint32_t s_next_version{};
 
@@ -175,6 +223,7 @@ private:
     AtomicDequeueState                m_dequeue_state;
 
     static inline auto s_consumed_marker = pe::make_shared<NodeProcessingResult>();
+    static inline auto s_consumed_batch_marker = pe::make_shared<NodeBatchResult>();
 
     static void process_request(Request *request, uint64_t seqnum)
     {
@@ -210,6 +259,19 @@ private:
                 }
             }
             break;
+        }
+        case Request::Type::eProcessHeadBatch: {
+            const auto& arg = std::get<ProcessHeadBatchRequest>(request->m_arg);
+            auto result = arg.m_pipeline->GetResult(seqnum);
+            if(std::ranges::size(result) > 0) {
+                auto ptr = pe::make_shared<NodeBatchResult>(*std::ranges::begin(result));
+                auto curr = arg.m_out->load(std::memory_order_relaxed);
+                while(!curr) {
+                    arg.m_out->compare_exchange_strong(curr, ptr, 
+                        std::memory_order_release, std::memory_order_relaxed);
+                }
+            }
+            break;
         }}
     }
 
@@ -415,6 +477,145 @@ public:
         result->store(s_consumed_marker, std::memory_order_release);
         return {ret, presult, seq};
     }
+
+    /* Dequeues up to 'max' nodes from the head of the queue in a
+     * single request, in the same order as they would be dequeued 
+     * by repeated 'ProcessHead' requests. The 'processor' is invoked 
+     * when at least one node is dequeued, and the 'fallback' when
+     * the queue is empty. Both may be invoked more than once, by
+     * different threads servicing the request.
+     */
+    template <typename RestartableProcessorFunc, typename RestartableFallbackFunc, typename SharedState>
+    requires requires (RestartableProcessorFunc processor, RestartableFallbackFunc fallback, 
+        pe::shared_ptr<SharedState> state, uint64_t seqnum) {
+
+        {processor(state, seqnum)} -> std::same_as<void>;
+        {fallback(state, seqnum)} -> std::same_as<void>;
+    }
+    std::pair<std::vector<T>, uint64_t>
+    ProcessHeadBatch(std::size_t max, RestartableProcessorFunc processor, 
+        RestartableFallbackFunc fallback, pe::shared_ptr<SharedState> shared_state, 
+        std::optional<uint32_t> seqnum = std::nullopt)
+    {
+        auto wrapped_processor = +[](std::any func, pe::shared_ptr<void> state, uint64_t seqnum) {
+            auto shared_state = pe::static_pointer_cast<SharedState>(state);
+            auto callable = any_cast<RestartableProcessorFunc>(func);
+            callable(shared_state, seqnum);
+        };
+        auto wrapped_fallback = +[](std::any func, pe::shared_ptr<void> state, uint64_t seqnum) {
+            auto shared_state = pe::static_pointer_cast<SharedState>(state);
+            auto callable = any_cast<RestartableFallbackFunc>(func);
+            callable(shared_state, seqnum);
+        };
+        NodeBatchProcessRequest batch_request{max, processor, fallback,
+            pe::static_pointer_cast<void>(shared_state),
+            wrapped_processor, wrapped_fallback};
+
+        auto pipeline = std::make_unique<HeadBatchProcessingPipeline>(
+            std::views::single(batch_request), *this,
+            +[](uint64_t seqnum, const NodeBatchProcessRequest& req, LockfreeSequencedQueue& self){
+
+                DequeueState dequeue_state = 
+                    self.m_dequeue_state.load(std::memory_order_acquire);
+
+                /* It's a 'lagging' request 
+                 */
+                if(dequeue_state.m_last_dequeue_req_seqnum > seqnum) {
+                    req.m_fallback(req.m_fallback_func, req.m_shared_state, seqnum);
+                    return std::optional<NodeBatchCommitRequest>{};
+                }
+
+                /* A competing thread executing the same request has
+                 * already committed the batch. The result of this stage
+                 * was agreed upon before then, so ours will be discarded.
+                 */
+                if(dequeue_state.m_last_dequeue_req_seqnum == seqnum) {
+                    return std::optional<NodeBatchCommitRequest>{};
+                }
+
+                /* Delete the nodes at the head which have already been
+                 * dequeued, until we get a batch with only fresh ones.
+                 */
+                std::vector<std::pair<uint64_t, T>> head;
+                bool deleted;
+                do{
+                    head = self.m_nodes.PeekHead(req.m_max);
+                    deleted = false;
+                    for(const auto& node : head) {
+                        if(node.first > dequeue_state.m_max_dequeued_node_seqnum)
+                            break;
+                        self.m_nodes.Delete(node.first);
+                        deleted = true;
+                    }
+                }while(deleted);
+
+                if(head.empty()) {
+                    req.m_fallback(req.m_fallback_func, req.m_shared_state, seqnum);
+                    return std::optional<NodeBatchCommitRequest>{};
+                }
+
+                NodeBatchCommitRequest ret{{}, head.back().first};
+                ret.m_nodes.reserve(head.size());
+                for(auto& node : head) {
+                    ret.m_nodes.push_back(std::move(node.second));
+                }
+                req.m_processor(req.m_processor_func, req.m_shared_state, seqnum);
+                return std::optional<NodeBatchCommitRequest>{std::move(ret)};
+            },
+            +[](uint64_t seqnum, const NodeBatchCommitRequest& req, LockfreeSequencedQueue& self){
+
+                DequeueState old_dequeue_state = 
+                    self.m_dequeue_state.load(std::memory_order_acquire);
+                uint32_t new_max_dequeued_node_seqnum;
+                do{
+                    /* This is a 'lagging' request, the nodes
+                     * have already been dequeued.
+                     */
+                    if(old_dequeue_state.m_last_dequeue_req_seqnum > seqnum)
+                        return std::optional<NodeBatchResult>{};
+
+                    /* A different thread servicing the same request
+                     * has already updated the dequeue state.
+                     */
+                    if(old_dequeue_state.m_last_dequeue_req_seqnum == seqnum)
+                        return std::optional<NodeBatchResult>{{req.m_nodes, seqnum}};
+
+                    new_max_dequeued_node_seqnum = std::max(
+                        old_dequeue_state.m_max_dequeued_node_seqnum,
+                        static_cast<uint32_t>(req.m_last_seqnum));
+
+                }while(!self.m_dequeue_state.compare_exchange_strong(old_dequeue_state, 
+                    {static_cast<uint32_t>(seqnum), new_max_dequeued_node_seqnum},
+                    std::memory_order_release, std::memory_order_acquire));
+
+                return std::optional<NodeBatchResult>{{req.m_nodes, seqnum}};
+            }
+        );
+        auto result = pe::make_shared<pe::atomic_shared_ptr<NodeBatchResult>>();
+        auto request = std::make_unique<Request>(
+            Request::Type::eProcessHeadBatch, 
+            std::in_place_type_t<ProcessHeadBatchRequest>{},
+            std::move(pipeline), shared_state, result);
+
+        m_work.PerformSerially(std::move(request), process_request, seqnum);
+
+        std::vector<T> ret{};
+        uint64_t seq = 0;
+        if(auto ptr = result->load(std::memory_order_acquire)) {
+            ret = ptr->m_nodes;
+            seq = ptr->m_seqnum;
+        }
+        result->store(s_consumed_batch_marker, std::memory_order_release);
+        return {ret, seq};
+    }
+
+    std::vector<T> DequeueBatch(std::size_t max, std::optional<uint32_t> seqnum = std::nullopt)
+    {
+        auto state = pe::make_shared<std::monostate>();
+        auto ret = ProcessHeadBatch(max, [](pe::shared_ptr<std::monostate>, uint64_t){},
+            [](pe::shared_ptr<std::monostate>, uint64_t){}, state, seqnum);
+        return std::get<0>(ret);
+    }
 };
 
 } // namespace pe
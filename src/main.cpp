@@ -29,6 +29,7 @@ import unistd;
 
 import <new>;
 import <cstdlib>;
+import <cerrno>;
 import <exception>;
 import <stdexcept>;
 import <algorithm>;
@@ -98,6 +99,32 @@ void operator delete[](void* ptr, std::align_val_t align) noexcept
     alloc.FreeAligned(ptr, align);
 }
 
+void operator delete(void *ptr, std::size_t size) noexcept
+{
+    pe::Allocator& alloc = pe::Allocator::Instance();
+    size = alloc.NextAlignedBlockSize(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    alloc.Free(ptr, size);
+}
+
+void operator delete[](void *ptr, std::size_t size) noexcept
+{
+    pe::Allocator& alloc = pe::Allocator::Instance();
+    size = alloc.NextAlignedBlockSize(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    alloc.Free(ptr, size);
+}
+
+void operator delete(void* ptr, std::size_t size, std::align_val_t align) noexcept
+{
+    pe::Allocator& alloc = pe::Allocator::Instance();
+    alloc.FreeAligned(ptr, size, align);
+}
+
+void operator delete[](void* ptr, std::size_t size, std::align_val_t align) noexcept
+{
+    pe::Allocator& alloc = pe::Allocator::Instance();
+    alloc.FreeAligned(ptr, size, align);
+}
+
 void *malloc(size_t size)
 {
     pe::Allocator& alloc = pe::Allocator::Instance();
@@ -118,26 +145,24 @@ void *realloc(void *ptr, size_t size)
 {
     pe::Allocator& alloc = pe::Allocator::Instance();
     size = alloc.NextAlignedBlockSize(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
-    auto ret = alloc.Allocate(size);
-    if(ptr) {
-        std::size_t copy_size = std::min(size, alloc.AllocationSize(ptr));
-        std::memcpy(ret, ptr, copy_size);
-        alloc.Free(ptr);
-    }
-    return ret;
+    return alloc.Reallocate(ptr, size);
 }
 
 void *memalign(size_t alignment, size_t size)
 {
-    if(alignment > pe::kMaxBlockSize)
+    if((alignment == 0) || (alignment & (alignment - 1))) {
+        errno = EINVAL;
         return nullptr;
+    }
     pe::Allocator& alloc = pe::Allocator::Instance();
-    size = alloc.NextAlignedBlockSize(size, alignment);
-    return alloc.Allocate(size);
+    return alloc.AllocateAligned(size, std::align_val_t{alignment});
 }
 
 int posix_memalign(void **memptr, size_t alignment, size_t size)
 {
+    if((alignment % sizeof(void*)) || (alignment & (alignment - 1)))
+        return EINVAL;
+
     if(size == 0) {
         *memptr = nullptr;
         return 0;
@@ -145,7 +170,7 @@ int posix_memalign(void **memptr, size_t alignment, size_t size)
 
     void *ret = memalign(alignment, size);
     if(!ret)
-        return -ENOMEM;
+        return ENOMEM;
 
     *memptr = ret;
     return 0;
@@ -164,7 +189,7 @@ void *valloc(size_t size)
 void *pvalloc(size_t size)
 {
     size_t page_size = getpagesize();
-    size = std::ceil(size / ((float)page_size)) * page_size;
+    size = ((size + page_size - 1) / page_size) * page_size;
     return memalign(page_size, size);
 }
 
@@ -30,6 +30,8 @@ import <string>;
 import <sstream>;
 import <exception>;
 import <cmath>;
+import <algorithm>;
+import <iterator>;
 
 namespace pe{
 
@@ -45,6 +47,188 @@ inline consteval T pow()
     return ret;
 }
 
+/*****************************************************************************/
+/* 4x4 CLOSED-FORM INVERSE                                                   */
+/*****************************************************************************/
+/*
+ * Cramer's rule, where the 2x2 sub-determinants of the top two
+ * rows (s0..s5) and of the bottom two rows (c0..c5) are shared
+ * between the determinant and all the cofactors.
+ */
+
+template <std::floating_point T>
+constexpr T determinant4x4(const T *a)
+{
+    T s0 = a[0] * a[5]  - a[4] * a[1];
+    T s1 = a[0] * a[6]  - a[4] * a[2];
+    T s2 = a[0] * a[7]  - a[4] * a[3];
+    T s3 = a[1] * a[6]  - a[5] * a[2];
+    T s4 = a[1] * a[7]  - a[5] * a[3];
+    T s5 = a[2] * a[7]  - a[6] * a[3];
+
+    T c5 = a[10] * a[15] - a[14] * a[11];
+    T c4 = a[9]  * a[15] - a[13] * a[11];
+    T c3 = a[9]  * a[14] - a[13] * a[10];
+    T c2 = a[8]  * a[15] - a[12] * a[11];
+    T c1 = a[8]  * a[14] - a[12] * a[10];
+    T c0 = a[8]  * a[13] - a[12] * a[9];
+
+    return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+}
+
+/* Writes the inverse to 'out' and returns the determinant. The
+ * output is not meaningful when the determinant is zero. 'out'
+ * may alias 'a'.
+ */
+template <std::floating_point T>
+constexpr T inverse4x4_scalar(const T *a, T *out)
+{
+    T s0 = a[0] * a[5]  - a[4] * a[1];
+    T s1 = a[0] * a[6]  - a[4] * a[2];
+    T s2 = a[0] * a[7]  - a[4] * a[3];
+    T s3 = a[1] * a[6]  - a[5] * a[2];
+    T s4 = a[1] * a[7]  - a[5] * a[3];
+    T s5 = a[2] * a[7]  - a[6] * a[3];
+
+    T c5 = a[10] * a[15] - a[14] * a[11];
+    T c4 = a[9]  * a[15] - a[13] * a[11];
+    T c3 = a[9]  * a[14] - a[13] * a[10];
+    T c2 = a[8]  * a[15] - a[12] * a[11];
+    T c1 = a[8]  * a[14] - a[12] * a[10];
+    T c0 = a[8]  * a[13] - a[12] * a[9];
+
+    T det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+    T inv = T{1} / det;
+
+    T ret[16] = {
+        ( a[5]  * c5 - a[6]  * c4 + a[7]  * c3) * inv,
+        (-a[1]  * c5 + a[2]  * c4 - a[3]  * c3) * inv,
+        ( a[13] * s5 - a[14] * s4 + a[15] * s3) * inv,
+        (-a[9]  * s5 + a[10] * s4 - a[11] * s3) * inv,
+
+        (-a[4]  * c5 + a[6]  * c2 - a[7]  * c1) * inv,
+        ( a[0]  * c5 - a[2]  * c2 + a[3]  * c1) * inv,
+        (-a[12] * s5 + a[14] * s2 - a[15] * s1) * inv,
+        ( a[8]  * s5 - a[10] * s2 + a[11] * s1) * inv,
+
+        ( a[4]  * c4 - a[5]  * c2 + a[7]  * c0) * inv,
+        (-a[0]  * c4 + a[1]  * c2 - a[3]  * c0) * inv,
+        ( a[12] * s4 - a[13] * s2 + a[15] * s0) * inv,
+        (-a[8]  * s4 + a[9]  * s2 - a[11] * s0) * inv,
+
+        (-a[4]  * c3 + a[5]  * c1 - a[6]  * c0) * inv,
+        ( a[0]  * c3 - a[1]  * c1 + a[2]  * c0) * inv,
+        (-a[12] * s3 + a[13] * s1 - a[14] * s0) * inv,
+        ( a[8]  * s3 - a[9]  * s1 + a[10] * s0) * inv,
+    };
+    std::copy(std::begin(ret), std::end(ret), out);
+    return det;
+}
+
+constexpr int shuffle_mask(int x, int y, int z, int w)
+{
+    return x | (y << 2) | (z << 4) | (w << 6);
+}
+
+template <int Mask>
+inline __m128 swizzle(__m128 v)
+{
+    return _mm_castsi128_ps(_mm_shuffle_epi32(_mm_castps_si128(v), Mask));
+}
+
+/* Operations on 2x2 row-major matrices packed into a single
+ * vector as (a0, a1, a2, a3).
+ */
+
+/* A * B */
+inline __m128 mat2_mul(__m128 a, __m128 b)
+{
+    return _mm_add_ps(
+        _mm_mul_ps(a, swizzle<shuffle_mask(0, 3, 0, 3)>(b)),
+        _mm_mul_ps(swizzle<shuffle_mask(1, 0, 3, 2)>(a), swizzle<shuffle_mask(2, 1, 2, 1)>(b)));
+}
+
+/* adj(A) * B */
+inline __m128 mat2_adj_mul(__m128 a, __m128 b)
+{
+    return _mm_sub_ps(
+        _mm_mul_ps(swizzle<shuffle_mask(3, 3, 0, 0)>(a), b),
+        _mm_mul_ps(swizzle<shuffle_mask(1, 1, 2, 2)>(a), swizzle<shuffle_mask(2, 3, 0, 1)>(b)));
+}
+
+/* A * adj(B) */
+inline __m128 mat2_mul_adj(__m128 a, __m128 b)
+{
+    return _mm_sub_ps(
+        _mm_mul_ps(a, swizzle<shuffle_mask(3, 0, 3, 0)>(b)),
+        _mm_mul_ps(swizzle<shuffle_mask(1, 0, 3, 2)>(a), swizzle<shuffle_mask(2, 1, 2, 1)>(b)));
+}
+
+/* Block-wise inversion, treating the matrix as four 2x2 blocks:
+ *
+ *  M = | A B |   M^-1 = 1/|M| | X Y |
+ *      | C D |                | Z W |
+ *
+ * where the blocks of the adjugate are computed from the 2x2
+ * adjugates and determinants of A, B, C and D. Returns the
+ * determinant. 'out' may alias 'in'.
+ */
+inline float inverse4x4_sse(const float *in, float *out)
+{
+    __m128 r0 = _mm_loadu_ps(in + 0);
+    __m128 r1 = _mm_loadu_ps(in + 4);
+    __m128 r2 = _mm_loadu_ps(in + 8);
+    __m128 r3 = _mm_loadu_ps(in + 12);
+
+    __m128 A = _mm_movelh_ps(r0, r1);
+    __m128 B = _mm_movehl_ps(r1, r0);
+    __m128 C = _mm_movelh_ps(r2, r3);
+    __m128 D = _mm_movehl_ps(r3, r2);
+
+    /* (|A|, |B|, |C|, |D|) */
+    __m128 det_sub = _mm_sub_ps(
+        _mm_mul_ps(_mm_shuffle_ps(r0, r2, shuffle_mask(0, 2, 0, 2)),
+                   _mm_shuffle_ps(r1, r3, shuffle_mask(1, 3, 1, 3))),
+        _mm_mul_ps(_mm_shuffle_ps(r0, r2, shuffle_mask(1, 3, 1, 3)),
+                   _mm_shuffle_ps(r1, r3, shuffle_mask(0, 2, 0, 2))));
+    __m128 det_a = swizzle<shuffle_mask(0, 0, 0, 0)>(det_sub);
+    __m128 det_b = swizzle<shuffle_mask(1, 1, 1, 1)>(det_sub);
+    __m128 det_c = swizzle<shuffle_mask(2, 2, 2, 2)>(det_sub);
+    __m128 det_d = swizzle<shuffle_mask(3, 3, 3, 3)>(det_sub);
+
+    __m128 d_c = mat2_adj_mul(D, C);
+    __m128 a_b = mat2_adj_mul(A, B);
+
+    __m128 x = _mm_sub_ps(_mm_mul_ps(det_d, A), mat2_mul(B, d_c));
+    __m128 w = _mm_sub_ps(_mm_mul_ps(det_a, D), mat2_mul(C, a_b));
+    __m128 y = _mm_sub_ps(_mm_mul_ps(det_b, C), mat2_mul_adj(D, a_b));
+    __m128 z = _mm_sub_ps(_mm_mul_ps(det_c, B), mat2_mul_adj(A, d_c));
+
+    /* |M| = |A||D| + |B||C| - tr(adj(A)B adj(D)C) */
+    __m128 tr = _mm_mul_ps(a_b, swizzle<shuffle_mask(0, 2, 1, 3)>(d_c));
+    tr = _mm_add_ps(tr, _mm_movehl_ps(tr, tr));
+    tr = _mm_add_ps(tr, swizzle<shuffle_mask(1, 0, 0, 0)>(tr));
+    tr = swizzle<shuffle_mask(0, 0, 0, 0)>(tr);
+
+    __m128 det = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(det_a, det_d), _mm_mul_ps(det_b, det_c)), tr);
+    __m128 rdet = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), det);
+
+    x = _mm_mul_ps(x, rdet);
+    y = _mm_mul_ps(y, rdet);
+    z = _mm_mul_ps(z, rdet);
+    w = _mm_mul_ps(w, rdet);
+
+    /* Take the adjugate of every block and store the rows.
+     */
+    _mm_storeu_ps(out + 0,  _mm_shuffle_ps(x, y, shuffle_mask(3, 1, 3, 1)));
+    _mm_storeu_ps(out + 4,  _mm_shuffle_ps(x, y, shuffle_mask(2, 0, 2, 0)));
+    _mm_storeu_ps(out + 8,  _mm_shuffle_ps(z, w, shuffle_mask(3, 1, 3, 1)));
+    _mm_storeu_ps(out + 12, _mm_shuffle_ps(z, w, shuffle_mask(2, 0, 2, 0)));
+
+    return _mm_cvtss_f32(det);
+}
+
+
 export
 template <std::size_t N, Number T> requires (N > 0)
 class alignas(64) Mat
@@ -154,6 +338,12 @@ public:
     constexpr Mat<N,T>    Adjoint() const;
     std::string           PrettyString() const;
 
+    /* Inverse of a matrix whose bottom row is (0, 0, 0, 1), such
+     * as any combination of rotation, scale and translation.
+     */
+    template <std::size_t M = N> requires (M == 4) && std::floating_point<T>
+    constexpr Mat<N,T>    AffineInverse() const;
+
     template<std::size_t M = N> requires (N > 1)
     Mat<M-1,T> Minor(std::size_t r, std::size_t c) const;
 
@@ -375,6 +565,29 @@ constexpr Mat<N,T> Mat<N,T>::Zero()
 template <std::size_t N, Number T> requires (N > 0)
 constexpr Mat<N,T> Mat<N,T>::Inverse() const
 {
+    if(!std::is_constant_evaluated()) {
+        /* The generic path creates many temporary matrices
+         * for the cofactors, so use closed-form inversion
+         * for the common floating-point 4x4 matrices.
+         */
+        if constexpr((N == 4) && std::is_same_v<float, T>) {
+            Mat<N,T> ret;
+            T det = inverse4x4_sse(m_raw, ret.m_raw);
+            if(equal(det, T{})) {
+                throw std::domain_error{"No inverse exists for this matrix"};
+            }
+            return ret;
+        }
+        if constexpr((N == 4) && std::is_same_v<double, T>) {
+            Mat<N,T> ret;
+            T det = inverse4x4_scalar(m_raw, ret.m_raw);
+            if(equal(det, T{})) {
+                throw std::domain_error{"No inverse exists for this matrix"};
+            }
+            return ret;
+        }
+    }
+
     T det = Determinant();
     if(!std::is_constant_evaluated()) {
         if(equal(det, T{})) {
@@ -384,6 +597,46 @@ constexpr Mat<N,T> Mat<N,T>::Inverse() const
     return Adjoint() / Determinant();
 }
 
+template <std::size_t N, Number T> requires (N > 0)
+template <std::size_t M> requires (M == 4) && std::floating_point<T>
+constexpr Mat<N,T> Mat<N,T>::AffineInverse() const
+{
+    const T *a = m_raw;
+
+    /* Invert the upper 3x3 part...
+     */
+    T c0 = a[5] * a[10] - a[6] * a[9];
+    T c1 = a[6] * a[8]  - a[4] * a[10];
+    T c2 = a[4] * a[9]  - a[5] * a[8];
+    T det = a[0] * c0 + a[1] * c1 + a[2] * c2;
+    if(!std::is_constant_evaluated()) {
+        if(equal(det, T{})) {
+            throw std::domain_error{"No inverse exists for this matrix"};
+        }
+    }
+    T inv = T{1} / det;
+
+    T r00 = c0 * inv;
+    T r01 = (a[2] * a[9] - a[1] * a[10]) * inv;
+    T r02 = (a[1] * a[6] - a[2] * a[5])  * inv;
+    T r10 = c1 * inv;
+    T r11 = (a[0] * a[10] - a[2] * a[8]) * inv;
+    T r12 = (a[2] * a[4]  - a[0] * a[6]) * inv;
+    T r20 = c2 * inv;
+    T r21 = (a[1] * a[8] - a[0] * a[9]) * inv;
+    T r22 = (a[0] * a[5] - a[1] * a[4]) * inv;
+
+    /* ...and undo the translation in the inverted space.
+     */
+    T tx = a[3], ty = a[7], tz = a[11];
+    return {
+        {r00, r01, r02, -(r00 * tx + r01 * ty + r02 * tz)},
+        {r10, r11, r12, -(r10 * tx + r11 * ty + r12 * tz)},
+        {r20, r21, r22, -(r20 * tx + r21 * ty + r22 * tz)},
+        {T{0}, T{0}, T{0}, T{1}}
+    };
+}
+
 template <std::size_t N, Number T> requires (N > 0)
 constexpr Mat<N,T> Mat<N,T>::Transpose() const
 {
@@ -420,6 +673,12 @@ template <std::size_t N, Number T> requires (N > 0)
 template <std::size_t M> requires (M >= 3)
 constexpr auto Mat<N,T>::Determinant() const
 {
+    if(!std::is_constant_evaluated()) {
+        if constexpr((N == 4) && std::floating_point<T>) {
+            return determinant4x4(m_raw);
+        }
+    }
+
     T ret = 0;
     constexpr_for<0, N, 1>([&]<std::size_t I>{
         auto val = m_raw[0 * N + I] * Minor<0, I>().Determinant(); 
@@ -0,0 +1,501 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Runtime metrics of the scheduler. Every thread accumulates
+ * its counters and histograms in its own cache-aligned shard,
+ * so recording a sample never contends with other threads.
+ * A snapshot aggregates all the shards and can be taken at
+ * any time, from any thread, while the metrics are being
+ * recorded:
+ *
+ *  pe::EnableSchedMetrics();
+ *  ...
+ *  auto snapshot = Scheduler().Metrics();
+ *  snapshot.WriteJSON(std::cout);
+ *
+ * When metrics are disabled, every instrumentation point costs
+ * a single relaxed load and a (predicted not-taken) branch.
+ */
+
+export module sched_metrics;
+
+import tls;
+import platform;
+import logger;
+import shared_ptr;
+
+import <cstdint>;
+import <cstring>;
+import <atomic>;
+import <array>;
+import <bit>;
+import <string>;
+import <string_view>;
+import <vector>;
+import <chrono>;
+import <ostream>;
+import <algorithm>;
+import <functional>;
+
+namespace pe{
+
+export inline constexpr std::size_t kMetricsMaxPriorities = 8;
+export inline constexpr std::size_t kMetricsMaxTaskTypes = 128;
+
+inline constexpr std::size_t kHistogramBuckets = 48;
+
+/*****************************************************************************/
+/* HISTOGRAM                                                                 */
+/*****************************************************************************/
+
+export
+struct HistogramSnapshot
+{
+    uint64_t                                m_count;
+    uint64_t                                m_total;
+    uint64_t                                m_max;
+    std::array<uint64_t, kHistogramBuckets> m_buckets;
+
+    void Merge(const HistogramSnapshot& other)
+    {
+        m_count += other.m_count;
+        m_total += other.m_total;
+        m_max = std::max(m_max, other.m_max);
+        for(int i = 0; i < kHistogramBuckets; i++) {
+            m_buckets[i] += other.m_buckets[i];
+        }
+    }
+
+    /* Returns an upper bound on the value at the specified
+     * percentile, which is accurate to a power of two.
+     */
+    uint64_t Percentile(double pct) const
+    {
+        if(m_count == 0)
+            return 0;
+        uint64_t rank = std::max<uint64_t>(1, m_count * pct / 100.0);
+        uint64_t seen = 0;
+        for(int i = 0; i < kHistogramBuckets; i++) {
+            seen += m_buckets[i];
+            if(seen >= rank)
+                return std::min(m_max, (uint64_t{1} << i));
+        }
+        return m_max;
+    }
+
+    uint64_t Mean() const
+    {
+        return (m_count > 0) ? (m_total / m_count) : 0;
+    }
+};
+
+/* A log2-bucketed histogram. It has a single writer (the thread
+ * owning the shard), so the fields are updated with plain
+ * relaxed loads and stores, but can be read concurrently.
+ */
+class Histogram
+{
+private:
+
+    std::atomic_uint64_t                                m_count;
+    std::atomic_uint64_t                                m_total;
+    std::atomic_uint64_t                                m_max;
+    std::array<std::atomic_uint64_t, kHistogramBuckets> m_buckets;
+
+    static void increment(std::atomic_uint64_t& counter, uint64_t delta)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + delta,
+            std::memory_order_relaxed);
+    }
+
+public:
+
+    Histogram()
+        : m_count{}
+        , m_total{}
+        , m_max{}
+        , m_buckets{}
+    {}
+
+    void Record(uint64_t value)
+    {
+        std::size_t bucket = std::min<std::size_t>(std::bit_width(value), kHistogramBuckets - 1);
+        increment(m_buckets[bucket], 1);
+        increment(m_total, value);
+        increment(m_count, 1);
+        if(value > m_max.load(std::memory_order_relaxed))
+            m_max.store(value, std::memory_order_relaxed);
+    }
+
+    HistogramSnapshot Snapshot() const
+    {
+        HistogramSnapshot ret{};
+        ret.m_count = m_count.load(std::memory_order_relaxed);
+        ret.m_total = m_total.load(std::memory_order_relaxed);
+        ret.m_max = m_max.load(std::memory_order_relaxed);
+        for(int i = 0; i < kHistogramBuckets; i++) {
+            ret.m_buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+        }
+        return ret;
+    }
+};
+
+/*****************************************************************************/
+/* TASK TYPE REGISTRY                                                        */
+/*****************************************************************************/
+/*
+ * A fixed-size lock-free set of interned task names. The index
+ * of a name in the table is used to key the per-type run slice
+ * histograms. The names are never freed. When the table fills
+ * up, all the remaining names are aggregated under the last
+ * slot.
+ */
+inline std::array<std::atomic<const char*>, kMetricsMaxTaskTypes> s_task_types{};
+inline constexpr std::size_t kOverflowTaskType = kMetricsMaxTaskTypes - 1;
+inline constexpr const char *kOverflowTaskTypeName = "<other>";
+
+export
+int TaskTypeID(std::string_view name)
+{
+    std::size_t hash = std::hash<std::string_view>{}(name);
+    for(int i = 0; i < kOverflowTaskType; i++) {
+
+        std::size_t idx = (hash + i) % kOverflowTaskType;
+        const char *curr = s_task_types[idx].load(std::memory_order_acquire);
+        if(curr) {
+            if(std::string_view{curr} == name)
+                return idx;
+            continue;
+        }
+
+        char *interned = new char[name.size() + 1];
+        std::memcpy(interned, name.data(), name.size());
+        interned[name.size()] = '\0';
+
+        if(s_task_types[idx].compare_exchange_strong(curr, interned,
+            std::memory_order_release, std::memory_order_acquire)) {
+            return idx;
+        }
+        delete[] interned;
+        if(std::string_view{curr} == name)
+            return idx;
+    }
+    return kOverflowTaskType;
+}
+
+/*****************************************************************************/
+/* METRICS SHARD                                                             */
+/*****************************************************************************/
+
+export
+struct alignas(kCacheLineSize) MetricsShard
+{
+    std::string                                             m_thread_name;
+
+    /* The queue depths are adjusted by the thieves as well as
+     * the owner, so they are updated with atomic RMW operations.
+     */
+    std::array<std::atomic_int64_t, kMetricsMaxPriorities>  m_queue_depth;
+
+    alignas(kCacheLineSize)
+    std::atomic_uint64_t                                    m_pops;
+    std::atomic_uint64_t                                    m_steals;
+    std::atomic_uint64_t                                    m_failed_steals;
+    std::atomic_uint64_t                                    m_idle_cycles;
+    std::atomic_uint64_t                                    m_busy_cycles;
+    std::atomic_uint64_t                                    m_messages_sent;
+    std::atomic_uint64_t                                    m_messages_received;
+
+    Histogram                                               m_enqueue_latency;
+    std::array<Histogram, kMetricsMaxTaskTypes>             m_run_slices;
+
+    MetricsShard(std::string thread_name)
+        : m_thread_name{thread_name}
+        , m_queue_depth{}
+        , m_pops{}
+        , m_steals{}
+        , m_failed_steals{}
+        , m_idle_cycles{}
+        , m_busy_cycles{}
+        , m_messages_sent{}
+        , m_messages_received{}
+        , m_enqueue_latency{}
+        , m_run_slices{}
+    {}
+
+    /* Only to be used by the owning thread.
+     */
+    static void Increment(std::atomic_uint64_t& counter, uint64_t delta = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + delta,
+            std::memory_order_relaxed);
+    }
+};
+
+/*****************************************************************************/
+/* METRICS STATE                                                             */
+/*****************************************************************************/
+
+struct MetricsClockSample
+{
+    uint64_t                              m_tsc;
+    std::chrono::steady_clock::time_point m_time;
+};
+
+inline std::atomic_bool                 s_metrics_enabled{false};
+inline std::atomic<MetricsClockSample*> s_metrics_epoch{nullptr};
+
+[[maybe_unused]] inline TLSAllocation<MetricsShard>& GetMetricsTLS()
+{
+    /* Shards are not deleted on thread exit so that the
+     * totals are not lost when threads are terminated.
+     */
+    static TLSAllocation s_metrics_tls = AllocTLS<MetricsShard>(false);
+    return s_metrics_tls;
+}
+
+export
+inline pe::shared_ptr<MetricsShard> GetMetricsShardPtr()
+{
+    return GetMetricsTLS().GetThreadSpecific(GetThreadName());
+}
+
+export
+inline MetricsShard& GetMetricsShard()
+{
+    static thread_local MetricsShard *t_shard = nullptr;
+    if(!t_shard) [[unlikely]] {
+        t_shard = GetMetricsShardPtr().get();
+    }
+    return *t_shard;
+}
+
+double metrics_ticks_per_usec()
+{
+    uint64_t now_tsc = rdtsc_after();
+    auto now_time = std::chrono::steady_clock::now();
+
+    double ticks_per_usec = tscfreq_mhz();
+    if(auto epoch = s_metrics_epoch.load(std::memory_order_acquire)) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            now_time - epoch->m_time).count();
+        if(elapsed > 0 && now_tsc > epoch->m_tsc)
+            ticks_per_usec = static_cast<double>(now_tsc - epoch->m_tsc) / elapsed;
+    }
+    if(ticks_per_usec <= 0)
+        ticks_per_usec = 1000.0;
+    return ticks_per_usec;
+}
+
+/*****************************************************************************/
+/* MODULE INTERFACE                                                          */
+/*****************************************************************************/
+
+export
+inline bool MetricsEnabled()
+{
+    return s_metrics_enabled.load(std::memory_order_relaxed);
+}
+
+export
+inline void EnableSchedMetrics()
+{
+    auto sample = new MetricsClockSample{rdtsc_before(), std::chrono::steady_clock::now()};
+    MetricsClockSample *expected = nullptr;
+    if(!s_metrics_epoch.compare_exchange_strong(expected, sample,
+        std::memory_order_release, std::memory_order_relaxed)) {
+        delete sample;
+    }
+    s_metrics_enabled.store(true, std::memory_order_relaxed);
+}
+
+export
+inline void DisableSchedMetrics()
+{
+    s_metrics_enabled.store(false, std::memory_order_relaxed);
+}
+
+/*****************************************************************************/
+/* SNAPSHOT                                                                  */
+/*****************************************************************************/
+
+export
+struct ThreadMetrics
+{
+    std::string          m_thread_name;
+    std::vector<int64_t> m_queue_depth;
+    uint64_t             m_pops;
+    uint64_t             m_steals;
+    uint64_t             m_failed_steals;
+    uint64_t             m_idle_usec;
+    uint64_t             m_busy_usec;
+};
+
+export
+struct MetricsSnapshot
+{
+    uint64_t                                               m_timestamp_usec;
+    double                                                 m_ticks_per_usec;
+    std::vector<ThreadMetrics>                             m_threads;
+    HistogramSnapshot                                      m_enqueue_latency;
+    std::vector<std::pair<std::string, HistogramSnapshot>> m_run_slices;
+    uint64_t                                               m_message_backlog;
+    uint64_t                                               m_io_queue_size;
+    uint64_t                                               m_io_busy_threads;
+
+    void WriteJSON(std::ostream& out) const;
+};
+
+inline void write_json_string(std::ostream& out, std::string_view str)
+{
+    out << '"';
+    for(char c : str) {
+        switch(c) {
+        case '"':  out << "\\\""; break;
+        case '\\': out << "\\\\"; break;
+        default:
+            if(static_cast<unsigned char>(c) < 0x20)
+                out << ' ';
+            else
+                out << c;
+        }
+    }
+    out << '"';
+}
+
+/* Histograms are recorded in TSC ticks and written out
+ * in microseconds.
+ */
+inline void write_histogram(std::ostream& out, const HistogramSnapshot& hist,
+    double ticks_per_usec)
+{
+    out << "{\"count\":" << hist.m_count
+        << ",\"mean_usec\":" << hist.Mean() / ticks_per_usec
+        << ",\"p50_usec\":" << hist.Percentile(50.0) / ticks_per_usec
+        << ",\"p90_usec\":" << hist.Percentile(90.0) / ticks_per_usec
+        << ",\"p99_usec\":" << hist.Percentile(99.0) / ticks_per_usec
+        << ",\"max_usec\":" << hist.m_max / ticks_per_usec
+        << ",\"total_usec\":" << hist.m_total / ticks_per_usec << "}";
+}
+
+void MetricsSnapshot::WriteJSON(std::ostream& out) const
+{
+    out << "{\"timestamp_usec\":" << m_timestamp_usec;
+
+    out << ",\"threads\":[";
+    for(int i = 0; i < std::size(m_threads); i++) {
+        const auto& thread = m_threads[i];
+        if(i > 0)
+            out << ",";
+        out << "{\"name\":";
+        write_json_string(out, thread.m_thread_name);
+        out << ",\"queue_depth\":[";
+        for(int j = 0; j < std::size(thread.m_queue_depth); j++) {
+            if(j > 0)
+                out << ",";
+            out << thread.m_queue_depth[j];
+        }
+        out << "],\"pops\":" << thread.m_pops
+            << ",\"steals\":" << thread.m_steals
+            << ",\"failed_steals\":" << thread.m_failed_steals
+            << ",\"idle_usec\":" << thread.m_idle_usec
+            << ",\"busy_usec\":" << thread.m_busy_usec << "}";
+    }
+    out << "]";
+
+    out << ",\"enqueue_latency\":";
+    write_histogram(out, m_enqueue_latency, m_ticks_per_usec);
+
+    out << ",\"run_slices\":{";
+    for(int i = 0; i < std::size(m_run_slices); i++) {
+        if(i > 0)
+            out << ",";
+        write_json_string(out, m_run_slices[i].first);
+        out << ":";
+        write_histogram(out, m_run_slices[i].second, m_ticks_per_usec);
+    }
+    out << "}";
+
+    out << ",\"message_backlog\":" << m_message_backlog
+        << ",\"io\":{\"queue_size\":" << m_io_queue_size
+        << ",\"busy_threads\":" << m_io_busy_threads << "}}";
+}
+
+/* Aggregate the metrics of all the threads. This can be called
+ * from any thread, concurrently with the threads recording the
+ * metrics. The counters of the individual shards are read
+ * independently, so the snapshot is not linearizable, but every
+ * value is one that was observed during the call. IO pool state
+ * is owned by the scheduler and is to be filled in by the caller.
+ */
+export
+MetricsSnapshot TakeMetricsSnapshot(std::size_t num_priorities)
+{
+    num_priorities = std::min(num_priorities, kMetricsMaxPriorities);
+    double ticks_per_usec = metrics_ticks_per_usec();
+
+    MetricsSnapshot ret{};
+    ret.m_timestamp_usec = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    ret.m_ticks_per_usec = ticks_per_usec;
+
+    std::array<HistogramSnapshot, kMetricsMaxTaskTypes> run_slices{};
+    uint64_t sent = 0, received = 0;
+
+    auto shards = GetMetricsTLS().GetThreadPtrsSnapshot();
+    for(const auto& shard : shards) {
+
+        ThreadMetrics thread{};
+        thread.m_thread_name = shard->m_thread_name;
+        for(int i = 0; i < num_priorities; i++) {
+            /* Tasks queued before the metrics were enabled
+             * can drive the depth below zero.
+             */
+            int64_t depth = shard->m_queue_depth[i].load(std::memory_order_relaxed);
+            thread.m_queue_depth.push_back(std::max<int64_t>(depth, 0));
+        }
+        thread.m_pops = shard->m_pops.load(std::memory_order_relaxed);
+        thread.m_steals = shard->m_steals.load(std::memory_order_relaxed);
+        thread.m_failed_steals = shard->m_failed_steals.load(std::memory_order_relaxed);
+        thread.m_idle_usec = shard->m_idle_cycles.load(std::memory_order_relaxed) / ticks_per_usec;
+        thread.m_busy_usec = shard->m_busy_cycles.load(std::memory_order_relaxed) / ticks_per_usec;
+        ret.m_threads.push_back(thread);
+
+        ret.m_enqueue_latency.Merge(shard->m_enqueue_latency.Snapshot());
+        for(int i = 0; i < kMetricsMaxTaskTypes; i++) {
+            run_slices[i].Merge(shard->m_run_slices[i].Snapshot());
+        }
+        sent += shard->m_messages_sent.load(std::memory_order_relaxed);
+        received += shard->m_messages_received.load(std::memory_order_relaxed);
+    }
+
+    for(int i = 0; i < kMetricsMaxTaskTypes; i++) {
+        if(run_slices[i].m_count == 0)
+            continue;
+        const char *name = s_task_types[i].load(std::memory_order_acquire);
+        if(i == kOverflowTaskType || !name)
+            name = kOverflowTaskTypeName;
+        ret.m_run_slices.emplace_back(name, run_slices[i]);
+    }
+
+    ret.m_message_backlog = (sent > received) ? (sent - received) : 0;
+    return ret;
+}
+
+} // namespace pe
@@ -0,0 +1,386 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Timeline tracing of the scheduler. When enabled, workers, IO
+ * threads and synchronization primitives record timestamped
+ * events into per-thread ring buffers. A window of the most
+ * recent events can then be exported in the Chrome trace-event
+ * JSON format, which can be loaded into 'chrome://tracing' or
+ * 'ui.perfetto.dev':
+ *
+ *  pe::EnableSchedTracing();
+ *  ...
+ *  pe::DumpChromeTrace("trace.json", std::chrono::seconds{2});
+ *
+ * When tracing is disabled, every instrumentation point costs
+ * a single relaxed load and a (predicted not-taken) branch.
+ */
+
+export module sched_trace;
+
+import tls;
+import platform;
+import logger;
+import shared_ptr;
+
+import <cstdint>;
+import <cstring>;
+import <atomic>;
+import <array>;
+import <string>;
+import <string_view>;
+import <vector>;
+import <chrono>;
+import <fstream>;
+import <ostream>;
+import <algorithm>;
+import <stdexcept>;
+
+namespace pe{
+
+inline constexpr std::size_t kTraceRingSize = 16384;
+
+static_assert((kTraceRingSize & (kTraceRingSize - 1)) == 0,
+    "Trace ring size must be a power of two.");
+
+/*****************************************************************************/
+/* TRACE EVENT TYPE                                                          */
+/*****************************************************************************/
+
+export
+enum class TraceEventType : uint8_t
+{
+    eTaskRun,
+    eSteal,
+    eEventNotify,
+    eLatchWait,
+    eBarrierWait,
+    eIOEnqueue,
+    eIOWork,
+};
+
+/*****************************************************************************/
+/* TRACE RECORD                                                              */
+/*****************************************************************************/
+
+struct alignas(64) TraceRecord
+{
+    uint64_t       m_tsc_start;
+    uint64_t       m_tsc_end;
+    uint64_t       m_arg;
+    TraceEventType m_type;
+    char           m_name[39];
+};
+
+static_assert(sizeof(TraceRecord) == 64);
+
+/*****************************************************************************/
+/* TRACE RING                                                                */
+/*****************************************************************************/
+/*
+ * A single-producer ring buffer of trace records. Only the
+ * owning thread writes to it. The head is published with
+ * 'release' semantics after a record is written, so that a
+ * reader can take a snapshot at any time without blocking
+ * the writer. Records overwritten while the snapshot was
+ * being taken are detected by re-reading the head and are
+ * discarded.
+ */
+class TraceRing
+{
+private:
+
+    std::array<TraceRecord, kTraceRingSize> m_records;
+    std::atomic_uint64_t                    m_head;
+    std::string                             m_thread_name;
+    uint32_t                                m_index;
+
+    static inline std::atomic_uint32_t s_next_index{};
+
+public:
+
+    TraceRing(std::string thread_name)
+        : m_records{}
+        , m_head{0}
+        , m_thread_name{thread_name}
+        , m_index{s_next_index.fetch_add(1, std::memory_order_relaxed)}
+    {}
+
+    void Push(TraceEventType type, uint64_t start, uint64_t end,
+        uint64_t arg, std::string_view name) noexcept
+    {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        TraceRecord& record = m_records[head & (kTraceRingSize - 1)];
+
+        record.m_tsc_start = start;
+        record.m_tsc_end = end;
+        record.m_arg = arg;
+        record.m_type = type;
+
+        std::size_t len = std::min(name.size(), sizeof(record.m_name) - 1);
+        std::memcpy(record.m_name, name.data(), len);
+        record.m_name[len] = '\0';
+
+        m_head.store(head + 1, std::memory_order_release);
+    }
+
+    std::vector<TraceRecord> Snapshot() const
+    {
+        uint64_t head = m_head.load(std::memory_order_acquire);
+        uint64_t first = (head > kTraceRingSize) ? (head - kTraceRingSize) : 0;
+
+        std::vector<TraceRecord> ret;
+        ret.reserve(head - first);
+        for(uint64_t i = first; i < head; i++) {
+            ret.push_back(m_records[i & (kTraceRingSize - 1)]);
+        }
+
+        /* Drop the records that the writer may have overwritten
+         * while we were copying them. This includes the slot of 
+         * the record at 'new_head', which may be in the middle 
+         * of being written.
+         */
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t new_head = m_head.load(std::memory_order_relaxed);
+        uint64_t overwritten = (new_head + 1 > kTraceRingSize) ? (new_head + 1 - kTraceRingSize) : 0;
+        if(overwritten > first) {
+            std::size_t ndrop = std::min<uint64_t>(overwritten - first, ret.size());
+            ret.erase(std::begin(ret), std::begin(ret) + ndrop);
+        }
+        return ret;
+    }
+
+    const std::string& ThreadName() const
+    {
+        return m_thread_name;
+    }
+
+    uint32_t Index() const
+    {
+        return m_index;
+    }
+};
+
+/*****************************************************************************/
+/* TRACING STATE                                                             */
+/*****************************************************************************/
+
+struct TraceClockSample
+{
+    uint64_t                              m_tsc;
+    std::chrono::steady_clock::time_point m_time;
+};
+
+inline std::atomic_bool               s_tracing_enabled{false};
+inline std::atomic<TraceClockSample*> s_trace_epoch{nullptr};
+
+[[maybe_unused]] inline TLSAllocation<TraceRing>& GetTraceTLS()
+{
+    /* Rings are not deleted on thread exit so that events
+     * of threads which have already terminated can still
+     * be exported.
+     */
+    static TLSAllocation s_trace_tls = AllocTLS<TraceRing>(false);
+    return s_trace_tls;
+}
+
+inline TraceRing& GetTraceRing()
+{
+    static thread_local TraceRing *t_ring = nullptr;
+    if(!t_ring) [[unlikely]] {
+        t_ring = GetTraceTLS().GetThreadSpecific(GetThreadName()).get();
+    }
+    return *t_ring;
+}
+
+/*****************************************************************************/
+/* MODULE INTERFACE                                                          */
+/*****************************************************************************/
+
+export
+inline bool TracingEnabled()
+{
+    return s_tracing_enabled.load(std::memory_order_relaxed);
+}
+
+export
+inline void EnableSchedTracing()
+{
+    auto sample = new TraceClockSample{rdtsc_before(), std::chrono::steady_clock::now()};
+    TraceClockSample *expected = nullptr;
+    if(!s_trace_epoch.compare_exchange_strong(expected, sample,
+        std::memory_order_release, std::memory_order_relaxed)) {
+        delete sample;
+    }
+    s_tracing_enabled.store(true, std::memory_order_relaxed);
+}
+
+export
+inline void DisableSchedTracing()
+{
+    s_tracing_enabled.store(false, std::memory_order_relaxed);
+}
+
+export
+inline void TraceSlice(TraceEventType type, uint64_t start, uint64_t end,
+    uint64_t arg = 0, std::string_view name = {})
+{
+    GetTraceRing().Push(type, start, end, arg, name);
+}
+
+export
+inline void TraceInstant(TraceEventType type, uint64_t arg = 0, std::string_view name = {})
+{
+    uint64_t now = rdtsc_before();
+    GetTraceRing().Push(type, now, now, arg, name);
+}
+
+/*****************************************************************************/
+/* CHROME TRACE EXPORT                                                       */
+/*****************************************************************************/
+
+inline const char *trace_category(TraceEventType type)
+{
+    switch(type) {
+    case TraceEventType::eTaskRun:     return "task";
+    case TraceEventType::eSteal:       return "steal";
+    case TraceEventType::eEventNotify: return "event";
+    case TraceEventType::eLatchWait:   return "sync";
+    case TraceEventType::eBarrierWait: return "sync";
+    case TraceEventType::eIOEnqueue:   return "io";
+    case TraceEventType::eIOWork:      return "io";
+    }
+    return "unknown";
+}
+
+inline const char *trace_default_name(TraceEventType type)
+{
+    switch(type) {
+    case TraceEventType::eTaskRun:     return "Run";
+    case TraceEventType::eSteal:       return "Steal";
+    case TraceEventType::eEventNotify: return "Notify";
+    case TraceEventType::eLatchWait:   return "LatchWait";
+    case TraceEventType::eBarrierWait: return "BarrierWait";
+    case TraceEventType::eIOEnqueue:   return "IOEnqueue";
+    case TraceEventType::eIOWork:      return "IOWork";
+    }
+    return "Unknown";
+}
+
+inline void write_json_string(std::ostream& out, std::string_view str)
+{
+    out << '"';
+    for(char c : str) {
+        switch(c) {
+        case '"':  out << "\\\""; break;
+        case '\\': out << "\\\\"; break;
+        default:
+            if(static_cast<unsigned char>(c) < 0x20)
+                out << ' ';
+            else
+                out << c;
+        }
+    }
+    out << '"';
+}
+
+/* Write out all the events that have ended within the last
+ * 'window' of time in the Chrome trace-event JSON format.
+ * This can be called from any thread, concurrently with
+ * the traced threads.
+ */
+export
+void ExportChromeTrace(std::ostream& out, std::chrono::microseconds window)
+{
+    uint64_t now_tsc = rdtsc_after();
+    auto now_time = std::chrono::steady_clock::now();
+
+    /* Derive the TSC rate from the time elapsed since tracing
+     * was first enabled, as CPUID does not report the TSC
+     * frequency on all processors.
+     */
+    double ticks_per_usec = tscfreq_mhz();
+    if(auto epoch = s_trace_epoch.load(std::memory_order_acquire)) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            now_time - epoch->m_time).count();
+        if(elapsed > 0 && now_tsc > epoch->m_tsc)
+            ticks_per_usec = static_cast<double>(now_tsc - epoch->m_tsc) / elapsed;
+    }
+    if(ticks_per_usec <= 0)
+        ticks_per_usec = 1000.0;
+
+    uint64_t window_ticks = window.count() * ticks_per_usec;
+    uint64_t begin_tsc = (now_tsc > window_ticks) ? (now_tsc - window_ticks) : 0;
+
+    auto to_usec = [&](uint64_t tsc){
+        return (tsc > begin_tsc) ? ((tsc - begin_tsc) / ticks_per_usec) : 0.0;
+    };
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+
+    auto rings = GetTraceTLS().GetThreadPtrsSnapshot();
+    for(const auto& ring : rings) {
+
+        if(!first)
+            out << ",";
+        first = false;
+
+        out << "{\"ph\":\"M\",\"pid\":0,\"tid\":" << ring->Index()
+            << ",\"name\":\"thread_name\",\"args\":{\"name\":";
+        write_json_string(out, ring->ThreadName());
+        out << "}}";
+
+        for(const auto& record : ring->Snapshot()) {
+
+            if(record.m_tsc_end < begin_tsc)
+                continue;
+
+            std::string_view name{record.m_name};
+            if(name.empty())
+                name = trace_default_name(record.m_type);
+
+            out << ",{\"name\":";
+            write_json_string(out, name);
+            out << ",\"cat\":\"" << trace_category(record.m_type) << "\"";
+            out << ",\"pid\":0,\"tid\":" << ring->Index();
+            out << ",\"ts\":" << to_usec(record.m_tsc_start);
+
+            if(record.m_tsc_end == record.m_tsc_start) {
+                out << ",\"ph\":\"i\",\"s\":\"t\"";
+            }else{
+                out << ",\"ph\":\"X\",\"dur\":"
+                    << (record.m_tsc_end - record.m_tsc_start) / ticks_per_usec;
+            }
+            out << ",\"args\":{\"arg\":" << record.m_arg << "}}";
+        }
+    }
+    out << "]}";
+}
+
+export
+void DumpChromeTrace(const std::string& path, std::chrono::microseconds window)
+{
+    std::ofstream out{path, std::ios::out | std::ios::trunc};
+    if(!out)
+        throw std::runtime_error{"Failed to open trace file: " + path};
+    ExportChromeTrace(out, window);
+}
+
+} // namespace pe
@@ -36,6 +36,8 @@ import meta;
 import assert;
 import atomic_work;
 import tls;
+import sched_trace;
+import sched_metrics;
 
 import <array>;
 import <queue>;
@@ -49,6 +51,15 @@ import <unordered_set>;
 import <stack>;
 import <any>;
 import <ranges>;
+import <chrono>;
+import <string>;
+import <exception>;
+import <mutex>;
+import <utility>;
+import <stdexcept>;
+import <vector>;
+import <span>;
+import <algorithm>;
 
 template <typename T, typename... Args>
 struct std::coroutine_traits<pe::shared_ptr<T>, Args...>
@@ -66,6 +77,7 @@ export using ::pe::Affinity;
 export using ::pe::Priority;
 export using tid_t = uint32_t;
 export class Scheduler;
+export class TaskBase;
 
 export 
 template <typename ReturnType, typename Derived, typename... Args>
@@ -124,6 +136,39 @@ enum class CreateMode : uint32_t
 export struct VoidType {};
 export constexpr VoidType Void = VoidType{};
 
+/*
+ * An awaitable which can be the operand of co_yield. This lets
+ * a task hand values off to something other than its' awaiter,
+ * such as a stream:
+ *
+ *     co_yield stream.Push(value);
+ */
+export
+template <typename T>
+concept YieldIntoAwaitable = requires {
+    typename std::remove_cvref_t<T>::yield_into_tag;
+};
+
+/*****************************************************************************/
+/* TASK CANCELLED                                                            */
+/*****************************************************************************/
+/*
+ * Thrown inside a task which has been cancelled when it reaches a
+ * cancellation point, unwinding it. The exception is passed on to 
+ * the task's awaiter, but is not treated as an unhandled exception 
+ * when there is none.
+ */
+export
+class TaskCancelled : public std::exception
+{
+public:
+
+    const char *what() const noexcept override
+    {
+        return "Task cancelled.";
+    }
+};
+
 /*****************************************************************************/
 /* MESSAGE                                                                   */
 /*****************************************************************************/
@@ -146,22 +191,25 @@ struct TaskInitialAwaitable
 {
 private:
 
-    Scheduler&  m_scheduler;
-    Schedulable m_schedulable;
-    CreateMode  m_mode;
+    Scheduler&      m_scheduler;
+    Schedulable     m_schedulable;
+    CreateMode      m_mode;
+    const TaskBase *m_task;
 
 public:
 
-    TaskInitialAwaitable(Scheduler& scheduler, Schedulable schedulable, CreateMode mode)
+    TaskInitialAwaitable(Scheduler& scheduler, Schedulable schedulable, CreateMode mode,
+        const TaskBase *task)
         : m_scheduler{scheduler}
         , m_schedulable{schedulable}
         , m_mode{mode}
+        , m_task{task}
     {}
 
     bool await_ready() const noexcept;
     template <typename PromiseType>
     void await_suspend(std::coroutine_handle<PromiseType>) const noexcept;
-    void await_resume() const noexcept {}
+    void await_resume() const;
 };
 
 /*****************************************************************************/
@@ -191,7 +239,7 @@ public:
     bool await_ready();
 
     template <typename OtherReturnType, typename OtherTaskType>
-    bool await_suspend(handle_type<OtherReturnType, OtherTaskType> awaiter_handle);
+    std::coroutine_handle<> await_suspend(handle_type<OtherReturnType, OtherTaskType> awaiter_handle);
 
     template <typename U = ReturnType>
     requires (!std::is_void_v<U>)
@@ -237,6 +285,7 @@ private:
     Scheduler&                          m_scheduler;
     Schedulable                         m_awaiter;
     pe::weak_ptr<void>                  m_awaiter_task;
+    const TaskBase                     *m_awaiter_base;
     tid_t                               m_awaiter_tid;
     std::optional<event_arg_t<Event>>   m_arg;
     void                              (*m_advance_state)(pe::weak_ptr<void>, TaskState);
@@ -259,6 +308,7 @@ public:
         : m_scheduler{task.Scheduler()}
         , m_awaiter{task.Schedulable()}
         , m_awaiter_task{task.shared_from_this()}
+        , m_awaiter_base{&task}
         , m_awaiter_tid{task.TID()}
         , m_arg{}
         , m_advance_state(+[](pe::weak_ptr<void> ptr, TaskState state){
@@ -312,6 +362,9 @@ public:
 
     bool await_ready()
     {
+        /* Don't consume the event when we are going to unwind */
+        if(m_awaiter_base->Cancelled()) [[unlikely]]
+            return true;
         auto event = m_next_event(m_awaiter_task);
         if(!event.has_value())
             return false;
@@ -322,10 +375,7 @@ public:
     template <typename PromiseType>
     bool await_suspend(std::coroutine_handle<PromiseType> awaiter_handle) noexcept;
 
-    event_arg_t<Event> await_resume()
-    {
-        return m_arg.value();
-    }
+    event_arg_t<Event> await_resume();
 
     void AdvanceState(TaskState state)
     {
@@ -354,14 +404,48 @@ public:
 /* YIELD AWAITABLE                                                           */
 /*****************************************************************************/
 
+/*
+ * Suspends the current task and makes 'm_schedulable' runnable.
+ * When yielding or returning to an awaiter, 'm_transfer' is set
+ * and the awaiter may be resumed directly on the current thread.
+ * If 'm_task' is set, it is checked for cancellation when it
+ * gets resumed.
+ */
 struct YieldAwaitable
 {
-    Scheduler&  m_scheduler;
-    Schedulable m_schedulable;
+    Scheduler&      m_scheduler;
+    Schedulable     m_schedulable;
+    bool            m_transfer{false};
+    const TaskBase *m_task{nullptr};
 
     bool await_ready() const noexcept { return false; }
-    void await_suspend(std::coroutine_handle<>) const noexcept;
-    void await_resume() const noexcept {}
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<>) const noexcept;
+    void await_resume() const;
+};
+
+/*
+ * Only suspends the current task when its' worker thread's 
+ * execution budget is exhausted or a task of a higher priority 
+ * is waiting to run on it. Nothing is copied unless the task 
+ * actually suspends. It is also a cancellation point.
+ */
+template <typename TaskType>
+struct MaybeYieldAwaitable
+{
+    TaskType& m_task;
+
+    bool await_ready() const noexcept 
+    {
+        return !ShouldYield(m_task.Priority());
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> handle) const noexcept
+    {
+        YieldAwaitable yield{m_task.Scheduler(), m_task.Schedulable(), false, &m_task};
+        return yield.await_suspend(handle);
+    }
+
+    void await_resume() const;
 };
 
 /*****************************************************************************/
@@ -398,6 +482,9 @@ public:
         }
 
         m_send_message(receiver, m_scheduler, m_message);
+        if(MetricsEnabled()) [[unlikely]] {
+            MetricsShard::Increment(GetMetricsShard().m_messages_sent);
+        }
         return true;
     }
 
@@ -408,145 +495,169 @@ public:
 };
 
 /*****************************************************************************/
-/* RECV AWAITABLE                                                            */
+/* MAILBOX DEQUEUE STATE                                                     */
 /*****************************************************************************/
-
-struct RecvAwaitable
+/*
+ * The task state transitions made while taking messages out of a
+ * task's mailbox, shared by all the ways of receiving messages. 
+ * Every consumed message advances the message sequence number in
+ * the task's control block. A receive which finds the mailbox empty
+ * and wants to block marks the task as such, so that it gets woken
+ * by the next sender.
+ */
+template <typename PromiseType>
+struct MailboxDequeueState
 {
-private:
+    using control_block_type = typename PromiseType::ControlBlock;
 
-    Schedulable              m_awaiter;
-    pe::weak_ptr<void>       m_awaiter_task;
-    Message                  m_message;
-
-    std::optional<Message> (*m_try_pop_message)(pe::shared_ptr<void>);
-    std::optional<Message> (*m_pop_message_or_block)(pe::shared_ptr<void>);
-
-public:
+    control_block_type m_expected;
+    PromiseType&       m_promise;
 
-    template <typename AwaiterType>
-    RecvAwaitable(Schedulable awaiter, pe::shared_ptr<AwaiterType> task)
-        : m_awaiter{awaiter}
-        , m_awaiter_task{task}
-        , m_message{}
-        , m_try_pop_message{+[](pe::shared_ptr<void> awaiter){
+    static bool advanced(uint8_t a, uint8_t b)
+    {
+        return (static_cast<int8_t>((b) - (a)) < 0);
+    }
 
-            auto task = pe::static_pointer_cast<AwaiterType>(awaiter);
-            return task->PollMessage();
-        }}
-        , m_pop_message_or_block{+[](pe::shared_ptr<void> awaiter){
+    static void Consume(const pe::shared_ptr<MailboxDequeueState> state, uint64_t seqnum)
+    {
+        auto expected = state->m_expected;
+        while(true) {
+            control_block_type newstate{
+                expected.m_state,
+                u8(seqnum),
+                expected.m_unblock_counter,
+                expected.m_notify_counter,
+                expected.m_event_seqnums,
+                expected.m_awaiting_event_mask,
+                expected.m_awaiter
+            };
+            if(advanced(expected.m_message_seqnum, seqnum))
+                break;
+            if(state->m_promise.TryAdvanceState(expected, newstate))
+                break;
+        }
+    }
 
-            struct DequeueState
-            {
-                AwaiterType::promise_type::ControlBlock m_expected;
-                AwaiterType::promise_type&              m_promise;
+    static void Block(const pe::shared_ptr<MailboxDequeueState> state, uint64_t seqnum)
+    {
+        auto expected = state->m_expected;
+        while(true) {
+            control_block_type newstate{
+                TaskState::eSendBlocked,
+                expected.m_message_seqnum,
+                expected.m_unblock_counter,
+                expected.m_notify_counter,
+                expected.m_event_seqnums,
+                expected.m_awaiting_event_mask,
+                expected.m_awaiter
             };
+            if(advanced(expected.m_message_seqnum, seqnum))
+                break;
+            if(state->m_promise.TryAdvanceState(expected, newstate))
+                break;
+            if(expected.m_state == TaskState::eSendBlocked)
+                break;
+        }
+    }
 
-            using queue_type = AwaiterType::message_queue_type;
+    static void Ignore(const pe::shared_ptr<MailboxDequeueState>, uint64_t) {}
+};
 
-            auto task = pe::static_pointer_cast<AwaiterType>(awaiter);
-            auto& promise = task->m_coro->Promise();
-            auto state = promise.PollState();
-            auto dequeue_state = pe::make_shared<DequeueState>(state,
-                task->m_coro->Promise());
+/*
+ * Type-erased access to the mailbox of the receiving task.
+ */
+struct MailboxReceiver
+{
+    pe::weak_ptr<void> m_task;
+    std::size_t      (*m_dequeue)(pe::shared_ptr<void>, std::span<Message>, bool);
+    bool             (*m_cancelled)(pe::shared_ptr<void>);
 
-            std::optional<Message> message;
-            typename queue_type::ProcessingResult result;
-            uint64_t pseqnum;
+    template <typename TaskType>
+    MailboxReceiver(pe::shared_ptr<TaskType> task)
+        : m_task{task}
+        , m_dequeue{+[](pe::shared_ptr<void> ptr, std::span<Message> out, bool block){
+            auto task = pe::static_pointer_cast<TaskType>(ptr);
+            std::size_t count = task->dequeue_messages(out, block);
+            if(block && (count == 0)) {
+                task->WakeIfCancelled();
+            }
+            return count;
+        }}
+        , m_cancelled{+[](pe::shared_ptr<void> ptr){
+            auto task = pe::static_pointer_cast<TaskType>(ptr);
+            return task->Cancelled();
+        }}
+    {}
 
-            auto processor = +[](const pe::shared_ptr<DequeueState> state, 
-                uint64_t seqnum, Message message) {
+    std::size_t Dequeue(std::span<Message> out, bool block) const
+    {
+        auto task = m_task.lock();
+        pe::assert(task != nullptr);
+        return m_dequeue(task, out, block);
+    }
 
-                auto advanced = +[](uint8_t a, uint8_t b) -> bool {
-                    return (static_cast<int8_t>((b) - (a)) < 0);
-                };
+    bool Cancelled() const
+    {
+        auto task = m_task.lock();
+        pe::assert(task != nullptr);
+        return m_cancelled(task);
+    }
+};
 
-                auto expected = state->m_expected;
-                while(true) {
-                    typename AwaiterType::promise_type::ControlBlock newstate{
-                        expected.m_state,
-                        u8(seqnum),
-                        expected.m_unblock_counter,
-                        expected.m_notify_counter,
-                        expected.m_event_seqnums,
-                        expected.m_awaiting_event_mask,
-                        expected.m_awaiter
-                    };
-                    if(advanced(expected.m_message_seqnum, seqnum))
-                        break;
-                    if(state->m_promise.TryAdvanceState(expected, newstate))
-                        break;
-                }
-                return queue_type::ProcessingResult::eDelete;
-            };
-            auto fallback = +[](const pe::shared_ptr<DequeueState> state, uint64_t seqnum) {
+/*****************************************************************************/
+/* RECV AWAITABLE                                                            */
+/*****************************************************************************/
 
-                auto advanced = +[](uint8_t a, uint8_t b) -> bool {
-                    return (static_cast<int8_t>((b) - (a)) < 0);
-                };
+struct RecvAwaitable
+{
+private:
 
-                auto expected = state->m_expected;
-                while(true) {
-                    typename AwaiterType::promise_type::ControlBlock newstate{
-                        TaskState::eSendBlocked,
-                        expected.m_message_seqnum,
-                        expected.m_unblock_counter,
-                        expected.m_notify_counter,
-                        expected.m_event_seqnums,
-                        expected.m_awaiting_event_mask,
-                        expected.m_awaiter
-                    };
-                    if(advanced(expected.m_message_seqnum, seqnum))
-                        break;
-                    if(state->m_promise.TryAdvanceState(expected, newstate))
-                        break;
-                    if(expected.m_state == TaskState::eSendBlocked)
-                        break;
-                }
-            };
-            std::tie(message, result, pseqnum) = task->m_message_queue.ProcessHead(processor,
-                fallback, dequeue_state);
+    Schedulable              m_awaiter;
+    MailboxReceiver          m_receiver;
+    Message                  m_message;
+    bool                     m_cancelled;
 
-            return message;
-        }}
+public:
+
+    template <typename AwaiterType>
+    RecvAwaitable(Schedulable awaiter, pe::shared_ptr<AwaiterType> task)
+        : m_awaiter{awaiter}
+        , m_receiver{task}
+        , m_message{}
+        , m_cancelled{false}
     {}
 
     bool await_ready() noexcept 
     {
-        auto awaiter = m_awaiter_task.lock();
-        pe::assert(awaiter != nullptr);
-
-        if(auto message = m_try_pop_message(awaiter)) {
-            m_message = message.value();
+        /* A cancelled task doesn't block, and leaves its' messages
+         * in the mailbox.
+         */
+        if((m_cancelled = m_receiver.Cancelled())) [[unlikely]]
             return true;
-        }
-        return false;
+        return (m_receiver.Dequeue({&m_message, 1}, false) > 0);
     }
 
     template <typename PromiseType>
     bool await_suspend(std::coroutine_handle<PromiseType> awaiter) noexcept
     {
-        auto receiver = m_awaiter_task.lock();
-        pe::assert(receiver != nullptr);
-
-        if(auto message = m_pop_message_or_block(receiver)) {
-            m_message = message.value();
-            return false;
-        }
-        return true;
+        return (m_receiver.Dequeue({&m_message, 1}, true) == 0);
     }
 
-    Message await_resume() const noexcept
+    Message await_resume()
     {
-        auto awaiter = m_awaiter_task.lock();
-        pe::assert(awaiter != nullptr);
+        if(m_cancelled) [[unlikely]]
+            throw TaskCancelled{};
 
         auto uninitialized = [](pe::weak_ptr<void> const& ptr){
             using wp = pe::weak_ptr<void>;
             return !ptr.owner_before(wp{}) && !wp{}.owner_before(ptr);
         };
+        /* We have been woken up by a sender */
         if(uninitialized(m_message.m_sender)) {
-            return m_try_pop_message(awaiter).value();
+            if(m_receiver.Cancelled()) [[unlikely]]
+                throw TaskCancelled{};
+            std::size_t count = m_receiver.Dequeue({&m_message, 1}, false);
+            pe::assert(count == 1);
         }
         return m_message;
     }
@@ -557,6 +668,65 @@ public:
     }
 };
 
+/*****************************************************************************/
+/* RECV BATCH AWAITABLE                                                      */
+/*****************************************************************************/
+/*
+ * Takes up to 'max' messages from the mailbox in a single dequeue
+ * request, suspending only when the mailbox is empty. The messages 
+ * are received in the same order as by repeated 'Receive' calls.
+ */
+struct RecvBatchAwaitable
+{
+private:
+
+    MailboxReceiver          m_receiver;
+    std::vector<Message>     m_messages;
+    std::size_t              m_count;
+    bool                     m_cancelled;
+
+public:
+
+    template <typename AwaiterType>
+    RecvBatchAwaitable(pe::shared_ptr<AwaiterType> task, std::size_t max)
+        : m_receiver{task}
+        , m_messages(max)
+        , m_count{0}
+        , m_cancelled{false}
+    {}
+
+    bool await_ready() noexcept 
+    {
+        if((m_cancelled = m_receiver.Cancelled())) [[unlikely]]
+            return true;
+        m_count = m_receiver.Dequeue(m_messages, false);
+        return (m_count > 0);
+    }
+
+    template <typename PromiseType>
+    bool await_suspend(std::coroutine_handle<PromiseType> awaiter) noexcept
+    {
+        m_count = m_receiver.Dequeue(m_messages, true);
+        return (m_count == 0);
+    }
+
+    std::vector<Message> await_resume()
+    {
+        if(m_cancelled) [[unlikely]]
+            throw TaskCancelled{};
+
+        /* We have been woken up by a sender */
+        if(m_count == 0) {
+            if(m_receiver.Cancelled()) [[unlikely]]
+                throw TaskCancelled{};
+            m_count = m_receiver.Dequeue(m_messages, false);
+        }
+        pe::assert(m_count > 0);
+        m_messages.resize(m_count);
+        return std::move(m_messages);
+    }
+};
+
 /*****************************************************************************/
 /* TASK PROMISE                                                              */
 /*****************************************************************************/
@@ -636,6 +806,7 @@ private:
     value_type                  m_value;
     std::exception_ptr          m_exception;
     std::vector<std::string>    m_exception_backtrace;
+    bool                        m_cancelled;
     Schedulable                 m_awaiter;
     /* Keep around a shared pointer to the Task instance which has 
      * the 'Run' coroutine method. This way we will prevent 
@@ -673,6 +844,15 @@ public:
     void unhandled_exception()
     {
         m_exception = std::current_exception();
+        try{
+            throw;
+        }catch(const TaskCancelled&) {
+            /* Cancellation is not an error. It is still propagated
+             * to the awaiter, if there is one.
+             */
+            m_cancelled = true;
+            return;
+        }catch(...) {}
         m_exception_backtrace = Backtrace();
     }
 
@@ -681,7 +861,8 @@ public:
         return {
             m_task->Scheduler(),
             Schedulable(),
-            m_task->GetCreateMode()
+            m_task->GetCreateMode(),
+            m_task.get()
         };
     }
 
@@ -720,7 +901,7 @@ public:
         /* We have an awaiter */
         if(state.m_awaiter) {
             AnnotateHappensAfter(__FILE__, __LINE__, &m_state);
-            auto ret = YieldAwaitable{task->Scheduler(), *state.m_awaiter};
+            auto ret = YieldAwaitable{task->Scheduler(), *state.m_awaiter, true};
             m_awaiter = {};
             return ret;
         }
@@ -728,7 +909,7 @@ public:
         /* We terminated due to an unhandled exception but don't 
          * have an awaiter. Propagate the exception to the main thread.
          */
-        if(m_exception) {
+        if(m_exception && !m_cancelled) {
             TaskException exc(std::string{task->Name()}, task->TID(), 
                 m_exception_backtrace, m_exception);
             task->Scheduler().template notify_event<EventType::eUnhandledTaskException>(exc);
@@ -763,6 +944,12 @@ public:
         return value;
     }
 
+    template <YieldIntoAwaitable Awaitable>
+    Awaitable yield_value(Awaitable&& value)
+    {
+        return std::forward<Awaitable>(value);
+    }
+
     template <typename U = ReturnType, std::convertible_to<U> From>
     requires (!std::is_void_v<U>)
     YieldAwaitable yield_value(From&& value)
@@ -800,13 +987,13 @@ public:
         /* We have an awaiter */
         if(state.m_awaiter) {
             AnnotateHappensAfter(__FILE__, __LINE__, &m_state);
-            auto ret = YieldAwaitable{m_task->Scheduler(), *state.m_awaiter};
+            auto ret = YieldAwaitable{m_task->Scheduler(), *state.m_awaiter, true, m_task.get()};
             m_awaiter = {};
             return ret;
         }
 
         /* We have become yield-blocked */
-        return {m_task->m_scheduler, {}};
+        return {m_task->m_scheduler, {}, false, m_task.get()};
     }
 
     template <typename U = ReturnType>
@@ -845,13 +1032,13 @@ public:
         /* We have an awaiter */
         if(state.m_awaiter) {
             AnnotateHappensAfter(__FILE__, __LINE__, &m_state);
-            auto ret = YieldAwaitable{m_task->m_scheduler, *state.m_awaiter};
+            auto ret = YieldAwaitable{m_task->m_scheduler, *state.m_awaiter, true, m_task.get()};
             m_awaiter = {};
             return ret;
         }
 
         /* We have become yield-blocked */
-        return {m_task->m_scheduler, {}};
+        return {m_task->m_scheduler, {}, false, m_task.get()};
     }
 
     template <typename... Args>
@@ -860,6 +1047,7 @@ public:
             0, 0, 0, 0, 0, nullptr}}
         , m_value{}
         , m_exception{}
+        , m_cancelled{false}
         , m_awaiter{}
         , m_task{task.shared_from_this()}
     {
@@ -895,6 +1083,24 @@ public:
         return m_state.Load(std::memory_order_acquire);
     }
 
+    /* Runs the completion of a task which is suspended at a 
+     * cancellation point as if it had unwound from there. Its'
+     * frame is destroyed, together with the locals which are 
+     * still alive, along with the task.
+     */
+    bool CompleteCancelled()
+    {
+        if(PollState().m_state != TaskState::eRunning)
+            return false;
+        m_exception = std::make_exception_ptr(TaskCancelled{});
+        m_cancelled = true;
+        auto next = final_suspend();
+        if(!next.m_schedulable.m_handle.expired()) {
+            next.m_scheduler.enqueue_task(next.m_schedulable);
+        }
+        return true;
+    }
+
     /* This is only called when the task is already suspended */
     void Terminate()
     {
@@ -939,13 +1145,44 @@ class TaskBase
 {
 private:
 
+    struct WaitHook
+    {
+        void (*m_wake)(void*);
+        void  *m_ctx;
+    };
+
     tid_t                                 m_tid;
     std::unique_ptr<char, void(*)(void*)> m_name;
     pe::shared_ptr<TaskBase>              m_parent;
     std::vector<pe::weak_ptr<TaskBase>>   m_children;
+    std::atomic_bool                      m_cancelled;
     std::atomic<Message*>                 m_response;
     void                                (*m_release)(TaskBase*);
     void                                (*m_unblock)(pe::shared_ptr<TaskBase>);
+    void                                (*m_wake_blocked)(TaskBase*);
+    bool                                (*m_drop)(TaskBase*);
+
+    /* Guards the children and the registered wait, which are
+     * walked by a cancellation from arbitrary threads.
+     */
+    std::mutex                            m_wait_lock;
+    WaitHook                              m_wait;
+
+    /* Set while the task is suspended at a point where it would
+     * only unwind if it were resumed cancelled. Written by the task
+     * before it gets queued and read by whoever dequeues it.
+     */
+    mutable bool                          m_cancellation_point;
+
+    /* Links of the root task registry. Only set for tasks which 
+     * were created without a parent.
+     */
+    int32_t                               m_root_shard;
+    TaskBase                             *m_root_prev;
+    TaskBase                             *m_root_next;
+    pe::weak_ptr<TaskBase>                m_root_ref;
+
+    friend class TaskRootRegistry;
 
 protected:
 
@@ -955,6 +1192,7 @@ protected:
         , m_name{Demangle(std::string{typeid(Derived).name()})}
         , m_parent{}
         , m_children{}
+        , m_cancelled{false}
         , m_response{}
         , m_release{+[](TaskBase *base){
             auto *task = static_cast<Derived*>(base);
@@ -962,8 +1200,23 @@ protected:
         }}
         , m_unblock{+[](pe::shared_ptr<TaskBase> base){
             auto task = pe::static_pointer_cast<Derived>(base);
-            task->m_scheduler.enqueue_task(task->Schedulable());
+            task->m_scheduler.wake_task(task->Schedulable());
+        }}
+        , m_wake_blocked{+[](TaskBase *base){
+            auto *task = static_cast<Derived*>(base);
+            task->wake_blocked();
+        }}
+        , m_drop{+[](TaskBase *base){
+            auto *task = static_cast<Derived*>(base);
+            return task->drop();
         }}
+        , m_wait_lock{}
+        , m_wait{}
+        , m_cancellation_point{false}
+        , m_root_shard{-1}
+        , m_root_prev{nullptr}
+        , m_root_next{nullptr}
+        , m_root_ref{}
     {}
 
 public:
@@ -989,6 +1242,7 @@ public:
 
     void AddChild(pe::shared_ptr<TaskBase> child)
     {
+        std::lock_guard<std::mutex> lock{m_wait_lock};
         m_children.push_back(child);
     }
 
@@ -1003,6 +1257,35 @@ public:
         m_release(this);
     }
 
+    /* Request cancellation of this task and all the tasks created 
+     * under it. This is cooperative: the tasks are unwound with a
+     * 'TaskCancelled' exception the next time they are resumed by 
+     * the scheduler or check for it with 'ThrowIfCancelled'. Tasks
+     * which are blocked on an event, a message or one of the sync
+     * primitives are woken up to unwind. IO awaits always wait for
+     * their work to finish, since it may refer to the task's frame.
+     * Queued tasks that have not been resumed since they last hit 
+     * a cancellation point are completed without being resumed.
+     */
+    void Cancel()
+    {
+        m_cancelled.store(true, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wake_cancelled();
+    }
+
+    /* A task is cancelled when it or any of its' ancestors is. The
+     * parent is set once, before the task starts running.
+     */
+    bool Cancelled() const
+    {
+        for(const TaskBase *curr = this; curr; curr = curr->m_parent.get()) {
+            if(curr->m_cancelled.load(std::memory_order_acquire)) [[unlikely]]
+                return true;
+        }
+        return false;
+    }
+
     void SetResponsePtr(Message *msg)
     {
         m_response.store(msg, std::memory_order_release);
@@ -1017,6 +1300,222 @@ public:
     {
         m_unblock(base);
     }
+
+    /* Registers the hook which a cancellation calls to wake up the
+     * task while it is suspended on a sync primitive. Fails if the
+     * task has already been cancelled, in which case it should not
+     * suspend. The hook is called with the lock held, so it can't 
+     * race with 'ClearWait'.
+     */
+    bool RegisterWait(void (*wake)(void*), void *ctx)
+    {
+        std::lock_guard<std::mutex> lock{m_wait_lock};
+        if(Cancelled()) [[unlikely]]
+            return false;
+        m_wait = {wake, ctx};
+        return true;
+    }
+
+    void ClearWait()
+    {
+        std::lock_guard<std::mutex> lock{m_wait_lock};
+        m_wait = {};
+    }
+
+    /* Called after the task has published itself as blocked on an 
+     * event or a message. Pairs with the fence in 'Cancel', so that
+     * either the cancellation sees the task blocked, or the task
+     * sees the cancellation.
+     */
+    void WakeIfCancelled()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(Cancelled()) [[unlikely]]
+            m_wake_blocked(this);
+    }
+
+    void SetCancellationPoint() const
+    {
+        m_cancellation_point = true;
+    }
+
+    void ClearCancellationPoint() const
+    {
+        m_cancellation_point = false;
+    }
+
+    /* Completes a dequeued task as cancelled, instead of resuming
+     * it, if it is cancelled and suspended at a cancellation point.
+     */
+    bool DropIfCancelled()
+    {
+        if(!m_cancellation_point || !Cancelled())
+            return false;
+        return m_drop(this);
+    }
+
+private:
+
+    void wake_cancelled()
+    {
+        std::vector<pe::weak_ptr<TaskBase>> children;
+        {
+            std::lock_guard<std::mutex> lock{m_wait_lock};
+            if(m_wait.m_wake) {
+                auto wait = std::exchange(m_wait, {});
+                wait.m_wake(wait.m_ctx);
+            }
+            children = m_children;
+        }
+        m_wake_blocked(this);
+        for(const auto& child : children) {
+            if(auto task = child.lock()) {
+                task->wake_cancelled();
+            }
+        }
+    }
+};
+
+/*****************************************************************************/
+/* TASK ROOT REGISTRY                                                        */
+/*****************************************************************************/
+/*
+ * Keeps track of the tasks created without a parent, from which
+ * the hierarchy of all live tasks is traversed at shutdown. The
+ * roots are kept in intrusive lists, sharded by the creating 
+ * thread, such that creating and destroying root tasks is O(1) 
+ * and threads which are spawning root tasks don't contend with 
+ * each other. A task is unlinked by its' destructor, which can 
+ * run on any thread.
+ */
+class TaskRootRegistry
+{
+private:
+
+    static constexpr std::size_t kNumShards = 64;
+
+    struct alignas(kCacheLineSize) Shard
+    {
+        std::mutex m_mutex;
+        TaskBase  *m_head{nullptr};
+    };
+
+    std::array<Shard, kNumShards> m_shards;
+
+    static inline std::atomic_uint32_t s_next_shard{0};
+
+    static int32_t thread_shard()
+    {
+        static thread_local int32_t t_shard = static_cast<int32_t>(
+            s_next_shard.fetch_add(1, std::memory_order_relaxed) % kNumShards);
+        return t_shard;
+    }
+
+public:
+
+    void Insert(const pe::shared_ptr<TaskBase>& task)
+    {
+        int32_t idx = thread_shard();
+        task->m_root_shard = idx;
+        task->m_root_ref = task;
+
+        auto& shard = m_shards[idx];
+        std::lock_guard<std::mutex> lock{shard.m_mutex};
+        task->m_root_prev = nullptr;
+        task->m_root_next = shard.m_head;
+        if(shard.m_head) {
+            shard.m_head->m_root_prev = task.get();
+        }
+        shard.m_head = task.get();
+    }
+
+    void Remove(TaskBase& task)
+    {
+        if(task.m_root_shard < 0)
+            return;
+
+        auto& shard = m_shards[task.m_root_shard];
+        std::lock_guard<std::mutex> lock{shard.m_mutex};
+        if(task.m_root_prev) {
+            task.m_root_prev->m_root_next = task.m_root_next;
+        }else{
+            shard.m_head = task.m_root_next;
+        }
+        if(task.m_root_next) {
+            task.m_root_next->m_root_prev = task.m_root_prev;
+        }
+        task.m_root_shard = -1;
+    }
+
+    /* Tasks which are being destroyed are still linked until
+     * their destructor gets to unlink them, but can no longer
+     * be locked and are skipped.
+     */
+    std::vector<pe::shared_ptr<TaskBase>> TakeSnapshot()
+    {
+        std::vector<pe::shared_ptr<TaskBase>> ret;
+        for(auto& shard : m_shards) {
+            std::lock_guard<std::mutex> lock{shard.m_mutex};
+            for(TaskBase *curr = shard.m_head; curr; curr = curr->m_root_next) {
+                if(auto task = curr->m_root_ref.lock()) {
+                    ret.push_back(std::move(task));
+                }
+            }
+        }
+        return ret;
+    }
+};
+
+/*****************************************************************************/
+/* CANCELLATION TOKEN                                                        */
+/*****************************************************************************/
+/*
+ * A handle for checking if a task (or any of its' ancestors) has
+ * been cancelled from outside the task itself, for example from 
+ * a long-running IO callable or from some other non-task code.
+ */
+export
+class CancellationToken
+{
+private:
+
+    pe::shared_ptr<const TaskBase> m_task;
+
+public:
+
+    CancellationToken() = default;
+
+    explicit CancellationToken(pe::shared_ptr<const TaskBase> task)
+        : m_task{task}
+    {}
+
+    bool IsCancelled() const
+    {
+        return m_task && m_task->Cancelled();
+    }
+
+    void ThrowIfCancelled() const
+    {
+        if(IsCancelled()) [[unlikely]]
+            throw TaskCancelled{};
+    }
+};
+
+/*
+ * A cancellation point which does not suspend the task.
+ */
+struct CancellationAwaitable
+{
+    const TaskBase& m_task;
+
+    bool await_ready() const noexcept { return true; }
+    void await_suspend(std::coroutine_handle<>) const noexcept {}
+
+    void await_resume() const
+    {
+        if(m_task.Cancelled()) [[unlikely]]
+            throw TaskCancelled{};
+    }
 };
 
 /* 
@@ -1067,7 +1566,13 @@ private:
     friend struct EventSubscriber;
 
     friend struct SendAwaitable;
-    friend struct RecvAwaitable;
+    friend struct MailboxReceiver;
+
+    /* Takes up to 'std::size(out)' messages from the mailbox, in
+     * a single dequeue request. When 'block' is set and there are 
+     * none, the task is marked as blocked on a sender.
+     */
+    std::size_t dequeue_messages(std::span<Message> out, bool block);
 
     template <EventType Event>
     std::optional<event_arg_t<Event>> next_event();
@@ -1077,6 +1582,17 @@ private:
 
     void release();
 
+    /* Moves the task out of the event-blocked or send-blocked
+     * state and schedules it, so that it can unwind.
+     */
+    void wake_blocked();
+    bool drop();
+
+    uint32_t home() const
+    {
+        return m_coro ? m_coro->Home() : kAnyWorker;
+    }
+
 protected:
 
     /* Uninstantiatable type to prevent constructing 
@@ -1113,14 +1629,23 @@ public:
     Priority    Priority() const      { return m_priority; }
     CreateMode  GetCreateMode() const { return m_create_mode; }
     Affinity    Affinity() const      { return m_affinity; }
-    Schedulable Schedulable() const   { return {m_priority, m_coro, m_affinity}; }
+    Schedulable Schedulable() const   { return {m_priority, m_coro, m_affinity, home()}; }
 
     bool                     Done() const;
     terminate_awaitable_type Terminate();
+    CancellationToken        GetCancellationToken();
+
+    /* Pin a task with a sticky affinity to the worker with the
+     * specified index, in the range [0, Scheduler().NumWorkers()).
+     * Takes effect the next time the task is scheduled.
+     */
+    void SetPreferredWorker(std::size_t index);
 
 protected:
 
     YieldAwaitable Yield(enum Affinity affinity);
+    MaybeYieldAwaitable<Derived> MaybeYield();
+    CancellationAwaitable ThrowIfCancelled();
 
     template <typename TaskType>
     SendAwaitable Send(pe::shared_ptr<TaskType> to, Message message);
@@ -1129,10 +1654,16 @@ protected:
     auto CallToken();
 
     RecvAwaitable Receive();
+    RecvBatchAwaitable ReceiveBatch(std::size_t max);
     void Reply(pe::shared_ptr<TaskBase> to, Message message);
 
     std::optional<Message> PollMessage();
 
+    /* Takes as many messages as will fit into 'out' without 
+     * blocking, returning the number of messages taken.
+     */
+    std::size_t PollMessages(std::span<Message> out);
+
     template <EventType Event>
     void Subscribe();
 
@@ -1310,7 +1841,7 @@ private:
     /* Structures for keeping track of and 
      * traversing a parent-child task hierarchy.
      */
-    LockfreeIterableSet<pe::weak_ptr<TaskBase>>       m_task_roots;
+    TaskRootRegistry                                  m_task_roots;
     TLSAllocation<std::stack<pe::weak_ptr<TaskBase>>> m_task_stacks;
     std::optional<TaskException>                      m_unhandled_exception;
 
@@ -1478,7 +2009,7 @@ private:
     bool has_subscriber(const EventSubscriber sub);
 
     void update_hierarchy(pe::shared_ptr<TaskBase> child);
-    void clear_root(tid_t tid);
+    void clear_root(TaskBase& task);
 
     template <std::invocable<pe::shared_ptr<TaskBase>> Visitor>
     void dfs_helper(pe::shared_ptr<TaskBase> root, Visitor visitor,
@@ -1488,6 +2019,9 @@ private:
     void dfs(Visitor visitor);
 
     void enqueue_task(Schedulable schedulable);
+    void yield_task(Schedulable schedulable);
+    void wake_task(Schedulable schedulable);
+    std::coroutine_handle<> transfer_task(Schedulable schedulable);
     void start_system_tasks();
     void Shutdown(std::optional<TaskException> = std::nullopt);
 
@@ -1514,11 +2048,14 @@ private:
     template <typename PromiseType>
     friend class Coroutine;
 
+    friend struct WaitNode;
     friend class Latch;
     friend class Barrier;
+    friend class WeightedSemaphore;
 
     friend class QuitHandler;
     friend class ExceptionForwarder;
+    friend class MetricsReporter;
 
     friend void PushCurrThreadTask(Scheduler *sched, pe::shared_ptr<TaskBase> task);
     friend void PopCurrThreadTask(Scheduler *sched);
@@ -1527,6 +2064,23 @@ private:
 public:
     Scheduler();
     void Run();
+
+    /* Take a snapshot of the runtime metrics. This is safe to
+     * call from any task. The values are only recorded while
+     * metrics are enabled with 'EnableSchedMetrics'.
+     */
+    MetricsSnapshot Metrics();
+
+    /* Enable the metrics and launch a system task that will
+     * periodically write out a snapshot as a single line of
+     * JSON to the file at 'path', or to stdout if the path
+     * is empty.
+     */
+    void ReportMetrics(std::chrono::milliseconds interval, std::string path = {});
+
+    /* The number of workers, including the main thread's.
+     */
+    std::size_t NumWorkers() const;
 };
 
 /*****************************************************************************/
@@ -1548,9 +2102,22 @@ bool TaskInitialAwaitable::await_ready() const noexcept
     return false;
 }
 
+void TaskInitialAwaitable::await_resume() const
+{
+    /* A task cancelled before it got to run unwinds right away */
+    if(m_task) {
+        m_task->ClearCancellationPoint();
+        if(m_task->Cancelled()) [[unlikely]]
+            throw TaskCancelled{};
+    }
+}
+
 template <typename PromiseType>
 void TaskInitialAwaitable::await_suspend(std::coroutine_handle<PromiseType> coro) const noexcept
 {
+    if(m_task) {
+        m_task->SetCancellationPoint();
+    }
     switch(m_mode) {
     case CreateMode::eLaunchAsync:
         m_scheduler.enqueue_task(m_schedulable);
@@ -1620,7 +2187,7 @@ bool TaskAwaitable<ReturnType, PromiseType>::await_ready()
 
 template <typename ReturnType, typename PromiseType>
 template <typename OtherReturnType, typename OtherTaskType>
-bool TaskAwaitable<ReturnType, PromiseType>::await_suspend(
+std::coroutine_handle<> TaskAwaitable<ReturnType, PromiseType>::await_suspend(
     handle_type<OtherReturnType, OtherTaskType> awaiter_handle)
 {
     auto& promise = m_coro->Promise();
@@ -1636,8 +2203,7 @@ bool TaskAwaitable<ReturnType, PromiseType>::await_suspend(
                 state.m_unblock_counter, state.m_notify_counter,
                 state.m_event_seqnums, state.m_awaiting_event_mask, ptr})) {
 
-                m_scheduler.enqueue_task(promise.Schedulable());
-                return true;
+                return m_scheduler.transfer_task(promise.Schedulable());
             }
             break;
         case TaskState::eYieldBlocked:
@@ -1645,7 +2211,7 @@ bool TaskAwaitable<ReturnType, PromiseType>::await_suspend(
                 {TaskState::eSuspended, state.m_message_seqnum,
                 state.m_unblock_counter, state.m_notify_counter,
                 state.m_event_seqnums, state.m_awaiting_event_mask, nullptr})) {
-                return false;
+                return awaiter_handle;
             }
             break;
         case TaskState::eZombie:
@@ -1653,11 +2219,11 @@ bool TaskAwaitable<ReturnType, PromiseType>::await_suspend(
                 {TaskState::eJoined, state.m_message_seqnum,
                 state.m_unblock_counter, state.m_notify_counter,
                 state.m_event_seqnums, state.m_awaiting_event_mask, nullptr})) {
-                return false;
+                return awaiter_handle;
             }
             break;
         case TaskState::eJoined:
-            return false;
+            return awaiter_handle;
         case TaskState::eEventBlocked:
         case TaskState::eSendBlocked:
         case TaskState::eReceiveBlocked:
@@ -1674,7 +2240,7 @@ bool TaskAwaitable<ReturnType, PromiseType>::await_suspend(
                 state.m_event_seqnums,
                 state.m_awaiting_event_mask, ptr})) {
 
-                return true;
+                return std::noop_coroutine();
             }
             break;
         }
@@ -1733,12 +2299,43 @@ U TaskTerminateAwaitable<ReturnType, PromiseType>::await_resume()
     }
 }
 
-void YieldAwaitable::await_suspend(
+void YieldAwaitable::await_resume() const
+{
+    if(m_task) {
+        m_task->ClearCancellationPoint();
+        if(m_task->Cancelled()) [[unlikely]]
+            throw TaskCancelled{};
+    }
+}
+
+template <typename TaskType>
+void MaybeYieldAwaitable<TaskType>::await_resume() const
+{
+    m_task.ClearCancellationPoint();
+    if(m_task.Cancelled()) [[unlikely]]
+        throw TaskCancelled{};
+}
+
+std::coroutine_handle<> YieldAwaitable::await_suspend(
     std::coroutine_handle<>) const noexcept
 {
-    if(!m_schedulable.m_handle.expired()) {
-        m_scheduler.enqueue_task(m_schedulable);
+    if(m_task) {
+        m_task->SetCancellationPoint();
     }
+    if(m_schedulable.m_handle.expired())
+        return std::noop_coroutine();
+    if(m_transfer)
+        return m_scheduler.transfer_task(m_schedulable);
+    m_scheduler.yield_task(m_schedulable);
+    return std::noop_coroutine();
+}
+
+template <EventType Event>
+event_arg_t<Event> EventAwaitable<Event>::await_resume()
+{
+    if(m_awaiter_base->Cancelled()) [[unlikely]]
+        throw TaskCancelled{};
+    return m_arg.value();
 }
 
 template <EventType Event>
@@ -1803,8 +2400,13 @@ bool EventAwaitable<Event>::await_suspend(
 
             }, enqueue_state, this->shared_from_this());
 
-            if(success)
+            if(success) {
+                /* Don't touch the awaitable from here on, as the
+                 * task may already be getting resumed.
+                 */
+                task->WakeIfCancelled();
                 return true;
+            }
         }
     }
 }
@@ -1860,7 +2462,7 @@ SendAwaitable::SendAwaitable(Scheduler& scheduler, Schedulable awaiter,
                     if(advanced(receiver_expected.m_message_seqnum, seqnum))
                         return true;
                     if(state->m_receiver_promise.TryAdvanceState(receiver_expected, newstate)) {
-                        state->m_scheduler.enqueue_task(state->m_schedulable);
+                        state->m_scheduler.wake_task(state->m_schedulable);
                         return true;
                     }
                 }else{
@@ -1905,7 +2507,7 @@ Task<ReturnType, Derived, Args...>::Task(TaskCreateToken token, class Scheduler&
 template <typename ReturnType, typename Derived, typename... Args>
 Task<ReturnType, Derived, Args...>::~Task()
 {
-    m_scheduler.clear_root(TID());
+    m_scheduler.clear_root(*this);
 }
 
 template <typename ReturnType, typename Derived, typename... Args>
@@ -2027,6 +2629,36 @@ void Task<ReturnType, Derived, Args...>::release()
     m_coro->Promise().Terminate();
 }
 
+template <typename ReturnType, typename Derived, typename... Args>
+void Task<ReturnType, Derived, Args...>::wake_blocked()
+{
+    auto& promise = m_coro->Promise();
+    auto state = promise.PollState();
+    while(true) {
+        bool event_blocked = (state.m_state == TaskState::eEventBlocked);
+        if(!event_blocked && (state.m_state != TaskState::eSendBlocked))
+            return;
+        /* Bumping the unblock counter makes any notification that 
+         * already dequeued the stale event awaitable fail to unblock.
+         */
+        if(promise.TryAdvanceState(state,
+            {TaskState::eRunning, state.m_message_seqnum,
+            u8(state.m_unblock_counter + event_blocked),
+            state.m_notify_counter, state.m_event_seqnums,
+            event_blocked ? u16(0) : state.m_awaiting_event_mask,
+            state.m_awaiter})) {
+            break;
+        }
+    }
+    m_scheduler.wake_task(Schedulable());
+}
+
+template <typename ReturnType, typename Derived, typename... Args>
+bool Task<ReturnType, Derived, Args...>::drop()
+{
+    return m_coro->Promise().CompleteCancelled();
+}
+
 template <typename ReturnType, typename Derived, typename... Args>
 template <typename... ConstructorArgs>
 [[nodiscard]] pe::shared_ptr<Derived> 
@@ -2092,7 +2724,38 @@ Task<ReturnType, Derived, Args...>::Yield(enum Affinity affinity)
     && (affinity != Affinity::eMainThread))
         throw std::runtime_error{
             "Cannot yield with a more relaxed affinity than the task was created with."};
-    return {m_scheduler, {m_priority, m_coro, affinity}};
+    return {m_scheduler, {m_priority, m_coro, affinity, home()}, false, this};
+}
+
+template <typename ReturnType, typename Derived, typename... Args>
+void Task<ReturnType, Derived, Args...>::SetPreferredWorker(std::size_t index)
+{
+    if(m_affinity != Affinity::eSticky)
+        throw std::runtime_error{"Only tasks with a sticky affinity can have a preferred worker."};
+    if(index >= m_scheduler.NumWorkers())
+        throw std::out_of_range{"Worker index out of range."};
+    m_coro->Pin(static_cast<uint32_t>(index));
+}
+
+template <typename ReturnType, typename Derived, typename... Args>
+MaybeYieldAwaitable<Derived>
+Task<ReturnType, Derived, Args...>::MaybeYield()
+{
+    return {static_cast<Derived&>(*this)};
+}
+
+template <typename ReturnType, typename Derived, typename... Args>
+CancellationAwaitable
+Task<ReturnType, Derived, Args...>::ThrowIfCancelled()
+{
+    return {*this};
+}
+
+template <typename ReturnType, typename Derived, typename... Args>
+CancellationToken
+Task<ReturnType, Derived, Args...>::GetCancellationToken()
+{
+    return CancellationToken{pe::static_pointer_cast<const TaskBase>(this->shared_from_this())};
 }
 
 template <typename ReturnType, typename Derived, typename... Args>
@@ -2119,6 +2782,14 @@ RecvAwaitable Task<ReturnType, Derived, Args...>::Receive()
     return RecvAwaitable{Schedulable(), this->shared_from_this()};
 }
 
+template <typename ReturnType, typename Derived, typename... Args>
+RecvBatchAwaitable Task<ReturnType, Derived, Args...>::ReceiveBatch(std::size_t max)
+{
+    if(max == 0)
+        throw std::invalid_argument{"Cannot receive an empty batch of messages."};
+    return RecvBatchAwaitable{this->shared_from_this(), max};
+}
+
 template <typename ReturnType, typename Derived, typename... Args>
 void Task<ReturnType, Derived, Args...>::Reply(pe::shared_ptr<TaskBase> to, Message message)
 {
@@ -2127,49 +2798,60 @@ void Task<ReturnType, Derived, Args...>::Reply(pe::shared_ptr<TaskBase> to, Mess
 }
 
 template <typename ReturnType, typename Derived, typename... Args>
-std::optional<Message> Task<ReturnType, Derived, Args...>::PollMessage()
+std::size_t Task<ReturnType, Derived, Args...>::dequeue_messages(std::span<Message> out, bool block)
 {
-    std::optional<Message> message;
-    typename message_queue_type::ProcessingResult result;
-    uint64_t pseqnum;
+    using state_type = MailboxDequeueState<promise_type>;
 
-    struct ProcessState
-    {
-        promise_type& m_promise;
-    };
+    if(std::empty(out))
+        return 0;
 
-    auto process_state = pe::make_shared<ProcessState>(m_coro->Promise());
-    std::tie(message, result, pseqnum) = m_message_queue.ProcessHead(+[](
-        const pe::shared_ptr<ProcessState> state, uint64_t seqnum, Message message){
+    auto& promise = m_coro->Promise();
+    auto state = pe::make_shared<state_type>(promise.PollState(), promise);
+    auto fallback = block ? &state_type::Block : &state_type::Ignore;
 
-        auto advanced = +[](uint8_t a, uint8_t b) -> bool {
-            return (static_cast<int8_t>((b) - (a)) < 0);
-        };
+    std::size_t count = 0;
+    if(std::size(out) == 1) {
+        auto [message, result, pseqnum] = m_message_queue.ProcessHead(+[](
+            const pe::shared_ptr<state_type> state, uint64_t seqnum, Message){
 
-        auto expected = state->m_promise.PollState();
-        while(true) {
-            typename promise_type::ControlBlock newstate{
-                expected.m_state,
-                u8(seqnum),
-                expected.m_unblock_counter,
-                expected.m_notify_counter,
-                expected.m_event_seqnums,
-                expected.m_awaiting_event_mask,
-                expected.m_awaiter
-            };
-            if(advanced(expected.m_message_seqnum, seqnum))
-                break;
-            if(state->m_promise.TryAdvanceState(expected, newstate))
-                break;
+            state_type::Consume(state, seqnum);
+            return message_queue_type::ProcessingResult::eDelete;
+
+        }, fallback, state);
+
+        if(message.has_value()) {
+            out[0] = std::move(message.value());
+            count = 1;
         }
+    }else{
+        auto [messages, pseqnum] = m_message_queue.ProcessHeadBatch(std::size(out),
+            &state_type::Consume, fallback, state);
 
-        return message_queue_type::ProcessingResult::eDelete;
+        std::move(std::begin(messages), std::end(messages), std::begin(out));
+        count = std::size(messages);
+    }
 
-    }, +[](const pe::shared_ptr<ProcessState> state, uint64_t seqnum){}, process_state);
+    if(count > 0 && MetricsEnabled()) [[unlikely]] {
+        MetricsShard::Increment(GetMetricsShard().m_messages_received, count);
+    }
+    return count;
+}
 
+template <typename ReturnType, typename Derived, typename... Args>
+std::optional<Message> Task<ReturnType, Derived, Args...>::PollMessage()
+{
+    Message message{};
+    if(dequeue_messages({&message, 1}, false) == 0)
+        return std::nullopt;
     return message;
 }
 
+template <typename ReturnType, typename Derived, typename... Args>
+std::size_t Task<ReturnType, Derived, Args...>::PollMessages(std::span<Message> out)
+{
+    return dequeue_messages(out, false);
+}
+
 template <typename ReturnType, typename Derived, typename... Args>
 template <EventType Event>
 void Task<ReturnType, Derived, Args...>::Subscribe()
@@ -2219,6 +2901,9 @@ template <typename ReturnType, typename Derived, typename... Args>
 template <std::invocable Callable>
 IOAwaitable<Callable> Task<ReturnType, Derived, Args...>::IO(Callable callable)
 {
+    /* Don't hand work to the IO pool that nobody will wait for */
+    if(Cancelled()) [[unlikely]]
+        throw TaskCancelled{};
     return IOAwaitable<Callable>{m_scheduler, Schedulable(), &m_scheduler.m_io_pool, callable};
 }
 
@@ -2257,14 +2942,14 @@ void Scheduler::update_hierarchy(pe::shared_ptr<TaskBase> child)
         parent->AddChild(child);
         child->SetParent(parent);
     }else{
-        m_task_roots.Insert(child->TID(), child);
+        m_task_roots.Insert(child);
         child->SetParent(nullptr);
     }
 }
 
-void Scheduler::clear_root(tid_t tid)
+void Scheduler::clear_root(TaskBase& task)
 {
-    m_task_roots.Delete(tid);
+    m_task_roots.Remove(task);
 }
 
 template <std::invocable<pe::shared_ptr<TaskBase>> Visitor>
@@ -2285,22 +2970,55 @@ void Scheduler::dfs_helper(pe::shared_ptr<TaskBase> root, Visitor visitor,
 template <std::invocable<pe::shared_ptr<TaskBase>> Visitor>
 void Scheduler::dfs(Visitor visitor)
 {
-    for(auto weak_root : m_task_roots.TakeSnapshot()) {
-
-        auto root = weak_root.second.lock();
-        if(!root)
-            continue;
-
+    for(auto& root : m_task_roots.TakeSnapshot()) {
         std::unordered_set<tid_t> visited{};
         dfs_helper(root, visitor, visited);
     }
 }
 
+std::size_t Scheduler::NumWorkers() const
+{
+    return m_worker_pool.NumWorkers();
+}
+
 void Scheduler::enqueue_task(Schedulable schedulable)
 {
     m_worker_pool.PushTask(schedulable);
 }
 
+void Scheduler::yield_task(Schedulable schedulable)
+{
+    m_worker_pool.PushYieldedTask(schedulable);
+}
+
+void Scheduler::wake_task(Schedulable schedulable)
+{
+    m_worker_pool.PushNextTask(schedulable);
+}
+
+std::coroutine_handle<> Scheduler::transfer_task(Schedulable schedulable)
+{
+    auto coro = pe::static_pointer_cast<UntypedCoroutine>(schedulable.m_handle.lock());
+    if(!coro)
+        return std::noop_coroutine();
+
+    if(!TryBeginTransfer(schedulable)) {
+        enqueue_task(schedulable);
+        return std::noop_coroutine();
+    }
+
+    /* The task is resumed in place of the current one, so it
+     * replaces it on top of the thread's task stack. This is
+     * popped by whoever pushed the task which started running.
+     */
+    auto& stack = *m_task_stacks.GetThreadSpecific();
+    if(!stack.empty()) {
+        stack.pop();
+        stack.push(coro->m_get_task(coro->m_handle));
+    }
+    return coro->m_handle;
+}
+
 template <EventType Event>
 void Scheduler::notify_event(event_arg_t<Event> arg)
 {
@@ -2319,6 +3037,13 @@ void Scheduler::notify_event(event_arg_t<Event> arg)
         event_variant_t{std::in_place_index_t<event>{}, arg},
         queue, snapshot, *this);
 
+    if(TracingEnabled()) [[unlikely]] {
+        uint64_t before = rdtsc_before();
+        m_notifications.PerformSerially(std::move(request), RestartableRequest::Process);
+        uint64_t after = rdtsc_after();
+        TraceSlice(TraceEventType::eEventNotify, before, after, event);
+        return;
+    }
     m_notifications.PerformSerially(std::move(request), RestartableRequest::Process);
 }
 
@@ -2467,7 +3192,7 @@ Scheduler::EventNotificationRestartableRequest::EventNotificationRestartableRequ
                  * there.
                  */
                 awaitable.SetArg(static_event_cast<Event>(state.m_arg));
-                state.m_scheduler.enqueue_task(awaitable.Awaiter(seqnum));
+                state.m_scheduler.wake_task(awaitable.Awaiter(seqnum));
             }
             return std::optional<std::monostate>{};
         }
@@ -2492,6 +3217,14 @@ void Scheduler::Run()
         throw m_unhandled_exception.value();
 }
 
+MetricsSnapshot Scheduler::Metrics()
+{
+    auto ret = TakeMetricsSnapshot(kNumPriorities);
+    ret.m_io_queue_size = m_io_pool.QueueSize();
+    ret.m_io_busy_threads = m_io_pool.BusyThreads();
+    return ret;
+}
+
 void Scheduler::Shutdown(std::optional<TaskException> exc)
 {
     pe::assert(std::this_thread::get_id() == g_main_thread_id);
@@ -2514,6 +3247,12 @@ void PopCurrThreadTask(Scheduler *sched)
     stack.pop();
 }
 
+export
+bool DropIfCancelled(pe::shared_ptr<TaskBase> task)
+{
+    return task->DropIfCancelled();
+}
+
 export
 void EnqueueTask(Scheduler *sched, Schedulable task)
 {
@@ -25,6 +25,9 @@ import logger;
 import concurrency;
 import meta;
 import platform;
+import sched_trace;
+import sched_metrics;
+import assert;
 
 import <coroutine>;
 import <cstdint>;
@@ -35,9 +38,130 @@ import <thread>;
 import <array>;
 import <tuple>;
 import <memory>;
+import <chrono>;
+import <string>;
+import <utility>;
+import <optional>;
+import <limits>;
+import <algorithm>;
+import <stdexcept>;
 
 namespace pe{
 
+/*****************************************************************************/
+/* WAIT NODE                                                                 */
+/*****************************************************************************/
+/*
+ * The state of a task suspended on one of the sync primitives,
+ * shared by the primitive and by a cancellation of the task. The
+ * one which claims the node first resumes the task: the primitive
+ * to hand it what it was waiting for, or the cancellation to have
+ * it unwind. The node is freed once both the primitive and the 
+ * awaiter are done with it.
+ */
+struct WaitNode
+{
+    Scheduler&           m_scheduler;
+    Schedulable          m_schedulable;
+    TaskBase&            m_task;
+    std::atomic_flag     m_claimed;
+    std::atomic_uint32_t m_refs;
+    bool                 m_cancelled;
+
+    template <typename PromiseType>
+    WaitNode(std::coroutine_handle<PromiseType> awaiter)
+        : m_scheduler{awaiter.promise().Scheduler()}
+        , m_schedulable{awaiter.promise().Schedulable()}
+        , m_task{*awaiter.promise().Task()}
+        , m_claimed{}
+        , m_refs{2}
+        , m_cancelled{false}
+    {}
+
+    WaitNode(WaitNode const&) = delete;
+    WaitNode& operator=(WaitNode const&) = delete;
+
+    virtual ~WaitNode() = default;
+
+    bool Claim()
+    {
+        return !m_claimed.test_and_set(std::memory_order_acq_rel);
+    }
+
+    bool Claimed() const
+    {
+        return m_claimed.test(std::memory_order_acquire);
+    }
+
+    void Wake()
+    {
+        m_scheduler.enqueue_task(m_schedulable);
+    }
+
+    void Unref()
+    {
+        if(m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    /* Registers the node with the awaiting task and hands it over
+     * to the primitive with 'publish', which returns false if there
+     * is no need to wait after all. In that case, 'undo' gives back
+     * whatever was acquired if the task got woken by a cancellation
+     * in the meantime. Returns whether the awaiter must suspend. As
+     * soon as the node is registered, the task can be resumed, so 
+     * the awaitable must not be touched.
+     */
+    template <std::invocable<> Publish, std::invocable<> Undo>
+    bool Suspend(Publish&& publish, Undo&& undo)
+    {
+        if(!m_task.RegisterWait(&WaitNode::wake_cancelled, this)) {
+            m_cancelled = true;
+            Unref();
+            return false;
+        }
+        if(publish())
+            return true;
+        /* The primitive never got the node, so drop its' reference */
+        if(Claim()) {
+            Unref();
+            return false;
+        }
+        undo();
+        Unref();
+        return true;
+    }
+
+    /* Called by the resumed awaiter. Returns whether the wait was
+     * ended by a cancellation.
+     */
+    bool Finish()
+    {
+        m_task.ClearWait();
+        bool cancelled = m_cancelled;
+        Unref();
+        return cancelled;
+    }
+
+protected:
+
+    /* Lets the primitive know that one of its' awaiters is gone */
+    virtual void on_cancelled() {}
+
+private:
+
+    static void wake_cancelled(void *ctx)
+    {
+        auto *node = static_cast<WaitNode*>(ctx);
+        if(!node->Claim())
+            return;
+        node->m_cancelled = true;
+        node->on_cancelled();
+        node->Wake();
+    }
+};
+
 /*****************************************************************************/
 /* LATCH                                                                     */
 /*****************************************************************************/
@@ -47,16 +171,27 @@ class Latch
 {
 private:
 
+    struct Waiter : public WaitNode
+    {
+        std::atomic<Waiter*> m_next;
+
+        template <typename PromiseType>
+        Waiter(std::coroutine_handle<PromiseType> awaiter)
+            : WaitNode{awaiter}
+            , m_next{nullptr}
+        {}
+    };
+
     struct Awaitable
     {
         Latch&                  m_latch;
-        Schedulable             m_schedulable;
-        std::atomic<Awaitable*> m_next;
+        Waiter                 *m_waiter;
+        uint64_t                m_wait_start;
 
         Awaitable(Latch& latch)
             : m_latch{latch}
-            , m_schedulable{}
-            , m_next{nullptr}
+            , m_waiter{nullptr}
+            , m_wait_start{0}
         {}
 
         bool await_ready() const noexcept
@@ -65,20 +200,37 @@ private:
             return (count == 0); 
         }
 
+        /* Waiting doesn't count down the latch, so a cancelled task
+         * can leave without affecting the other waiters.
+         */
         template <typename PromiseType>
         bool await_suspend(std::coroutine_handle<PromiseType> awaiter)
         {
-            m_schedulable = awaiter.promise().Schedulable();
-            return m_latch.try_add_awaiter_safe(*this);
+            auto *waiter = new Waiter{awaiter};
+            m_waiter = waiter;
+            if(TracingEnabled()) [[unlikely]] {
+                m_wait_start = rdtsc_before();
+            }
+            return waiter->Suspend(
+                [&latch = m_latch, waiter]{ return latch.try_add_awaiter_safe(*waiter); },
+                []{}
+            );
         }
 
-        void await_resume() const noexcept {}
+        void await_resume()
+        {
+            if(m_waiter && std::exchange(m_waiter, nullptr)->Finish()) [[unlikely]]
+                throw TaskCancelled{};
+            if(m_wait_start) [[unlikely]] {
+                TraceSlice(TraceEventType::eLatchWait, m_wait_start, rdtsc_after());
+            }
+        }
     };
 
     struct alignas(16) ControlBlock
     {
         uint64_t   m_max;
-        Awaitable *m_awaiters_head;
+        Waiter    *m_awaiters_head;
     };
 
     using AtomicControlBlock = DoubleQuadWordAtomic<ControlBlock>;
@@ -86,24 +238,28 @@ private:
     AtomicControlBlock m_ctrl;
     Scheduler&         m_scheduler;
 
-    bool try_add_awaiter_safe(Awaitable& awaitable)
+    bool try_add_awaiter_safe(Waiter& waiter)
     {
         auto expected = m_ctrl.Load(std::memory_order_relaxed);
         do{
-            awaitable.m_next.store(expected.m_awaiters_head, std::memory_order_release);
+            waiter.m_next.store(expected.m_awaiters_head, std::memory_order_release);
             if(expected.m_max == 0)
                 return false;
-        }while(!m_ctrl.CompareExchange(expected, {expected.m_max, &awaitable},
+        }while(!m_ctrl.CompareExchange(expected, {expected.m_max, &waiter},
             std::memory_order_release, std::memory_order_relaxed));
         return true;
     }
 
-    void wake_awaiters()
+    /* Waiters which have been cancelled are already claimed */
+    void wake_awaiters(Waiter *curr)
     {
-        Awaitable *curr = m_ctrl.Load(std::memory_order_acquire).m_awaiters_head;
         while(curr) {
-            m_scheduler.enqueue_task(curr->m_schedulable);
-            curr = curr->m_next.load(std::memory_order_acquire);
+            Waiter *next = curr->m_next.load(std::memory_order_acquire);
+            if(curr->Claim()) {
+                m_scheduler.enqueue_task(curr->m_schedulable);
+            }
+            curr->Unref();
+            curr = next;
         }
     }
 
@@ -119,6 +275,22 @@ public:
         , m_scheduler{scheduler}
     {}
 
+    /* The waiters of a latch which never opened stay suspended,
+     * but they can still be woken up by a cancellation.
+     */
+    ~Latch()
+    {
+        auto ctrl = m_ctrl.Load(std::memory_order_acquire);
+        if(ctrl.m_max == 0)
+            return;
+        Waiter *curr = ctrl.m_awaiters_head;
+        while(curr) {
+            Waiter *next = curr->m_next.load(std::memory_order_relaxed);
+            curr->Unref();
+            curr = next;
+        }
+    }
+
     void CountDown()
     {
         auto expected = m_ctrl.Load(std::memory_order_relaxed);
@@ -129,7 +301,7 @@ public:
             std::memory_order_release, std::memory_order_relaxed));
 
         if(expected.m_max == 1) {
-            wake_awaiters();
+            wake_awaiters(m_ctrl.Load(std::memory_order_acquire).m_awaiters_head);
         }
     }
 
@@ -160,16 +332,16 @@ class Barrier
 {
 private:
 
-    struct AwaiterNode
+    struct Waiter : public WaitNode
     {
-        std::atomic<AwaiterNode*> m_next;
-        uint16_t                  m_phase;
-        Schedulable               m_schedulable;
+        std::atomic<Waiter*> m_next;
+        uint16_t             m_phase;
 
-        AwaiterNode(uint16_t phase, Schedulable schedulable)
-            : m_next{nullptr}
+        template <typename PromiseType>
+        Waiter(std::coroutine_handle<PromiseType> awaiter, uint16_t phase)
+            : WaitNode{awaiter}
+            , m_next{nullptr}
             , m_phase{phase}
-            , m_schedulable{schedulable}
         {}
     };
 
@@ -177,10 +349,14 @@ private:
     {
         Barrier&                m_barrier;
         uint16_t                m_phase;
+        Waiter                 *m_waiter;
+        uint64_t                m_wait_start;
 
         Awaitable(Barrier& barrier, uint16_t phase)
             : m_barrier{barrier}
             , m_phase{phase}
+            , m_waiter{nullptr}
+            , m_wait_start{0}
         {}
 
         bool await_ready() const noexcept
@@ -189,16 +365,32 @@ private:
             return (read.m_phase != m_phase);
         }
 
+        /* The arrival has already been counted, so a cancelled task
+         * only stops waiting for the phase to complete.
+         */
         template <typename PromiseType>
         bool await_suspend(std::coroutine_handle<PromiseType> awaiter)
         {
-            auto schedulable = awaiter.promise().Schedulable();
-            auto node = std::make_unique<AwaiterNode>(m_phase, schedulable);
+            auto *waiter = new Waiter{awaiter, m_phase};
+            m_waiter = waiter;
             AnnotateHappensBefore(__FILE__, __LINE__, &m_barrier.m_ctrl);
-            return m_barrier.try_add_awaiter_safe(std::move(node));
+            if(TracingEnabled()) [[unlikely]] {
+                m_wait_start = rdtsc_before();
+            }
+            return waiter->Suspend(
+                [&barrier = m_barrier, waiter]{ return barrier.try_add_awaiter_safe(*waiter); },
+                []{}
+            );
         }
 
-        void await_resume() const noexcept {}
+        void await_resume()
+        {
+            if(m_waiter && std::exchange(m_waiter, nullptr)->Finish()) [[unlikely]]
+                throw TaskCancelled{};
+            if(m_wait_start) [[unlikely]] {
+                TraceSlice(TraceEventType::eBarrierWait, m_wait_start, rdtsc_after(), m_phase);
+            }
+        }
     };
 
     struct alignas(16) ControlBlock
@@ -207,7 +399,7 @@ private:
         uint16_t     m_max;
         uint16_t     m_p0_counter;
         uint16_t     m_p1_counter;
-        AwaiterNode *m_awaiters_head;
+        Waiter      *m_awaiters_head;
     };
 
     using AtomicControlBlock = DoubleQuadWordAtomic<ControlBlock>;
@@ -216,19 +408,19 @@ private:
     Scheduler&            m_scheduler;
     std::function<void()> m_completion;
 
-    bool try_add_awaiter_safe(std::unique_ptr<AwaiterNode> awaiter)
+    bool try_add_awaiter_safe(Waiter& waiter)
     {
         ControlBlock next;
         auto expected = m_ctrl.Load(std::memory_order_acquire);
 
         do{
-            awaiter->m_next.store(expected.m_awaiters_head, std::memory_order_release);
+            waiter.m_next.store(expected.m_awaiters_head, std::memory_order_release);
             AnnotateHappensBefore(__FILE__, __LINE__, &m_ctrl);
 
-            if(expected.m_phase != awaiter->m_phase)
+            if(expected.m_phase != waiter.m_phase)
                 return false;
             next = {expected.m_phase, expected.m_max, expected.m_p0_counter, 
-                expected.m_p1_counter, awaiter.get()};
+                expected.m_p1_counter, &waiter};
 
         }while(!m_ctrl.CompareExchange(expected, next,
             std::memory_order_release, std::memory_order_relaxed));
@@ -236,16 +428,19 @@ private:
         /* Another thread will need to 'acquire' the control block
          * to make sure that the writes to 'm_schedulable' are visible.
          */
-        awaiter.release();
         return true;
     }
 
-    void wake_awaiters(AwaiterNode *head)
+    /* Waiters which have been cancelled are already claimed */
+    void wake_awaiters(Waiter *head)
     {
         while(head) {
-            auto node = std::unique_ptr<AwaiterNode>(head);
-            m_scheduler.enqueue_task(node->m_schedulable);
-            head = node->m_next.load(std::memory_order_acquire);
+            Waiter *next = head->m_next.load(std::memory_order_acquire);
+            if(head->Claim()) {
+                m_scheduler.enqueue_task(head->m_schedulable);
+            }
+            head->Unref();
+            head = next;
         }
     }
 
@@ -275,6 +470,19 @@ public:
         , m_completion{}
     {}
 
+    /* The waiters of a phase which never completed stay suspended,
+     * but they can still be woken up by a cancellation.
+     */
+    ~Barrier()
+    {
+        Waiter *curr = m_ctrl.Load(std::memory_order_acquire).m_awaiters_head;
+        while(curr) {
+            Waiter *next = curr->m_next.load(std::memory_order_relaxed);
+            curr->Unref();
+            curr = next;
+        }
+    }
+
     void Arrive()
     {
         auto expected = m_ctrl.Load(std::memory_order_relaxed);
@@ -375,6 +583,743 @@ public:
     }
 };
 
+/*****************************************************************************/
+/* WEIGHTED SEMAPHORE                                                        */
+/*****************************************************************************/
+/*
+ * The common core of the asynchronous mutexes and the semaphore.
+ * Every acquisition takes some number of units of a counted
+ * resource, and an awaiter which cannot get its' units right away
+ * suspends until they are handed over to it by a release.
+ *
+ * Suspending awaiters push their (intrusive) awaitable onto a
+ * lock-free stack in the control block. A release that finds any
+ * awaiters takes on the 'handoff' role, which makes it the only
+ * one allowed to touch the FIFO of queued awaiters. It moves the
+ * pushed awaiters to the back of the FIFO and hands the released
+ * units to awaiters at the front, for as long as there are enough
+ * of them. Releases which run during a handoff just add their
+ * units, leaving them to be distributed by the handoff. New
+ * acquisitions do not barge ahead of queued awaiters. Awaiters 
+ * which get cancelled are dropped from the queue by a handoff,
+ * which the cancellation starts if there is none in progress.
+ */
+class WeightedSemaphore
+{
+private:
+
+    struct Waiter : public WaitNode
+    {
+        WeightedSemaphore& m_semaphore;
+        uint32_t           m_weight;
+        Waiter            *m_next;
+
+        template <typename PromiseType>
+        Waiter(std::coroutine_handle<PromiseType> awaiter, WeightedSemaphore& semaphore, 
+            uint32_t weight)
+            : WaitNode{awaiter}
+            , m_semaphore{semaphore}
+            , m_weight{weight}
+            , m_next{nullptr}
+        {}
+
+        void on_cancelled() override
+        {
+            m_semaphore.prune();
+        }
+    };
+
+public:
+
+    struct Awaitable
+    {
+        WeightedSemaphore& m_semaphore;
+        uint32_t           m_weight;
+        Waiter            *m_waiter;
+
+        Awaitable(WeightedSemaphore& semaphore, uint32_t weight)
+            : m_semaphore{semaphore}
+            , m_weight{weight}
+            , m_waiter{nullptr}
+        {}
+
+        bool await_ready() noexcept
+        {
+            return m_semaphore.TryAcquire(m_weight);
+        }
+
+        /* A cancelled awaiter leaves the queue without taking any
+         * units. If it got the units at the same time, it gives 
+         * them back.
+         */
+        template <typename PromiseType>
+        bool await_suspend(std::coroutine_handle<PromiseType> awaiter)
+        {
+            auto *waiter = new Waiter{awaiter, m_semaphore, m_weight};
+            m_waiter = waiter;
+            return waiter->Suspend(
+                [&semaphore = m_semaphore, waiter]{ return semaphore.acquire_or_push(*waiter); },
+                [&semaphore = m_semaphore, weight = m_weight]{ semaphore.Release(weight); }
+            );
+        }
+
+        void await_resume()
+        {
+            if(m_waiter && std::exchange(m_waiter, nullptr)->Finish()) [[unlikely]]
+                throw TaskCancelled{};
+        }
+    };
+
+private:
+
+    struct alignas(16) ControlBlock
+    {
+        int32_t    m_count;
+        uint16_t   m_queued;
+        uint16_t   m_handoff;
+        Waiter    *m_head;
+    };
+
+    using AtomicControlBlock = DoubleQuadWordAtomic<ControlBlock>;
+
+    AtomicControlBlock m_ctrl;
+    Scheduler&         m_scheduler;
+
+    /* Only touched by the thread performing the handoff */
+    Waiter            *m_queue_head;
+    Waiter            *m_queue_tail;
+
+    /* While a handoff is in progress, the count still includes the
+     * units which are about to be granted to the queued awaiters.
+     */
+    bool can_acquire(const ControlBlock& ctrl, uint32_t weight) const
+    {
+        return (ctrl.m_count >= static_cast<int32_t>(weight))
+            && !ctrl.m_queued
+            && !ctrl.m_handoff
+            && !ctrl.m_head;
+    }
+
+    /* The handoff field holds a non-zero tag while a handoff is in 
+     * progress. Changing it makes the handoff go over the queue
+     * once more before it finishes.
+     */
+    static uint16_t next_handoff_tag(uint16_t tag)
+    {
+        return (tag == std::numeric_limits<uint16_t>::max()) ? uint16_t{1} : static_cast<uint16_t>(tag + 1);
+    }
+
+    bool acquire_or_push(Waiter& waiter)
+    {
+        auto expected = m_ctrl.Load(std::memory_order_relaxed);
+        while(true) {
+            if(can_acquire(expected, waiter.m_weight)) {
+                if(m_ctrl.CompareExchange(expected, {
+                    expected.m_count - static_cast<int32_t>(waiter.m_weight),
+                    expected.m_queued, expected.m_handoff, expected.m_head},
+                    std::memory_order_acquire, std::memory_order_relaxed)) {
+                    return false;
+                }
+                continue;
+            }
+            waiter.m_next = expected.m_head;
+            if(m_ctrl.CompareExchange(expected, {expected.m_count, 
+                expected.m_queued, expected.m_handoff, &waiter},
+                std::memory_order_release, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    void append_to_queue(Waiter *stack)
+    {
+        /* The stack has the most recent awaiter on top */
+        Waiter *reversed = nullptr;
+        Waiter *tail = stack;
+        while(stack) {
+            Waiter *next = stack->m_next;
+            stack->m_next = reversed;
+            reversed = stack;
+            stack = next;
+        }
+        if(!reversed)
+            return;
+        if(m_queue_tail) {
+            m_queue_tail->m_next = reversed;
+        }else{
+            m_queue_head = reversed;
+        }
+        m_queue_tail = tail;
+    }
+
+    Waiter *pop_queue_head()
+    {
+        Waiter *ret = m_queue_head;
+        m_queue_head = ret->m_next;
+        if(!m_queue_head) {
+            m_queue_tail = nullptr;
+        }
+        ret->m_next = nullptr;
+        return ret;
+    }
+
+    void handoff(ControlBlock expected, Waiter *stack)
+    {
+        int32_t granted = 0;
+        Waiter *woken_head = nullptr;
+        Waiter *woken_tail = nullptr;
+
+        while(true) {
+            append_to_queue(stack);
+            stack = nullptr;
+
+            /* Awaiters which got cancelled are claimed already, and 
+             * are dropped when they get to the front of the queue.
+             */
+            while(m_queue_head) {
+                Waiter *front = m_queue_head;
+                bool fits = (expected.m_count - granted >= static_cast<int32_t>(front->m_weight));
+                if(!fits && !front->Claimed())
+                    break;
+                pop_queue_head();
+                if(!fits || !front->Claim()) {
+                    front->Unref();
+                    continue;
+                }
+                granted += front->m_weight;
+                if(woken_tail) {
+                    woken_tail->m_next = front;
+                }else{
+                    woken_head = front;
+                }
+                woken_tail = front;
+            }
+
+            if(expected.m_head) {
+                /* More awaiters arrived in the meantime. Take them. */
+                Waiter *head = expected.m_head;
+                if(m_ctrl.CompareExchange(expected, {expected.m_count,
+                    expected.m_queued, expected.m_handoff, nullptr},
+                    std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    stack = head;
+                    expected.m_head = nullptr;
+                }
+                continue;
+            }
+
+            ControlBlock next{expected.m_count - granted, 
+                static_cast<uint16_t>(m_queue_head != nullptr), 0, nullptr};
+            if(m_ctrl.CompareExchange(expected, next,
+                std::memory_order_acq_rel, std::memory_order_acquire)) {
+                break;
+            }
+        }
+
+        /* The awaiters own their units now. The nodes are kept 
+         * alive by our reference until they have been woken up.
+         */
+        while(woken_head) {
+            Waiter *next = woken_head->m_next;
+            m_scheduler.enqueue_task(woken_head->m_schedulable);
+            woken_head->Unref();
+            woken_head = next;
+        }
+    }
+
+    /* Called when one of the awaiters got cancelled, so that the
+     * awaiters queued behind it don't keep waiting on its' account.
+     */
+    void prune()
+    {
+        auto expected = m_ctrl.Load(std::memory_order_relaxed);
+        while(true) {
+            if(expected.m_handoff) {
+                if(m_ctrl.CompareExchange(expected, {expected.m_count, expected.m_queued,
+                    next_handoff_tag(expected.m_handoff), expected.m_head},
+                    std::memory_order_release, std::memory_order_relaxed)) {
+                    return;
+                }
+                continue;
+            }
+            if(!expected.m_queued && !expected.m_head)
+                return;
+            Waiter *stack = expected.m_head;
+            ControlBlock next{expected.m_count, expected.m_queued, 1, nullptr};
+            if(m_ctrl.CompareExchange(expected, next,
+                std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                handoff(next, stack);
+                return;
+            }
+        }
+    }
+
+public:
+
+    WeightedSemaphore(WeightedSemaphore&&) = delete;
+    WeightedSemaphore(WeightedSemaphore const&) = delete;
+    WeightedSemaphore& operator=(WeightedSemaphore&&) = delete;
+    WeightedSemaphore& operator=(WeightedSemaphore const&) = delete;
+
+    WeightedSemaphore(Scheduler& scheduler, int32_t count)
+        : m_ctrl{ControlBlock{count, 0, 0, nullptr}}
+        , m_scheduler{scheduler}
+        , m_queue_head{nullptr}
+        , m_queue_tail{nullptr}
+    {}
+
+    ~WeightedSemaphore()
+    {
+        [[maybe_unused]] auto ctrl = m_ctrl.Load(std::memory_order_relaxed);
+        pe::assert(!ctrl.m_head && !ctrl.m_queued);
+    }
+
+    bool TryAcquire(uint32_t weight)
+    {
+        auto expected = m_ctrl.Load(std::memory_order_relaxed);
+        while(can_acquire(expected, weight)) {
+            if(m_ctrl.CompareExchange(expected, {
+                expected.m_count - static_cast<int32_t>(weight),
+                expected.m_queued, expected.m_handoff, expected.m_head},
+                std::memory_order_acquire, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* Takes as many of the available units as it can, up to
+     * 'max', without waiting. Returns the number of units taken.
+     */
+    uint32_t TryAcquireUpTo(uint32_t max)
+    {
+        auto expected = m_ctrl.Load(std::memory_order_relaxed);
+        while(max && can_acquire(expected, 1)) {
+            int32_t taken = std::min(expected.m_count, static_cast<int32_t>(max));
+            if(m_ctrl.CompareExchange(expected, {expected.m_count - taken,
+                expected.m_queued, expected.m_handoff, expected.m_head},
+                std::memory_order_acquire, std::memory_order_relaxed)) {
+                return static_cast<uint32_t>(taken);
+            }
+        }
+        return 0;
+    }
+
+    Awaitable Acquire(uint32_t weight)
+    {
+        return {*this, weight};
+    }
+
+    void Release(uint32_t weight)
+    {
+        auto expected = m_ctrl.Load(std::memory_order_relaxed);
+        while(true) {
+            int32_t count = expected.m_count + static_cast<int32_t>(weight);
+            if(expected.m_handoff || (!expected.m_queued && !expected.m_head)) {
+                if(m_ctrl.CompareExchange(expected, {count, expected.m_queued,
+                    expected.m_handoff, expected.m_head},
+                    std::memory_order_release, std::memory_order_relaxed)) {
+                    return;
+                }
+                continue;
+            }
+            Waiter *stack = expected.m_head;
+            ControlBlock next{count, expected.m_queued, 1, nullptr};
+            if(m_ctrl.CompareExchange(expected, next,
+                std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                handoff(next, stack);
+                return;
+            }
+        }
+    }
+};
+
+/*****************************************************************************/
+/* ASYNC MUTEX                                                               */
+/*****************************************************************************/
+/*
+ * A mutex which suspends the awaiting task, rather than blocking
+ * the worker thread, until the lock is handed over to it:
+ *
+ *     co_await mutex.Lock();
+ *     ...
+ *     mutex.Unlock();
+ *
+ * or, to unlock when leaving the scope:
+ *
+ *     auto lock = co_await mutex.ScopedLock();
+ */
+export
+class AsyncMutex
+{
+private:
+
+    WeightedSemaphore m_semaphore;
+
+public:
+
+    class LockGuard
+    {
+    private:
+
+        AsyncMutex *m_mutex;
+
+    public:
+
+        explicit LockGuard(AsyncMutex& mutex)
+            : m_mutex{&mutex}
+        {}
+
+        LockGuard(LockGuard const&) = delete;
+        LockGuard& operator=(LockGuard const&) = delete;
+
+        LockGuard(LockGuard&& other) noexcept
+            : m_mutex{std::exchange(other.m_mutex, nullptr)}
+        {}
+
+        ~LockGuard()
+        {
+            if(m_mutex) {
+                m_mutex->Unlock();
+            }
+        }
+    };
+
+    struct ScopedAwaitable : public WeightedSemaphore::Awaitable
+    {
+        AsyncMutex& m_mutex;
+
+        ScopedAwaitable(AsyncMutex& mutex)
+            : WeightedSemaphore::Awaitable{mutex.m_semaphore, 1}
+            , m_mutex{mutex}
+        {}
+
+        LockGuard await_resume()
+        {
+            WeightedSemaphore::Awaitable::await_resume();
+            return LockGuard{m_mutex};
+        }
+    };
+
+    explicit AsyncMutex(Scheduler& scheduler)
+        : m_semaphore{scheduler, 1}
+    {}
+
+    bool TryLock()
+    {
+        return m_semaphore.TryAcquire(1);
+    }
+
+    WeightedSemaphore::Awaitable Lock()
+    {
+        return m_semaphore.Acquire(1);
+    }
+
+    ScopedAwaitable ScopedLock()
+    {
+        return {*this};
+    }
+
+    void Unlock()
+    {
+        m_semaphore.Release(1);
+    }
+};
+
+/*****************************************************************************/
+/* ASYNC SHARED MUTEX                                                        */
+/*****************************************************************************/
+/*
+ * A readers-writer lock with the same suspension semantics as
+ * AsyncMutex. The awaiters are served in order, so a writer is
+ * not starved by a steady stream of readers.
+ */
+export
+class AsyncSharedMutex
+{
+private:
+
+    static constexpr uint32_t kMaxSharedOwners = uint32_t{1} << 24;
+
+    WeightedSemaphore m_semaphore;
+
+public:
+
+    explicit AsyncSharedMutex(Scheduler& scheduler)
+        : m_semaphore{scheduler, kMaxSharedOwners}
+    {}
+
+    bool TryLock()
+    {
+        return m_semaphore.TryAcquire(kMaxSharedOwners);
+    }
+
+    WeightedSemaphore::Awaitable Lock()
+    {
+        return m_semaphore.Acquire(kMaxSharedOwners);
+    }
+
+    void Unlock()
+    {
+        m_semaphore.Release(kMaxSharedOwners);
+    }
+
+    bool TryLockShared()
+    {
+        return m_semaphore.TryAcquire(1);
+    }
+
+    WeightedSemaphore::Awaitable LockShared()
+    {
+        return m_semaphore.Acquire(1);
+    }
+
+    void UnlockShared()
+    {
+        m_semaphore.Release(1);
+    }
+};
+
+/*****************************************************************************/
+/* ASYNC SEMAPHORE                                                           */
+/*****************************************************************************/
+
+export
+class AsyncSemaphore
+{
+private:
+
+    WeightedSemaphore m_semaphore;
+
+public:
+
+    explicit AsyncSemaphore(Scheduler& scheduler, uint32_t count)
+        : m_semaphore{scheduler, static_cast<int32_t>(count)}
+    {}
+
+    bool TryAcquire()
+    {
+        return m_semaphore.TryAcquire(1);
+    }
+
+    WeightedSemaphore::Awaitable Acquire()
+    {
+        return m_semaphore.Acquire(1);
+    }
+
+    void Release(uint32_t count = 1)
+    {
+        m_semaphore.Release(count);
+    }
+};
+
+/*****************************************************************************/
+/* STREAM                                                                    */
+/*****************************************************************************/
+/*
+ * A bounded single-producer, single-consumer channel of values
+ * between two tasks. Unlike yielding values to an awaiter, which
+ * hands over every value with a scheduler round trip, the producer
+ * only suspends when the buffer is full and the consumer only when
+ * it is empty, letting the two run concurrently:
+ *
+ *     co_yield stream.Push(value);       // or co_await
+ *     ...
+ *     stream.Close();
+ *
+ * and on the consuming side:
+ *
+ *     while(auto value = co_await stream.Next()) { ... }
+ *
+ * or, taking all the available values (up to a limit) at once:
+ *
+ *     auto batch = co_await stream.NextBatch(64);
+ *
+ * Next and NextBatch return an empty optional or vector once
+ * the stream is closed and all values have been consumed.
+ *
+ * The ring buffer indices are each owned by one side, and the
+ * free slots and the ready values are counted by a pair of 
+ * semaphores, which also provide the required ordering.
+ */
+export
+template <typename T>
+class Stream
+{
+private:
+
+    static constexpr uint64_t kOpen = std::numeric_limits<uint64_t>::max();
+
+    std::vector<std::optional<T>>        m_buffer;
+    WeightedSemaphore                    m_slots;
+    WeightedSemaphore                    m_values;
+    alignas(kCacheLineSize) uint64_t     m_write_idx;
+    alignas(kCacheLineSize) uint64_t     m_read_idx;
+    std::atomic<uint64_t>                m_closed_at;
+
+    static uint32_t checked_capacity(uint32_t capacity)
+    {
+        if(capacity == 0 || capacity > static_cast<uint32_t>(std::numeric_limits<int32_t>::max()))
+            throw std::invalid_argument{"Invalid stream capacity."};
+        return capacity;
+    }
+
+    std::optional<T>& slot(uint64_t idx)
+    {
+        return m_buffer[idx % m_buffer.size()];
+    }
+
+    void push_acquired(T&& value)
+    {
+        slot(m_write_idx++).emplace(std::move(value));
+        m_values.Release(1);
+    }
+
+    /* Consumes the values for 'nunits' acquired units. Once the 
+     * stream is closed, there is one more unit than there are 
+     * values, which is given back so that later reads also see 
+     * the end of the stream.
+     */
+    template <typename Sink>
+    void pop_acquired(uint32_t nunits, Sink&& sink)
+    {
+        uint64_t closed_at = m_closed_at.load(std::memory_order_acquire);
+        uint32_t nread = 0;
+        while(nread < nunits) {
+            if(m_read_idx == closed_at) {
+                m_values.Release(nunits - nread);
+                break;
+            }
+            auto& next = slot(m_read_idx++);
+            sink(std::move(*next));
+            next.reset();
+            nread++;
+        }
+        if(nread) {
+            m_slots.Release(nread);
+        }
+    }
+
+    struct PushAwaitable : public WeightedSemaphore::Awaitable
+    {
+        using yield_into_tag = void;
+
+        Stream& m_stream;
+        T       m_value;
+
+        PushAwaitable(Stream& stream, T&& value)
+            : WeightedSemaphore::Awaitable{stream.m_slots, 1}
+            , m_stream{stream}
+            , m_value{std::move(value)}
+        {}
+
+        void await_resume()
+        {
+            WeightedSemaphore::Awaitable::await_resume();
+            m_stream.push_acquired(std::move(m_value));
+        }
+    };
+
+    struct NextAwaitable : public WeightedSemaphore::Awaitable
+    {
+        Stream& m_stream;
+
+        NextAwaitable(Stream& stream)
+            : WeightedSemaphore::Awaitable{stream.m_values, 1}
+            , m_stream{stream}
+        {}
+
+        std::optional<T> await_resume()
+        {
+            WeightedSemaphore::Awaitable::await_resume();
+            std::optional<T> ret{};
+            m_stream.pop_acquired(1, [&ret](T&& value){
+                ret.emplace(std::move(value));
+            });
+            return ret;
+        }
+    };
+
+    struct BatchAwaitable : public WeightedSemaphore::Awaitable
+    {
+        Stream&  m_stream;
+        uint32_t m_max;
+
+        BatchAwaitable(Stream& stream, uint32_t max)
+            : WeightedSemaphore::Awaitable{stream.m_values, 1}
+            , m_stream{stream}
+            , m_max{max}
+        {}
+
+        std::vector<T> await_resume()
+        {
+            WeightedSemaphore::Awaitable::await_resume();
+            uint32_t nunits = 1 + m_stream.m_values.TryAcquireUpTo(m_max - 1);
+            std::vector<T> ret{};
+            ret.reserve(nunits);
+            m_stream.pop_acquired(nunits, [&ret](T&& value){
+                ret.push_back(std::move(value));
+            });
+            return ret;
+        }
+    };
+
+public:
+
+    Stream(Scheduler& scheduler, uint32_t capacity)
+        : m_buffer(checked_capacity(capacity))
+        , m_slots{scheduler, static_cast<int32_t>(capacity)}
+        , m_values{scheduler, 0}
+        , m_write_idx{0}
+        , m_read_idx{0}
+        , m_closed_at{kOpen}
+    {}
+
+    /* Suspends the producer until there is a free slot for the value */
+    PushAwaitable Push(T value)
+    {
+        return {*this, std::move(value)};
+    }
+
+    /* Moves out of 'value' only when there is a free slot */
+    bool TryPush(T& value)
+    {
+        if(!m_slots.TryAcquire(1))
+            return false;
+        push_acquired(std::move(value));
+        return true;
+    }
+
+    /* Called by the producer after the last value has been pushed */
+    void Close()
+    {
+        if(m_closed_at.load(std::memory_order_relaxed) != kOpen)
+            throw std::runtime_error{"Close on closed stream."};
+        m_closed_at.store(m_write_idx, std::memory_order_release);
+        m_values.Release(1);
+    }
+
+    /* Suspends the consumer until there is a value to take */
+    NextAwaitable Next()
+    {
+        return {*this};
+    }
+
+    /* Suspends the consumer until there is at least one value to
+     * take, and then takes all the ready values, up to 'max'.
+     */
+    BatchAwaitable NextBatch(uint32_t max)
+    {
+        if(max == 0)
+            throw std::invalid_argument{"Empty stream batch."};
+        return {*this, max};
+    }
+
+    uint32_t Capacity() const
+    {
+        return static_cast<uint32_t>(m_buffer.size());
+    }
+};
+
 /*****************************************************************************/
 /* SCHEDULER                                                                 */
 /*****************************************************************************/
@@ -388,5 +1333,12 @@ void Scheduler::start_system_tasks()
         CreateMode::eLaunchSync, Affinity::eMainThread);
 }
 
+void Scheduler::ReportMetrics(std::chrono::milliseconds interval, std::string path)
+{
+    EnableSchedMetrics();
+    std::ignore = MetricsReporter::Create(*this, Priority::eLow,
+        CreateMode::eLaunchAsync, Affinity::eAny, interval, path);
+}
+
 }; //namespace pe
 
@@ -20,11 +20,20 @@
 export module sync:system_tasks;
 
 import :scheduler;
+import :io_pool;
 import logger;
 import event;
+import sched_metrics;
 
 import <stdexcept>;
 import <optional>;
+import <chrono>;
+import <string>;
+import <sstream>;
+import <fstream>;
+import <iostream>;
+import <thread>;
+import <algorithm>;
 
 namespace pe{
 
@@ -88,5 +97,63 @@ public:
     }
 };
 
+export
+class MetricsReporter : public Task<void, MetricsReporter, std::chrono::milliseconds, std::string>
+{
+private:
+
+    using base = Task<void, MetricsReporter, std::chrono::milliseconds, std::string>;
+    using base::base;
+
+    static constexpr std::chrono::milliseconds kQuitPollInterval{10};
+
+    /* Sleeps in short steps, so that the IO thread is given 
+     * back promptly once the scheduler starts shutting down.
+     * Returns false if the sleep was cut short.
+     */
+    static bool sleep_unless_quitting(const IOPool& pool, std::chrono::milliseconds interval)
+    {
+        auto deadline = std::chrono::steady_clock::now() + interval;
+        while(!pool.Quitting()) {
+            auto now = std::chrono::steady_clock::now();
+            if(now >= deadline)
+                return true;
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+                deadline - now, kQuitPollInterval));
+        }
+        return false;
+    }
+
+    virtual MetricsReporter::handle_type Run(std::chrono::milliseconds interval, std::string path)
+    {
+        std::ofstream file;
+        if(!path.empty()) {
+            file.open(path, std::ios::out | std::ios::trunc);
+            if(!file)
+                throw std::runtime_error{"Failed to open metrics file: " + path};
+        }
+        std::ostream& out = path.empty() ? std::cout : file;
+        const IOPool& pool = Scheduler().m_io_pool;
+
+        while(true) {
+            bool slept = co_await IO([&pool, interval]{ 
+                return sleep_unless_quitting(pool, interval); 
+            });
+            if(!slept)
+                co_return;
+
+            std::ostringstream line;
+            Scheduler().Metrics().WriteJSON(line);
+            line << "\n";
+
+            /* Keep the blocking write off the worker threads */
+            co_await IO([&out, str = line.str()]{
+                out << str;
+                out.flush();
+            });
+        }
+    }
+};
+
 } // namespace pe
 
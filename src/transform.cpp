@@ -0,0 +1,349 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+export module transform;
+
+import ecs;
+import sync;
+import nmatrix;
+import flat_hash_map;
+
+import <cstdint>;
+import <vector>;
+import <limits>;
+import <thread>;
+import <algorithm>;
+import <stdexcept>;
+
+/* Propagation of local transforms down an entity hierarchy.
+ * The hierarchy is flattened in breadth-first order, such
+ * that every depth level is a contiguous range of nodes
+ * whose parents all belong to the previous level. The levels
+ * are then processed one after another, with the nodes of a
+ * single level being split into batches that are processed
+ * in parallel by the worker pool. Nodes with an unchanged
+ * local transform whose parent has not changed either are
+ * skipped, so that only the dirty subtrees are recomputed.
+ */
+
+namespace pe{
+
+/*****************************************************************************/
+/* COMPONENTS                                                                */
+/*****************************************************************************/
+
+export
+struct Transform
+{
+    Mat4f m_local{Mat4f::Identity()};
+    Mat4f m_world{Mat4f::Identity()};
+    bool  m_dirty{true};
+
+    void SetLocal(const Mat4f& local)
+    {
+        m_local = local;
+        m_dirty = true;
+    }
+};
+
+export
+struct Parent
+{
+    static constexpr entity_t kNone = std::numeric_limits<entity_t>::max();
+
+    entity_t m_id{kNone};
+};
+
+/*****************************************************************************/
+/* TRANSFORM HIERARCHY                                                       */
+/*****************************************************************************/
+/*
+ * The flattened hierarchy of all entities in the world having
+ * a Transform component. An entity without a Parent component,
+ * or one whose parent is Parent::kNone, is a root. The cached
+ * layout is rebuilt whenever entities are added to or removed
+ * from the world, but changing the Parent component of an
+ * existing entity requires an explicit call to Invalidate().
+ */
+
+export
+template <typename World = pe::World<>>
+class PropagateTransforms;
+
+template <typename World>
+class PropagateTransformsBatch;
+
+export
+template <typename World = pe::World<>>
+class TransformHierarchy
+{
+private:
+
+    static constexpr uint32_t kNoParent = std::numeric_limits<uint32_t>::max();
+
+    std::vector<Transform*>  m_nodes;
+    std::vector<uint32_t>    m_parents;
+    std::vector<std::size_t> m_level_offsets;
+    std::vector<Mat4f>       m_world;
+    std::vector<uint8_t>     m_changed;
+    uint64_t                 m_generation;
+    bool                     m_valid;
+    bool                     m_full_update;
+
+    template <typename OtherWorld>
+    friend class PropagateTransforms;
+
+    template <typename OtherWorld>
+    friend class PropagateTransformsBatch;
+
+    void rebuild();
+    void refresh();
+    void propagate(std::size_t begin, std::size_t end);
+
+public:
+
+    TransformHierarchy();
+
+    void        Invalidate() { m_valid = false; }
+    std::size_t Size() const { return m_nodes.size(); }
+    std::size_t Depth() const { return m_level_offsets.size() - 1; }
+
+    /* Propagate the transforms on the calling thread. Use the
+     * PropagateTransforms task to spread the work across the
+     * worker pool.
+     */
+    void Update();
+};
+
+/*****************************************************************************/
+/* PROPAGATE TRANSFORMS                                                      */
+/*****************************************************************************/
+
+template <typename World>
+class PropagateTransformsBatch : public Task<void, PropagateTransformsBatch<World>,
+                                            TransformHierarchy<World>&, std::size_t, std::size_t>
+{
+    using base = Task<void, PropagateTransformsBatch<World>,
+                      TransformHierarchy<World>&, std::size_t, std::size_t>;
+    using base::base;
+
+    /* Number of nodes propagated between checks of the worker's
+     * execution budget.
+     */
+    static constexpr std::size_t kNodesPerSlice = 4096;
+
+    virtual base::handle_type Run(TransformHierarchy<World>& hierarchy,
+        std::size_t begin, std::size_t end)
+    {
+        while(begin < end) {
+            std::size_t slice_end = std::min(begin + kNodesPerSlice, end);
+            hierarchy.propagate(begin, slice_end);
+            begin = slice_end;
+            co_await this->MaybeYield();
+        }
+        co_return;
+    }
+};
+
+export
+template <typename World>
+class PropagateTransforms : public Task<void, PropagateTransforms<World>,
+                                       TransformHierarchy<World>&>
+{
+    using base = Task<void, PropagateTransforms<World>, TransformHierarchy<World>&>;
+    using base::base;
+
+    /* Levels smaller than this are not worth splitting up.
+     */
+    static constexpr std::size_t kMinBatchSize = 2048;
+
+    virtual base::handle_type Run(TransformHierarchy<World>& hierarchy)
+    {
+        hierarchy.refresh();
+
+        std::size_t nthreads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<pe::shared_ptr<PropagateTransformsBatch<World>>> batches;
+
+        for(std::size_t level = 0; level < hierarchy.Depth(); level++) {
+
+            std::size_t begin = hierarchy.m_level_offsets[level];
+            std::size_t end = hierarchy.m_level_offsets[level + 1];
+            std::size_t batch_size = std::max(kMinBatchSize,
+                (end - begin + nthreads - 1) / nthreads);
+
+            /* Hand off all but the last batch to the workers
+             * and process the last one on this task.
+             */
+            batches.clear();
+            while(end - begin > batch_size) {
+                batches.push_back(PropagateTransformsBatch<World>::Create(
+                    this->Scheduler(), this->Priority(), pe::CreateMode::eLaunchAsync,
+                    pe::Affinity::eAny, hierarchy, begin, begin + batch_size));
+                begin += batch_size;
+            }
+            hierarchy.propagate(begin, end);
+
+            /* The next level reads the world transforms of this one */
+            for(auto& batch : batches) {
+                co_await batch;
+            }
+        }
+        hierarchy.m_full_update = false;
+        co_return;
+    }
+};
+
+/*****************************************************************************/
+/* MODULE IMPLEMENTATION                                                     */
+/*****************************************************************************/
+
+template <typename World>
+TransformHierarchy<World>::TransformHierarchy()
+    : m_nodes{}
+    , m_parents{}
+    , m_level_offsets{0}
+    , m_world{}
+    , m_changed{}
+    , m_generation{}
+    , m_valid{false}
+    , m_full_update{true}
+{}
+
+template <typename World>
+void TransformHierarchy<World>::rebuild()
+{
+    FlatHashMap<entity_t, uint32_t> index{};
+    std::vector<Transform*> nodes{};
+    for(auto [eid, transform] : components_view<World, Transform>()) {
+        index[eid] = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(&transform);
+    }
+    const std::size_t nnodes = nodes.size();
+
+    std::vector<uint32_t> parents(nnodes, kNoParent);
+    for(auto [eid, parent] : components_view<World, Parent>()) {
+        if(!index.contains(eid) || (parent.m_id == Parent::kNone))
+            continue;
+        if(!index.contains(parent.m_id))
+            throw std::logic_error{"The parent entity has no Transform component."};
+        parents[index[eid]] = index[parent.m_id];
+    }
+
+    /* Group the children of every node together...
+     */
+    std::vector<uint32_t> first_child(nnodes + 1, 0);
+    for(std::size_t i = 0; i < nnodes; i++) {
+        if(parents[i] != kNoParent)
+            first_child[parents[i] + 1]++;
+    }
+    for(std::size_t i = 0; i < nnodes; i++) {
+        first_child[i + 1] += first_child[i];
+    }
+    std::vector<uint32_t> children(first_child[nnodes]);
+    std::vector<uint32_t> cursor(first_child.begin(), first_child.end() - 1);
+    for(std::size_t i = 0; i < nnodes; i++) {
+        if(parents[i] != kNoParent)
+            children[cursor[parents[i]]++] = static_cast<uint32_t>(i);
+    }
+
+    /* ...and lay the nodes out level by level, starting from
+     * the roots. Siblings end up adjacent to one another and
+     * in the same order as their parents.
+     */
+    std::vector<uint32_t> order{};
+    order.reserve(nnodes);
+    for(std::size_t i = 0; i < nnodes; i++) {
+        if(parents[i] == kNoParent)
+            order.push_back(static_cast<uint32_t>(i));
+    }
+    m_level_offsets.assign(1, 0);
+    std::size_t level_begin = 0;
+    while(level_begin < order.size()) {
+        std::size_t level_end = order.size();
+        m_level_offsets.push_back(level_end);
+        for(std::size_t i = level_begin; i < level_end; i++) {
+            uint32_t node = order[i];
+            order.insert(order.end(), children.begin() + first_child[node],
+                children.begin() + first_child[node + 1]);
+        }
+        level_begin = level_end;
+    }
+    if(order.size() != nnodes)
+        throw std::logic_error{"The transform hierarchy contains a cycle."};
+
+    std::vector<uint32_t> position(nnodes);
+    m_nodes.resize(nnodes);
+    m_parents.resize(nnodes);
+    for(std::size_t i = 0; i < nnodes; i++) {
+        uint32_t node = order[i];
+        position[node] = static_cast<uint32_t>(i);
+        m_nodes[i] = nodes[node];
+        m_parents[i] = (parents[node] == kNoParent) ? kNoParent : position[parents[node]];
+    }
+
+    m_world.resize(nnodes);
+    m_changed.assign(nnodes, 0);
+    m_full_update = true;
+}
+
+template <typename World>
+void TransformHierarchy<World>::refresh()
+{
+    uint64_t generation = World::Generation();
+    if(m_valid && (generation == m_generation))
+        return;
+    rebuild();
+    m_generation = generation;
+    m_valid = true;
+}
+
+template <typename World>
+void TransformHierarchy<World>::propagate(std::size_t begin, std::size_t end)
+{
+    for(std::size_t i = begin; i < end; i++) {
+
+        Transform& node = *m_nodes[i];
+        uint32_t parent = m_parents[i];
+        bool changed = m_full_update || node.m_dirty
+                    || ((parent != kNoParent) && m_changed[parent]);
+        m_changed[i] = changed;
+        if(!changed)
+            continue;
+
+        if(parent == kNoParent) {
+            m_world[i] = node.m_local;
+        }else{
+            m_world[i] = m_world[parent] * node.m_local;
+        }
+        node.m_world = m_world[i];
+        node.m_dirty = false;
+    }
+}
+
+template <typename World>
+void TransformHierarchy<World>::Update()
+{
+    refresh();
+    for(std::size_t level = 0; level < Depth(); level++) {
+        propagate(m_level_offsets[level], m_level_offsets[level + 1]);
+    }
+    m_full_update = false;
+}
+
+} // namespace pe
@@ -20,7 +20,7 @@
 export module sync:worker_pool;
 
 import tls;
-import lockfree_deque;
+import chase_lev_deque;
 import lockfree_queue;
 import shared_ptr;
 import assert;
@@ -28,6 +28,8 @@ import atomic_bitset;
 import platform;
 import logger;
 import concurrency;
+import sched_trace;
+import sched_metrics;
 
 import <coroutine>;
 import <optional>;
@@ -35,6 +37,10 @@ import <array>;
 import <string>;
 import <thread>;
 import <vector>;
+import <atomic>;
+import <chrono>;
+import <limits>;
+import <type_traits>;
 
 namespace pe{
 
@@ -47,6 +53,7 @@ export class TaskBase;
 export class Scheduler;
 export void PushCurrThreadTask(Scheduler *sched, pe::shared_ptr<TaskBase> task);
 export void PopCurrThreadTask(Scheduler *sched);
+export bool DropIfCancelled(pe::shared_ptr<TaskBase> task);
 
 /*****************************************************************************/
 /* PRIORITY                                                                  */
@@ -65,6 +72,8 @@ enum class Priority
 
 constexpr std::size_t kNumPriorities = static_cast<std::size_t>(Priority::eNumPriorities);
 
+static_assert(kNumPriorities <= kMetricsMaxPriorities);
+
 /*****************************************************************************/
 /* AFFINITY                                                                  */
 /*****************************************************************************/
@@ -74,19 +83,166 @@ enum class Affinity
 {
     eAny,
     eMainThread,
+    /* Prefer the worker which has last run the task */
+    eSticky,
 };
 
+/*
+ * A task with a sticky affinity has a 'home' worker: the one that
+ * has last run it, or the one it was explicitly pinned to. It is 
+ * routed to a per-priority queue owned by its' home worker, which 
+ * is not visible to regular stealing, so that a long-lived task 
+ * owning a large working set does not drag it between the caches 
+ * of different cores. A thief can only take a task from such a queue 
+ * when the home worker has not polled for work for longer than 
+ * 'kStickyStealDelay' (it is asleep, or stuck in a long slice), or 
+ * when it has more than 'kMaxStickyBacklog' sticky tasks of the 
+ * same priority queued up. The thief then becomes the task's new 
+ * home, unless it is pinned. Workers are indexed from 0 (the main 
+ * thread's) to the number of worker threads.
+ */
+constexpr uint32_t kAnyWorker = std::numeric_limits<uint32_t>::max();
+constexpr int32_t kMaxStickyBacklog = 16;
+constexpr std::chrono::microseconds kStickyStealDelay{200};
+
+inline thread_local uint32_t t_worker_index = kAnyWorker;
+
 /*****************************************************************************/
 /* SCHEDULABLE                                                               */
 /*****************************************************************************/
 
 struct Schedulable
 {
+    /* Apart from plain values, only holds a weak_ptr, which 
+     * refers to its' control block through a bare pointer. It
+     * can thus be stored directly in the slots of the deques.
+     */
+    using trivially_relocatable = std::true_type;
+
     Priority           m_priority;
     pe::weak_ptr<void> m_handle;
     Affinity           m_affinity;
+    /* Only used with a sticky affinity */
+    uint32_t           m_home{kAnyWorker};
+    /* Only set when scheduler metrics are enabled */
+    uint64_t           m_enqueue_tsc{};
 };
 
+/*****************************************************************************/
+/* SYMMETRIC TRANSFER                                                        */
+/*****************************************************************************/
+/*
+ * A task which suspends to hand off control to another task that
+ * can run on the current thread right away (an awaited child, or
+ * the awaiter of a yielding or returning task), resumes it directly
+ * by returning its' handle from 'await_suspend', instead of making
+ * a round trip through the ready queue. The number of consecutive
+ * hand-offs per resume by a worker is bounded, such that two tasks
+ * ping-ponging between each other will eventually go through the
+ * ready queue and not starve other tasks.
+ */
+constexpr uint32_t kMaxTransferDepth = 32;
+
+inline thread_local uint32_t t_transfer_depth = 0;
+
+bool TryBeginTransfer(const Schedulable& task)
+{
+    if(t_transfer_depth >= kMaxTransferDepth)
+        return false;
+    if((task.m_affinity == Affinity::eMainThread)
+    && (std::this_thread::get_id() != g_main_thread_id))
+        return false;
+    if((task.m_affinity == Affinity::eSticky)
+    && (task.m_home != kAnyWorker)
+    && (task.m_home != t_worker_index))
+        return false;
+    t_transfer_depth++;
+    return true;
+}
+
+/*****************************************************************************/
+/* NEXT TASK SLOT                                                            */
+/*****************************************************************************/
+/*
+ * A task woken up by a message or an event is placed in a single
+ * LIFO slot of the waking worker, such that it runs next, on the
+ * core which has just produced its' input. A task which is woken
+ * while the slot is occupied displaces the old one into the ready
+ * queue. The owner runs at most 'kMaxNextTaskStreak' tasks from
+ * the slot in a row before going back to its' ready queue, so that
+ * two tasks ping-ponging via the slot cannot starve the queue. The
+ * slot can only be stolen once a task has sat in it for at least
+ * 'kNextTaskStealDelay'.
+ */
+constexpr uint32_t kMaxNextTaskStreak = 16;
+constexpr std::chrono::microseconds kNextTaskStealDelay{20};
+
+/* The slot points into a small set of nodes owned by the worker,
+ * so that no allocation is made per wakeup. A node is in use from
+ * the time the owner fills it in until the thread which claimed it
+ * from the slot has copied the task out. Only the owner fills in
+ * nodes, and should they all be in use, the woken task goes to the
+ * ready queue instead.
+ */
+constexpr std::size_t kNumNextTaskNodes = 4;
+
+struct NextTaskNode
+{
+    Schedulable      m_task{};
+    std::atomic_bool m_free{true};
+};
+
+/*****************************************************************************/
+/* YIELD QUEUE                                                               */
+/*****************************************************************************/
+/*
+ * The owner pops its' deque in LIFO order, so a task yielding back 
+ * onto it would be the very next one to run, starving any other 
+ * tasks of the same priority. Instead, yielded tasks are put at the
+ * back of a per-priority FIFO queue, which is only consulted once
+ * the deque runs dry, or after 'kMaxYieldBypass' tasks were taken 
+ * from the deque while it was non-empty. Thieves can take tasks 
+ * from it like from the deque.
+ */
+constexpr uint32_t kMaxYieldBypass = 16;
+
+/*****************************************************************************/
+/* EXECUTION BUDGET                                                          */
+/*****************************************************************************/
+/*
+ * Every time a worker resumes a task, it gets an execution budget.
+ * A long-running task can give up its' worker at a cheap check 
+ * point (the task's 'MaybeYield') once the budget is exhausted, or 
+ * right away if a task of a higher priority is waiting in the
+ * worker's own queue, where it could otherwise only be picked up
+ * by stealing. Tasks handed off by symmetric transfer share the
+ * budget of the resume they were transferred from.
+ */
+constexpr std::chrono::microseconds kResumeBudget{500};
+
+/* Used when the TSC frequency is not reported by CPUID */
+constexpr uint64_t kFallbackTSCFreqMHz = 2'000;
+
+inline thread_local uint64_t t_resume_start_tsc = 0;
+
+inline uint64_t tsc_cycles_per_us()
+{
+    static const uint64_t s_freq_mhz = []{
+        uint64_t freq_mhz = tscfreq_mhz();
+        if(freq_mhz == 0)
+            freq_mhz = kFallbackTSCFreqMHz;
+        return freq_mhz;
+    }();
+    return s_freq_mhz;
+}
+
+inline uint64_t resume_budget_cycles()
+{
+    return tsc_cycles_per_us() * kResumeBudget.count();
+}
+
+bool ShouldYield(Priority priority);
+
 /*****************************************************************************/
 /* COROUTINE                                                                 */
 /*****************************************************************************/
@@ -100,8 +256,11 @@ private:
 
     std::coroutine_handle<PromiseType> m_handle;
     std::string                        m_name;
+    int                                m_type_id;
     Scheduler                         *m_scheduler;
     pe::shared_ptr<TaskBase>         (*m_get_task)(std::coroutine_handle<void>);
+    std::atomic<uint32_t>              m_home{kAnyWorker};
+    std::atomic_bool                   m_pinned{false};
 
     friend class Scheduler;
     friend class Worker;
@@ -111,11 +270,20 @@ private:
         m_handle.resume();
     }
 
+    void SetLastWorker(uint32_t worker)
+    {
+        if(m_pinned.load(std::memory_order_relaxed))
+            return;
+        if(m_home.load(std::memory_order_relaxed) != worker)
+            m_home.store(worker, std::memory_order_relaxed);
+    }
+
 public:
 
     Coroutine(std::coroutine_handle<PromiseType> handle, std::string name)
         : m_handle{handle}
         , m_name{name}
+        , m_type_id{-1}
         , m_scheduler{&handle.promise().Scheduler()}
         , m_get_task{+[](std::coroutine_handle<> handle){
             auto coro = std::coroutine_handle<PromiseType>::from_address(handle.address());
@@ -134,6 +302,7 @@ public:
             m_handle.destroy();
         std::swap(m_handle, other.m_handle);
         std::swap(m_name, other.m_name);
+        std::swap(m_type_id, other.m_type_id);
     }
 
     Coroutine& operator=(Coroutine&& other) noexcept
@@ -144,6 +313,7 @@ public:
             m_handle.destroy();
         std::swap(m_handle, other.m_handle);
         std::swap(m_name, other.m_name);
+        std::swap(m_type_id, other.m_type_id);
         return *this;
     }
 
@@ -166,6 +336,17 @@ public:
         return m_name;
     }
 
+    uint32_t Home() const
+    {
+        return m_home.load(std::memory_order_relaxed);
+    }
+
+    void Pin(uint32_t worker)
+    {
+        m_pinned.store(true, std::memory_order_relaxed);
+        m_home.store(worker, std::memory_order_relaxed);
+    }
+
     void PushCurrThreadTask()
     {
         pe::PushCurrThreadTask(m_scheduler, m_get_task(m_handle));
@@ -175,6 +356,15 @@ public:
     {
         pe::PopCurrThreadTask(m_scheduler);
     }
+
+    /* A task which has been cancelled while it was queued at a
+     * cancellation point is completed without being resumed.
+     */
+    bool DropIfCancelled()
+    {
+        auto task = m_get_task(m_handle);
+        return task && pe::DropIfCancelled(task);
+    }
 };
 
 using UntypedCoroutine = Coroutine<void>;
@@ -198,20 +388,105 @@ private:
      * those priorities for which we only have tasks that have
      * an affinity for the current worker's thread. 
      */
-    std::array<LockfreeDeque<Schedulable>, kNumPriorities> m_tasks;
+    std::array<ChaseLevDeque<Schedulable>, kNumPriorities> m_tasks;
     AtomicBitset                                           m_available;
     AtomicBitset                                           m_stealable;
     WorkerPool&                                            m_pool;
+    pe::shared_ptr<MetricsShard>                           m_metrics;
+
+    /* The task in the slot is kept in one of the nodes, so that it
+     * can be claimed with a single exchange by either the owner or
+     * a thief.
+     */
+    std::array<NextTaskNode, kNumNextTaskNodes>            m_next_nodes;
+    std::atomic<NextTaskNode*>                             m_next;
+    std::atomic<std::chrono::steady_clock::rep>            m_next_time;
+    uint32_t                                               m_next_streak;
+
+    /* Tasks with a sticky affinity for this worker. These can be
+     * pushed from any thread, so they are kept out of the deques.
+     */
+    uint32_t                                               m_index;
+    std::array<LockfreeQueue<Schedulable>, kNumPriorities> m_sticky;
+    std::array<std::atomic<int32_t>, kNumPriorities>       m_sticky_depth;
+    std::atomic<uint64_t>                                  m_last_poll_tsc;
+
+    /* Tasks which have yielded on this worker */
+    std::array<LockfreeQueue<Schedulable>, kNumPriorities> m_yielded;
+    std::array<std::atomic<int32_t>, kNumPriorities>       m_yielded_depth;
+    std::array<uint32_t, kNumPriorities>                   m_yield_bypass;
 
     void quit();
 
+    static std::optional<Schedulable> take_queued(LockfreeQueue<Schedulable>& queue,
+        std::atomic<int32_t>& depth)
+    {
+        /* Don't touch the queue's head when there is nothing to take */
+        if(depth.load(std::memory_order_relaxed) <= 0)
+            return std::nullopt;
+        auto ret = queue.Dequeue();
+        if(ret.has_value()) {
+            depth.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return ret;
+    }
+
+    std::optional<Schedulable> take_sticky(std::size_t prio)
+    {
+        return take_queued(m_sticky[prio], m_sticky_depth[prio]);
+    }
+
+    std::optional<Schedulable> take_yielded(std::size_t prio)
+    {
+        return take_queued(m_yielded[prio], m_yielded_depth[prio]);
+    }
+
+    std::optional<Schedulable> take_unsticky(std::size_t prio)
+    {
+        if(m_yielded_depth[prio].load(std::memory_order_relaxed) <= 0) {
+            m_yield_bypass[prio] = 0;
+            return m_tasks[prio].Pop();
+        }
+        if(m_yield_bypass[prio] < kMaxYieldBypass) {
+            if(auto ret = m_tasks[prio].Pop()) {
+                m_yield_bypass[prio]++;
+                return ret;
+            }
+        }
+        m_yield_bypass[prio] = 0;
+        if(auto ret = take_yielded(prio))
+            return ret;
+        return m_tasks[prio].Pop();
+    }
+
+    void resume_instrumented(const Schedulable& task, UntypedCoroutine& coro);
+
+    static Schedulable take_next(NextTaskNode *node)
+    {
+        Schedulable ret{std::move(node->m_task)};
+        node->m_free.store(true, std::memory_order_release);
+        return ret;
+    }
+
 public:
 
-    Worker(WorkerPool& pool)
+    Worker(WorkerPool& pool, uint32_t index = kAnyWorker)
         : m_tasks{}
         , m_available{kNumPriorities}
         , m_stealable{kNumPriorities}
         , m_pool{pool}
+        , m_metrics{GetMetricsShardPtr()}
+        , m_next_nodes{}
+        , m_next{nullptr}
+        , m_next_time{0}
+        , m_next_streak{0}
+        , m_index{index}
+        , m_sticky{}
+        , m_sticky_depth{}
+        , m_last_poll_tsc{0}
+        , m_yielded{}
+        , m_yielded_depth{}
+        , m_yield_bypass{}
     {}
 
     bool ClaimsHasStealableTaskWithPriority(Priority prio)
@@ -249,13 +524,50 @@ public:
         return m_available.FindFirstSet();
     }
 
+    bool HasTaskWithHigherPriority(Priority priority)
+    {
+        auto highest = FindHighestAvailablePriority();
+        if(!highest.has_value())
+            return false;
+        return (kNumPriorities - 1 - highest.value()) > static_cast<std::size_t>(priority);
+    }
+
+    uint32_t Index() const
+    {
+        return m_index;
+    }
+
     std::optional<Schedulable> TryPop(Priority priority)
     {
         std::size_t prio = static_cast<std::size_t>(priority);
-        auto ret = m_tasks[prio].PopLeft();
+        /* Sticky tasks can only be run by us, so take them
+         * first and leave the stealable ones to the thieves.
+         */
+        auto ret = take_sticky(prio);
+        if(!ret.has_value()) {
+            ret = take_unsticky(prio);
+            if(!ret.has_value()) {
+                ClearHasStealableTaskWithPriority(priority);
+            }
+        }
         if(!ret.has_value()) {
-            ClearHasStealableTaskWithPriority(priority);
             ClearHasTaskWithPriority(priority);
+            /* A sticky task could have been pushed by another thread
+             * right before we cleared the bit, in which case it must
+             * be set again. Yielded tasks are only pushed by us, but
+             * a thief may have failed to take the last one.
+             */
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(m_sticky_depth[prio].load(std::memory_order_seq_cst) > 0) {
+                SetHasTaskWithPriority(priority);
+            }
+            if(m_yielded_depth[prio].load(std::memory_order_seq_cst) > 0) {
+                SetHasTaskWithPriority(priority);
+                SetHasStealableTaskWithPriority(priority);
+            }
+        }else if(MetricsEnabled()) [[unlikely]] {
+            m_metrics->m_queue_depth[prio].fetch_sub(1, std::memory_order_relaxed);
+            MetricsShard::Increment(m_metrics->m_pops);
         }
         return ret;
     }
@@ -267,10 +579,133 @@ public:
          * thread.
          */
         std::size_t prio = static_cast<std::size_t>(priority);
-        return m_tasks[prio].PopRight();
+        auto ret = m_tasks[prio].Steal();
+        if(!ret.has_value()) {
+            ret = take_yielded(prio);
+        }
+        if(MetricsEnabled()) [[unlikely]] {
+            /* The steal is accounted to the shard of the thief */
+            auto& thief = GetMetricsShard();
+            if(ret.has_value()) {
+                m_metrics->m_queue_depth[prio].fetch_sub(1, std::memory_order_relaxed);
+                MetricsShard::Increment(thief.m_steals);
+            }else{
+                MetricsShard::Increment(thief.m_failed_steals);
+            }
+        }
+        return ret;
+    }
+
+    /* Returns the task that was displaced from the slot, if any.
+     * Must only be called by the owner.
+     */
+    std::optional<Schedulable> PushNextTask(Schedulable task)
+    {
+        NextTaskNode *node = nullptr;
+        for(auto& candidate : m_next_nodes) {
+            if(candidate.m_free.load(std::memory_order_acquire)) {
+                node = &candidate;
+                break;
+            }
+        }
+        if(!node) [[unlikely]]
+            return task;
+
+        node->m_free.store(false, std::memory_order_relaxed);
+        node->m_task = task;
+
+        auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+        m_next_time.store(now, std::memory_order_relaxed);
+
+        NextTaskNode *prev = m_next.exchange(node, std::memory_order_acq_rel);
+        if(!prev)
+            return std::nullopt;
+        return take_next(prev);
+    }
+
+    /* When 'fair' is set, a long enough streak of tasks taken
+     * from the slot makes the owner look at its' queue first.
+     */
+    std::optional<Schedulable> TryPopNext(bool fair)
+    {
+        if(fair && (m_next_streak >= kMaxNextTaskStreak)) {
+            m_next_streak = 0;
+            return std::nullopt;
+        }
+        NextTaskNode *next = m_next.exchange(nullptr, std::memory_order_acq_rel);
+        if(!next) {
+            m_next_streak = 0;
+            return std::nullopt;
+        }
+        m_next_streak++;
+        return take_next(next);
+    }
+
+    std::optional<Schedulable> TryStealNext()
+    {
+        if(!m_next.load(std::memory_order_relaxed))
+            return std::nullopt;
+
+        using namespace std::chrono;
+        auto now = steady_clock::now().time_since_epoch().count();
+        auto delay = duration_cast<steady_clock::duration>(kNextTaskStealDelay).count();
+        if(now - m_next_time.load(std::memory_order_relaxed) < delay)
+            return std::nullopt;
+
+        NextTaskNode *next = m_next.exchange(nullptr, std::memory_order_acq_rel);
+        if(!next)
+            return std::nullopt;
+
+        if(MetricsEnabled()) [[unlikely]] {
+            MetricsShard::Increment(GetMetricsShard().m_steals);
+        }
+        return take_next(next);
+    }
+
+    /* Safe to call from any thread */
+    void PushStickyTask(Schedulable task)
+    {
+        std::size_t prio = static_cast<std::size_t>(task.m_priority);
+        m_sticky[prio].Enqueue(task);
+        m_sticky_depth[prio].fetch_add(1, std::memory_order_seq_cst);
+
+        if(MetricsEnabled()) [[unlikely]] {
+            m_metrics->m_queue_depth[prio].fetch_add(1, std::memory_order_relaxed);
+        }
+        SetHasTaskWithPriority(task.m_priority);
+    }
+
+    bool ClaimsHasStealableStickyTaskWithPriority(Priority priority, uint64_t now_tsc) const
+    {
+        std::size_t prio = static_cast<std::size_t>(priority);
+        int32_t depth = m_sticky_depth[prio].load(std::memory_order_relaxed);
+        if(depth <= 0)
+            return false;
+        if(depth > kMaxStickyBacklog)
+            return true;
+        uint64_t last_poll = m_last_poll_tsc.load(std::memory_order_relaxed);
+        return (now_tsc > last_poll)
+            && (now_tsc - last_poll >= tsc_cycles_per_us() * kStickyStealDelay.count());
+    }
+
+    std::optional<Schedulable> TryStealSticky(Priority priority)
+    {
+        std::size_t prio = static_cast<std::size_t>(priority);
+        auto ret = take_sticky(prio);
+        if(MetricsEnabled()) [[unlikely]] {
+            auto& thief = GetMetricsShard();
+            if(ret.has_value()) {
+                m_metrics->m_queue_depth[prio].fetch_sub(1, std::memory_order_relaxed);
+                MetricsShard::Increment(thief.m_steals);
+            }else{
+                MetricsShard::Increment(thief.m_failed_steals);
+            }
+        }
+        return ret;
     }
 
     void PushTask(Schedulable task);
+    void PushYieldedTask(Schedulable task);
     void Work();
 };
 
@@ -279,13 +714,18 @@ class WorkerPool
 {
 private:
 
-    TLSAllocation<Worker>      m_workers;
-    pe::shared_ptr<Worker>     m_main_worker;
-    LockfreeQueue<Schedulable> m_main_tasks;
-    std::vector<std::thread>   m_worker_threads;
-    AtomicBitset               m_priorities;
-    std::atomic_flag           m_quit;
-    std::atomic_uint           m_num_exited;
+    TLSAllocation<Worker>               m_workers;
+    pe::shared_ptr<Worker>              m_main_worker;
+    LockfreeQueue<Schedulable>          m_main_tasks;
+    std::vector<std::thread>            m_worker_threads;
+    AtomicBitset                        m_priorities;
+    std::atomic_flag                    m_quit;
+    std::atomic_uint                    m_num_exited;
+    /* Filled in before the constructor returns and
+     * immutable afterwards.
+     */
+    std::vector<pe::shared_ptr<Worker>> m_indexed_workers;
+    std::atomic_uint                    m_num_started;
 
     using WorkerSet = std::vector<std::reference_wrapper<Worker>>;
 
@@ -319,19 +759,41 @@ public:
 
     WorkerPool(std::size_t num_workers)
         : m_workers{AllocTLS<Worker>()}
-        , m_main_worker{m_workers.GetThreadSpecific(*this)}
+        , m_main_worker{m_workers.GetThreadSpecific(*this, uint32_t{0})}
         , m_main_tasks{}
         , m_worker_threads{}
         , m_priorities{kNumPriorities}
         , m_quit{}
+        , m_indexed_workers(num_workers + 1)
+        , m_num_started{0}
     {
+        m_indexed_workers[0] = m_main_worker;
         for(int i = 0; i < num_workers; i++){
-            auto workfn = [this]() {
-                m_workers.GetThreadSpecific(*this)->Work();
+            auto workfn = [this, i, num_workers]() {
+                uint32_t index = static_cast<uint32_t>(i + 1);
+                auto worker = m_workers.GetThreadSpecific(*this, index);
+                m_indexed_workers[index] = worker;
+                /* Don't look for sticky tasks to steal before 
+                 * all the workers are registered.
+                 */
+                m_num_started.fetch_add(1, std::memory_order_release);
+                while(m_num_started.load(std::memory_order_acquire) < num_workers) {
+                    std::this_thread::yield();
+                }
+                worker->Work();
             };
             m_worker_threads.emplace_back(workfn);
             SetThreadName(m_worker_threads[i], "worker-" + std::to_string(i));
         }
+        while(m_num_started.load(std::memory_order_acquire) < num_workers) {
+            std::this_thread::yield();
+        }
+    }
+
+    /* Including the main thread's worker */
+    std::size_t NumWorkers() const
+    {
+        return std::size(m_indexed_workers);
     }
 
     bool IsMainWorker(const Worker *worker) const
@@ -352,7 +814,43 @@ public:
         }
     }
 
-    std::optional<Schedulable> FindTask()
+private:
+
+    std::optional<Schedulable> steal_next_task()
+    {
+        auto self = m_workers.GetThreadSpecific(*this);
+        for(const auto& worker : m_workers.GetThreadPtrsSnapshot()) {
+            if(worker == self)
+                continue;
+            if(auto task = worker->TryStealNext())
+                return task;
+        }
+        return std::nullopt;
+    }
+
+    std::optional<Schedulable> steal_sticky_task()
+    {
+        auto self = m_workers.GetThreadSpecific(*this);
+        uint64_t now = rdtsc_before();
+        for(std::size_t prio_bit = 0; prio_bit < kNumPriorities; prio_bit++) {
+            Priority priority = static_cast<Priority>(kNumPriorities - 1 - prio_bit);
+            for(const auto& worker : m_indexed_workers) {
+                if(worker == self)
+                    continue;
+                if(!worker->ClaimsHasStealableStickyTaskWithPriority(priority, now))
+                    continue;
+                if(auto task = worker->TryStealSticky(priority)) {
+                    if(TracingEnabled()) [[unlikely]] {
+                        TraceInstant(TraceEventType::eSteal, static_cast<uint64_t>(priority));
+                    }
+                    return task;
+                }
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::optional<Schedulable> find_queued_task()
     {
         /* Exhaustively search local and global pools, attempting steals */
         auto first_set = next_available_prio();
@@ -375,6 +873,10 @@ public:
                 if(!stolen_task.has_value())
                     continue;
 
+                if(TracingEnabled()) [[unlikely]] {
+                    TraceInstant(TraceEventType::eSteal, static_cast<uint64_t>(priority));
+                }
+
                 /* Try to find the first available task that doesn't have
                  * an affinity for the specific thread. 
                  */
@@ -414,19 +916,90 @@ public:
         return std::nullopt;
     }
 
+public:
+
+    std::optional<Schedulable> FindTask()
+    {
+        auto& self = *m_workers.GetThreadSpecific(*this);
+        if(auto task = self.TryPopNext(true))
+            return task;
+        if(auto task = find_queued_task())
+            return task;
+        if(auto task = self.TryPopNext(false))
+            return task;
+        if(auto task = steal_next_task())
+            return task;
+        return steal_sticky_task();
+    }
+
     void PushTask(Schedulable task)
     {
         Priority priority = task.m_priority;
         std::size_t priority_bit = kNumPriorities - 1 - static_cast<std::size_t>(priority);
 
+        if(MetricsEnabled()) [[unlikely]] {
+            task.m_enqueue_tsc = rdtsc_before();
+        }
+
         if(task.m_affinity == Affinity::eMainThread) {
             PushMainTask(task);
+        }else if((task.m_affinity == Affinity::eSticky)
+              && (task.m_home < std::size(m_indexed_workers))) {
+            m_indexed_workers[task.m_home]->PushStickyTask(task);
         }else{
             m_workers.GetThreadSpecific(*this)->PushTask(task);
             m_priorities.Set(priority_bit);
         }
     }
 
+    /* Puts the task behind the other ready tasks of its' priority 
+     * on the current worker.
+     */
+    void PushYieldedTask(Schedulable task)
+    {
+        if((t_worker_index == kAnyWorker)
+        || (task.m_affinity != Affinity::eAny)) {
+            PushTask(task);
+            return;
+        }
+        Priority priority = task.m_priority;
+        std::size_t priority_bit = kNumPriorities - 1 - static_cast<std::size_t>(priority);
+
+        if(MetricsEnabled()) [[unlikely]] {
+            task.m_enqueue_tsc = rdtsc_before();
+        }
+        m_workers.GetThreadSpecific(*this)->PushYieldedTask(task);
+        m_priorities.Set(priority_bit);
+    }
+
+    /* Makes the task the next one to run on the current worker.
+     * Threads which are not workers (such as the IO threads) have
+     * nobody to run their next slot, which could then only be 
+     * drained by stealing, so they fall back to a regular push.
+     */
+    void PushNextTask(Schedulable task)
+    {
+        if(t_worker_index == kAnyWorker) {
+            PushTask(task);
+            return;
+        }
+        auto self = m_workers.GetThreadSpecific(*this);
+        if((task.m_affinity == Affinity::eMainThread)
+        || ((task.m_affinity == Affinity::eSticky)
+         && (task.m_home != kAnyWorker)
+         && (task.m_home != self->Index()))) {
+            PushTask(task);
+            return;
+        }
+        if(MetricsEnabled()) [[unlikely]] {
+            task.m_enqueue_tsc = rdtsc_before();
+        }
+        auto displaced = self->PushNextTask(task);
+        if(displaced.has_value()) {
+            PushTask(displaced.value());
+        }
+    }
+
     void PerformMainThreadWork()
     {
         pe::assert(m_workers.GetThreadSpecific(*this) == m_main_worker);
@@ -479,7 +1052,11 @@ void Worker::quit()
 void Worker::PushTask(Schedulable task)
 {
     std::size_t prio = static_cast<std::size_t>(task.m_priority);
-    m_tasks[prio].PushLeft(task);
+    m_tasks[prio].Push(task);
+
+    if(MetricsEnabled()) [[unlikely]] {
+        m_metrics->m_queue_depth[prio].fetch_add(1, std::memory_order_relaxed);
+    }
 
     SetHasTaskWithPriority(task.m_priority);
     if(!(m_pool.IsMainWorker(this) && task.m_affinity == Affinity::eMainThread)) {
@@ -487,8 +1064,59 @@ void Worker::PushTask(Schedulable task)
     }
 }
 
+void Worker::PushYieldedTask(Schedulable task)
+{
+    std::size_t prio = static_cast<std::size_t>(task.m_priority);
+    m_yielded[prio].Enqueue(task);
+    m_yielded_depth[prio].fetch_add(1, std::memory_order_seq_cst);
+
+    if(MetricsEnabled()) [[unlikely]] {
+        m_metrics->m_queue_depth[prio].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    SetHasTaskWithPriority(task.m_priority);
+    SetHasStealableTaskWithPriority(task.m_priority);
+}
+
+void Worker::resume_instrumented(const Schedulable& task, UntypedCoroutine& coro)
+{
+    uint64_t before = rdtsc_before();
+    coro.Resume();
+    uint64_t after = rdtsc_after();
+
+    if(TracingEnabled()) {
+        TraceSlice(TraceEventType::eTaskRun, before, after,
+            static_cast<uint64_t>(task.m_priority), coro.m_name);
+    }
+    if(MetricsEnabled()) {
+        if(coro.m_type_id < 0) [[unlikely]] {
+            coro.m_type_id = TaskTypeID(coro.m_name);
+        }
+        if(task.m_enqueue_tsc && before > task.m_enqueue_tsc) {
+            m_metrics->m_enqueue_latency.Record(before - task.m_enqueue_tsc);
+        }
+        m_metrics->m_run_slices[coro.m_type_id].Record(after - before);
+        MetricsShard::Increment(m_metrics->m_busy_cycles, after - before);
+    }
+}
+
+inline thread_local Worker *t_worker = nullptr;
+
+bool ShouldYield(Priority priority)
+{
+    /* Not running on a worker thread */
+    Worker *worker = t_worker;
+    if(!worker) [[unlikely]]
+        return false;
+    if(worker->HasTaskWithHigherPriority(priority))
+        return true;
+    return (rdtsc_before() - t_resume_start_tsc) >= resume_budget_cycles();
+}
+
 void Worker::Work()
 {
+    t_worker = this;
+    t_worker_index = m_index;
     Backoff backoff{10, 1'000, 0};
     while(true) {
         if(m_pool.ShouldQuit()) {
@@ -498,13 +1126,30 @@ void Worker::Work()
         if(m_pool.IsMainWorker(this)) {
             m_pool.DrainMainTasksQueue();
         }
+        m_last_poll_tsc.store(rdtsc_before(), std::memory_order_relaxed);
         auto task = m_pool.FindTask();
         if(task.has_value()) {
             auto coro = pe::static_pointer_cast<UntypedCoroutine>(task.value().m_handle.lock());
+            if(coro->DropIfCancelled()) [[unlikely]] {
+                backoff.Reset();
+                continue;
+            }
+            coro->SetLastWorker(m_index);
             coro->PushCurrThreadTask();
-            coro->Resume();
+            t_transfer_depth = 0;
+            t_resume_start_tsc = rdtsc_before();
+            if(TracingEnabled() || MetricsEnabled()) [[unlikely]] {
+                resume_instrumented(task.value(), *coro);
+            }else{
+                coro->Resume();
+            }
             coro->PopCurrThreadTask();
             backoff.Reset();
+        }else if(MetricsEnabled()) [[unlikely]] {
+            uint64_t before = rdtsc_before();
+            backoff.BackoffMaybe();
+            uint64_t after = rdtsc_after();
+            MetricsShard::Increment(m_metrics->m_idle_cycles, after - before);
         }else{
             backoff.BackoffMaybe();
         }
@@ -0,0 +1,496 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+import logger;
+import assert;
+import alloc;
+import benchmark;
+import frame_arena;
+import platform;
+import unistd;
+import mman;
+
+import <cstdlib>;
+import <cstring>;
+import <algorithm>;
+import <vector>;
+import <array>;
+import <string>;
+import <thread>;
+import <atomic>;
+import <fstream>;
+import <new>;
+import <memory>;
+import <random>;
+
+
+constexpr std::size_t kReallocMaxSize = 256 * 1024 * 1024;
+constexpr std::size_t kReallocStartSize = 8;
+constexpr int kReallocIters = 16;
+
+constexpr std::size_t kPingPongIters = 256;
+constexpr std::size_t kPingPongSizes[] = {16, 256, 4096};
+
+constexpr std::size_t kChurnFrames = 64;
+constexpr std::size_t kChurnBlocksPerFrame = 12;
+constexpr std::size_t kChurnMinSize = 64 * 1024;
+constexpr std::size_t kChurnMaxSize = 8 * 1024 * 1024;
+
+constexpr std::size_t kSharedObjects = 64 * 1024;
+constexpr std::size_t kSharedIters = 16;
+
+constexpr std::size_t kScratchFrames = 1024;
+constexpr std::size_t kScratchVectorsPerFrame = 256;
+constexpr std::size_t kScratchElements = 48;
+
+constexpr std::size_t kFirstTouchObjects = 4;
+constexpr std::size_t kFirstTouchSizes[] = {
+    8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384
+};
+
+/*****************************************************************************/
+/* Realloc Benchmark                                                         */
+/*****************************************************************************/
+
+void *naive_realloc(pe::Allocator& alloc, void *ptr, std::size_t size)
+{
+    void *ret = alloc.Allocate(size);
+    if(ptr) {
+        std::size_t copy_size = std::min(size, alloc.AllocationSize(ptr));
+        std::memcpy(ret, ptr, copy_size);
+        alloc.Free(ptr);
+    }
+    return ret;
+}
+
+template <typename Realloc>
+void realloc_doubling(pe::Allocator& alloc, Realloc realloc)
+{
+    void *ptr = nullptr;
+    std::size_t prev_size = 0;
+
+    for(std::size_t size = kReallocStartSize; size <= kReallocMaxSize; size *= 2) {
+        ptr = realloc(alloc, ptr, size);
+        pe::assert(ptr != nullptr);
+        /* Touch the newly added tail of the buffer, as
+         * a growing container would.
+         */
+        std::memset(static_cast<std::byte*>(ptr) + prev_size, 0x1, size - prev_size);
+        prev_size = size;
+    }
+    /* Shrink the buffer back down by halves.
+     */
+    for(std::size_t size = kReallocMaxSize / 2; size >= kReallocStartSize; size /= 2) {
+        ptr = realloc(alloc, ptr, size);
+        pe::assert(ptr != nullptr);
+        pe::assert(static_cast<std::byte*>(ptr)[size - 1] == std::byte{0x1});
+    }
+    alloc.Free(ptr);
+}
+
+void benchmark_realloc(pe::BenchmarkSuite& suite, pe::Allocator& alloc)
+{
+    pe::ioprint(pe::TextColor::eYellow, "Starting realloc benchmark...");
+
+    suite.Run("realloc_doubling", {{"strategy", "copy"}}, [&]{
+        for(int i = 0; i < kReallocIters; i++) {
+            realloc_doubling(alloc, naive_realloc);
+        }
+        return kReallocIters;
+    });
+
+    suite.Run("realloc_doubling", {{"strategy", "reallocate"}}, [&]{
+        for(int i = 0; i < kReallocIters; i++) {
+            realloc_doubling(alloc, [](pe::Allocator& alloc, void *ptr, std::size_t size){
+                return alloc.Reallocate(ptr, size);
+            });
+        }
+        return kReallocIters;
+    });
+}
+
+/*****************************************************************************/
+/* First Touch Benchmark                                                     */
+/*****************************************************************************/
+/*
+ * Allocate a handful of objects of every size class from a fresh 
+ * thread, so that every size class has to be filled from a newly
+ * mapped superblock. The latency of the first allocation of each 
+ * size class and the growth of the resident set are reported.
+ */
+
+std::size_t resident_bytes()
+{
+    std::ifstream statm{"/proc/self/statm"};
+    std::size_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * getpagesize();
+}
+
+std::vector<uint64_t> first_touch(pe::Allocator& alloc)
+{
+    std::vector<uint64_t> latencies;
+    for(std::size_t size : kFirstTouchSizes) {
+        for(std::size_t i = 0; i < kFirstTouchObjects; i++) {
+            uint64_t before = pe::rdtsc_before();
+            void *ptr = alloc.Allocate(size);
+            uint64_t after = pe::rdtsc_after();
+            if(i == 0)
+                latencies.push_back(after - before);
+            std::memset(ptr, 0x1, size);
+        }
+    }
+    return latencies;
+}
+
+void benchmark_first_touch(pe::BenchmarkSuite& suite, pe::Allocator& alloc)
+{
+    pe::ioprint(pe::TextColor::eYellow, "Starting first touch benchmark...");
+
+    /* The objects are intentionally never freed, so that every 
+     * iteration is forced to map new superblocks.
+     */
+    auto bench = suite.Case("first_touch", {{"objects", std::to_string(kFirstTouchObjects)}});
+    while(bench.Next()) {
+
+        std::atomic_flag go{};
+        std::vector<uint64_t> latencies;
+        std::size_t rss_before = resident_bytes();
+
+        std::thread thread{[&]{
+            while(!go.test(std::memory_order_acquire));
+            latencies = first_touch(alloc);
+        }};
+
+        bench.Start();
+        go.test_and_set(std::memory_order_release);
+        thread.join();
+        bench.Stop(std::size(kFirstTouchSizes) * kFirstTouchObjects, latencies);
+
+        if(!bench.Warmup()) {
+            pe::dbgprint("resident set growth for", kFirstTouchObjects, 
+                "objects of", std::size(kFirstTouchSizes), "size classes:",
+                resident_bytes() - rss_before, "bytes");
+        }
+    }
+}
+
+/*****************************************************************************/
+/* Ping-Pong Benchmark                                                       */
+/*****************************************************************************/
+/*
+ * Repeatedly allocate and then free a batch of blocks of the same 
+ * size. Batches that span a superblock's worth of blocks used to 
+ * make the thread cache alternate between flushing all of its'
+ * blocks and filling back up from the heap.
+ */
+
+void benchmark_ping_pong(pe::BenchmarkSuite& suite, pe::Allocator& alloc)
+{
+    pe::ioprint(pe::TextColor::eYellow, "Starting alloc/free ping-pong benchmark...");
+
+    for(std::size_t size : kPingPongSizes) {
+
+        const std::size_t per_superblock = pe::kSuperblockSize / size;
+        for(std::size_t batch : {per_superblock / 2, per_superblock, per_superblock * 2}) {
+
+            std::vector<void*> blocks(batch);
+            suite.Run("ping_pong", {{"size", std::to_string(size)}, 
+                {"batch", std::to_string(batch)}}, [&]{
+                for(std::size_t i = 0; i < kPingPongIters; i++) {
+                    for(auto& block : blocks) {
+                        block = alloc.Allocate(size);
+                    }
+                    for(auto block : blocks) {
+                        alloc.Free(block);
+                    }
+                }
+                return kPingPongIters * batch * 2;
+            });
+
+            auto stats = alloc.GetThreadCacheStats();
+            pe::dbgprint("size:", size, "batch:", batch,
+                "cached bytes:", stats.m_cached_bytes,
+                "budget bytes:", stats.m_budget_bytes,
+                "overhead bytes:", stats.m_overhead_bytes);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* Large Block Churn Benchmark                                               */
+/*****************************************************************************/
+/*
+ * Emulate per-frame scratch buffers: every frame allocates a set of
+ * large blocks of 64 KiB to 8 MiB, writes to every page of them and
+ * frees them all at the end of the frame.
+ */
+
+std::vector<std::size_t> churn_sizes()
+{
+    std::vector<std::size_t> ret;
+    uint32_t state = 1;
+    for(std::size_t i = 0; i < kChurnBlocksPerFrame; i++) {
+        state = state * 1664525u + 1013904223u;
+        std::size_t size = kChurnMinSize << ((state >> 8) % 8);
+        size += (state >> 16) % size;
+        ret.push_back(std::min(size, kChurnMaxSize));
+    }
+    return ret;
+}
+
+template <typename Allocate, typename Free>
+std::size_t large_churn(const std::vector<std::size_t>& sizes, Allocate allocate, Free free)
+{
+    std::vector<void*> blocks(std::size(sizes));
+    for(std::size_t frame = 0; frame < kChurnFrames; frame++) {
+        for(std::size_t i = 0; i < std::size(sizes); i++) {
+            auto block = static_cast<std::byte*>(allocate(sizes[i]));
+            for(std::size_t offset = 0; offset < sizes[i]; offset += 4096) {
+                block[offset] = std::byte{0x1};
+            }
+            blocks[i] = block;
+        }
+        for(std::size_t i = 0; i < std::size(sizes); i++) {
+            free(blocks[i], sizes[i]);
+        }
+    }
+    return kChurnFrames * std::size(sizes);
+}
+
+void benchmark_large_churn(pe::BenchmarkSuite& suite, pe::Allocator& alloc)
+{
+    pe::ioprint(pe::TextColor::eYellow, "Starting large block churn benchmark...");
+
+    auto sizes = churn_sizes();
+    suite.Run("large_churn", {{"strategy", "mmap"}}, [&]{
+        return large_churn(sizes, [](std::size_t size){
+            return mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        }, [](void *ptr, std::size_t size){
+            munmap(ptr, size);
+        });
+    });
+    suite.Run("large_churn", {{"strategy", "allocator"}}, [&]{
+        return large_churn(sizes, [&](std::size_t size){
+            return alloc.Allocate(size);
+        }, [&](void *ptr, std::size_t){
+            alloc.Free(ptr);
+        });
+    });
+    suite.Run("large_churn", {{"strategy", "allocator_aligned"}}, [&]{
+        return large_churn(sizes, [&](std::size_t size){
+            return alloc.AllocateAligned(size, std::align_val_t{64 * 1024});
+        }, [&](void *ptr, std::size_t){
+            alloc.FreeAligned(ptr, std::align_val_t{64 * 1024});
+        });
+    });
+    pe::dbgprint("large mappings retained:", alloc.GetRetainedLargeBytes(), "bytes");
+}
+
+/*****************************************************************************/
+/* Shared Object Churn Benchmark                                             */
+/*****************************************************************************/
+/*
+ * Create and destroy a large number of shared objects of different
+ * sizes, in a random order. Compare freeing the blocks by looking up 
+ * their size class in the pagemap against passing the allocation 
+ * size, as sized operator delete does.
+ */
+
+template <typename T, bool Sized>
+struct BenchAllocator
+{
+    using value_type = T;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = BenchAllocator<U, Sized>;
+    };
+
+    pe::Allocator *m_alloc;
+
+    BenchAllocator(pe::Allocator& alloc)
+        : m_alloc{&alloc}
+    {}
+
+    template <typename U>
+    BenchAllocator(const BenchAllocator<U, Sized>& other)
+        : m_alloc{other.m_alloc}
+    {}
+
+    T *allocate(std::size_t n)
+    {
+        std::size_t size = m_alloc->NextAlignedBlockSize(n * sizeof(T), alignof(T));
+        return static_cast<T*>(m_alloc->Allocate(size));
+    }
+
+    void deallocate(T *ptr, std::size_t n)
+    {
+        if constexpr(Sized) {
+            std::size_t size = m_alloc->NextAlignedBlockSize(n * sizeof(T), alignof(T));
+            m_alloc->Free(ptr, size);
+        }else{
+            m_alloc->Free(ptr);
+        }
+    }
+
+    template <typename U>
+    bool operator==(const BenchAllocator<U, Sized>& other) const
+    {
+        return (m_alloc == other.m_alloc);
+    }
+};
+
+template <std::size_t Size>
+struct Payload
+{
+    std::array<std::byte, Size> m_data{};
+};
+
+template <std::size_t Size, bool Sized>
+std::shared_ptr<void> make_payload(pe::Allocator& alloc)
+{
+    return std::allocate_shared<Payload<Size>>(BenchAllocator<Payload<Size>, Sized>{alloc});
+}
+
+template <bool Sized>
+std::size_t shared_churn(pe::Allocator& alloc)
+{
+    std::vector<std::shared_ptr<void>> objects(kSharedObjects);
+    std::default_random_engine generator{};
+
+    for(std::size_t iter = 0; iter < kSharedIters; iter++) {
+        for(std::size_t i = 0; i < kSharedObjects; i++) {
+            switch(i % 4) {
+            case 0: objects[i] = make_payload<16, Sized>(alloc); break;
+            case 1: objects[i] = make_payload<80, Sized>(alloc); break;
+            case 2: objects[i] = make_payload<240, Sized>(alloc); break;
+            case 3: objects[i] = make_payload<1000, Sized>(alloc); break;
+            }
+        }
+        std::shuffle(std::begin(objects), std::end(objects), generator);
+        for(auto& object : objects) {
+            object.reset();
+        }
+    }
+    return kSharedIters * kSharedObjects;
+}
+
+void benchmark_shared_churn(pe::BenchmarkSuite& suite, pe::Allocator& alloc)
+{
+    pe::ioprint(pe::TextColor::eYellow, "Starting shared object churn benchmark...");
+
+    suite.Run("shared_churn", {{"free", "pagemap"}}, [&]{
+        return shared_churn<false>(alloc);
+    });
+    suite.Run("shared_churn", {{"free", "sized"}}, [&]{
+        return shared_churn<true>(alloc);
+    });
+}
+
+/*****************************************************************************/
+/* Frame Scratch Benchmark                                                   */
+/*****************************************************************************/
+/*
+ * Emulate the temporary per-frame containers of the engine loop (i.e.
+ * subscriber snapshots and parallel work descriptors): every frame 
+ * builds a number of short-lived vectors, which are discarded before 
+ * the next frame begins.
+ */
+
+struct ScratchElement
+{
+    uint64_t m_id;
+    uint64_t m_counter;
+    void    *m_ptr;
+};
+
+template <typename Allocator>
+std::size_t frame_scratch(Allocator allocator)
+{
+    for(std::size_t frame = 0; frame < kScratchFrames; frame++) {
+        pe::FrameArena::NewFrame();
+        for(std::size_t i = 0; i < kScratchVectorsPerFrame; i++) {
+            std::vector<ScratchElement, Allocator> scratch{allocator};
+            for(std::size_t j = 0; j < kScratchElements; j++) {
+                scratch.push_back({j, i, nullptr});
+            }
+        }
+    }
+    return kScratchFrames;
+}
+
+void benchmark_frame_scratch(pe::BenchmarkSuite& suite, pe::Allocator& alloc)
+{
+    pe::ioprint(pe::TextColor::eYellow, "Starting frame scratch benchmark...");
+
+    pe::BenchmarkParams common{
+        {"vectors_per_frame", std::to_string(kScratchVectorsPerFrame)},
+        {"elements", std::to_string(kScratchElements)}
+    };
+    auto with = [&](std::string allocator){
+        auto ret = common;
+        ret.push_back({"allocator", allocator});
+        return ret;
+    };
+
+    suite.Run("frame_scratch", with("general"), [&]{
+        return frame_scratch(BenchAllocator<ScratchElement, true>{alloc});
+    });
+    suite.Run("frame_scratch", with("frame_arena"), [&]{
+        return frame_scratch(pe::FrameAllocator<ScratchElement>{});
+    });
+
+    auto stats = pe::FrameArena::GetStats();
+    pe::dbgprint("frame arena allocated:", stats.m_allocated_bytes, 
+        "bytes in last frame, mapped:", stats.m_mapped_bytes, "bytes");
+}
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_SUCCESS;
+    try{
+
+        pe::ioprint(pe::TextColor::eGreen, "Benchmarking allocator...");
+
+        pe::BenchmarkSuite suite{"alloc", argc, argv};
+        pe::Allocator& alloc = pe::Allocator::Instance();
+        benchmark_first_touch(suite, alloc);
+        benchmark_realloc(suite, alloc);
+        benchmark_ping_pong(suite, alloc);
+        benchmark_large_churn(suite, alloc);
+        benchmark_shared_churn(suite, alloc);
+        benchmark_frame_scratch(suite, alloc);
+        suite.Finish();
+
+        pe::ioprint(pe::TextColor::eGreen, "Benchmarking finished");
+
+    }catch(std::exception &e){
+
+        pe::ioprint(pe::LogLevel::eError, "Unhandled std::exception:", e.what());
+        ret = EXIT_FAILURE;
+
+    }catch(...){
+
+        pe::ioprint(pe::LogLevel::eError, "Unknown unhandled exception.");
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
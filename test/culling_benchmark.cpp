@@ -0,0 +1,224 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+import culling;
+import batch_math;
+import ecs;
+import sync;
+import nvector;
+import nmatrix;
+import logger;
+import event;
+import benchmark;
+
+import <cstdlib>;
+import <cstdint>;
+import <cmath>;
+import <array>;
+import <vector>;
+import <memory>;
+import <string>;
+import <exception>;
+
+
+constexpr std::size_t kNumVolumes = 1'000'000;
+constexpr std::size_t kNumViews = 64;
+constexpr float kWorldSize = 1000.0f;
+
+struct Prop
+    : public pe::Entity<Prop, pe::World<>>
+    , public pe::WithComponent<Prop, pe::BoundingSphere>
+{};
+
+struct Building
+    : public pe::Entity<Building, pe::World<>>
+    , public pe::WithComponent<Building, pe::BoundingBox>
+{};
+
+/*****************************************************************************/
+/* Helpers                                                                   */
+/*****************************************************************************/
+
+/* Deterministic values in the range [0, 1).
+ */
+float next_value(uint32_t& state)
+{
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) / static_cast<float>(1u << 24);
+}
+
+const char *level_name(pe::SIMDLevel level)
+{
+    switch(level) {
+    case pe::SIMDLevel::eScalar: return "scalar";
+    case pe::SIMDLevel::eSSE:    return "sse";
+    case pe::SIMDLevel::eAVX2:   return "avx2";
+    }
+    return "unknown";
+}
+
+std::vector<pe::SIMDLevel> supported_levels()
+{
+    std::vector<pe::SIMDLevel> ret{pe::SIMDLevel::eScalar, pe::SIMDLevel::eSSE};
+    if(pe::SupportedSIMDLevel() == pe::SIMDLevel::eAVX2)
+        ret.push_back(pe::SIMDLevel::eAVX2);
+    return ret;
+}
+
+/* Cameras scattered over the world, each looking in a
+ * different direction.
+ */
+std::vector<std::array<pe::Vec4f, 6>> make_views(uint32_t& state)
+{
+    auto proj = pe::Mat4f::Perspective(M_PI / 3.0f, 16.0f / 9.0f, 0.1f, 250.0f);
+    std::vector<std::array<pe::Vec4f, 6>> ret{};
+    for(std::size_t i = 0; i < kNumViews; i++) {
+        pe::Vec3f position{next_value(state) * kWorldSize, 0.0f, next_value(state) * kWorldSize};
+        float yaw = next_value(state) * 2.0f * M_PI;
+        auto camera = pe::Mat4f::Translate(position) * pe::Mat4f::RotateXYZ({0.0f, yaw, 0.0f});
+        ret.push_back(pe::FrustumPlanes(proj * camera.AffineInverse()));
+    }
+    return ret;
+}
+
+/*****************************************************************************/
+/* Benchmarks                                                                */
+/*****************************************************************************/
+
+void benchmark_kernels(pe::BenchmarkSuite& suite)
+{
+    pe::ioprint(pe::TextColor::eYellow, "Starting culling kernel benchmark...");
+
+    uint32_t state = 1;
+    std::vector<float> xs(kNumVolumes), ys(kNumVolumes), zs(kNumVolumes);
+    std::vector<float> rs(kNumVolumes), exs(kNumVolumes), eys(kNumVolumes), ezs(kNumVolumes);
+    for(std::size_t i = 0; i < kNumVolumes; i++) {
+        xs[i] = next_value(state) * kWorldSize;
+        ys[i] = next_value(state) * 10.0f;
+        zs[i] = next_value(state) * kWorldSize;
+        rs[i] = next_value(state) * 2.0f;
+        exs[i] = next_value(state) * 2.0f;
+        eys[i] = next_value(state) * 2.0f;
+        ezs[i] = next_value(state) * 2.0f;
+    }
+    auto views = make_views(state);
+    std::vector<uint64_t> mask((kNumVolumes + 63) / 64);
+
+    for(auto level : supported_levels()) {
+        suite.Run("cull_kernel", {{"volume", "sphere"}, {"simd", level_name(level)}}, [&]{
+            for(const auto& planes : views) {
+                pe::CullSpheres(planes, pe::ConstSpheresSoA{xs, ys, zs, rs}, mask, level);
+            }
+            return kNumVolumes * kNumViews;
+        });
+        suite.Run("cull_kernel", {{"volume", "box"}, {"simd", level_name(level)}}, [&]{
+            for(const auto& planes : views) {
+                pe::CullBoxes(planes, pe::ConstBoxesSoA{xs, ys, zs, exs, eys, ezs}, mask, level);
+            }
+            return kNumVolumes * kNumViews;
+        });
+    }
+}
+
+class Tester : public pe::Task<void, Tester, pe::BenchmarkSuite&>
+{
+    using pe::Task<void, Tester, pe::BenchmarkSuite&>::Task;
+
+    virtual Tester::handle_type Run(pe::BenchmarkSuite& suite)
+    {
+        pe::ioprint(pe::TextColor::eYellow, "Creating", kNumVolumes, "entities...");
+
+        uint32_t state = 2;
+        auto props = std::make_unique<Prop[]>(kNumVolumes / 2);
+        auto buildings = std::make_unique<Building[]>(kNumVolumes / 2);
+        for(std::size_t i = 0; i < kNumVolumes / 2; i++) {
+            props[i].Set<pe::BoundingSphere>({
+                pe::Vec3f{next_value(state) * kWorldSize, 0.0f, next_value(state) * kWorldSize},
+                next_value(state) * 2.0f
+            });
+            buildings[i].Set<pe::BoundingBox>({
+                pe::Vec3f{next_value(state) * kWorldSize, 0.0f, next_value(state) * kWorldSize},
+                pe::Vec3f{next_value(state) * 2.0f, next_value(state) * 2.0f, next_value(state) * 2.0f}
+            });
+        }
+
+        pe::VisibilityQuery<> query{};
+        for(const auto& planes : make_views(state)) {
+            query.AddView(planes);
+        }
+
+        pe::ioprint(pe::TextColor::eYellow, "Starting visibility query benchmark...");
+        for(bool parallel : {false, true}) {
+            auto bench = suite.Case("visibility_query", {
+                {"views", std::to_string(kNumViews)},
+                {"mode", parallel ? "parallel" : "serial"}
+            });
+            while(bench.Next()) {
+                bench.Start();
+                if(parallel) {
+                    co_await pe::CullVisible<>::Create(Scheduler(), pe::Priority::eHigh,
+                        pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, query);
+                }else{
+                    query.Update();
+                }
+                bench.Stop(kNumVolumes * kNumViews);
+            }
+        }
+
+        Broadcast<pe::EventType::eQuit>();
+        co_return;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_SUCCESS;
+    try{
+
+        pe::ioprint(pe::TextColor::eGreen, "Starting Culling benchmark.");
+
+        pe::BenchmarkSuite suite{"culling", argc, argv};
+        benchmark_kernels(suite);
+        {
+            pe::Scheduler scheduler{};
+            auto tester = Tester::Create(scheduler, pe::Priority::eNormal,
+                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, suite);
+            scheduler.Run();
+        }
+        suite.Finish();
+
+        pe::ioprint(pe::TextColor::eGreen, "Finished Culling benchmark.");
+
+    }catch(pe::TaskException &e){
+
+        e.Print();
+        ret = EXIT_FAILURE;
+
+    }catch(std::exception &e){
+
+        pe::ioprint(pe::LogLevel::eError, "Unhandled std::exception:", e.what());
+        ret = EXIT_FAILURE;
+
+    }catch(...){
+
+        pe::ioprint(pe::LogLevel::eError, "Unknown unhandled exception.");
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
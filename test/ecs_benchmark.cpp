@@ -23,6 +23,7 @@ import logger;
 import sync;
 import event;
 import meta;
+import benchmark;
 
 import <cstdlib>;
 import <atomic>;
@@ -30,10 +31,13 @@ import <chrono>;
 import <tuple>;
 import <thread>;
 import <array>;
+import <memory>;
+import <optional>;
+import <string>;
 
 
-constexpr std::chrono::microseconds kIterateBenchDuration{5'000'000};
-constexpr std::chrono::microseconds kQueryBenchDuration{5'000'000};
+constexpr std::chrono::microseconds kIterateBenchDuration{1'000'000};
+constexpr std::chrono::microseconds kQueryBenchDuration{1'000'000};
 constexpr std::size_t kEntitiesPerType = 10'000;
 
 using BenchResult = std::tuple<std::chrono::microseconds, std::size_t>;
@@ -228,17 +232,23 @@ class ComponentIterator : public pe::Task<void,
     virtual typename ComponentIterator<Component>::handle_type 
     Run(std::atomic_flag& quit, std::atomic_uint64_t& count)
     {
-        uint64_t curr = 0;
+        /* The components have already been incremented
+         * by the previous repetitions of the benchmark.
+         */
+        std::optional<uint64_t> curr{};
         while(!quit.test(std::memory_order_relaxed)) {
 
             uint64_t nitems = 0;
             for(auto&& [eid, component] : pe::components_view<pe::World<>, Component>()) {
-                pe::assert<true>(uint64_t(component) == curr);
+                if(!curr)
+                    curr = uint64_t(component);
+                pe::assert<true>(uint64_t(component) == *curr);
                 component++;
                 nitems++;
             }
             count.fetch_add(nitems, std::memory_order_relaxed);
-            curr++;
+            if(curr)
+                (*curr)++;
             co_await this->Yield(this->Affinity());
         }
         co_return;
@@ -371,61 +381,60 @@ class ComponentGetterMaster : public pe::Task<BenchResult,
 /* Top-level benchmarking logic                                              */
 /*****************************************************************************/
 
-class Tester : public pe::Task<void, Tester>
+class Tester : public pe::Task<void, Tester, pe::BenchmarkSuite&>
 {
-    using pe::Task<void, Tester>::Task;
+    using pe::Task<void, Tester, pe::BenchmarkSuite&>::Task;
 
-    virtual Tester::handle_type Run()
+    virtual Tester::handle_type Run(pe::BenchmarkSuite& suite)
     {
-        pe::ioprint(pe::TextColor::eYellow, "Starting Creation benchmark...");
-        auto before = std::chrono::steady_clock::now();
-
         [[maybe_unused]] FullEntitySet set{};
 
-        auto after = std::chrono::steady_clock::now();
-        auto delta = std::chrono::duration_cast<std::chrono::microseconds>(after - before);
-        auto seconds = delta.count() / 1'000'000.0f;
-        auto nentities = 16 * kEntitiesPerType;
-
-        pe::dbgprint("Created", nentities, "in",
-            seconds, "secs (", pe::fmt::cat{}, nentities / seconds,
-            "entities per second)");
+        pe::ioprint(pe::TextColor::eYellow, "Starting Creation benchmark...");
+        {
+            constexpr auto nentities = std::tuple_size_v<decltype(FullEntitySet{}.m_entities)>
+                                     * kEntitiesPerType;
+            auto bench = suite.Case("creation", {{"entities", std::to_string(nentities)}});
+            while(bench.Next()) {
+                bench.Start();
+                auto created = std::make_unique<FullEntitySet>();
+                bench.Stop(nentities);
+            }
+        }
 
         pe::ioprint(pe::TextColor::eYellow, "Starting Iteration benchmark...");
         {
             /* When there are read-write dependencies between different 
              * components, the taskgraph module can be used.
              */
-            auto master = ComponentIteratorMaster<
-                ComponentA,
-                ComponentB,
-                ComponentC,
-                ComponentD,
-                ComponentE,
-                ComponentF,
-                ComponentG,
-                ComponentH,
-                ComponentI,
-                ComponentJ,
-                ComponentK,
-                ComponentL,
-                ComponentM,
-                ComponentN,
-                ComponentO
-            >::Create(
-                Scheduler(), 
-                pe::Priority::eHigh,
-                pe::CreateMode::eLaunchAsync, 
-                pe::Affinity::eAny, 
-                kIterateBenchDuration);
-
-            auto result = co_await master;
-            auto seconds = std::get<0>(result).count() / 1'000'000.0f;
-            auto naccesses = std::get<1>(result);
-
-            pe::dbgprint(naccesses, "component accesses by", 16, "tasks in", 
-                seconds, "secs (", pe::fmt::cat{}, naccesses / seconds,
-                "accesses per second)");
+            auto bench = suite.Case("iteration", {{"tasks", "15"}});
+            while(bench.Next()) {
+                bench.Start();
+                auto master = ComponentIteratorMaster<
+                    ComponentA,
+                    ComponentB,
+                    ComponentC,
+                    ComponentD,
+                    ComponentE,
+                    ComponentF,
+                    ComponentG,
+                    ComponentH,
+                    ComponentI,
+                    ComponentJ,
+                    ComponentK,
+                    ComponentL,
+                    ComponentM,
+                    ComponentN,
+                    ComponentO
+                >::Create(
+                    Scheduler(), 
+                    pe::Priority::eHigh,
+                    pe::CreateMode::eLaunchAsync, 
+                    pe::Affinity::eAny, 
+                    kIterateBenchDuration);
+
+                auto result = co_await master;
+                bench.Stop(std::get<1>(result));
+            }
         }
 
         pe::ioprint(pe::TextColor::eYellow, "Starting Query benchmark...");
@@ -433,37 +442,36 @@ class Tester : public pe::Task<void, Tester>
             /* Again, the taskgraph module can be used to 
              * specify read-write dependencies
              */
-            auto master = ComponentGetterMaster<
-                ComponentA,
-                ComponentB,
-                ComponentC,
-                ComponentD,
-                ComponentE,
-                ComponentF,
-                ComponentG,
-                ComponentH,
-                ComponentI,
-                ComponentJ,
-                ComponentK,
-                ComponentL,
-                ComponentM,
-                ComponentN,
-                ComponentO
-            >::Create(
-                Scheduler(), 
-                pe::Priority::eHigh,
-                pe::CreateMode::eLaunchAsync, 
-                pe::Affinity::eAny, 
-                set,
-                kQueryBenchDuration);
-
-            auto result = co_await master;
-            auto seconds = std::get<0>(result).count() / 1'000'000.0f;
-            auto naccesses = std::get<1>(result);
-
-            pe::dbgprint(naccesses, "component accesses by", 16, "tasks in", 
-                seconds, "secs (", pe::fmt::cat{}, naccesses / seconds,
-                "accesses per second)");
+            auto bench = suite.Case("query", {{"tasks", "15"}});
+            while(bench.Next()) {
+                bench.Start();
+                auto master = ComponentGetterMaster<
+                    ComponentA,
+                    ComponentB,
+                    ComponentC,
+                    ComponentD,
+                    ComponentE,
+                    ComponentF,
+                    ComponentG,
+                    ComponentH,
+                    ComponentI,
+                    ComponentJ,
+                    ComponentK,
+                    ComponentL,
+                    ComponentM,
+                    ComponentN,
+                    ComponentO
+                >::Create(
+                    Scheduler(), 
+                    pe::Priority::eHigh,
+                    pe::CreateMode::eLaunchAsync, 
+                    pe::Affinity::eAny, 
+                    set,
+                    kQueryBenchDuration);
+
+                auto result = co_await master;
+                bench.Stop(std::get<1>(result));
+            }
         }
 
         Broadcast<pe::EventType::eQuit>();
@@ -471,16 +479,21 @@ class Tester : public pe::Task<void, Tester>
     }
 };
 
-int main()
+int main(int argc, char **argv)
 {
     int ret = EXIT_SUCCESS;
     try{
 
         pe::ioprint(pe::TextColor::eGreen, "Starting ECS benchmark.");
 
-        pe::Scheduler scheduler{};
-        auto tester = Tester::Create(scheduler);
-        scheduler.Run();
+        pe::BenchmarkSuite suite{"ecs", argc, argv};
+        {
+            pe::Scheduler scheduler{};
+            auto tester = Tester::Create(scheduler, pe::Priority::eNormal,
+                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, suite);
+            scheduler.Run();
+        }
+        suite.Finish();
 
         pe::ioprint(pe::TextColor::eGreen, "Finished ECS benchmark.");
 
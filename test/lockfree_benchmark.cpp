@@ -0,0 +1,837 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Throughput and latency of the lock-free containers under
+ * different contention profiles, measured against a mutex-
+ * protected standard library container doing the same work.
+ *
+ * The queue-like containers are run with the following
+ * producer:consumer profiles, where T is the thread count:
+ *
+ *  mixed  every thread alternates between a push and a pop
+ *  1:1    a single producer and a single consumer
+ *  1:N    a single producer and T-1 consumers
+ *  N:1    T-1 producers and a single consumer
+ *  N:N    T/2 producers and T/2 consumers
+ *
+ * The work-stealing deques are run with a single owner
+ * thread and T-1 thieves, in the following profiles:
+ *
+ *  spawn  the owner pops back most of what it pushes, so
+ *         the thieves only get the occasional leftover
+ *  steal  the owner only pushes and the thieves take
+ *         (almost) everything
+ *
+ * The set-like containers (and the bitset) are run with
+ * read-heavy, balanced and write-heavy operation mixes.
+ *
+ * Every case is run with 8-byte values. The 'mixed' and 'N:N'
+ * profiles and the balanced set mix are also run with 64 and
+ * 256 byte values.
+ */
+
+import benchmark;
+import logger;
+import shared_ptr;
+import lockfree_queue;
+import lockfree_deque;
+import chase_lev_deque;
+import lockfree_stack;
+import lockfree_list;
+import lockfree_iterable_list;
+import lockfree_sequenced_queue;
+import atomic_bitset;
+
+import <cstdlib>;
+import <cstdint>;
+import <cstddef>;
+import <array>;
+import <atomic>;
+import <string>;
+import <string_view>;
+import <optional>;
+import <variant>;
+import <mutex>;
+import <queue>;
+import <deque>;
+import <stack>;
+import <set>;
+import <vector>;
+import <compare>;
+import <exception>;
+
+
+/* The total number of operations of a case is split
+ * between the threads, so that the run time of a case
+ * is roughly independent of the thread count.
+ */
+constexpr std::size_t kTotalOps = 1 << 20;
+constexpr std::size_t kSequencedQueueTotalOps = 1 << 16;
+constexpr std::size_t kStackCapacity = 4096;
+constexpr std::size_t kSpawnPopInterval = 8;
+constexpr std::size_t kKeyRange = 1024;
+constexpr std::size_t kNumBits = 4096;
+
+/*****************************************************************************/
+/* Values                                                                    */
+/*****************************************************************************/
+
+template <std::size_t Size>
+requires (Size >= sizeof(uint64_t))
+struct Value
+{
+    uint64_t                                      m_key{};
+    std::array<std::byte, Size - sizeof(uint64_t)> m_payload{};
+
+    Value() = default;
+
+    Value(uint64_t key)
+        : m_key{key}
+        , m_payload{}
+    {}
+
+    bool operator==(const Value& rhs) const
+    {
+        return (m_key == rhs.m_key);
+    }
+
+    std::strong_ordering operator<=>(const Value& rhs) const
+    {
+        return (m_key <=> rhs.m_key);
+    }
+};
+
+/* A cheap per-thread random number generator, so that
+ * generating keys does not dominate the measurements.
+ */
+struct XorShift
+{
+    uint64_t m_state;
+
+    XorShift(std::size_t seed)
+        : m_state{0x9E3779B97F4A7C15ull * (seed + 1)}
+    {}
+
+    uint64_t operator()()
+    {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+        return m_state;
+    }
+};
+
+/*****************************************************************************/
+/* Queue Adapters                                                            */
+/*****************************************************************************/
+/*
+ * A uniform 'Push'/'Pop' interface over all the queue-like
+ * containers. 'Push' returns false when a bounded container
+ * is full.
+ */
+
+template <typename T>
+struct QueueAdapter
+{
+    static constexpr const char *kName = "queue";
+    static constexpr std::size_t kTotalOps = ::kTotalOps;
+
+    pe::LockfreeQueue<T> m_queue{};
+
+    bool Push(const T& value)
+    {
+        m_queue.Enqueue(value);
+        return true;
+    }
+
+    std::optional<T> Pop()
+    {
+        return m_queue.Dequeue();
+    }
+};
+
+template <typename T>
+struct DequeAdapter
+{
+    static constexpr const char *kName = "deque";
+    static constexpr std::size_t kTotalOps = ::kTotalOps;
+
+    pe::LockfreeDeque<T> m_deque{};
+
+    bool Push(const T& value)
+    {
+        m_deque.PushLeft(value);
+        return true;
+    }
+
+    std::optional<T> Pop()
+    {
+        return m_deque.PopRight();
+    }
+};
+
+template <typename T>
+struct StackAdapter
+{
+    static constexpr const char *kName = "stack";
+    static constexpr std::size_t kTotalOps = ::kTotalOps;
+
+    pe::LockfreeStack<kStackCapacity, T> m_stack{};
+
+    bool Push(const T& value)
+    {
+        return m_stack.Push(value);
+    }
+
+    std::optional<T> Pop()
+    {
+        return m_stack.Pop();
+    }
+};
+
+template <typename T>
+struct SequencedQueueAdapter
+{
+    static constexpr const char *kName = "sequenced_queue";
+    static constexpr std::size_t kTotalOps = kSequencedQueueTotalOps;
+
+    pe::LockfreeSequencedQueue<T>     m_queue{};
+    pe::shared_ptr<std::monostate>    m_state{pe::make_shared<std::monostate>()};
+
+    bool Push(const T& value)
+    {
+        return m_queue.ConditionallyEnqueue(+[](pe::shared_ptr<std::monostate>, uint64_t, T){
+            return true;
+        }, m_state, value);
+    }
+
+    std::optional<T> Pop()
+    {
+        return m_queue.Dequeue();
+    }
+};
+
+template <typename T>
+struct MutexQueueAdapter
+{
+    static constexpr const char *kName = "mutex_std_queue";
+    static constexpr std::size_t kTotalOps = ::kTotalOps;
+
+    std::mutex    m_mutex{};
+    std::queue<T> m_queue{};
+
+    bool Push(const T& value)
+    {
+        std::lock_guard lock{m_mutex};
+        m_queue.push(value);
+        return true;
+    }
+
+    std::optional<T> Pop()
+    {
+        std::lock_guard lock{m_mutex};
+        if(m_queue.empty())
+            return std::nullopt;
+        T ret = m_queue.front();
+        m_queue.pop();
+        return ret;
+    }
+};
+
+template <typename T>
+struct MutexStackAdapter
+{
+    static constexpr const char *kName = "mutex_std_stack";
+    static constexpr std::size_t kTotalOps = ::kTotalOps;
+
+    std::mutex                   m_mutex{};
+    std::stack<T, std::vector<T>> m_stack{};
+
+    bool Push(const T& value)
+    {
+        std::lock_guard lock{m_mutex};
+        if(m_stack.size() == kStackCapacity)
+            return false;
+        m_stack.push(value);
+        return true;
+    }
+
+    std::optional<T> Pop()
+    {
+        std::lock_guard lock{m_mutex};
+        if(m_stack.empty())
+            return std::nullopt;
+        T ret = m_stack.top();
+        m_stack.pop();
+        return ret;
+    }
+};
+
+/*****************************************************************************/
+/* Work-Stealing Deque Adapters                                              */
+/*****************************************************************************/
+/*
+ * A uniform 'Push'/'Pop'/'Steal' interface over the deques
+ * which can back the ready queues of the workers. 'Push' and
+ * 'Pop' are only called by the owner.
+ */
+
+template <typename T>
+struct ChaseLevAdapter
+{
+    static constexpr const char *kName = "chase_lev_deque";
+
+    pe::ChaseLevDeque<T> m_deque{};
+
+    void Push(const T& value)
+    {
+        m_deque.Push(value);
+    }
+
+    std::optional<T> Pop()
+    {
+        return m_deque.Pop();
+    }
+
+    std::optional<T> Steal()
+    {
+        return m_deque.Steal();
+    }
+};
+
+template <typename T>
+struct LockfreeDequeAdapter
+{
+    static constexpr const char *kName = "lockfree_deque";
+
+    pe::LockfreeDeque<T> m_deque{};
+
+    void Push(const T& value)
+    {
+        m_deque.PushLeft(value);
+    }
+
+    std::optional<T> Pop()
+    {
+        return m_deque.PopLeft();
+    }
+
+    std::optional<T> Steal()
+    {
+        return m_deque.PopRight();
+    }
+};
+
+template <typename T>
+struct MutexDequeAdapter
+{
+    static constexpr const char *kName = "mutex_std_deque";
+
+    std::mutex    m_mutex{};
+    std::deque<T> m_deque{};
+
+    void Push(const T& value)
+    {
+        std::lock_guard lock{m_mutex};
+        m_deque.push_back(value);
+    }
+
+    std::optional<T> Pop()
+    {
+        std::lock_guard lock{m_mutex};
+        if(m_deque.empty())
+            return std::nullopt;
+        T ret = m_deque.back();
+        m_deque.pop_back();
+        return ret;
+    }
+
+    std::optional<T> Steal()
+    {
+        std::lock_guard lock{m_mutex};
+        if(m_deque.empty())
+            return std::nullopt;
+        T ret = m_deque.front();
+        m_deque.pop_front();
+        return ret;
+    }
+};
+
+/*****************************************************************************/
+/* Set Adapters                                                              */
+/*****************************************************************************/
+
+template <typename T>
+struct ListAdapter
+{
+    static constexpr const char *kName = "list";
+
+    pe::LockfreeList<T> m_list{};
+
+    bool Insert(const T& value) { return m_list.Insert(value); }
+    bool Delete(const T& value) { return m_list.Delete(value); }
+    bool Find(const T& value)   { return m_list.Find(value);   }
+};
+
+template <typename T>
+struct IterableListAdapter
+{
+    static constexpr const char *kName = "iterable_list";
+
+    pe::LockfreeIterableList<T> m_list{};
+
+    bool Insert(const T& value) { return m_list.Insert(value); }
+    bool Delete(const T& value) { return m_list.Delete(value); }
+    bool Find(const T& value)   { return m_list.Find(value);   }
+};
+
+template <typename T>
+struct MutexSetAdapter
+{
+    static constexpr const char *kName = "mutex_std_set";
+
+    std::mutex  m_mutex{};
+    std::set<T> m_set{};
+
+    bool Insert(const T& value)
+    {
+        std::lock_guard lock{m_mutex};
+        return m_set.insert(value).second;
+    }
+
+    bool Delete(const T& value)
+    {
+        std::lock_guard lock{m_mutex};
+        return (m_set.erase(value) > 0);
+    }
+
+    bool Find(const T& value)
+    {
+        std::lock_guard lock{m_mutex};
+        return m_set.contains(value);
+    }
+};
+
+struct BitsetAdapter
+{
+    static constexpr const char *kName = "atomic_bitset";
+
+    pe::AtomicBitset m_bitset{kNumBits};
+
+    void Set(std::size_t bit)   { m_bitset.Set(bit);          }
+    void Clear(std::size_t bit) { m_bitset.Clear(bit);        }
+    bool Test(std::size_t bit)  { return m_bitset.Test(bit); }
+};
+
+struct MutexBitsetAdapter
+{
+    static constexpr const char *kName = "mutex_std_vector_bool";
+
+    std::mutex        m_mutex{};
+    std::vector<bool> m_bits = std::vector<bool>(kNumBits);
+
+    void Set(std::size_t bit)
+    {
+        std::lock_guard lock{m_mutex};
+        m_bits[bit] = true;
+    }
+
+    void Clear(std::size_t bit)
+    {
+        std::lock_guard lock{m_mutex};
+        m_bits[bit] = false;
+    }
+
+    bool Test(std::size_t bit)
+    {
+        std::lock_guard lock{m_mutex};
+        return m_bits[bit];
+    }
+};
+
+/*****************************************************************************/
+/* Queue Benchmarks                                                          */
+/*****************************************************************************/
+
+enum class Profile
+{
+    eMixed,
+    eOneToOne,
+    eOneToMany,
+    eManyToOne,
+    eManyToMany,
+};
+
+const char *profile_name(Profile profile)
+{
+    switch(profile) {
+    case Profile::eMixed:      return "mixed";
+    case Profile::eOneToOne:   return "1:1";
+    case Profile::eOneToMany:  return "1:N";
+    case Profile::eManyToOne:  return "N:1";
+    case Profile::eManyToMany: return "N:N";
+    }
+    return "unknown";
+}
+
+/* Returns the number of producers for the profile, or
+ * nothing if the profile cannot be run with 'nthreads'.
+ */
+std::optional<std::size_t> num_producers(Profile profile, std::size_t nthreads)
+{
+    switch(profile) {
+    case Profile::eMixed:
+        return nthreads;
+    case Profile::eOneToOne:
+        if(nthreads != 2)
+            return std::nullopt;
+        return 1;
+    case Profile::eOneToMany:
+        if(nthreads < 3)
+            return std::nullopt;
+        return 1;
+    case Profile::eManyToOne:
+        if(nthreads < 3)
+            return std::nullopt;
+        return nthreads - 1;
+    case Profile::eManyToMany:
+        if(nthreads < 4 || nthreads % 2)
+            return std::nullopt;
+        return nthreads / 2;
+    }
+    return std::nullopt;
+}
+
+template <typename Adapter, typename T>
+void benchmark_queue(pe::BenchmarkSuite& suite, Profile profile, std::size_t nthreads)
+{
+    auto nproducers = num_producers(profile, nthreads);
+    if(!nproducers)
+        return;
+
+    pe::BenchmarkParams params{
+        {"profile", profile_name(profile)},
+        {"value_size", std::to_string(sizeof(T))},
+        {"threads", std::to_string(nthreads)}
+    };
+    const std::size_t ops_per_thread = Adapter::kTotalOps / nthreads;
+
+    Adapter container{};
+
+    if(profile == Profile::eMixed) {
+        suite.RunParallel(Adapter::kName, params, nthreads,
+            [&](std::size_t idx, pe::LatencySampler& sampler){
+            std::size_t nops = 0;
+            for(std::size_t i = 0; i < ops_per_thread / 2; i++) {
+                sampler.Measure([&]{ nops += container.Push(T{i}); });
+                sampler.Measure([&]{ nops += container.Pop().has_value(); });
+            }
+            return nops;
+        });
+        return;
+    }
+
+    /* Every producer pushes a fixed number of values. The consumers
+     * drain the container until it is empty and all the producers
+     * have finished. The count of finished producers is never reset,
+     * so the consumers wait for it to reach the total for all the
+     * iterations run so far.
+     */
+    const std::size_t pushes_per_producer = Adapter::kTotalOps / 2 / *nproducers;
+    std::atomic_size_t nproducers_done{0};
+    std::vector<std::size_t> niterations(nthreads);
+
+    suite.RunParallel(Adapter::kName, params, nthreads,
+        [&](std::size_t idx, pe::LatencySampler& sampler){
+        std::size_t nops = 0;
+        const std::size_t target = ++niterations[idx] * *nproducers;
+        if(idx < *nproducers) {
+            for(std::size_t i = 0; i < pushes_per_producer; i++) {
+                bool pushed = false;
+                while(!pushed) {
+                    sampler.Measure([&]{ pushed = container.Push(T{i}); });
+                }
+                nops++;
+            }
+            nproducers_done.fetch_add(1, std::memory_order_release);
+        }else{
+            while(true) {
+                bool done = (nproducers_done.load(std::memory_order_acquire) == target);
+                std::optional<T> value{};
+                sampler.Measure([&]{ value = container.Pop(); });
+                if(value) {
+                    nops++;
+                    continue;
+                }
+                if(done)
+                    break;
+            }
+        }
+        return nops;
+    });
+}
+
+template <typename T>
+void benchmark_queues(pe::BenchmarkSuite& suite, Profile profile, std::size_t nthreads)
+{
+    benchmark_queue<QueueAdapter<T>, T>(suite, profile, nthreads);
+    benchmark_queue<DequeAdapter<T>, T>(suite, profile, nthreads);
+    benchmark_queue<StackAdapter<T>, T>(suite, profile, nthreads);
+    benchmark_queue<SequencedQueueAdapter<T>, T>(suite, profile, nthreads);
+    benchmark_queue<MutexQueueAdapter<T>, T>(suite, profile, nthreads);
+    benchmark_queue<MutexStackAdapter<T>, T>(suite, profile, nthreads);
+}
+
+/*****************************************************************************/
+/* Work-Stealing Benchmarks                                                  */
+/*****************************************************************************/
+
+enum class StealProfile
+{
+    eSpawnHeavy,
+    eStealHeavy
+};
+
+const char *steal_profile_name(StealProfile profile)
+{
+    switch(profile) {
+    case StealProfile::eSpawnHeavy: return "spawn";
+    case StealProfile::eStealHeavy: return "steal";
+    }
+    return "unknown";
+}
+
+/* Thread 0 is the owner of the deque and all the others are
+ * thieves. The owner pushes a fixed number of values and then
+ * drains what is left over. The thieves keep stealing until
+ * the owner has finished and the deque is empty. As with the
+ * queues, the count of finished iterations is never reset.
+ */
+template <typename Adapter, typename T>
+void benchmark_work_stealing(pe::BenchmarkSuite& suite, StealProfile profile, std::size_t nthreads)
+{
+    if(profile == StealProfile::eStealHeavy && nthreads < 2)
+        return;
+
+    pe::BenchmarkParams params{
+        {"profile", steal_profile_name(profile)},
+        {"value_size", std::to_string(sizeof(T))},
+        {"threads", std::to_string(nthreads)}
+    };
+    const std::size_t npushes = kTotalOps / 2;
+
+    Adapter deque{};
+    std::atomic_size_t nowner_done{0};
+    std::vector<std::size_t> niterations(nthreads);
+
+    suite.RunParallel(std::string{"ws_"} + Adapter::kName, params, nthreads,
+        [&](std::size_t idx, pe::LatencySampler& sampler){
+        std::size_t nops = 0;
+        const std::size_t target = ++niterations[idx];
+        if(idx == 0) {
+            for(std::size_t i = 0; i < npushes; i++) {
+                sampler.Measure([&]{ deque.Push(T{i}); });
+                nops++;
+                if(profile == StealProfile::eSpawnHeavy && (i % kSpawnPopInterval)) {
+                    std::optional<T> value{};
+                    sampler.Measure([&]{ value = deque.Pop(); });
+                    nops += value.has_value();
+                }
+            }
+            while(deque.Pop().has_value()) {
+                nops++;
+            }
+            nowner_done.fetch_add(1, std::memory_order_release);
+        }else{
+            while(true) {
+                bool done = (nowner_done.load(std::memory_order_acquire) == target);
+                std::optional<T> value{};
+                sampler.Measure([&]{ value = deque.Steal(); });
+                if(value) {
+                    nops++;
+                    continue;
+                }
+                if(done)
+                    break;
+            }
+        }
+        return nops;
+    });
+}
+
+template <typename T>
+void benchmark_work_stealing_deques(pe::BenchmarkSuite& suite, StealProfile profile, std::size_t nthreads)
+{
+    benchmark_work_stealing<ChaseLevAdapter<T>, T>(suite, profile, nthreads);
+    benchmark_work_stealing<LockfreeDequeAdapter<T>, T>(suite, profile, nthreads);
+    benchmark_work_stealing<MutexDequeAdapter<T>, T>(suite, profile, nthreads);
+}
+
+/*****************************************************************************/
+/* Set Benchmarks                                                            */
+/*****************************************************************************/
+
+struct OpMix
+{
+    const char *m_name;
+    uint32_t    m_insert_pct;
+    uint32_t    m_delete_pct;
+};
+
+constexpr OpMix kReadHeavy{"read_heavy", 5, 5};
+constexpr OpMix kBalanced{"balanced", 25, 25};
+constexpr OpMix kWriteHeavy{"write_heavy", 50, 50};
+
+template <typename Adapter, typename T>
+void benchmark_set(pe::BenchmarkSuite& suite, OpMix mix, std::size_t nthreads)
+{
+    pe::BenchmarkParams params{
+        {"mix", mix.m_name},
+        {"value_size", std::to_string(sizeof(T))},
+        {"threads", std::to_string(nthreads)}
+    };
+    const std::size_t ops_per_thread = kTotalOps / nthreads;
+
+    /* Start out with the set half full.
+     */
+    Adapter container{};
+    for(uint64_t key = 0; key < kKeyRange; key += 2) {
+        container.Insert(T{key});
+    }
+
+    suite.RunParallel(Adapter::kName, params, nthreads,
+        [&](std::size_t idx, pe::LatencySampler& sampler){
+        XorShift rng{idx};
+        for(std::size_t i = 0; i < ops_per_thread; i++) {
+            uint64_t rand = rng();
+            T key{rand % kKeyRange};
+            uint32_t pct = (rand >> 32) % 100;
+            if(pct < mix.m_insert_pct) {
+                sampler.Measure([&]{ container.Insert(key); });
+            }else if(pct < mix.m_insert_pct + mix.m_delete_pct) {
+                sampler.Measure([&]{ container.Delete(key); });
+            }else{
+                sampler.Measure([&]{ container.Find(key); });
+            }
+        }
+        return ops_per_thread;
+    });
+}
+
+template <typename T>
+void benchmark_sets(pe::BenchmarkSuite& suite, OpMix mix, std::size_t nthreads)
+{
+    benchmark_set<ListAdapter<T>, T>(suite, mix, nthreads);
+    benchmark_set<IterableListAdapter<T>, T>(suite, mix, nthreads);
+    benchmark_set<MutexSetAdapter<T>, T>(suite, mix, nthreads);
+}
+
+template <typename Adapter>
+void benchmark_bitset(pe::BenchmarkSuite& suite, OpMix mix, std::size_t nthreads)
+{
+    pe::BenchmarkParams params{
+        {"mix", mix.m_name},
+        {"threads", std::to_string(nthreads)}
+    };
+    const std::size_t ops_per_thread = kTotalOps / nthreads;
+
+    Adapter bitset{};
+    suite.RunParallel(Adapter::kName, params, nthreads,
+        [&](std::size_t idx, pe::LatencySampler& sampler){
+        XorShift rng{idx};
+        for(std::size_t i = 0; i < ops_per_thread; i++) {
+            uint64_t rand = rng();
+            std::size_t bit = rand % kNumBits;
+            uint32_t pct = (rand >> 32) % 100;
+            if(pct < mix.m_insert_pct) {
+                sampler.Measure([&]{ bitset.Set(bit); });
+            }else if(pct < mix.m_insert_pct + mix.m_delete_pct) {
+                sampler.Measure([&]{ bitset.Clear(bit); });
+            }else{
+                sampler.Measure([&]{ bitset.Test(bit); });
+            }
+        }
+        return ops_per_thread;
+    });
+}
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_SUCCESS;
+    try{
+
+        pe::ioprint(pe::TextColor::eGreen, "Benchmarking lock-free containers...");
+
+        pe::BenchmarkSuite suite{"lockfree", argc, argv};
+        auto sweep = suite.Threads({1, 2, 4, 8, 16, 32, 64});
+
+        pe::ioprint(pe::TextColor::eYellow, "Starting queue benchmarks...");
+        for(auto profile : {Profile::eMixed, Profile::eOneToOne, Profile::eOneToMany,
+                            Profile::eManyToOne, Profile::eManyToMany}) {
+            for(std::size_t nthreads : sweep) {
+                benchmark_queues<Value<8>>(suite, profile, nthreads);
+                if(profile == Profile::eMixed || profile == Profile::eManyToMany) {
+                    benchmark_queues<Value<64>>(suite, profile, nthreads);
+                    benchmark_queues<Value<256>>(suite, profile, nthreads);
+                }
+            }
+        }
+
+        pe::ioprint(pe::TextColor::eYellow, "Starting work-stealing deque benchmarks...");
+        for(auto profile : {StealProfile::eSpawnHeavy, StealProfile::eStealHeavy}) {
+            for(std::size_t nthreads : sweep) {
+                benchmark_work_stealing_deques<Value<8>>(suite, profile, nthreads);
+                benchmark_work_stealing_deques<Value<64>>(suite, profile, nthreads);
+            }
+        }
+
+        pe::ioprint(pe::TextColor::eYellow, "Starting set benchmarks...");
+        for(auto mix : {kReadHeavy, kBalanced, kWriteHeavy}) {
+            for(std::size_t nthreads : sweep) {
+                benchmark_sets<Value<8>>(suite, mix, nthreads);
+                if(std::string_view{mix.m_name} == kBalanced.m_name) {
+                    benchmark_sets<Value<64>>(suite, mix, nthreads);
+                    benchmark_sets<Value<256>>(suite, mix, nthreads);
+                }
+            }
+        }
+
+        pe::ioprint(pe::TextColor::eYellow, "Starting bitset benchmarks...");
+        for(auto mix : {kReadHeavy, kBalanced, kWriteHeavy}) {
+            for(std::size_t nthreads : sweep) {
+                benchmark_bitset<BitsetAdapter>(suite, mix, nthreads);
+                benchmark_bitset<MutexBitsetAdapter>(suite, mix, nthreads);
+            }
+        }
+
+        suite.Finish();
+        pe::ioprint(pe::TextColor::eGreen, "Benchmarking finished");
+
+    }catch(std::exception &e){
+
+        pe::ioprint(pe::LogLevel::eError, "Unhandled std::exception:", e.what());
+        ret = EXIT_FAILURE;
+
+    }catch(...){
+
+        pe::ioprint(pe::LogLevel::eError, "Unknown unhandled exception.");
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
@@ -0,0 +1,238 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+import benchmark;
+import batch_math;
+import nvector;
+import nmatrix;
+import logger;
+
+import <cstdlib>;
+import <cstdint>;
+import <string>;
+import <vector>;
+import <algorithm>;
+import <exception>;
+
+
+constexpr std::size_t kNumPoints = 1'000'000;
+constexpr std::size_t kNumMatrices = 100'000;
+constexpr std::size_t kPasses = 10;
+
+/*****************************************************************************/
+/* Helpers                                                                   */
+/*****************************************************************************/
+
+float next_value(uint32_t& state)
+{
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) / static_cast<float>(1u << 24) * 20.0f - 10.0f;
+}
+
+pe::Mat4f random_matrix(uint32_t& state)
+{
+    pe::Mat4f ret{};
+    for(auto& value : ret) {
+        value = next_value(state);
+    }
+    return ret;
+}
+
+const char *level_name(pe::SIMDLevel level)
+{
+    switch(level) {
+    case pe::SIMDLevel::eScalar: return "scalar";
+    case pe::SIMDLevel::eSSE:    return "sse";
+    case pe::SIMDLevel::eAVX2:   return "avx2";
+    }
+    return "unknown";
+}
+
+std::vector<pe::SIMDLevel> supported_levels()
+{
+    std::vector<pe::SIMDLevel> ret{pe::SIMDLevel::eScalar, pe::SIMDLevel::eSSE};
+    if(pe::SupportedSIMDLevel() == pe::SIMDLevel::eAVX2)
+        ret.push_back(pe::SIMDLevel::eAVX2);
+    return ret;
+}
+
+/*****************************************************************************/
+/* Benchmarks                                                                */
+/*****************************************************************************/
+
+void benchmark_transform_points(pe::BenchmarkSuite& suite)
+{
+    pe::ioprint(pe::TextColor::eYellow, "Starting point transform benchmark...");
+
+    uint32_t state = 1;
+    auto mat = pe::Mat4f::Translate({1.0f, 2.0f, 3.0f}) * pe::Mat4f::RotateXYZ({0.5f, 1.5f, 3.0f});
+
+    std::vector<pe::Vec3f> points(kNumPoints), out(kNumPoints);
+    std::vector<float> xs(kNumPoints), ys(kNumPoints), zs(kNumPoints);
+    std::vector<float> ox(kNumPoints), oy(kNumPoints), oz(kNumPoints);
+    for(std::size_t i = 0; i < kNumPoints; i++) {
+        points[i] = {next_value(state), next_value(state), next_value(state)};
+        xs[i] = points[i].x();
+        ys[i] = points[i].y();
+        zs[i] = points[i].z();
+    }
+
+    for(auto level : supported_levels()) {
+        suite.Run("transform_points", {{"layout", "aos"}, {"simd", level_name(level)}}, [&]{
+            for(std::size_t i = 0; i < kPasses; i++) {
+                pe::TransformPoints(mat, points, out, level);
+            }
+            return kNumPoints * kPasses;
+        });
+        suite.Run("transform_points", {{"layout", "soa"}, {"simd", level_name(level)}}, [&]{
+            for(std::size_t i = 0; i < kPasses; i++) {
+                pe::TransformPoints(mat, pe::ConstPointsSoA{xs, ys, zs},
+                    pe::PointsSoA{ox, oy, oz}, level);
+            }
+            return kNumPoints * kPasses;
+        });
+    }
+}
+
+void benchmark_multiply_matrices(pe::BenchmarkSuite& suite)
+{
+    pe::ioprint(pe::TextColor::eYellow, "Starting batched matrix product benchmark...");
+
+    uint32_t state = 2;
+    std::vector<pe::Mat4f> lhs(kNumMatrices), rhs(kNumMatrices), out(kNumMatrices);
+    for(std::size_t i = 0; i < kNumMatrices; i++) {
+        lhs[i] = random_matrix(state);
+        rhs[i] = random_matrix(state);
+    }
+    auto parent = random_matrix(state);
+
+    suite.Run("multiply_matrices", {{"mode", "pairwise"}, {"simd", "operator*"}}, [&]{
+        for(std::size_t i = 0; i < kPasses; i++) {
+            for(std::size_t j = 0; j < kNumMatrices; j++) {
+                out[j] = lhs[j] * rhs[j];
+            }
+        }
+        return kNumMatrices * kPasses;
+    });
+
+    for(auto level : supported_levels()) {
+        suite.Run("multiply_matrices", {{"mode", "pairwise"}, {"simd", level_name(level)}}, [&]{
+            for(std::size_t i = 0; i < kPasses; i++) {
+                pe::MultiplyMatrices(lhs, rhs, out, level);
+            }
+            return kNumMatrices * kPasses;
+        });
+        suite.Run("multiply_matrices", {{"mode", "parent"}, {"simd", level_name(level)}}, [&]{
+            for(std::size_t i = 0; i < kPasses; i++) {
+                pe::MultiplyMatrices(parent, rhs, out, level);
+            }
+            return kNumMatrices * kPasses;
+        });
+    }
+}
+
+void benchmark_inverse(pe::BenchmarkSuite& suite)
+{
+    pe::ioprint(pe::TextColor::eYellow, "Starting matrix inverse benchmark...");
+
+    uint32_t state = 3;
+    std::vector<pe::Mat4f> mats(kNumMatrices), out(kNumMatrices);
+    std::vector<pe::Mat4d> dmats(kNumMatrices), dout(kNumMatrices);
+    for(std::size_t i = 0; i < kNumMatrices; i++) {
+        pe::Vec3f angles{next_value(state), next_value(state), next_value(state)};
+        pe::Vec3f offset{next_value(state), next_value(state), next_value(state)};
+        mats[i] = pe::Mat4f::Translate(offset) * pe::Mat4f::RotateXYZ(angles);
+        std::copy(mats[i].cbegin(), mats[i].cend(), dmats[i].begin());
+    }
+
+    /* The generic cofactor expansion, as used in constant evaluation */
+    suite.Run("inverse", {{"type", "float"}, {"method", "generic"}}, [&]{
+        for(std::size_t j = 0; j < kNumMatrices; j++) {
+            out[j] = mats[j].Adjoint() / mats[j].Determinant();
+        }
+        return kNumMatrices;
+    });
+    suite.Run("inverse", {{"type", "float"}, {"method", "closed_form"}}, [&]{
+        for(std::size_t i = 0; i < kPasses; i++) {
+            for(std::size_t j = 0; j < kNumMatrices; j++) {
+                out[j] = mats[j].Inverse();
+            }
+        }
+        return kNumMatrices * kPasses;
+    });
+    suite.Run("inverse", {{"type", "float"}, {"method", "affine"}}, [&]{
+        for(std::size_t i = 0; i < kPasses; i++) {
+            for(std::size_t j = 0; j < kNumMatrices; j++) {
+                out[j] = mats[j].AffineInverse();
+            }
+        }
+        return kNumMatrices * kPasses;
+    });
+
+    suite.Run("inverse", {{"type", "double"}, {"method", "generic"}}, [&]{
+        for(std::size_t j = 0; j < kNumMatrices; j++) {
+            dout[j] = dmats[j].Adjoint() / dmats[j].Determinant();
+        }
+        return kNumMatrices;
+    });
+    suite.Run("inverse", {{"type", "double"}, {"method", "closed_form"}}, [&]{
+        for(std::size_t i = 0; i < kPasses; i++) {
+            for(std::size_t j = 0; j < kNumMatrices; j++) {
+                dout[j] = dmats[j].Inverse();
+            }
+        }
+        return kNumMatrices * kPasses;
+    });
+    suite.Run("inverse", {{"type", "double"}, {"method", "affine"}}, [&]{
+        for(std::size_t i = 0; i < kPasses; i++) {
+            for(std::size_t j = 0; j < kNumMatrices; j++) {
+                dout[j] = dmats[j].AffineInverse();
+            }
+        }
+        return kNumMatrices * kPasses;
+    });
+}
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_SUCCESS;
+    try{
+
+        pe::ioprint(pe::TextColor::eGreen, "Benchmarking math kernels...");
+
+        pe::BenchmarkSuite suite{"math", argc, argv};
+        benchmark_transform_points(suite);
+        benchmark_multiply_matrices(suite);
+        benchmark_inverse(suite);
+        suite.Finish();
+
+        pe::ioprint(pe::TextColor::eGreen, "Benchmarking finished");
+
+    }catch(std::exception &e){
+
+        pe::ioprint(pe::LogLevel::eError, "Unhandled std::exception:", e.what());
+        ret = EXIT_FAILURE;
+
+    }catch(...){
+
+        pe::ioprint(pe::LogLevel::eError, "Unknown unhandled exception.");
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
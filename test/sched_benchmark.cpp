@@ -24,6 +24,8 @@ import assert;
 import nmatrix;
 import alloc;
 import unistd;
+import benchmark;
+import platform;
 
 import <new>;
 import <cstdlib>;
@@ -34,11 +36,17 @@ import <vector>;
 import <thread>;
 import <any>;
 import <limits>;
+import <string>;
+import <cstdint>;
+import <algorithm>;
+import <mutex>;
+import <utility>;
+import <tuple>;
 
 
-constexpr std::chrono::microseconds kCPUBenchDuration{5'000'000};
-constexpr std::chrono::microseconds kMessageBenchDuration{5'000'000};
-constexpr std::chrono::microseconds kNotifyBenchDuration{5'000'000};
+constexpr std::chrono::microseconds kCPUBenchDuration{1'000'000};
+constexpr std::chrono::microseconds kMessageBenchDuration{1'000'000};
+constexpr std::chrono::microseconds kNotifyBenchDuration{1'000'000};
 
 using BenchResult = std::tuple<std::chrono::microseconds, std::size_t>;
 
@@ -184,6 +192,113 @@ class SenderReceiverMaster : public pe::Task<BenchResult, SenderReceiverMaster,
     }
 };
 
+/*
+ * Many senders sharing the mailbox of a single receiver, which 
+ * takes its' messages either one at a time, or in batches.
+ */
+constexpr std::size_t kMailboxBatchSize = 64;
+
+class MailboxReceiver : public pe::Task<void, MailboxReceiver, std::size_t, bool>
+{
+    using Task<void, MailboxReceiver, std::size_t, bool>::Task;
+
+    virtual MailboxReceiver::handle_type Run(std::size_t nsenders, bool batched)
+    {
+        std::size_t nquit = 0;
+        auto handle = [&](const pe::Message& msg) {
+            Reply(msg.m_sender.lock(), pe::Message{this->shared_from_this(), 0, 0});
+            if(msg.m_header == 0x1)
+                nquit++;
+        };
+        while(nquit < nsenders) {
+            if(batched) {
+                auto batch = co_await ReceiveBatch(kMailboxBatchSize);
+                for(const auto& msg : batch) {
+                    handle(msg);
+                }
+            }else{
+                handle(co_await Receive());
+            }
+        }
+    }
+};
+
+class MailboxSender : public pe::Task<void, MailboxSender, pe::shared_ptr<MailboxReceiver>,
+    std::atomic_uint64_t&, std::atomic_flag&>
+{
+    using Task<void, MailboxSender, pe::shared_ptr<MailboxReceiver>,
+        std::atomic_uint64_t&, std::atomic_flag&>::Task;
+
+    virtual MailboxSender::handle_type Run(pe::shared_ptr<MailboxReceiver> receiver,
+        std::atomic_uint64_t& nsends, std::atomic_flag& done)
+    {
+        while(!done.test(std::memory_order_relaxed)) {
+            co_await Send(receiver, pe::Message{this->shared_from_this(), 0, 0});
+            nsends.fetch_add(1, std::memory_order_relaxed);
+        }
+        co_await Send(receiver, pe::Message{this->shared_from_this(), 0x1, 0});
+        nsends.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+class MailboxMaster : public pe::Task<BenchResult, MailboxMaster, 
+    std::size_t, bool, std::chrono::microseconds>
+{
+    using Task<BenchResult, MailboxMaster, std::size_t, bool, std::chrono::microseconds>::Task;
+
+    virtual MailboxMaster::handle_type Run(std::size_t nsenders, bool batched,
+        std::chrono::microseconds duration)
+    {
+        std::atomic_uint64_t nsends{0};
+        std::atomic_flag done{};
+        std::vector<pe::shared_ptr<MailboxSender>> senders;
+
+        auto before = std::chrono::steady_clock::now();
+        auto receiver = MailboxReceiver::Create(Scheduler(), pe::Priority::eNormal,
+            pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, nsenders, batched);
+        for(std::size_t i = 0; i < nsenders; i++) {
+            senders.push_back(MailboxSender::Create(Scheduler(), pe::Priority::eNormal,
+                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, receiver, nsends, done));
+        }
+        co_await IO([duration]{ std::this_thread::sleep_for(duration); });
+        done.test_and_set(std::memory_order_relaxed);
+        for(auto& sender : senders) {
+            co_await sender;
+        }
+        co_await receiver;
+        auto after = std::chrono::steady_clock::now();
+        auto delta = std::chrono::duration_cast<std::chrono::microseconds>(after - before);
+        co_return std::make_tuple(delta, nsends.load(std::memory_order_relaxed));
+    }
+};
+
+/*
+ * A single sender and receiver exchanging a fixed number of
+ * messages, to measure the round-trip latency of a message
+ * and its' reply, rather than the throughput.
+ */
+class PingPongMaster : public pe::Task<BenchResult, PingPongMaster, std::size_t>
+{
+    using Task<BenchResult, PingPongMaster, std::size_t>::Task;
+
+    virtual PingPongMaster::handle_type Run(std::size_t nmsgs)
+    {
+        auto receiver = Receiver::Create(Scheduler(), pe::Priority::eNormal,
+            pe::CreateMode::eLaunchAsync, pe::Affinity::eAny);
+
+        auto before = std::chrono::steady_clock::now();
+        for(std::size_t i = 0; i < nmsgs; i++) {
+            uint64_t header = (i == nmsgs - 1) ? 0x1 : 0x0;
+            co_await Send(receiver, pe::Message{this->shared_from_this(), header, 0});
+        }
+        co_await receiver;
+
+        auto after = std::chrono::steady_clock::now();
+        auto delta = std::chrono::duration_cast<std::chrono::microseconds>(after - before);
+        co_return std::make_tuple(delta, nmsgs);
+    }
+};
+
 /*****************************************************************************/
 /* Notification Benchmark                                                    */
 /*****************************************************************************/
@@ -324,71 +439,752 @@ class TaskCreationMaster : public pe::Task<BenchResult, TaskCreationMaster, std:
     }
 };
 
+/*****************************************************************************/
+/* Root Task Creation Benchmark                                              */
+/*****************************************************************************/
+/*
+ * Tasks created from outside of any task (here from IO threads)
+ * have no parent and are registered as roots of the task hierarchy.
+ * A number of spawners create root tasks concurrently, which are
+ * destroyed on the workers as soon as they have run.
+ */
+
+constexpr std::size_t kRootsPerSpawner = 20'000;
+
+class RootTask : public pe::Task<void, RootTask, std::atomic_uint64_t&>
+{
+    using Task<void, RootTask, std::atomic_uint64_t&>::Task;
+
+    virtual RootTask::handle_type Run(std::atomic_uint64_t& ndone)
+    {
+        ndone.fetch_add(1, std::memory_order_relaxed);
+        co_return;
+    }
+};
+
+class RootSpawner : public pe::Task<void, RootSpawner, std::atomic_uint64_t&>
+{
+    using Task<void, RootSpawner, std::atomic_uint64_t&>::Task;
+
+    virtual RootSpawner::handle_type Run(std::atomic_uint64_t& ndone)
+    {
+        co_await IO([this, &ndone]{
+            for(std::size_t i = 0; i < kRootsPerSpawner; i++) {
+                std::ignore = RootTask::Create(Scheduler(), pe::Priority::eNormal,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, ndone);
+            }
+        });
+    }
+};
+
+class RootCreationMaster : public pe::Task<BenchResult, RootCreationMaster, std::size_t>
+{
+    using Task<BenchResult, RootCreationMaster, std::size_t>::Task;
+
+    virtual RootCreationMaster::handle_type Run(std::size_t nspawners)
+    {
+        std::atomic_uint64_t ndone{0};
+        std::vector<pe::shared_ptr<RootSpawner>> spawners;
+        std::size_t total = nspawners * kRootsPerSpawner;
+
+        auto before = std::chrono::steady_clock::now();
+        for(std::size_t i = 0; i < nspawners; i++) {
+            spawners.push_back(RootSpawner::Create(Scheduler(), pe::Priority::eNormal,
+                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, ndone));
+        }
+        for(auto& spawner : spawners) {
+            co_await spawner;
+        }
+        while(ndone.load(std::memory_order_relaxed) < total) {
+            co_await Yield(Affinity());
+        }
+        auto after = std::chrono::steady_clock::now();
+
+        auto delta = std::chrono::duration_cast<std::chrono::microseconds>(after - before);
+        co_return std::make_tuple(delta, total);
+    }
+};
+
+/*****************************************************************************/
+/* Hand-off Benchmark                                                        */
+/*****************************************************************************/
+/*
+ * Measures the cost of handing off control between an awaiter
+ * and the awaited task: a generator yielding values one by one
+ * to its' awaiter, and a master repeatedly calling a child task
+ * which returns right away.
+ */
+
+class Generator : public pe::Task<uint64_t, Generator, std::size_t>
+{
+    using Task<uint64_t, Generator, std::size_t>::Task;
+
+    virtual Generator::handle_type Run(std::size_t nvalues)
+    {
+        for(uint64_t i = 0; i < nvalues; i++) {
+            co_yield i;
+        }
+        co_return nvalues;
+    }
+};
+
+class GeneratorMaster : public pe::Task<BenchResult, GeneratorMaster, std::size_t>
+{
+    using Task<BenchResult, GeneratorMaster, std::size_t>::Task;
+
+    virtual GeneratorMaster::handle_type Run(std::size_t nvalues)
+    {
+        auto before = std::chrono::steady_clock::now();
+
+        auto generator = Generator::Create(Scheduler(), Priority(),
+            pe::CreateMode::eSuspend, pe::Affinity::eAny, nvalues);
+        uint64_t sum = 0;
+        for(std::size_t i = 0; i <= nvalues; i++) {
+            sum += co_await generator;
+        }
+        pe::assert(sum == nvalues * (nvalues - 1) / 2 + nvalues);
+
+        auto after = std::chrono::steady_clock::now();
+        auto delta = std::chrono::duration_cast<std::chrono::microseconds>(after - before);
+        co_return std::make_tuple(delta, nvalues);
+    }
+};
+
+class Callee : public pe::Task<uint64_t, Callee, uint64_t>
+{
+    using Task<uint64_t, Callee, uint64_t>::Task;
+
+    virtual Callee::handle_type Run(uint64_t arg)
+    {
+        co_return arg + 1;
+    }
+};
+
+class CallMaster : public pe::Task<BenchResult, CallMaster, std::size_t>
+{
+    using Task<BenchResult, CallMaster, std::size_t>::Task;
+
+    virtual CallMaster::handle_type Run(std::size_t ncalls)
+    {
+        auto before = std::chrono::steady_clock::now();
+
+        uint64_t value = 0;
+        for(std::size_t i = 0; i < ncalls; i++) {
+            auto callee = Callee::Create(Scheduler(), Priority(),
+                pe::CreateMode::eSuspend, pe::Affinity::eAny, value);
+            value = co_await callee;
+        }
+        pe::assert(value == ncalls);
+
+        auto after = std::chrono::steady_clock::now();
+        auto delta = std::chrono::duration_cast<std::chrono::microseconds>(after - before);
+        co_return std::make_tuple(delta, ncalls);
+    }
+};
+
+/*****************************************************************************/
+/* Stream benchmark                                                          */
+/*****************************************************************************/
+/*
+ * A producer streaming values to a consumer through a bounded
+ * buffer, consumed one by one or in batches. Compare with the 
+ * generator benchmark, where every value is handed off directly.
+ */
+
+constexpr uint32_t kStreamBatchSize = 64;
+
+class StreamProducer : public pe::Task<void, StreamProducer, pe::Stream<uint64_t>&, std::size_t>
+{
+    using Task<void, StreamProducer, pe::Stream<uint64_t>&, std::size_t>::Task;
+
+    virtual StreamProducer::handle_type Run(pe::Stream<uint64_t>& stream, std::size_t nvalues)
+    {
+        for(uint64_t i = 0; i < nvalues; i++) {
+            co_yield stream.Push(i);
+        }
+        stream.Close();
+    }
+};
+
+class StreamMaster : public pe::Task<BenchResult, StreamMaster, uint32_t, bool, std::size_t>
+{
+    using Task<BenchResult, StreamMaster, uint32_t, bool, std::size_t>::Task;
+
+    virtual StreamMaster::handle_type Run(uint32_t capacity, bool batched, std::size_t nvalues)
+    {
+        auto before = std::chrono::steady_clock::now();
+
+        pe::Stream<uint64_t> stream{Scheduler(), capacity};
+        auto producer = StreamProducer::Create(Scheduler(), pe::Priority::eNormal,
+            pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, stream, nvalues);
+        uint64_t sum = 0;
+        if(batched) {
+            while(true) {
+                auto batch = co_await stream.NextBatch(kStreamBatchSize);
+                if(batch.empty())
+                    break;
+                for(auto value : batch) {
+                    sum += value;
+                }
+            }
+        }else{
+            while(auto value = co_await stream.Next()) {
+                sum += *value;
+            }
+        }
+        co_await producer;
+        pe::assert(sum == nvalues * (nvalues - 1) / 2);
+
+        auto after = std::chrono::steady_clock::now();
+        auto delta = std::chrono::duration_cast<std::chrono::microseconds>(after - before);
+        co_return std::make_tuple(delta, nvalues);
+    }
+};
+
+/*****************************************************************************/
+/* Lock contention benchmark                                                 */
+/*****************************************************************************/
+/*
+ * A number of tasks repeatedly entering a short critical section.
+ * The asynchronous primitives suspend the waiting tasks, freeing
+ * up the worker thread, while std::mutex blocks the worker thread
+ * for as long as the lock is contended.
+ */
+
+constexpr std::size_t kLockIterations = 10'000;
+constexpr std::size_t kCriticalSectionWork = 64;
+constexpr std::size_t kWriterPeriod = 8;
+constexpr uint32_t kSemaphoreCount = 4;
+
+enum class LockKind
+{
+    eAsyncMutex,
+    eStdMutex,
+    eAsyncSharedMutex,
+    eAsyncSemaphore
+};
+
+struct LockBenchState
+{
+    pe::AsyncMutex       m_async_mutex;
+    std::mutex           m_std_mutex;
+    pe::AsyncSharedMutex m_shared_mutex;
+    pe::AsyncSemaphore   m_semaphore;
+    uint64_t             m_value{1};
+    std::atomic_uint64_t m_nentered{0};
+
+    LockBenchState(pe::Scheduler& scheduler)
+        : m_async_mutex{scheduler}
+        , m_std_mutex{}
+        , m_shared_mutex{scheduler}
+        , m_semaphore{scheduler, kSemaphoreCount}
+    {}
+};
+
+__attribute__((noinline))
+uint64_t critical_section_work(uint64_t value)
+{
+    for(std::size_t i = 0; i < kCriticalSectionWork; i++) {
+        value = value * 6364136223846793005ull + 1442695040888963407ull;
+    }
+    return value;
+}
+
+class LockContender : public pe::Task<void, LockContender, LockKind, LockBenchState&>
+{
+    using Task<void, LockContender, LockKind, LockBenchState&>::Task;
+
+    virtual LockContender::handle_type Run(LockKind kind, LockBenchState& state)
+    {
+        for(std::size_t i = 0; i < kLockIterations; i++) {
+            switch(kind) {
+            case LockKind::eAsyncMutex: {
+                auto lock = co_await state.m_async_mutex.ScopedLock();
+                state.m_value = critical_section_work(state.m_value);
+                break;
+            }
+            case LockKind::eStdMutex: {
+                std::lock_guard<std::mutex> lock{state.m_std_mutex};
+                state.m_value = critical_section_work(state.m_value);
+                break;
+            }
+            case LockKind::eAsyncSharedMutex:
+                if(i % kWriterPeriod == 0) {
+                    co_await state.m_shared_mutex.Lock();
+                    state.m_value = critical_section_work(state.m_value);
+                    state.m_shared_mutex.Unlock();
+                }else{
+                    co_await state.m_shared_mutex.LockShared();
+                    critical_section_work(state.m_value);
+                    state.m_shared_mutex.UnlockShared();
+                }
+                break;
+            case LockKind::eAsyncSemaphore:
+                co_await state.m_semaphore.Acquire();
+                critical_section_work(state.m_value);
+                state.m_semaphore.Release();
+                break;
+            }
+            state.m_nentered.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+};
+
+class LockContentionMaster : public pe::Task<BenchResult, LockContentionMaster, 
+    LockKind, std::size_t>
+{
+    using Task<BenchResult, LockContentionMaster, LockKind, std::size_t>::Task;
+
+    virtual LockContentionMaster::handle_type Run(LockKind kind, std::size_t ntasks)
+    {
+        LockBenchState state{Scheduler()};
+        std::vector<pe::shared_ptr<LockContender>> contenders;
+
+        auto before = std::chrono::steady_clock::now();
+        for(std::size_t i = 0; i < ntasks; i++) {
+            contenders.push_back(LockContender::Create(Scheduler(), pe::Priority::eNormal,
+                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, kind, state));
+        }
+        for(auto& contender : contenders) {
+            co_await contender;
+        }
+        auto after = std::chrono::steady_clock::now();
+
+        auto nentered = state.m_nentered.load(std::memory_order_relaxed);
+        pe::assert(nentered == ntasks * kLockIterations);
+        auto delta = std::chrono::duration_cast<std::chrono::microseconds>(after - before);
+        co_return std::make_tuple(delta, nentered);
+    }
+};
+
+/*****************************************************************************/
+/* Speculative search benchmark                                              */
+/*****************************************************************************/
+/*
+ * A number of searchers race to find a result, each one needing
+ * a different amount of work. Once the first one is done, the rest
+ * of the work is wasted. With cancellation, the losing searchers
+ * are unwound at their next cancellation point rather than being
+ * run to completion.
+ */
+
+constexpr std::size_t kNumSearchers = 16;
+constexpr std::size_t kSearchChunkWork = 4096;
+constexpr std::size_t kMinSearchChunks = 64;
+
+class Searcher : public pe::Task<void, Searcher, std::size_t, 
+    std::atomic_uint64_t&, std::atomic_flag&, pe::Latch&>
+{
+    using Task<void, Searcher, std::size_t, std::atomic_uint64_t&, 
+        std::atomic_flag&, pe::Latch&>::Task;
+
+    virtual Searcher::handle_type Run(std::size_t nchunks, std::atomic_uint64_t& nexecuted,
+        std::atomic_flag& found, pe::Latch& first_found)
+    {
+        uint64_t value = nchunks;
+        for(std::size_t i = 0; i < nchunks; i++) {
+            co_await ThrowIfCancelled();
+            for(std::size_t j = 0; j < kSearchChunkWork / kCriticalSectionWork; j++) {
+                value = critical_section_work(value);
+            }
+            nexecuted.fetch_add(1, std::memory_order_relaxed);
+            co_await Yield(Affinity());
+        }
+        pe::assert(value != 0);
+        if(!found.test_and_set(std::memory_order_relaxed)) {
+            first_found.CountDown();
+        }
+    }
+};
+
+class SpeculativeSearchMaster : public pe::Task<BenchResult, SpeculativeSearchMaster, bool>
+{
+    using Task<BenchResult, SpeculativeSearchMaster, bool>::Task;
+
+    virtual SpeculativeSearchMaster::handle_type Run(bool cancel)
+    {
+        std::atomic_uint64_t nexecuted{0};
+        std::atomic_flag found{};
+        pe::Latch first_found{Scheduler(), 1};
+        std::vector<pe::shared_ptr<Searcher>> searchers;
+
+        auto before = std::chrono::steady_clock::now();
+        for(std::size_t i = 0; i < kNumSearchers; i++) {
+            std::size_t nchunks = kMinSearchChunks * (i + 1);
+            searchers.push_back(Searcher::Create(Scheduler(), pe::Priority::eNormal,
+                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, 
+                nchunks, nexecuted, found, first_found));
+        }
+        co_await first_found;
+        if(cancel) {
+            for(auto& searcher : searchers) {
+                searcher->Cancel();
+            }
+        }
+        for(auto& searcher : searchers) {
+            try{
+                co_await searcher;
+            }catch(pe::TaskCancelled&) {}
+        }
+        auto after = std::chrono::steady_clock::now();
+
+        auto delta = std::chrono::duration_cast<std::chrono::microseconds>(after - before);
+        co_return std::make_tuple(delta, nexecuted.load(std::memory_order_relaxed));
+    }
+};
+
+/*****************************************************************************/
+/* Critical task latency benchmark                                           */
+/*****************************************************************************/
+/*
+ * Every worker is kept busy by a low priority task burning CPU, 
+ * which every now and then spawns a critical task onto its' own 
+ * worker's queue. A greedy burner never suspends, so the critical 
+ * task waits until some worker is free to steal it. A cooperative
+ * one calls 'MaybeYield' after every chunk of work, giving up the
+ * worker as soon as the critical task is waiting.
+ */
+
+constexpr std::size_t kBurnChunks = 2'000;
+constexpr std::size_t kBurnChunkWork = 256;
+constexpr std::size_t kProbePeriod = 100;
+
+class CriticalProbe : public pe::Task<void, CriticalProbe, uint64_t, uint64_t&>
+{
+    using Task<void, CriticalProbe, uint64_t, uint64_t&>::Task;
+
+    virtual CriticalProbe::handle_type Run(uint64_t created_tsc, uint64_t& latency)
+    {
+        latency = pe::rdtsc_before() - created_tsc;
+        co_return;
+    }
+};
+
+class Burner : public pe::Task<void, Burner, bool, std::vector<uint64_t>&>
+{
+    using Task<void, Burner, bool, std::vector<uint64_t>&>::Task;
+
+    virtual Burner::handle_type Run(bool cooperative, std::vector<uint64_t>& latencies)
+    {
+        std::vector<pe::shared_ptr<CriticalProbe>> probes;
+        latencies.resize(kBurnChunks / kProbePeriod);
+
+        uint64_t value = 1;
+        for(std::size_t i = 0; i < kBurnChunks; i++) {
+            if(i % kProbePeriod == 0) {
+                probes.push_back(CriticalProbe::Create(Scheduler(), pe::Priority::eCritical,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, 
+                    pe::rdtsc_before(), latencies[i / kProbePeriod]));
+            }
+            for(std::size_t j = 0; j < kBurnChunkWork; j++) {
+                value = critical_section_work(value);
+            }
+            if(cooperative) {
+                co_await MaybeYield();
+            }
+        }
+        pe::assert(value != 0);
+        for(auto& probe : probes) {
+            co_await probe;
+        }
+    }
+};
+
+class CriticalLatencyMaster : public pe::Task<std::vector<uint64_t>, CriticalLatencyMaster, bool>
+{
+    using Task<std::vector<uint64_t>, CriticalLatencyMaster, bool>::Task;
+
+    virtual CriticalLatencyMaster::handle_type Run(bool cooperative)
+    {
+        std::size_t nburners = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::vector<uint64_t>> latencies(nburners);
+        std::vector<pe::shared_ptr<Burner>> burners;
+
+        for(std::size_t i = 0; i < nburners; i++) {
+            burners.push_back(Burner::Create(Scheduler(), pe::Priority::eLow,
+                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, cooperative, latencies[i]));
+        }
+        for(auto& burner : burners) {
+            co_await burner;
+        }
+
+        std::vector<uint64_t> ret;
+        for(const auto& burner_latencies : latencies) {
+            ret.insert(std::end(ret), std::begin(burner_latencies), std::end(burner_latencies));
+        }
+        co_return ret;
+    }
+};
+
+/*****************************************************************************/
+/* Actor Frame Benchmark                                                     */
+/*****************************************************************************/
+/*
+ * Long-lived actors each own a working set, which they update once
+ * per frame before meeting at a barrier. Actors with an 'eAny' affinity
+ * are resumed by whichever worker gets to them first, so the state
+ * migrates between caches from frame to frame, while 'eSticky' ones
+ * keep going back to the same worker.
+ */
+
+constexpr std::size_t kActorStateSize = 32 * 1024;
+constexpr std::size_t kActorFrames = 200;
+
+class Actor : public pe::Task<void, Actor, std::size_t, pe::Barrier&>
+{
+    using Task<void, Actor, std::size_t, pe::Barrier&>::Task;
+
+    virtual Actor::handle_type Run(std::size_t nframes, pe::Barrier& frame)
+    {
+        std::vector<uint64_t> state(kActorStateSize / sizeof(uint64_t), 1);
+        for(std::size_t i = 0; i < nframes; i++) {
+            for(auto& value : state) {
+                value = critical_section_work(value);
+            }
+            co_await frame.ArriveAndWait();
+        }
+        pe::assert(state[0] != 0);
+    }
+};
+
+class ActorFrameMaster : public pe::Task<std::vector<uint64_t>, ActorFrameMaster, 
+    pe::Affinity, std::size_t>
+{
+    using Task<std::vector<uint64_t>, ActorFrameMaster, pe::Affinity, std::size_t>::Task;
+
+    virtual ActorFrameMaster::handle_type Run(pe::Affinity affinity, std::size_t nactors)
+    {
+        pe::Barrier frame{Scheduler(), static_cast<uint16_t>(nactors + 1)};
+        std::vector<pe::shared_ptr<Actor>> actors;
+        for(std::size_t i = 0; i < nactors; i++) {
+            actors.push_back(Actor::Create(Scheduler(), pe::Priority::eNormal,
+                pe::CreateMode::eLaunchAsync, affinity, kActorFrames, frame));
+        }
+
+        std::vector<uint64_t> frame_times;
+        frame_times.reserve(kActorFrames);
+        for(std::size_t i = 0; i < kActorFrames; i++) {
+            uint64_t before = pe::rdtsc_before();
+            co_await frame.ArriveAndWait();
+            frame_times.push_back(pe::rdtsc_after() - before);
+        }
+        for(auto& actor : actors) {
+            co_await actor;
+        }
+        co_return frame_times;
+    }
+};
+
 /*****************************************************************************/
 /* Top-level benchmarking logic                                              */
 /*****************************************************************************/
 
-class Benchmarker : public pe::Task<void, Benchmarker>
+class Benchmarker : public pe::Task<void, Benchmarker, pe::BenchmarkSuite&>
 {
-    using Task<void, Benchmarker>::Task;
+    using Task<void, Benchmarker, pe::BenchmarkSuite&>::Task;
 
-    virtual Benchmarker::handle_type Run()
+    virtual Benchmarker::handle_type Run(pe::BenchmarkSuite& suite)
     {
         pe::ioprint(pe::TextColor::eGreen, "Benchmarking scheduler...");
 
         pe::ioprint(pe::TextColor::eYellow, "Starting CPU benchmark...");
-        std::size_t ntasks[] = {2, 4, 6, 8, 10, 12, 16, 24, 32};
-        for(int i = 0; i < std::size(ntasks); i++) {
-            const std::size_t n = ntasks[i];
-            auto master = CPUWorkMaster::Create(Scheduler(), pe::Priority::eHigh,
-                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, n, kCPUBenchDuration);
-            auto result = co_await master;
-            auto seconds = std::get<0>(result).count() / 1'000'000.0f;
-            auto nmults = std::get<1>(result);
-            pe::dbgprint(nmults, "matrix multiplications by", n, "tasks in", 
-                seconds, "secs (", pe::fmt::cat{}, nmults / seconds,
-                "multiplications per second)");
+        for(std::size_t n : suite.Threads({2, 4, 6, 8, 10, 12, 16, 24, 32})) {
+            auto bench = suite.Case("cpu_scaling", {{"tasks", std::to_string(n)}});
+            while(bench.Next()) {
+                bench.Start();
+                auto master = CPUWorkMaster::Create(Scheduler(), pe::Priority::eHigh,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, n, kCPUBenchDuration);
+                auto result = co_await master;
+                bench.Stop(std::get<1>(result));
+            }
         }
 
         pe::ioprint(pe::TextColor::eYellow, "Starting message sending benchmark...");
-        std::size_t nmsgpairs[] = {1, 2, 3, 4, 5, 6, 8, 12, 16, 18};
-        for(int i = 0; i < std::size(nmsgpairs); i++) {
-            const std::size_t n = nmsgpairs[i];
-            auto master = SenderReceiverMaster::Create(Scheduler(), pe::Priority::eHigh,
-                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, n, kMessageBenchDuration);
-            auto result = co_await master;
-            auto seconds = std::get<0>(result).count() / 1'000'000.0f;
-            auto nsends = std::get<1>(result);
-            pe::dbgprint(nsends, "messages sent by", n, "task(s) in", 
-                seconds, "secs (", pe::fmt::cat{}, nsends / seconds,
-                "messages per second)");
+        for(std::size_t n : suite.Threads({1, 2, 3, 4, 5, 6, 8, 12, 16, 18})) {
+            auto bench = suite.Case("messages", {{"pairs", std::to_string(n)}});
+            while(bench.Next()) {
+                bench.Start();
+                auto master = SenderReceiverMaster::Create(Scheduler(), pe::Priority::eHigh,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, n, kMessageBenchDuration);
+                auto result = co_await master;
+                bench.Stop(std::get<1>(result));
+            }
+        }
+
+        pe::ioprint(pe::TextColor::eYellow, "Starting mailbox benchmark...");
+        for(std::size_t n : suite.Threads({1, 2, 4, 8, 16, 32})) {
+            for(bool batched : {false, true}) {
+                auto bench = suite.Case("mailbox", {{"senders", std::to_string(n)},
+                    {"receive", batched ? "batch" : "single"}});
+                while(bench.Next()) {
+                    bench.Start();
+                    auto master = MailboxMaster::Create(Scheduler(), pe::Priority::eHigh,
+                        pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, n, batched, 
+                        kMessageBenchDuration);
+                    auto result = co_await master;
+                    bench.Stop(std::get<1>(result));
+                }
+            }
+        }
+
+        pe::ioprint(pe::TextColor::eYellow, "Starting message latency benchmark...");
+        std::size_t nmsgs[] = {10'000, 100'000};
+        for(std::size_t n : nmsgs) {
+            auto bench = suite.Case("message_latency", {{"messages", std::to_string(n)}});
+            while(bench.Next()) {
+                /* Timed with Start/Stop to also get the cache
+                 * miss counts of the round trips.
+                 */
+                bench.Start();
+                auto master = PingPongMaster::Create(Scheduler(), pe::Priority::eHigh,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, n);
+                auto result = co_await master;
+                bench.Stop(std::get<1>(result));
+            }
         }
 
         pe::ioprint(pe::TextColor::eYellow, "Starting notification benchmark...");
-        std::size_t nnotifypairs[] = {1, 2, 3, 4, 5, 6, 8};
-        for(int i = 0; i < std::size(nnotifypairs); i++) {
-            const std::size_t n = nnotifypairs[i];
-            auto master = EventProducerConsumerMaster::Create(Scheduler(), pe::Priority::eHigh,
-                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, n, kNotifyBenchDuration);
-            auto result = co_await master;
-            auto seconds = std::get<0>(result).count() / 1'000'000.0f;
-            auto nnotifies = std::get<1>(result);
-            pe::dbgprint(nnotifies, "notifications sent by", n, "task(s) in", 
-                seconds, "secs (", pe::fmt::cat{}, nnotifies / seconds,
-                "notifications per second)");
+        for(std::size_t n : suite.Threads({1, 2, 3, 4, 5, 6, 8})) {
+            auto bench = suite.Case("notifications", {{"pairs", std::to_string(n)}});
+            while(bench.Next()) {
+                bench.Start();
+                auto master = EventProducerConsumerMaster::Create(Scheduler(), pe::Priority::eHigh,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, n, kNotifyBenchDuration);
+                auto result = co_await master;
+                bench.Stop(std::get<1>(result));
+            }
         }
 
         pe::ioprint(pe::TextColor::eYellow, "Starting task creation benchmark...");
         std::size_t ncreated[] = {1'000, 10'000, 50'000, 100'000};
-        for(int i = 0; i < std::size(ncreated); i++) {
-            const std::size_t n = ncreated[i];
-            auto master = TaskCreationMaster::Create(Scheduler(), pe::Priority::eHigh,
-                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, n);
-            auto result = co_await master;
-            auto seconds = std::get<0>(result).count() / 1'000'000.0f;
-            pe::dbgprint(n, "tasks created in",
-                seconds, "secs (", pe::fmt::cat{}, n / seconds,
-                "tasks per second)");
+        for(std::size_t n : ncreated) {
+            auto bench = suite.Case("task_creation", {{"tasks", std::to_string(n)}});
+            while(bench.Next()) {
+                /* Only the creation of the tasks is timed
+                 * by the master task.
+                 */
+                auto master = TaskCreationMaster::Create(Scheduler(), pe::Priority::eHigh,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, n);
+                auto result = co_await master;
+                bench.Record(std::get<0>(result), n);
+            }
+        }
+
+        pe::ioprint(pe::TextColor::eYellow, "Starting root task creation benchmark...");
+        for(std::size_t n : suite.Threads({1, 2, 4, 8, 16})) {
+            auto bench = suite.Case("root_task_creation", {{"spawners", std::to_string(n)}});
+            while(bench.Next()) {
+                auto master = RootCreationMaster::Create(Scheduler(), pe::Priority::eHigh,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, n);
+                auto result = co_await master;
+                bench.Record(std::get<0>(result), std::get<1>(result));
+            }
+        }
+
+        pe::ioprint(pe::TextColor::eYellow, "Starting hand-off benchmark...");
+        std::size_t nhandoffs[] = {10'000, 100'000, 1'000'000};
+        for(std::size_t n : nhandoffs) {
+            auto bench = suite.Case("generator", {{"values", std::to_string(n)}});
+            while(bench.Next()) {
+                auto master = GeneratorMaster::Create(Scheduler(), pe::Priority::eHigh,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, n);
+                auto result = co_await master;
+                bench.Record(std::get<0>(result), n);
+            }
+        }
+        for(std::size_t n : nhandoffs) {
+            auto bench = suite.Case("call_return", {{"calls", std::to_string(n)}});
+            while(bench.Next()) {
+                auto master = CallMaster::Create(Scheduler(), pe::Priority::eHigh,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, n);
+                auto result = co_await master;
+                bench.Record(std::get<0>(result), n);
+            }
+        }
+
+        pe::ioprint(pe::TextColor::eYellow, "Starting stream benchmark...");
+        constexpr std::size_t kNumStreamed = 1'000'000;
+        uint32_t capacities[] = {1, 64, 4096};
+        for(uint32_t capacity : capacities) {
+            for(bool batched : {false, true}) {
+                auto bench = suite.Case("stream", {{"buffer", std::to_string(capacity)},
+                    {"consume", batched ? "batch" : "single"}});
+                while(bench.Next()) {
+                    auto master = StreamMaster::Create(Scheduler(), pe::Priority::eHigh,
+                        pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, 
+                        capacity, batched, kNumStreamed);
+                    auto result = co_await master;
+                    bench.Record(std::get<0>(result), std::get<1>(result));
+                }
+            }
+        }
+
+        pe::ioprint(pe::TextColor::eYellow, "Starting lock contention benchmark...");
+        std::pair<LockKind, const char*> lock_kinds[] = {
+            {LockKind::eAsyncMutex,       "async_mutex"},
+            {LockKind::eStdMutex,         "std_mutex"},
+            {LockKind::eAsyncSharedMutex, "async_shared_mutex"},
+            {LockKind::eAsyncSemaphore,   "async_semaphore"},
+        };
+        std::size_t ncontenders[] = {2, 4, 8, 16, 32, 64};
+        for(auto [kind, name] : lock_kinds) {
+            for(std::size_t n : ncontenders) {
+                auto bench = suite.Case("lock_contention", 
+                    {{"lock", name}, {"tasks", std::to_string(n)}});
+                while(bench.Next()) {
+                    auto master = LockContentionMaster::Create(Scheduler(), pe::Priority::eHigh,
+                        pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, kind, n);
+                    auto result = co_await master;
+                    bench.Record(std::get<0>(result), std::get<1>(result));
+                }
+            }
+        }
+
+        pe::ioprint(pe::TextColor::eYellow, "Starting speculative search benchmark...");
+        for(bool cancel : {false, true}) {
+            auto bench = suite.Case("speculative_search", {{"cancel", cancel ? "yes" : "no"}});
+            while(bench.Next()) {
+                /* The item count is the number of work chunks which 
+                 * were actually executed, i.e. the CPU time spent.
+                 */
+                auto master = SpeculativeSearchMaster::Create(Scheduler(), pe::Priority::eHigh,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, cancel);
+                auto result = co_await master;
+                bench.Record(std::get<0>(result), std::get<1>(result));
+            }
+        }
+
+        pe::ioprint(pe::TextColor::eYellow, "Starting critical task latency benchmark...");
+        for(bool cooperative : {false, true}) {
+            auto bench = suite.Case("critical_latency", 
+                {{"burner", cooperative ? "cooperative" : "greedy"}});
+            while(bench.Next()) {
+                bench.Start();
+                auto master = CriticalLatencyMaster::Create(Scheduler(), pe::Priority::eHigh,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, cooperative);
+                auto latencies = co_await master;
+                std::size_t nprobes = std::size(latencies);
+                bench.Stop(nprobes, std::move(latencies));
+            }
+        }
+
+        pe::ioprint(pe::TextColor::eYellow, "Starting actor frame benchmark...");
+        std::size_t nactors[] = {16, 64, 256};
+        for(std::size_t n : nactors) {
+            for(auto affinity : {pe::Affinity::eAny, pe::Affinity::eSticky}) {
+                auto bench = suite.Case("actor_frames", {{"actors", std::to_string(n)},
+                    {"affinity", affinity == pe::Affinity::eSticky ? "sticky" : "any"}});
+                while(bench.Next()) {
+                    /* The latencies are the frame times, while the
+                     * cache misses show the working sets migrating.
+                     */
+                    bench.Start();
+                    auto master = ActorFrameMaster::Create(Scheduler(), pe::Priority::eHigh,
+                        pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, affinity, n);
+                    auto frame_times = co_await master;
+                    bench.Stop(kActorFrames * n, std::move(frame_times));
+                }
+            }
         }
 
         pe::ioprint(pe::TextColor::eGreen, "Benchmarking finished");
@@ -397,14 +1193,23 @@ class Benchmarker : public pe::Task<void, Benchmarker>
     }
 };
 
-int main()
+int main(int argc, char **argv)
 {
     int ret = EXIT_SUCCESS;
     try{
 
-        pe::Scheduler scheduler{};
-        auto tester = Benchmarker::Create(scheduler);
-        scheduler.Run();
+        /* Must be created before the scheduler's worker
+         * threads in order for them to inherit the
+         * hardware counters.
+         */
+        pe::BenchmarkSuite suite{"scheduler", argc, argv};
+        {
+            pe::Scheduler scheduler{};
+            auto tester = Benchmarker::Create(scheduler, pe::Priority::eNormal,
+                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, suite);
+            scheduler.Run();
+        }
+        suite.Finish();
 
     }catch(pe::TaskException &e) {
 
@@ -423,4 +1228,3 @@ int main()
     }
     return ret;
 }
-
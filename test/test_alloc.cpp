@@ -28,6 +28,10 @@ import <future>;
 import <optional>;
 import <array>;
 import <random>;
+import <cstring>;
+import <new>;
+import <thread>;
+import <atomic>;
 
 
 constexpr int kNumDescriptors = 1024;
@@ -192,6 +196,69 @@ void test_allocator_single_thread(pe::Allocator& alloc)
     }
 }
 
+void test_thread_cache_budget(pe::Allocator& alloc)
+{
+    constexpr std::size_t kBlockSize = 64;
+    std::vector<void*> allocations(kNumBlocks);
+
+    for(int i = 0; i < 4; i++) {
+        for(auto& allocation : allocations) {
+            allocation = alloc.Allocate(kBlockSize);
+            pe::assert(allocation != nullptr);
+        }
+        for(auto allocation : allocations) {
+            alloc.Free(allocation);
+        }
+        /* Freeing more blocks than the budget allows must have
+         * returned the excess to the heap.
+         */
+        auto stats = alloc.GetThreadCacheStats();
+        pe::assert(stats.m_cached_bytes <= stats.m_budget_bytes);
+        pe::assert(stats.m_cached_bytes < kNumBlocks * kBlockSize);
+    }
+}
+
+void test_sized_free(pe::Allocator& alloc)
+{
+    constexpr std::array<std::size_t, 8> kSizes{
+        8, 24, 100, 512, 4000, 16384, 65536, 1048576
+    };
+    std::vector<void*> allocations;
+
+    for(int i = 0; i < kNumBlocks; i++) {
+        allocations.push_back(alloc.Allocate(kSizes[i % std::size(kSizes)]));
+    }
+    for(int i = 0; i < kNumBlocks; i++) {
+        alloc.Free(allocations[i], kSizes[i % std::size(kSizes)]);
+    }
+}
+
+void test_large_blocks(pe::Allocator& alloc)
+{
+    constexpr std::size_t kLargeSize = 256 * 1024;
+    constexpr std::array<std::size_t, 4> kAlignments{
+        8192, 64 * 1024, 1024 * 1024, 4 * 1024 * 1024
+    };
+
+    for(std::size_t alignment : kAlignments) {
+        void *ptr = alloc.AllocateAligned(kLargeSize, std::align_val_t{alignment});
+        pe::assert(ptr != nullptr);
+        pe::assert(reinterpret_cast<uintptr_t>(ptr) % alignment == 0);
+        std::memset(ptr, 0x1, kLargeSize);
+        alloc.FreeAligned(ptr, std::align_val_t{alignment});
+    }
+
+    /* A freed mapping is recycled for a block of a similar size.
+     */
+    void *first = alloc.Allocate(kLargeSize);
+    std::memset(first, 0x1, kLargeSize);
+    alloc.Free(first);
+    void *second = alloc.Allocate(kLargeSize - 4096);
+    pe::assert(second == first);
+    pe::assert(alloc.AllocationSize(second) == kLargeSize - 4096);
+    alloc.Free(second);
+}
+
 void allocator(pe::Allocator& alloc, pe::LockfreeQueue<void*>& queue)
 {
     std::default_random_engine generator;
@@ -231,6 +298,49 @@ void deallocator(pe::Allocator& alloc,
     }
 }
 
+/* Constructed before the thread's cache, so it is destroyed
+ * after the cache is already gone.
+ */
+struct LateFreer
+{
+    static constexpr std::array<std::size_t, 4> kSizes{16, 256, 4096, 1048576};
+
+    pe::Allocator&                    m_alloc;
+    std::atomic_bool&                 m_done;
+    std::array<void*, kSizes.size()>  m_blocks{};
+
+    ~LateFreer()
+    {
+        auto stats = m_alloc.GetThreadCacheStats();
+        pe::assert(stats.m_overhead_bytes == 0);
+
+        for(void *block : m_blocks) {
+            m_alloc.Free(block);
+        }
+        for(std::size_t size : kSizes) {
+            void *block = m_alloc.Allocate(size);
+            std::memset(block, 0x1, size);
+            m_alloc.Free(block, size);
+        }
+        m_done.store(true, std::memory_order_release);
+    }
+};
+
+void test_free_after_thread_cache(pe::Allocator& alloc)
+{
+    std::atomic_bool done{false};
+    std::thread thread{[&alloc, &done](){
+        thread_local LateFreer late{alloc, done};
+        for(std::size_t i = 0; i < std::size(LateFreer::kSizes); i++) {
+            late.m_blocks[i] = alloc.Allocate(LateFreer::kSizes[i]);
+            std::memset(late.m_blocks[i], 0x1, LateFreer::kSizes[i]);
+        }
+        pe::assert(alloc.GetThreadCacheStats().m_overhead_bytes > 0);
+    }};
+    thread.join();
+    pe::assert(done.load(std::memory_order_acquire));
+}
+
 void test_allocator_multi_thread(pe::Allocator& alloc)
 {
     std::vector<std::future<void>> tasks{};
@@ -266,6 +376,10 @@ int main()
         test_descriptor_list();
         test_pagemap();
         test_allocator_single_thread(alloc);
+        test_thread_cache_budget(alloc);
+        test_sized_free(alloc);
+        test_large_blocks(alloc);
+        test_free_after_thread_cache(alloc);
         test_allocator_multi_thread(alloc);
 
         pe::ioprint(pe::TextColor::eGreen, "Finished memory allocation test.");
@@ -0,0 +1,196 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+import chase_lev_deque;
+import platform;
+import logger;
+import assert;
+
+import <cstdlib>;
+import <atomic>;
+import <optional>;
+import <string>;
+import <vector>;
+import <future>;
+import <numeric>;
+import <algorithm>;
+import <exception>;
+import <memory>;
+import <type_traits>;
+
+
+constexpr int kNumThieves = 8;
+constexpr int kNumValues = 200'000;
+constexpr int kPopInterval = 3;
+
+void test_single_threaded()
+{
+    pe::ChaseLevDeque<int> deque{};
+    pe::assert(deque.Empty());
+    pe::assert(!deque.Pop().has_value());
+    pe::assert(!deque.Steal().has_value());
+
+    /* Push enough values to force the buffer to grow a few times */
+    for(int i = 0; i < 1000; i++) {
+        deque.Push(i);
+    }
+    pe::assert(deque.Size() == 1000);
+
+    /* The owner pops from the bottom and thieves steal from the top */
+    pe::assert(deque.Pop().value() == 999);
+    pe::assert(deque.Steal().value() == 0);
+    pe::assert(deque.Steal().value() == 1);
+    pe::assert(deque.Pop().value() == 998);
+
+    int expected = 997;
+    while(auto value = deque.Pop()) {
+        pe::assert(value.value() == expected--);
+    }
+    pe::assert(expected == 1);
+    pe::assert(deque.Empty());
+
+    /* Wrap around the circular buffer without growing it */
+    for(int i = 0; i < 10'000; i++) {
+        deque.Push(i);
+        deque.Push(i + 1);
+        pe::assert(deque.Steal().value() == i);
+        pe::assert(deque.Pop().value() == i + 1);
+    }
+    pe::assert(deque.Empty());
+}
+
+/* Not trivially copyable, but trivially relocatable, so it
+ * is stored directly in the deque's slots.
+ */
+struct Relocatable
+{
+    using trivially_relocatable = std::true_type;
+
+    std::unique_ptr<int> m_value;
+};
+
+static_assert(pe::TriviallyRelocatable<Relocatable>);
+static_assert(!std::is_trivially_copyable_v<Relocatable>);
+
+/* The owner pushes all the values, occasionally popping
+ * some back, while the thieves are stealing concurrently.
+ * Every value must be taken exactly once. The values own 
+ * heap memory so that a double free or a torn copy of a 
+ * value that was not won would be caught.
+ */
+template <typename T, typename Make, typename Get>
+void test_owner_and_thieves(Make make, Get get)
+{
+    pe::ChaseLevDeque<T> deque{};
+    std::atomic_bool done{false};
+    std::vector<std::vector<int>> taken(kNumThieves + 1);
+
+    std::vector<std::future<void>> thieves{};
+    for(int i = 0; i < kNumThieves; i++) {
+        thieves.push_back(std::async(std::launch::async, [&, i](){
+            while(true) {
+                bool finished = done.load(std::memory_order_acquire);
+                auto value = deque.Steal();
+                if(value.has_value()) {
+                    taken[i].push_back(get(value.value()));
+                    continue;
+                }
+                if(finished)
+                    break;
+            }
+        }));
+    }
+
+    auto& owner = taken[kNumThieves];
+    for(int i = 0; i < kNumValues; i++) {
+        deque.Push(make(i));
+        if(i % kPopInterval == 0) {
+            if(auto value = deque.Pop())
+                owner.push_back(get(value.value()));
+        }
+    }
+    while(auto value = deque.Pop()) {
+        owner.push_back(get(value.value()));
+    }
+    done.store(true, std::memory_order_release);
+
+    for(const auto& thief : thieves) {
+        thief.wait();
+    }
+
+    std::vector<int> all{};
+    for(const auto& values : taken) {
+        all.insert(std::end(all), std::begin(values), std::end(values));
+    }
+    std::sort(std::begin(all), std::end(all));
+
+    std::vector<int> expected(kNumValues);
+    std::iota(std::begin(expected), std::end(expected), 0);
+    pe::assert(all == expected);
+    pe::assert(deque.Empty());
+
+    /* Values left in the deque are destroyed along with it */
+    for(int i = 0; i < kNumValues / 100; i++) {
+        deque.Push(make(i));
+    }
+
+    std::size_t nstolen = std::size(all) - std::size(owner);
+    pe::dbgprint("The thieves stole", nstolen, "of", kNumValues, "value(s).");
+}
+
+int main()
+{
+    int ret = EXIT_SUCCESS;
+    try{
+
+        pe::ioprint(pe::TextColor::eGreen, "Starting single-threaded test.");
+        test_single_threaded();
+        pe::ioprint(pe::TextColor::eGreen, "Finished single-threaded test.");
+
+        pe::ioprint(pe::TextColor::eGreen, "Starting owner and thieves test.");
+        pe::dbgtime<true>([&](){
+            test_owner_and_thieves<std::string>(
+                [](int i){ return std::to_string(i); },
+                [](const std::string& value){ return std::stoi(value); });
+        }, [&](uint64_t delta) {
+            pe::dbgprint("Chase-Lev deque test with", kNumValues, "boxed value(s) took",
+                pe::rdtsc_usec(delta), "microseconds.");
+        });
+        pe::dbgtime<true>([&](){
+            test_owner_and_thieves<Relocatable>(
+                [](int i){ return Relocatable{std::make_unique<int>(i)}; },
+                [](const Relocatable& value){ return *value.m_value; });
+        }, [&](uint64_t delta) {
+            pe::dbgprint("Chase-Lev deque test with", kNumValues, "inline value(s) took",
+                pe::rdtsc_usec(delta), "microseconds.");
+        });
+        pe::ioprint(pe::TextColor::eGreen, "Finished owner and thieves test.");
+
+    }catch(std::exception &e){
+
+        pe::ioprint(pe::LogLevel::eError, "Unhandled std::exception:", e.what());
+        ret = EXIT_FAILURE;
+
+    }catch(...){
+
+        pe::ioprint(pe::LogLevel::eError, "Unknown unhandled exception.");
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
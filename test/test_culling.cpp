@@ -0,0 +1,237 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+import culling;
+import batch_math;
+import ecs;
+import sync;
+import nvector;
+import nmatrix;
+import assert;
+import logger;
+
+import <cstdlib>;
+import <cstdint>;
+import <cmath>;
+import <array>;
+import <vector>;
+import <algorithm>;
+
+
+constexpr std::size_t kNumVolumes = 10'003;
+constexpr std::size_t kNumPlanes = 6;
+
+struct Prop
+    : public pe::Entity<Prop, pe::World<>>
+    , public pe::WithComponent<Prop, pe::BoundingSphere>
+{};
+
+struct Building
+    : public pe::Entity<Building, pe::World<>>
+    , public pe::WithComponent<Building, pe::BoundingBox>
+{};
+
+/* Deterministic values in the range [-10, 10).
+ */
+float next_value(uint32_t& state)
+{
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) / static_cast<float>(1u << 24) * 20.0f - 10.0f;
+}
+
+bool test_bit(std::span<const uint64_t> mask, std::size_t i)
+{
+    return (mask[i / 64] >> (i % 64)) & 1;
+}
+
+void test_kernels()
+{
+    uint32_t state = 1;
+
+    std::array<pe::Vec4f, kNumPlanes> planes;
+    for(auto& plane : planes) {
+        pe::Vec3f normal{next_value(state), next_value(state), next_value(state)};
+        normal.Normalize();
+        plane = {normal.x(), normal.y(), normal.z(), std::fabs(next_value(state))};
+    }
+
+    std::vector<float> xs(kNumVolumes), ys(kNumVolumes), zs(kNumVolumes);
+    std::vector<float> rs(kNumVolumes), exs(kNumVolumes), eys(kNumVolumes), ezs(kNumVolumes);
+    for(std::size_t i = 0; i < kNumVolumes; i++) {
+        xs[i] = next_value(state);
+        ys[i] = next_value(state);
+        zs[i] = next_value(state);
+        rs[i] = std::fabs(next_value(state)) * 0.2f;
+        exs[i] = std::fabs(next_value(state)) * 0.2f;
+        eys[i] = std::fabs(next_value(state)) * 0.2f;
+        ezs[i] = std::fabs(next_value(state)) * 0.2f;
+    }
+
+    /* Reference results, marking the volumes that are too
+     * close to a plane to be classified reliably in single
+     * precision.
+     */
+    std::vector<bool> sphere_visible(kNumVolumes), box_visible(kNumVolumes);
+    std::vector<bool> ambiguous(kNumVolumes);
+    for(std::size_t i = 0; i < kNumVolumes; i++) {
+        bool sphere_in = true, box_in = true;
+        for(const auto& plane : planes) {
+            double d = double(plane.x()) * xs[i] + double(plane.y()) * ys[i]
+                     + double(plane.z()) * zs[i] + plane.w();
+            double r = std::fabs(plane.x()) * exs[i] + std::fabs(plane.y()) * eys[i]
+                     + std::fabs(plane.z()) * ezs[i];
+            sphere_in = sphere_in && (d + rs[i] >= 0);
+            box_in = box_in && (d + r >= 0);
+            if(std::fabs(d + rs[i]) < 1e-3 || std::fabs(d + r) < 1e-3)
+                ambiguous[i] = true;
+        }
+        sphere_visible[i] = sphere_in;
+        box_visible[i] = box_in;
+    }
+
+    pe::SIMDLevel levels[] = {pe::SIMDLevel::eScalar, pe::SIMDLevel::eSSE, pe::SIMDLevel::eAVX2};
+    for(auto level : levels) {
+        std::vector<uint64_t> sphere_mask((kNumVolumes + 63) / 64, ~uint64_t{0});
+        std::vector<uint64_t> box_mask((kNumVolumes + 63) / 64, ~uint64_t{0});
+        pe::CullSpheres(planes, pe::ConstSpheresSoA{xs, ys, zs, rs}, sphere_mask, level);
+        pe::CullBoxes(planes, pe::ConstBoxesSoA{xs, ys, zs, exs, eys, ezs}, box_mask, level);
+
+        std::size_t nvisible = 0;
+        for(std::size_t i = 0; i < kNumVolumes; i++) {
+            nvisible += test_bit(sphere_mask, i);
+            if(ambiguous[i])
+                continue;
+            pe::assert(test_bit(sphere_mask, i) == sphere_visible[i], "Sphere culling mismatch");
+            pe::assert(test_bit(box_mask, i) == box_visible[i], "Box culling mismatch");
+        }
+        for(std::size_t i = kNumVolumes; i < sphere_mask.size() * 64; i++) {
+            pe::assert(!test_bit(sphere_mask, i), "Bit set past the last volume");
+        }
+
+        std::vector<uint32_t> indices(kNumVolumes);
+        std::size_t count = pe::CompactVisible(sphere_mask, indices);
+        pe::assert(count == nvisible);
+        pe::assert(std::is_sorted(indices.begin(), indices.begin() + count));
+        for(std::size_t i = 0; i < count; i++) {
+            pe::assert(test_bit(sphere_mask, indices[i]));
+        }
+    }
+
+    /* A camera at the origin looking down the negative z axis.
+     */
+    auto proj = pe::Mat4f::Perspective(M_PI / 2.0f, 1.0f, 0.1f, 100.0f);
+    auto frustum = pe::FrustumPlanes(proj);
+    auto point_visible = [&](pe::Vec3f point, float radius){
+        std::array<uint64_t, 1> mask{};
+        float x = point.x(), y = point.y(), z = point.z();
+        pe::CullSpheres(frustum, pe::ConstSpheresSoA{{&x, 1}, {&y, 1}, {&z, 1}, {&radius, 1}}, mask);
+        return test_bit(mask, 0);
+    };
+    pe::assert(point_visible({0.0f, 0.0f, -5.0f}, 0.0f));
+    pe::assert(point_visible({4.0f, -4.0f, -5.0f}, 0.0f));
+    pe::assert(!point_visible({0.0f, 0.0f, 5.0f}, 0.0f));
+    pe::assert(!point_visible({0.0f, 0.0f, -200.0f}, 0.0f));
+    pe::assert(!point_visible({10.0f, 0.0f, -5.0f}, 0.0f));
+    pe::assert(point_visible({10.0f, 0.0f, -5.0f}, 5.0f));
+}
+
+class Tester : public pe::Task<void, Tester>
+{
+    using Task<void, Tester>::Task;
+
+    virtual Tester::handle_type Run()
+    {
+        pe::ioprint(pe::TextColor::eYellow, "Testing visibility queries...");
+
+        /* Props are laid out along the x axis and buildings
+         * along the z axis.
+         */
+        std::vector<Prop> props(kNumVolumes);
+        std::vector<Building> buildings(kNumVolumes);
+        for(std::size_t i = 0; i < kNumVolumes; i++) {
+            props[i].Set<pe::BoundingSphere>({pe::Vec3f{float(i), 0.0f, 0.0f}, 0.25f});
+            buildings[i].Set<pe::BoundingBox>({pe::Vec3f{0.0f, 5.0f, float(i)},
+                pe::Vec3f{0.25f, 0.25f, 0.25f}});
+        }
+
+        /* Two views, each only seeing one kind of volume */
+        std::array<pe::Vec4f, 2> slab_x{pe::Vec4f{1, 0, 0, -99.5f}, pe::Vec4f{-1, 0, 0, 200.5f}};
+        std::array<pe::Vec4f, 1> above{pe::Vec4f{0, 1, 0, -1.0f}};
+
+        pe::VisibilityQuery<> query{};
+        query.AddView(slab_x);
+        query.AddView(above);
+        query.Update();
+        pe::assert(query.NumSpheres() == kNumVolumes);
+        pe::assert(query.NumBoxes() == kNumVolumes);
+
+        auto expected_slab = query.Visible(0);
+        auto expected_above = query.Visible(1);
+        pe::assert(expected_slab.size() == 101);
+        pe::assert(expected_above.size() == kNumVolumes);
+        for(std::size_t i = 0; i < kNumVolumes; i++) {
+            bool in_slab = (i >= 100) && (i <= 200);
+            pe::assert(test_bit(query.SphereMask(0), i) == in_slab);
+            pe::assert(!test_bit(query.SphereMask(1), i));
+            pe::assert(!test_bit(query.BoxMask(0), i));
+            pe::assert(test_bit(query.BoxMask(1), i));
+        }
+
+        co_await pe::CullVisible<>::Create(Scheduler(), pe::Priority::eNormal,
+            pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, query);
+        pe::assert(query.Visible(0) == expected_slab, "Parallel query mismatch");
+        pe::assert(query.Visible(1) == expected_above, "Parallel query mismatch");
+
+        pe::ioprint(pe::TextColor::eYellow, "Testing visibility queries finished");
+        Broadcast<pe::EventType::eQuit>();
+        co_return;
+    }
+};
+
+int main()
+{
+    int ret = EXIT_SUCCESS;
+    try{
+
+        pe::ioprint(pe::TextColor::eGreen, "Starting Culling test.");
+        test_kernels();
+        {
+            pe::Scheduler scheduler{};
+            auto tester = Tester::Create(scheduler);
+            scheduler.Run();
+        }
+        pe::ioprint(pe::TextColor::eGreen, "Finished Culling test.");
+
+    }catch(pe::TaskException &e) {
+
+        e.Print();
+        ret = EXIT_FAILURE;
+
+    }catch(std::exception &e){
+
+        pe::ioprint(pe::LogLevel::eError, "Unhandled std::exception:", e.what());
+        ret = EXIT_FAILURE;
+
+    }catch(...){
+
+        pe::ioprint(pe::LogLevel::eError, "Unknown unhandled exception.");
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
@@ -0,0 +1,199 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+import frame_arena;
+import flat_hash_map;
+import logger;
+import assert;
+
+import <cstdlib>;
+import <cstdint>;
+import <cstring>;
+import <vector>;
+import <thread>;
+import <functional>;
+import <exception>;
+import <new>;
+import <limits>;
+
+
+constexpr std::size_t kNumElements = 100'000;
+constexpr std::size_t kNumFrames = 64;
+constexpr std::size_t kNumThreads = 8;
+
+void test_lifetime()
+{
+    /* Data allocated during a frame must stay intact
+     * throughout the following frame.
+     */
+    std::byte *prev = nullptr;
+    for(std::size_t frame = 0; frame < kNumFrames; frame++) {
+        pe::FrameArena::NewFrame();
+        auto *curr = static_cast<std::byte*>(pe::FrameArena::Allocate(4096));
+        std::memset(curr, static_cast<int>(frame % 256), 4096);
+        if(prev) {
+            for(std::size_t i = 0; i < 4096; i++) {
+                pe::assert(prev[i] == std::byte((frame - 1) % 256));
+            }
+        }
+        prev = curr;
+    }
+    pe::dbgprint("Frame data lives across one frame boundary");
+}
+
+void test_alignment()
+{
+    pe::FrameArena::NewFrame();
+    for(std::size_t alignment = 1; alignment <= 4096; alignment *= 2) {
+        void *ptr = pe::FrameArena::Allocate(3, alignment);
+        pe::assert(reinterpret_cast<uintptr_t>(ptr) % alignment == 0);
+    }
+    /* Oversized blocks are placed in dedicated chunks.
+     */
+    void *big = pe::FrameArena::Allocate(4 * 1024 * 1024, 64);
+    pe::assert(reinterpret_cast<uintptr_t>(big) % 64 == 0);
+    std::memset(big, 0x1, 4 * 1024 * 1024);
+}
+
+void test_oversized()
+{
+    /* An oversized block whose chunk happens to round up to the
+     * regular chunk size must still not be bump-allocated from.
+     */
+    constexpr std::size_t kBigSize = 256 * 1024 - 4096;
+    pe::FrameArena::NewFrame();
+    pe::FrameArena::NewFrame();
+    auto *big = static_cast<std::byte*>(pe::FrameArena::Allocate(kBigSize));
+    std::memset(big, 0xab, kBigSize);
+    for(std::size_t i = 0; i < kNumElements; i++) {
+        auto *small = pe::FrameArena::Allocate(64);
+        std::memset(small, 0x00, 64);
+    }
+    for(std::size_t i = 0; i < kBigSize; i++) {
+        pe::assert(big[i] == std::byte{0xab});
+    }
+    pe::dbgprint("Oversized blocks keep their chunk to themselves");
+
+    /* A size which would wrap around when the chunk header and
+     * alignment padding are added must be rejected.
+     */
+    bool threw = false;
+    try{
+        pe::FrameArena::Allocate(std::numeric_limits<std::size_t>::max() - 16, 64);
+    }catch(std::bad_alloc&) {
+        threw = true;
+    }
+    pe::assert(threw);
+}
+
+void test_reset()
+{
+    pe::FrameArena::NewFrame();
+    for(std::size_t i = 0; i < kNumElements; i++) {
+        pe::FrameArena::Allocate(64);
+    }
+    auto stats = pe::FrameArena::GetStats();
+    pe::assert(stats.m_allocated_bytes >= kNumElements * 64);
+
+    /* After two frames, the arena is reset and its' chunks reused.
+     */
+    pe::FrameArena::NewFrame();
+    pe::FrameArena::NewFrame();
+    pe::FrameArena::Allocate(64);
+    auto after = pe::FrameArena::GetStats();
+    pe::assert(after.m_allocated_bytes == 64);
+    pe::assert(after.m_mapped_bytes <= stats.m_mapped_bytes);
+}
+
+void test_containers()
+{
+    pe::FrameArena::NewFrame();
+
+    std::vector<uint64_t, pe::FrameAllocator<uint64_t>> vector;
+    for(std::size_t i = 0; i < kNumElements; i++) {
+        vector.push_back(i);
+    }
+    for(std::size_t i = 0; i < kNumElements; i++) {
+        pe::assert(vector[i] == i);
+    }
+
+    pe::FlatHashMap<int, int, std::hash<int>, std::equal_to<int>,
+        pe::FrameAllocator<int>, pe::FrameAllocator<int>, 
+        pe::FrameAllocator<uint8_t>> map{};
+    for(int i = 0; i < static_cast<int>(kNumElements); i++) {
+        map.insert({i, -i});
+    }
+    for(int i = 0; i < static_cast<int>(kNumElements); i++) {
+        pe::assert(map.find(i) != map.end());
+        pe::assert(map.find(i)->second == -i);
+    }
+    pe::dbgprint("Frame allocations:", pe::FrameArena::GetStats().m_allocated_bytes, "bytes");
+}
+
+void test_threads()
+{
+    /* Every thread allocates from its' own arenas.
+     */
+    std::vector<std::thread> threads;
+    for(std::size_t i = 0; i < kNumThreads; i++) {
+        threads.emplace_back([i]{
+            std::vector<std::byte*> blocks;
+            for(std::size_t j = 0; j < kNumElements / kNumThreads; j++) {
+                auto block = static_cast<std::byte*>(pe::FrameArena::Allocate(32));
+                std::memset(block, static_cast<int>(i), 32);
+                blocks.push_back(block);
+            }
+            for(auto block : blocks) {
+                pe::assert(block[0] == std::byte(i) && block[31] == std::byte(i));
+            }
+        });
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+}
+
+int main()
+{
+    int ret = EXIT_SUCCESS;
+
+    try{
+
+        pe::ioprint(pe::TextColor::eGreen, "Testing frame arena.");
+        test_lifetime();
+        test_alignment();
+        test_oversized();
+        test_reset();
+        test_containers();
+        test_threads();
+        pe::ioprint(pe::TextColor::eGreen, "Finished frame arena test.");
+
+    }catch(std::exception &e){
+
+        pe::ioprint(pe::LogLevel::eError, "Unhandled std::exception:", e.what());
+        ret = EXIT_FAILURE;
+
+    }catch(...){
+
+        pe::ioprint(pe::LogLevel::eError, "Unknown unhandled exception.");
+        ret = EXIT_FAILURE;
+    }
+
+    return ret;
+}
+
@@ -0,0 +1,260 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <malloc.h>
+
+import logger;
+import assert;
+import alloc;
+import unistd;
+
+import <new>;
+import <cstdlib>;
+import <cerrno>;
+import <cstring>;
+import <cstdint>;
+import <array>;
+import <exception>;
+
+/*****************************************************************************/
+/* Allocation overrides - the same as the ones installed by the engine.      */
+/*****************************************************************************/
+
+#if !(defined(__SANITIZE_ADDRESS__) || __has_feature(address_sanitizer))
+void *malloc(size_t size)
+{
+    pe::Allocator& alloc = pe::Allocator::Instance();
+    size = alloc.NextAlignedBlockSize(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    return alloc.Allocate(size);
+}
+
+void *calloc(size_t num, size_t size)
+{
+    pe::Allocator& alloc = pe::Allocator::Instance();
+    size = alloc.NextAlignedBlockSize(num * size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    auto ret = alloc.Allocate(size);
+    std::memset(ret, 0, size);
+    return ret;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    pe::Allocator& alloc = pe::Allocator::Instance();
+    size = alloc.NextAlignedBlockSize(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    return alloc.Reallocate(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    if((alignment == 0) || (alignment & (alignment - 1))) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    pe::Allocator& alloc = pe::Allocator::Instance();
+    return alloc.AllocateAligned(size, std::align_val_t{alignment});
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if((alignment % sizeof(void*)) || (alignment & (alignment - 1)))
+        return EINVAL;
+
+    if(size == 0) {
+        *memptr = nullptr;
+        return 0;
+    }
+
+    void *ret = memalign(alignment, size);
+    if(!ret)
+        return ENOMEM;
+
+    *memptr = ret;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+void *valloc(size_t size)
+{
+    return memalign(getpagesize(), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page_size = getpagesize();
+    size = ((size + page_size - 1) / page_size) * page_size;
+    return memalign(page_size, size);
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    pe::Allocator& alloc = pe::Allocator::Instance();
+    return alloc.AllocationSize(ptr);
+}
+
+void free(void *ptr)
+{
+    pe::Allocator& alloc = pe::Allocator::Instance();
+    alloc.Free(ptr);
+}
+#endif
+
+/*****************************************************************************/
+/* Tests                                                                     */
+/*****************************************************************************/
+
+constexpr std::array<std::size_t, 5> kSizes{
+    24, 1000, 12 * 1024, 256 * 1024, 3 * 1024 * 1024
+};
+
+constexpr std::array<std::size_t, 9> kAlignments{
+    8, 64, 4096, 8192, 16 * 1024, 32 * 1024, 64 * 1024, 1024 * 1024, 4 * 1024 * 1024
+};
+
+bool aligned(void *ptr, std::size_t alignment)
+{
+    return (reinterpret_cast<uintptr_t>(ptr) % alignment) == 0;
+}
+
+void check_block(void *ptr, std::size_t size, std::size_t alignment)
+{
+    pe::assert(ptr != nullptr);
+    pe::assert(aligned(ptr, alignment));
+    pe::assert(malloc_usable_size(ptr) >= size);
+    std::memset(ptr, 0x1, size);
+}
+
+void test_memalign()
+{
+    for(std::size_t alignment : kAlignments) {
+        for(std::size_t size : kSizes) {
+            void *ptr = memalign(alignment, size);
+            check_block(ptr, size, alignment);
+            free(ptr);
+
+            ptr = aligned_alloc(alignment, size);
+            check_block(ptr, size, alignment);
+            free(ptr);
+        }
+    }
+    pe::dbgprint("memalign and aligned_alloc honor alignments of up to",
+        kAlignments.back(), "bytes");
+
+    for(std::size_t alignment : {0, 3, 24, 96, 4097}) {
+        errno = 0;
+        pe::assert(memalign(alignment, 64) == nullptr);
+        pe::assert(errno == EINVAL);
+        errno = 0;
+        pe::assert(aligned_alloc(alignment, 64) == nullptr);
+        pe::assert(errno == EINVAL);
+    }
+    pe::dbgprint("memalign and aligned_alloc reject invalid alignments");
+}
+
+void test_posix_memalign()
+{
+    for(std::size_t alignment : kAlignments) {
+        for(std::size_t size : kSizes) {
+            void *ptr = nullptr;
+            pe::assert(posix_memalign(&ptr, alignment, size) == 0);
+            check_block(ptr, size, alignment);
+            free(ptr);
+        }
+    }
+    void *ptr = nullptr;
+    pe::assert(posix_memalign(&ptr, sizeof(void*) / 2, 64) == EINVAL);
+    pe::assert(posix_memalign(&ptr, 3 * sizeof(void*), 64) == EINVAL);
+    pe::assert(ptr == nullptr);
+    pe::dbgprint("posix_memalign validates its' alignment");
+}
+
+void test_page_aligned()
+{
+    const std::size_t page_size = getpagesize();
+    for(std::size_t size : kSizes) {
+        void *ptr = valloc(size);
+        check_block(ptr, size, page_size);
+        free(ptr);
+
+        std::size_t rounded = ((size + page_size - 1) / page_size) * page_size;
+        ptr = pvalloc(size);
+        check_block(ptr, rounded, page_size);
+        free(ptr);
+    }
+    /* Large sizes must not lose precision when rounded up.
+     */
+    std::size_t huge = 16 * 1024 * 1024 + page_size + 1;
+    void *ptr = pvalloc(huge);
+    check_block(ptr, huge + page_size - 1, page_size);
+    free(ptr);
+    pe::dbgprint("valloc and pvalloc return page-aligned blocks");
+}
+
+void test_realloc_aligned()
+{
+    /* Blocks from the aligned entry points can be grown and
+     * shrunk like any other.
+     */
+    constexpr std::size_t kAlignment = 1024 * 1024;
+    constexpr std::size_t kSize = 64 * 1024;
+    auto *ptr = static_cast<unsigned char*>(memalign(kAlignment, kSize));
+    check_block(ptr, kSize, kAlignment);
+
+    ptr = static_cast<unsigned char*>(realloc(ptr, 4 * kSize));
+    pe::assert(ptr != nullptr);
+    for(std::size_t i = 0; i < kSize; i++) {
+        pe::assert(ptr[i] == 0x1);
+    }
+    ptr = static_cast<unsigned char*>(realloc(ptr, kSize / 4));
+    pe::assert(ptr != nullptr);
+    for(std::size_t i = 0; i < kSize / 4; i++) {
+        pe::assert(ptr[i] == 0x1);
+    }
+    free(ptr);
+}
+
+int main()
+{
+    int ret = EXIT_SUCCESS;
+    try{
+
+        pe::ioprint(pe::TextColor::eGreen, "Starting malloc replacement test.");
+
+        test_memalign();
+        test_posix_memalign();
+        test_page_aligned();
+        test_realloc_aligned();
+
+        pe::ioprint(pe::TextColor::eGreen, "Finished malloc replacement test.");
+
+    }catch(std::exception &e){
+
+        pe::ioprint(pe::LogLevel::eError, "Unhandled std::exception:", e.what());
+        ret = EXIT_FAILURE;
+
+    }catch(...){
+
+        pe::ioprint(pe::LogLevel::eError, "Unknown unhandled exception.");
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
@@ -22,15 +22,23 @@ import nmatrix;
 import logger;
 import assert;
 import platform;
+import batch_math;
 
 import <cstdlib>;
 import <exception>;
+import <stdexcept>;
 import <array>;
 import <memory>;
+import <vector>;
+import <span>;
+import <algorithm>;
+import <cmath>;
 
 
 constexpr std::size_t kNumMatrices = 1'000'000;
 constexpr std::size_t kNumLoops = 1'000;
+constexpr std::size_t kNumBatchPoints = 1'003;
+constexpr std::size_t kNumBatchMatrices = 37;
 
 void test_matrix()
 {
@@ -165,6 +173,199 @@ void test_matrix()
         pe::Mat4d::RotateXYZ({0.5, 1.5, 3.0});
 }
 
+/* Deterministic values in the range [-10, 10).
+ */
+float next_value(uint32_t& state)
+{
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) / static_cast<float>(1u << 24) * 20.0f - 10.0f;
+}
+
+pe::Mat4f random_matrix(uint32_t& state)
+{
+    pe::Mat4f ret{};
+    for(auto& value : ret) {
+        value = next_value(state);
+    }
+    return ret;
+}
+
+void test_batch_transforms()
+{
+    uint32_t state = 1;
+    pe::SIMDLevel levels[] = {pe::SIMDLevel::eScalar, pe::SIMDLevel::eSSE, pe::SIMDLevel::eAVX2};
+
+    /* Transforming points must match the matrix-vector
+     * product with w = 1. The point count is not a
+     * multiple of the vector width, to cover the tails.
+     */
+    auto mat = random_matrix(state);
+    mat[3][0] = 0.0f;
+    mat[3][1] = 0.0f;
+    mat[3][2] = 0.0f;
+    mat[3][3] = 1.0f;
+
+    std::vector<pe::Vec3f> points(kNumBatchPoints);
+    std::vector<float> xs(kNumBatchPoints), ys(kNumBatchPoints), zs(kNumBatchPoints);
+    for(std::size_t i = 0; i < kNumBatchPoints; i++) {
+        points[i] = {next_value(state), next_value(state), next_value(state)};
+        xs[i] = points[i].x();
+        ys[i] = points[i].y();
+        zs[i] = points[i].z();
+    }
+
+    std::vector<pe::Vec3f> expected(kNumBatchPoints);
+    for(std::size_t i = 0; i < kNumBatchPoints; i++) {
+        pe::Vec4f point{points[i].x(), points[i].y(), points[i].z(), 1.0f};
+        expected[i] = (mat * point).xyz();
+    }
+
+    for(auto level : levels) {
+        std::vector<pe::Vec3f> out(kNumBatchPoints);
+        pe::TransformPoints(mat, points, out, level);
+        for(std::size_t i = 0; i < kNumBatchPoints; i++) {
+            pe::assert(out[i] == expected[i], "Batched point transform mismatch");
+        }
+
+        std::vector<float> ox(kNumBatchPoints), oy(kNumBatchPoints), oz(kNumBatchPoints);
+        pe::TransformPoints(mat, pe::ConstPointsSoA{xs, ys, zs}, pe::PointsSoA{ox, oy, oz}, level);
+        for(std::size_t i = 0; i < kNumBatchPoints; i++) {
+            pe::assert(pe::Vec3f{ox[i], oy[i], oz[i]} == expected[i],
+                "Batched SoA point transform mismatch");
+        }
+
+        /* In-place */
+        std::vector<pe::Vec3f> inplace = points;
+        pe::TransformPoints(mat, inplace, inplace, level);
+        for(std::size_t i = 0; i < kNumBatchPoints; i++) {
+            pe::assert(inplace[i] == expected[i], "In-place point transform mismatch");
+        }
+    }
+
+    /* Batched matrix products must match the single product.
+     */
+    std::vector<pe::Mat4f> lhs(kNumBatchMatrices), rhs(kNumBatchMatrices);
+    for(std::size_t i = 0; i < kNumBatchMatrices; i++) {
+        lhs[i] = random_matrix(state);
+        rhs[i] = random_matrix(state);
+    }
+    auto parent = random_matrix(state);
+
+    for(auto level : levels) {
+        std::vector<pe::Mat4f> out(kNumBatchMatrices);
+        pe::MultiplyMatrices(lhs, rhs, out, level);
+        for(std::size_t i = 0; i < kNumBatchMatrices; i++) {
+            pe::assert(out[i] == lhs[i] * rhs[i], "Batched matrix product mismatch");
+        }
+
+        pe::MultiplyMatrices(parent, rhs, out, level);
+        for(std::size_t i = 0; i < kNumBatchMatrices; i++) {
+            pe::assert(out[i] == parent * rhs[i], "Batched parent-child product mismatch");
+        }
+    }
+
+    bool threw = false;
+    try{
+        std::vector<pe::Vec3f> small(kNumBatchPoints - 1);
+        pe::TransformPoints(mat, points, small);
+    }catch(std::length_error&) {
+        threw = true;
+    }
+    pe::assert(threw, "Undersized output span was not rejected");
+}
+
+void test_inverse()
+{
+    uint32_t state = 3;
+
+    /* The closed-form runtime inverse must agree with
+     * the generic path used in constant evaluation.
+     */
+    constexpr pe::Mat4d dmat{
+        { 2, -1,  0,  3},
+        { 1,  4,  2, -2},
+        { 0,  3,  5,  1},
+        {-1,  2,  1,  6}
+    };
+    constexpr auto static_inverse = dmat.Inverse();
+    constexpr auto static_det = dmat.Determinant();
+    static_assert((dmat * static_inverse) == pe::Mat4d::Identity());
+
+    auto dynamic_inverse = dmat.Inverse();
+    pe::assert(dynamic_inverse == static_inverse, "Closed-form double inverse mismatch");
+    pe::assert(std::abs(dmat.Determinant() - static_det) < 1e-9, "Closed-form determinant mismatch");
+
+    constexpr pe::Mat4f fmat{
+        { 2, -1,  0,  3},
+        { 1,  4,  2, -2},
+        { 0,  3,  5,  1},
+        {-1,  2,  1,  6}
+    };
+    constexpr auto static_finverse = fmat.Inverse();
+    pe::assert(fmat.Inverse() == static_finverse, "Closed-form float inverse mismatch");
+    pe::assert(std::abs(fmat.Determinant() - static_det) < 1e-3,
+        "Closed-form float determinant mismatch");
+
+    /* Random, well-conditioned matrices: a random transform
+     * with a small random perturbation on top.
+     */
+    for(int i = 0; i < 1000; i++) {
+        pe::Vec3f angles{next_value(state), next_value(state), next_value(state)};
+        pe::Vec3f offset{next_value(state), next_value(state), next_value(state)};
+        auto mat = pe::Mat4f::Translate(offset) * pe::Mat4f::RotateXYZ(angles);
+        for(auto& value : mat) {
+            value += next_value(state) * 0.01f;
+        }
+        pe::assert((mat * mat.Inverse()) == pe::Mat4f::Identity(), "Inaccurate float inverse");
+
+        pe::Mat4d wide;
+        std::copy(mat.cbegin(), mat.cend(), wide.begin());
+        pe::assert((wide * wide.Inverse()) == pe::Mat4d::Identity(), "Inaccurate double inverse");
+    }
+
+    /* The affine-only inverse must agree with the full one.
+     */
+    constexpr pe::Mat4d affine = pe::Mat4d::Translate({1.0, -2.0, 3.0}) * pe::Mat4d{
+        {2, 0, 1, 0},
+        {0, 3, 0, 0},
+        {1, 0, 4, 0},
+        {0, 0, 0, 1}
+    };
+    constexpr auto static_affine_inverse = affine.AffineInverse();
+    static_assert(static_affine_inverse == affine.Inverse());
+    pe::assert(affine.AffineInverse() == static_affine_inverse, "Affine inverse mismatch");
+
+    for(int i = 0; i < 1000; i++) {
+        pe::Vec3f angles{next_value(state), next_value(state), next_value(state)};
+        pe::Vec3f offset{next_value(state), next_value(state), next_value(state)};
+        auto mat = pe::Mat4f::Translate(offset) * pe::Mat4f::RotateXYZ(angles);
+        pe::assert(mat.AffineInverse() == mat.Inverse(), "Affine float inverse mismatch");
+        pe::assert((mat * mat.AffineInverse()) == pe::Mat4f::Identity(),
+            "Inaccurate affine float inverse");
+    }
+
+    /* Singular matrices must be rejected by all paths.
+     */
+    constexpr pe::Mat4f singular{
+        {1, 2, 3, 4},
+        {2, 4, 6, 8},
+        {0, 1, 0, 1},
+        {0, 0, 0, 1}
+    };
+    int nthrown = 0;
+    try{
+        [[maybe_unused]] auto inverse = singular.Inverse();
+    }catch(std::domain_error&) {
+        nthrown++;
+    }
+    try{
+        [[maybe_unused]] auto inverse = singular.AffineInverse();
+    }catch(std::domain_error&) {
+        nthrown++;
+    }
+    pe::assert(nthrown == 2, "Singular matrix was not rejected");
+}
+
 __attribute__((optnone))
 void matrix_benchmark()
 {
@@ -185,6 +386,8 @@ int main()
 
         pe::ioprint(pe::TextColor::eGreen, "Starting Matrix test.");
         test_matrix();
+        test_batch_transforms();
+        test_inverse();
         pe::dbgtime<true>([&](){
             matrix_benchmark();
         }, [&](uint64_t delta) {
@@ -29,11 +29,14 @@ import <variant>;
 import <any>;
 import <random>;
 import <cmath>;
+import <algorithm>;
 
 
 constexpr int kNumClients = 32;
 constexpr int kNumRequests = 500;
 constexpr float kEpsilon = 1.0f / 10000;
+constexpr int kNumOrderedSenders = 8;
+constexpr int kNumOrderedMessages = 200;
 
 enum ArithmeticRequestType
 {
@@ -171,6 +174,69 @@ public:
     {}
 };
 
+struct Sequenced
+{
+    int m_sender;
+    int m_seqnum;
+};
+
+/* Receives the messages either one at a time, or mixing batches
+ * of different sizes with single receives. The replies are only
+ * sent once the entire batch has been received, so that messages
+ * from different senders pile up in the mailbox. Either way, the
+ * messages of every sender must arrive in the order they were sent.
+ */
+class SequencedReceiver : public pe::Task<std::size_t, SequencedReceiver, bool>
+{
+    using Task<std::size_t, SequencedReceiver, bool>::Task;
+
+    virtual SequencedReceiver::handle_type Run(bool batched)
+    {
+        std::vector<int> expected(kNumOrderedSenders, 0);
+        int remaining = kNumOrderedSenders * kNumOrderedMessages;
+        std::size_t max_batch = 0;
+        uint32_t round = 0;
+
+        while(remaining > 0) {
+            std::vector<pe::Message> batch;
+            if(batched && (++round % 4 != 0)) {
+                std::size_t max = 1 + (round % kNumOrderedSenders);
+                batch = co_await ReceiveBatch(max);
+                pe::assert(std::size(batch) > 0 && std::size(batch) <= max);
+            }else{
+                batch.push_back(co_await Receive());
+            }
+            for(const auto& msg : batch) {
+                auto sequenced = any_cast<Sequenced>(msg.m_payload);
+                pe::assert(sequenced.m_seqnum == expected[sequenced.m_sender]++,
+                    "Messages received out of order!");
+            }
+            for(const auto& msg : batch) {
+                Reply(msg.m_sender.lock(), pe::Message{this->shared_from_this()});
+            }
+            remaining -= static_cast<int>(std::size(batch));
+            max_batch = std::max(max_batch, std::size(batch));
+        }
+        for(int count : expected) {
+            pe::assert(count == kNumOrderedMessages);
+        }
+        co_return max_batch;
+    }
+};
+
+class SequencedSender : public pe::Task<void, SequencedSender,
+    pe::shared_ptr<SequencedReceiver>, int>
+{
+    using Task<void, SequencedSender, pe::shared_ptr<SequencedReceiver>, int>::Task;
+
+    virtual SequencedSender::handle_type Run(pe::shared_ptr<SequencedReceiver> receiver, int id)
+    {
+        for(int i = 0; i < kNumOrderedMessages; i++) {
+            co_await Send(receiver, pe::Message{this->shared_from_this(), 0, Sequenced{id, i}});
+        }
+    }
+};
+
 class Tester : public pe::Task<void, Tester>
 {
     using Task<void, Tester>::Task;
@@ -195,6 +261,26 @@ class Tester : public pe::Task<void, Tester>
             ArithmeticRequestType::eQuit, std::monostate{}});
         co_await server;
 
+        for(bool batched : {false, true}) {
+            pe::ioprint(pe::TextColor::eGreen, batched
+                ? "Starting batched receive ordering test..."
+                : "Starting receive ordering test...");
+            auto receiver = SequencedReceiver::Create(Scheduler(), pe::Priority::eNormal,
+                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, batched);
+
+            std::vector<pe::shared_ptr<SequencedSender>> senders{};
+            for(int i = 0; i < kNumOrderedSenders; i++) {
+                senders.push_back(SequencedSender::Create(Scheduler(), pe::Priority::eNormal,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, receiver, i));
+            }
+            for(auto& sender : senders) {
+                co_await sender;
+            }
+            std::size_t max_batch = co_await receiver;
+            pe::dbgprint("Received", kNumOrderedSenders * kNumOrderedMessages,
+                "message(s) in order, in batches of up to", max_batch);
+        }
+
         pe::ioprint(pe::TextColor::eGreen, "Testing finished");
         Broadcast<pe::EventType::eQuit>();
     }
@@ -21,11 +21,14 @@ import sync;
 import logger;
 import meta;
 import event;
+import assert;
 
 import <cstdlib>;
 import <string>;
 import <atomic>;
 import <vector>;
+import <cstdint>;
+import <memory>;
 
 class LatchWorker : public pe::Task<
     void, LatchWorker, std::string&, pe::Latch&, pe::Latch&>
@@ -162,6 +165,341 @@ class BarrierTester : public pe::Task<void, BarrierTester>
     }
 };
 
+constexpr int kNumContenders = 16;
+constexpr int kNumIterations = 200;
+constexpr int kSemaphoreCount = 3;
+
+/* State shared by the tasks contending for a lock. The counter
+ * is deliberately not atomic - it is protected by the lock.
+ */
+struct Contended
+{
+    int              m_counter{0};
+    std::atomic_int  m_readers{0};
+    std::atomic_int  m_writers{0};
+    std::atomic_int  m_holders{0};
+    std::atomic_int  m_max_holders{0};
+};
+
+class MutexWorker : public pe::Task<void, MutexWorker, pe::AsyncMutex&, Contended&>
+{
+    using Task<void, MutexWorker, pe::AsyncMutex&, Contended&>::Task;
+
+    virtual MutexWorker::handle_type Run(pe::AsyncMutex& mutex, Contended& state)
+    {
+        for(int i = 0; i < kNumIterations; i++) {
+            if(i % 2) {
+                co_await mutex.Lock();
+                int value = state.m_counter;
+                /* Give the other tasks a chance to run while we hold the lock */
+                co_await Yield(Affinity());
+                state.m_counter = value + 1;
+                mutex.Unlock();
+            }else{
+                auto lock = co_await mutex.ScopedLock();
+                int value = state.m_counter;
+                co_await Yield(Affinity());
+                state.m_counter = value + 1;
+            }
+        }
+    }
+};
+
+class SharedMutexWorker : public pe::Task<void, SharedMutexWorker, 
+    pe::AsyncSharedMutex&, Contended&, bool>
+{
+    using Task<void, SharedMutexWorker, pe::AsyncSharedMutex&, Contended&, bool>::Task;
+
+    virtual SharedMutexWorker::handle_type Run(pe::AsyncSharedMutex& mutex,
+        Contended& state, bool writer)
+    {
+        for(int i = 0; i < kNumIterations; i++) {
+            if(writer) {
+                co_await mutex.Lock();
+                pe::assert(state.m_readers.load() == 0);
+                int writers = state.m_writers.fetch_add(1);
+                pe::assert(writers == 0);
+                state.m_counter++;
+                co_await Yield(Affinity());
+                state.m_writers.fetch_sub(1);
+                mutex.Unlock();
+            }else{
+                co_await mutex.LockShared();
+                state.m_readers.fetch_add(1);
+                pe::assert(state.m_writers.load() == 0);
+                co_await Yield(Affinity());
+                state.m_readers.fetch_sub(1);
+                mutex.UnlockShared();
+            }
+        }
+    }
+};
+
+class SemaphoreWorker : public pe::Task<void, SemaphoreWorker, pe::AsyncSemaphore&, Contended&>
+{
+    using Task<void, SemaphoreWorker, pe::AsyncSemaphore&, Contended&>::Task;
+
+    virtual SemaphoreWorker::handle_type Run(pe::AsyncSemaphore& semaphore, Contended& state)
+    {
+        for(int i = 0; i < kNumIterations; i++) {
+            co_await semaphore.Acquire();
+            int holders = state.m_holders.fetch_add(1) + 1;
+            pe::assert(holders <= kSemaphoreCount);
+            int max = state.m_max_holders.load();
+            while(holders > max && !state.m_max_holders.compare_exchange_weak(max, holders));
+            co_await Yield(Affinity());
+            state.m_holders.fetch_sub(1);
+            semaphore.Release();
+        }
+    }
+};
+
+/* Half of the workers spin on TryLock while the others queue up
+ * in Lock, so that TryLock races with Unlock handing the lock off
+ * to a queued waiter.
+ */
+class TryLockWorker : public pe::Task<void, TryLockWorker, pe::AsyncMutex&, Contended&, bool>
+{
+    using Task<void, TryLockWorker, pe::AsyncMutex&, Contended&, bool>::Task;
+
+    virtual TryLockWorker::handle_type Run(pe::AsyncMutex& mutex, Contended& state, bool spin)
+    {
+        for(int i = 0; i < kNumIterations; i++) {
+            if(spin) {
+                while(!mutex.TryLock()) {
+                    co_await Yield(Affinity());
+                }
+            }else{
+                co_await mutex.Lock();
+            }
+            int holders = state.m_holders.fetch_add(1) + 1;
+            pe::assert(holders == 1);
+            state.m_counter++;
+            if(i % 2)
+                co_await Yield(Affinity());
+            state.m_holders.fetch_sub(1);
+            mutex.Unlock();
+        }
+    }
+};
+
+class AsyncLockTester : public pe::Task<void, AsyncLockTester>
+{
+    using Task<void, AsyncLockTester>::Task;
+
+    virtual AsyncLockTester::handle_type Run()
+    {
+        {
+            pe::AsyncMutex mutex{Scheduler()};
+            Contended state{};
+            std::vector<pe::shared_ptr<MutexWorker>> tasks;
+            for(int i = 0; i < kNumContenders; i++) {
+                tasks.push_back(MutexWorker::Create(Scheduler(), pe::Priority::eNormal,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, mutex, state));
+            }
+            for(auto& task : tasks) {
+                co_await task;
+            }
+            pe::assert(state.m_counter == kNumContenders * kNumIterations);
+            pe::assert(mutex.TryLock());
+            pe::assert(!mutex.TryLock());
+            mutex.Unlock();
+            pe::dbgprint("  AsyncMutex counted to", state.m_counter);
+        }
+        {
+            pe::AsyncMutex mutex{Scheduler()};
+            Contended state{};
+            std::vector<pe::shared_ptr<TryLockWorker>> tasks;
+            for(int i = 0; i < kNumContenders; i++) {
+                tasks.push_back(TryLockWorker::Create(Scheduler(), pe::Priority::eNormal,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, mutex, state, i % 2));
+            }
+            for(auto& task : tasks) {
+                co_await task;
+            }
+            pe::assert(state.m_holders.load() == 0);
+            pe::assert(state.m_counter == kNumContenders * kNumIterations);
+            pe::dbgprint("  AsyncMutex stayed exclusive with TryLock racing handoffs");
+        }
+        {
+            pe::AsyncSharedMutex mutex{Scheduler()};
+            Contended state{};
+            std::vector<pe::shared_ptr<SharedMutexWorker>> tasks;
+            for(int i = 0; i < kNumContenders; i++) {
+                bool writer = (i % 4 == 0);
+                tasks.push_back(SharedMutexWorker::Create(Scheduler(), pe::Priority::eNormal,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, mutex, state, writer));
+            }
+            for(auto& task : tasks) {
+                co_await task;
+            }
+            pe::assert(state.m_counter == (kNumContenders / 4) * kNumIterations);
+            pe::assert(mutex.TryLockShared());
+            pe::assert(mutex.TryLockShared());
+            pe::assert(!mutex.TryLock());
+            mutex.UnlockShared();
+            mutex.UnlockShared();
+            pe::assert(mutex.TryLock());
+            pe::assert(!mutex.TryLockShared());
+            mutex.Unlock();
+            pe::dbgprint("  AsyncSharedMutex writers counted to", state.m_counter);
+        }
+        {
+            pe::AsyncSemaphore semaphore{Scheduler(), kSemaphoreCount};
+            Contended state{};
+            std::vector<pe::shared_ptr<SemaphoreWorker>> tasks;
+            for(int i = 0; i < kNumContenders; i++) {
+                tasks.push_back(SemaphoreWorker::Create(Scheduler(), pe::Priority::eNormal,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, semaphore, state));
+            }
+            for(auto& task : tasks) {
+                co_await task;
+            }
+            pe::assert(state.m_holders.load() == 0);
+            pe::dbgprint("  AsyncSemaphore had at most", state.m_max_holders.load(), "holder(s)");
+        }
+    }
+};
+
+constexpr uint64_t kNumStreamValues = 10'000;
+
+class StreamProducer : public pe::Task<void, StreamProducer, pe::Stream<uint64_t>&>
+{
+    using Task<void, StreamProducer, pe::Stream<uint64_t>&>::Task;
+
+    virtual StreamProducer::handle_type Run(pe::Stream<uint64_t>& stream)
+    {
+        for(uint64_t i = 0; i < kNumStreamValues; i++) {
+            if(i % 2) {
+                co_yield stream.Push(i);
+            }else{
+                co_await stream.Push(i);
+            }
+        }
+        stream.Close();
+    }
+};
+
+class StreamTester : public pe::Task<void, StreamTester>
+{
+    using Task<void, StreamTester>::Task;
+
+    virtual StreamTester::handle_type Run()
+    {
+        uint32_t capacities[] = {1, 7, 64};
+        for(uint32_t capacity : capacities) {
+            pe::Stream<uint64_t> stream{Scheduler(), capacity};
+            auto producer = StreamProducer::Create(Scheduler(), pe::Priority::eNormal,
+                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, stream);
+
+            uint64_t expected = 0;
+            while(auto value = co_await stream.Next()) {
+                pe::assert(*value == expected++);
+            }
+            pe::assert(expected == kNumStreamValues);
+            pe::assert(!(co_await stream.Next()));
+            co_await producer;
+            pe::dbgprint("  Stream of capacity", capacity, "passed", expected, "values one by one");
+        }
+        for(uint32_t capacity : capacities) {
+            pe::Stream<uint64_t> stream{Scheduler(), capacity};
+            auto producer = StreamProducer::Create(Scheduler(), pe::Priority::eNormal,
+                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, stream);
+
+            uint64_t expected = 0;
+            std::size_t nbatches = 0;
+            while(true) {
+                auto batch = co_await stream.NextBatch(16);
+                if(batch.empty())
+                    break;
+                pe::assert(batch.size() <= 16);
+                for(auto value : batch) {
+                    pe::assert(value == expected++);
+                }
+                nbatches++;
+            }
+            pe::assert(expected == kNumStreamValues);
+            pe::assert((co_await stream.NextBatch(16)).empty());
+            co_await producer;
+            pe::dbgprint("  Stream of capacity", capacity, "passed", expected, 
+                "values in", nbatches, "batches");
+        }
+    }
+};
+
+constexpr int kNumStreamPairs = 8;
+
+/* Mixes Next and NextBatch so that both the blocking and the
+ * non-blocking acquisition paths race with the producer's releases.
+ */
+class StreamConsumer : public pe::Task<uint64_t, StreamConsumer, pe::Stream<uint64_t>&>
+{
+    using Task<uint64_t, StreamConsumer, pe::Stream<uint64_t>&>::Task;
+
+    void consume(std::vector<bool>& seen, uint64_t& nseen, uint64_t value)
+    {
+        pe::assert(value < kNumStreamValues);
+        pe::assert(!seen[value]);
+        seen[value] = true;
+        nseen++;
+    }
+
+    virtual StreamConsumer::handle_type Run(pe::Stream<uint64_t>& stream)
+    {
+        std::vector<bool> seen(kNumStreamValues, false);
+        uint64_t nseen = 0;
+        for(uint64_t i = 0;; i++) {
+            if(i % 3) {
+                auto value = co_await stream.Next();
+                if(!value)
+                    break;
+                consume(seen, nseen, *value);
+            }else{
+                auto batch = co_await stream.NextBatch(3);
+                if(batch.empty())
+                    break;
+                for(auto value : batch) {
+                    consume(seen, nseen, value);
+                }
+            }
+            if(i % 5 == 0)
+                co_await Yield(Affinity());
+        }
+        co_return nseen;
+    }
+};
+
+class StreamStressTester : public pe::Task<void, StreamStressTester>
+{
+    using Task<void, StreamStressTester>::Task;
+
+    virtual StreamStressTester::handle_type Run()
+    {
+        uint32_t capacities[] = {1, 2};
+        for(uint32_t capacity : capacities) {
+            std::vector<std::unique_ptr<pe::Stream<uint64_t>>> streams;
+            std::vector<pe::shared_ptr<StreamProducer>> producers;
+            std::vector<pe::shared_ptr<StreamConsumer>> consumers;
+            for(int i = 0; i < kNumStreamPairs; i++) {
+                streams.push_back(std::make_unique<pe::Stream<uint64_t>>(Scheduler(), capacity));
+                consumers.push_back(StreamConsumer::Create(Scheduler(), pe::Priority::eNormal,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, *streams.back()));
+                producers.push_back(StreamProducer::Create(Scheduler(), pe::Priority::eNormal,
+                    pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, *streams.back()));
+            }
+            for(auto& consumer : consumers) {
+                uint64_t nseen = co_await consumer;
+                pe::assert(nseen == kNumStreamValues);
+            }
+            for(auto& producer : producers) {
+                co_await producer;
+            }
+            pe::dbgprint("  ", kNumStreamPairs, "concurrent streams of capacity", capacity,
+                "neither lost nor duplicated any values");
+        }
+    }
+};
+
 class Tester : public pe::Task<void, Tester>
 {
     using Task<void, Tester>::Task;
@@ -176,6 +514,18 @@ class Tester : public pe::Task<void, Tester>
         auto barrier_test = BarrierTester::Create(Scheduler());
         co_await barrier_test;
 
+        pe::ioprint(pe::TextColor::eGreen, "Testing AsyncMutex, AsyncSharedMutex and AsyncSemaphore");
+        auto lock_test = AsyncLockTester::Create(Scheduler());
+        co_await lock_test;
+
+        pe::ioprint(pe::TextColor::eGreen, "Testing Stream");
+        auto stream_test = StreamTester::Create(Scheduler());
+        co_await stream_test;
+
+        pe::ioprint(pe::TextColor::eGreen, "Testing Stream under contention");
+        auto stream_stress_test = StreamStressTester::Create(Scheduler());
+        co_await stream_stress_test;
+
         pe::ioprint(pe::TextColor::eGreen, "Testing Finished");
         Broadcast<pe::EventType::eQuit>();
     }
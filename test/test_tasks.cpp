@@ -29,6 +29,10 @@ import <chrono>;
 import <variant>;
 import <any>;
 import <vector>;
+import <atomic>;
+import <tuple>;
+import <cstdint>;
+import <stdexcept>;
 
 
 constexpr int kNumEventProducers = 10;
@@ -36,6 +40,10 @@ constexpr int kNumEventConsumers = 10;
 constexpr int kNumEventsProduced = 100;
 constexpr int kNumMessagesSend = 100;
 constexpr int kNumMessageSendReceivePairs = 10;
+constexpr int kNumStickyActors = 16;
+constexpr uint32_t kNumStickyFrames = 100;
+constexpr std::size_t kNumSpinnersPerWorker = 4;
+constexpr uint32_t kNumSpinRounds = 8;
 
 class Yielder : public pe::Task<int, Yielder>
 {
@@ -265,6 +273,220 @@ public:
     {}
 };
 
+class Spinner : public pe::Task<void, Spinner, std::atomic_int&>
+{
+    using Task<void, Spinner, std::atomic_int&>::Task;
+
+    virtual Spinner::handle_type Run(std::atomic_int& iterations)
+    {
+        while(true) {
+            iterations.fetch_add(1, std::memory_order_relaxed);
+            co_await ThrowIfCancelled();
+            co_await Yield(Affinity());
+        }
+    }
+};
+
+class SpinnerGroup : public pe::Task<void, SpinnerGroup, std::atomic_int&>
+{
+    using Task<void, SpinnerGroup, std::atomic_int&>::Task;
+
+    virtual SpinnerGroup::handle_type Run(std::atomic_int& iterations)
+    {
+        /* Not awaited: this one unwinds without an awaiter */
+        std::ignore = Spinner::Create(Scheduler(), pe::Priority::eNormal,
+            pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, iterations);
+
+        auto first = Spinner::Create(Scheduler(), pe::Priority::eNormal,
+            pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, iterations);
+        auto second = Spinner::Create(Scheduler(), pe::Priority::eNormal,
+            pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, iterations);
+        co_await first;
+        co_await second;
+    }
+};
+
+class NeverRun : public pe::Task<void, NeverRun, bool&>
+{
+    using Task<void, NeverRun, bool&>::Task;
+
+    virtual NeverRun::handle_type Run(bool& ran)
+    {
+        ran = true;
+        co_return;
+    }
+};
+
+/* Nothing will ever wake up any of the awaits. Since the task 
+ * is already cancelled, they must throw instead of blocking.
+ */
+class CancelledWaiter : public pe::Task<int, CancelledWaiter>
+{
+    using Task<int, CancelledWaiter>::Task;
+
+    virtual CancelledWaiter::handle_type Run()
+    {
+        int ncancelled = 0;
+        pe::Latch never_done{Scheduler(), 1};
+        Cancel();
+
+        try{
+            co_await Receive();
+        }catch(pe::TaskCancelled&) {
+            ncancelled++;
+        }
+
+        try{
+            co_await ReceiveBatch(4);
+        }catch(pe::TaskCancelled&) {
+            ncancelled++;
+        }
+
+        Subscribe<pe::EventType::eNewFrame>();
+        try{
+            co_await Event<pe::EventType::eNewFrame>();
+        }catch(pe::TaskCancelled&) {
+            ncancelled++;
+        }
+        Unsubscribe<pe::EventType::eNewFrame>();
+
+        try{
+            co_await never_done;
+        }catch(pe::TaskCancelled&) {
+            ncancelled++;
+        }
+
+        try{
+            co_await IO([]{ pe::assert(0); });
+        }catch(pe::TaskCancelled&) {
+            ncancelled++;
+        }
+
+        co_return ncancelled;
+    }
+};
+
+enum class ParkOn
+{
+    eEvent,
+    eReceive,
+    eLatch,
+    eSemaphore
+};
+
+/* Blocks on something that is never going to happen, until it
+ * gets cancelled.
+ */
+class ParkedWaiter : public pe::Task<void, ParkedWaiter, ParkOn, std::atomic_int&, 
+    pe::Latch&, pe::AsyncSemaphore&>
+{
+    using Task<void, ParkedWaiter, ParkOn, std::atomic_int&, pe::Latch&, pe::AsyncSemaphore&>::Task;
+
+    virtual ParkedWaiter::handle_type Run(ParkOn what, std::atomic_int& parked,
+        pe::Latch& latch, pe::AsyncSemaphore& semaphore)
+    {
+        switch(what) {
+        case ParkOn::eEvent:
+            Subscribe<pe::EventType::eUser>();
+            parked.fetch_add(1, std::memory_order_release);
+            try{
+                co_await Event<pe::EventType::eUser>();
+            }catch(pe::TaskCancelled&) {
+                Unsubscribe<pe::EventType::eUser>();
+                throw;
+            }
+            break;
+        case ParkOn::eReceive:
+            parked.fetch_add(1, std::memory_order_release);
+            co_await Receive();
+            break;
+        case ParkOn::eLatch:
+            parked.fetch_add(1, std::memory_order_release);
+            co_await latch;
+            break;
+        case ParkOn::eSemaphore:
+            parked.fetch_add(1, std::memory_order_release);
+            co_await semaphore.Acquire();
+            break;
+        }
+        pe::assert(0);
+    }
+};
+
+class FlagSetter : public pe::Task<void, FlagSetter, std::atomic_flag&>
+{
+    using Task<void, FlagSetter, std::atomic_flag&>::Task;
+
+    virtual FlagSetter::handle_type Run(std::atomic_flag& flag)
+    {
+        flag.test_and_set(std::memory_order_release);
+        co_return;
+    }
+};
+
+class BusyWaiter : public pe::Task<uint64_t, BusyWaiter>
+{
+    using Task<uint64_t, BusyWaiter>::Task;
+
+    virtual BusyWaiter::handle_type Run()
+    {
+        /* Spin until a critical task spawned onto this worker has run,
+         * giving it a chance to at every check point.
+         */
+        std::atomic_flag flag{};
+        auto setter = FlagSetter::Create(Scheduler(), pe::Priority::eCritical,
+            pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, flag);
+        uint64_t nchecks = 0;
+        while(!flag.test(std::memory_order_acquire)) {
+            co_await MaybeYield();
+            nchecks++;
+        }
+        co_await setter;
+        co_return nchecks;
+    }
+};
+
+class RoundSpinner : public pe::Task<uint64_t, RoundSpinner, std::atomic<uint32_t>&, uint32_t>
+{
+    using Task<uint64_t, RoundSpinner, std::atomic<uint32_t>&, uint32_t>::Task;
+
+    virtual RoundSpinner::handle_type Run(std::atomic<uint32_t>& arrived, uint32_t nspinners)
+    {
+        /* There are more spinners than workers, so every round can
+         * only complete if the yielding spinners let the others run.
+         */
+        uint64_t nyields = 0;
+        for(uint32_t round = 1; round <= kNumSpinRounds; round++) {
+            arrived.fetch_add(1, std::memory_order_relaxed);
+            while(arrived.load(std::memory_order_relaxed) < round * nspinners) {
+                co_await MaybeYield();
+                nyields++;
+            }
+        }
+        co_return nyields;
+    }
+};
+
+class StickyActor : public pe::Task<uint32_t, StickyActor, uint32_t>
+{
+    using Task<uint32_t, StickyActor, uint32_t>::Task;
+
+    virtual StickyActor::handle_type Run(uint32_t nframes)
+    {
+        /* Count how many times we have been moved to another thread */
+        uint32_t migrations = 0;
+        auto thread = std::this_thread::get_id();
+        for(uint32_t i = 0; i < nframes; i++) {
+            co_await Yield(Affinity());
+            if(std::this_thread::get_id() != thread) {
+                thread = std::this_thread::get_id();
+                migrations++;
+            }
+        }
+        co_return migrations;
+    }
+};
+
 class Tester : public pe::Task<void, Tester>
 {
     using Task<void, Tester>::Task;
@@ -301,6 +523,119 @@ class Tester : public pe::Task<void, Tester>
             pe::dbgprint("Caught exception:", exc.what());
         }
 
+        pe::ioprint(pe::TextColor::eGreen, "Testing Cancellation");
+        std::atomic_int iterations{0};
+        auto group = SpinnerGroup::Create(Scheduler(), pe::Priority::eNormal,
+            pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, iterations);
+        auto token = group->GetCancellationToken();
+        while(iterations.load(std::memory_order_relaxed) < 100) {
+            co_await Yield(Affinity());
+        }
+        pe::assert(!token.IsCancelled());
+        group->Cancel();
+        pe::assert(token.IsCancelled());
+        try{
+            co_await group;
+            pe::assert(0);
+        }catch(pe::TaskCancelled& exc) {
+            pe::dbgprint("Caught exception:", exc.what());
+        }
+
+        bool ran = false;
+        auto never = NeverRun::Create(Scheduler(), pe::Priority::eNormal,
+            pe::CreateMode::eSuspend, pe::Affinity::eAny, ran);
+        never->Cancel();
+        try{
+            co_await never;
+            pe::assert(0);
+        }catch(pe::TaskCancelled& exc) {
+            pe::dbgprint("Caught exception:", exc.what());
+        }
+        pe::assert(!ran);
+
+        auto waiter = CancelledWaiter::Create(Scheduler());
+        pe::assert(co_await waiter == 5);
+
+        std::atomic_int parked{0};
+        pe::Latch never_done{Scheduler(), 1};
+        pe::AsyncSemaphore no_units{Scheduler(), 0};
+        const ParkOn waits[] = {ParkOn::eEvent, ParkOn::eReceive, ParkOn::eLatch, 
+            ParkOn::eSemaphore};
+        std::vector<pe::shared_ptr<ParkedWaiter>> parked_waiters;
+        for(auto what : waits) {
+            parked_waiters.push_back(ParkedWaiter::Create(Scheduler(), pe::Priority::eNormal,
+                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, what, parked, 
+                never_done, no_units));
+        }
+        while(parked.load(std::memory_order_acquire) < static_cast<int>(parked_waiters.size())) {
+            co_await Yield(Affinity());
+        }
+        /* Give the waiters a chance to actually block */
+        for(int i = 0; i < 16; i++) {
+            co_await Yield(Affinity());
+        }
+        for(auto& parked_waiter : parked_waiters) {
+            parked_waiter->Cancel();
+            try{
+                co_await parked_waiter;
+                pe::assert(0);
+            }catch(pe::TaskCancelled& exc) {
+                pe::dbgprint("Caught exception:", exc.what());
+            }
+        }
+        /* The cancelled waiter must not hold up later acquisitions */
+        no_units.Release();
+        pe::assert(no_units.TryAcquire());
+
+        pe::ioprint(pe::TextColor::eGreen, "Testing MaybeYield");
+        auto busy_waiter = BusyWaiter::Create(Scheduler(), pe::Priority::eLow);
+        pe::dbgprint("Critical task ran after", co_await busy_waiter, "check(s)");
+
+        pe::ioprint(pe::TextColor::eGreen, "Testing yield fairness");
+        std::atomic<uint32_t> arrived{0};
+        const auto nspinners = static_cast<uint32_t>(kNumSpinnersPerWorker * Scheduler().NumWorkers());
+        std::vector<pe::shared_ptr<RoundSpinner>> spinners;
+        for(uint32_t i = 0; i < nspinners; i++) {
+            spinners.push_back(RoundSpinner::Create(Scheduler(), pe::Priority::eNormal,
+                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, arrived, nspinners));
+        }
+        uint64_t nyields = 0;
+        for(auto& spinner : spinners) {
+            nyields += co_await spinner;
+        }
+        pe::assert(arrived.load() == nspinners * kNumSpinRounds);
+        pe::dbgprint(nspinners, "spinners completed", kNumSpinRounds, "rounds with",
+            nyields, "yield(s)");
+
+        pe::ioprint(pe::TextColor::eGreen, "Testing StickyActor");
+        std::vector<pe::shared_ptr<StickyActor>> actors;
+        for(int i = 0; i < kNumStickyActors; i++) {
+            actors.push_back(StickyActor::Create(Scheduler(), pe::Priority::eNormal,
+                pe::CreateMode::eSuspend, pe::Affinity::eSticky, kNumStickyFrames));
+            if(i % 2 == 0) {
+                actors.back()->SetPreferredWorker(static_cast<std::size_t>(i) % Scheduler().NumWorkers());
+            }
+        }
+        uint32_t migrations = 0;
+        for(auto& actor : actors) {
+            migrations += co_await actor;
+        }
+        pe::dbgprint("Sticky actors migrated", migrations, "time(s) in",
+            kNumStickyActors * kNumStickyFrames, "frame(s)");
+
+        try{
+            actors[0]->SetPreferredWorker(Scheduler().NumWorkers());
+            pe::assert(0);
+        }catch(std::out_of_range& exc) {
+            pe::dbgprint("Caught exception:", exc.what());
+        }
+        try{
+            yielder->SetPreferredWorker(0);
+            pe::assert(0);
+        }catch(std::runtime_error& exc) {
+            pe::dbgprint("Caught exception:", exc.what());
+        }
+
         pe::ioprint(pe::TextColor::eGreen, "Testing SlavePinger / MasterPonger");
         auto spinger = PingerSlave::Create(Scheduler());
         co_await spinger;
@@ -0,0 +1,228 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+import transform;
+import ecs;
+import sync;
+import nvector;
+import nmatrix;
+import assert;
+import logger;
+
+import <cstdlib>;
+import <memory>;
+import <stdexcept>;
+
+
+constexpr std::size_t kNumWideNodes = 20'000;
+constexpr std::size_t kNumWideLevels = 4;
+
+struct Root
+    : public pe::Entity<Root, pe::World<>>
+    , public pe::WithComponent<Root, pe::Transform>
+{};
+
+struct Node
+    : public pe::Entity<Node, pe::World<>>
+    , public pe::WithComponent<Node, pe::Transform>
+    , public pe::WithComponent<Node, pe::Parent>
+{};
+
+void set_local(auto& entity, const pe::Mat4f& local)
+{
+    auto transform = entity.template Get<pe::Transform>();
+    transform.SetLocal(local);
+    entity.template Set<pe::Transform>(std::move(transform));
+}
+
+void set_parent(Node& node, const auto& parent)
+{
+    node.Set<pe::Parent>(pe::Parent{parent.m_id});
+}
+
+pe::Mat4f world(auto& entity)
+{
+    return entity.template Get<pe::Transform>().m_world;
+}
+
+void test_hierarchy()
+{
+    pe::TransformHierarchy<> hierarchy{};
+
+    Root root{};
+    Node a{}, b{}, c{}, sibling{};
+    set_parent(a, root);
+    set_parent(b, a);
+    set_parent(c, b);
+    set_parent(sibling, root);
+
+    auto root_local = pe::Mat4f::Translate({1.0f, 0.0f, 0.0f});
+    auto a_local = pe::Mat4f::RotateXYZ({0.0f, 0.0f, 0.5f});
+    auto b_local = pe::Mat4f::Translate({0.0f, 2.0f, 0.0f});
+    auto c_local = pe::Mat4f::Translate({0.0f, 0.0f, 3.0f});
+    auto sibling_local = pe::Mat4f::Translate({-1.0f, 0.0f, 0.0f});
+    set_local(root, root_local);
+    set_local(a, a_local);
+    set_local(b, b_local);
+    set_local(c, c_local);
+    set_local(sibling, sibling_local);
+
+    hierarchy.Update();
+    pe::assert(hierarchy.Size() == 5);
+    pe::assert(hierarchy.Depth() == 4);
+    pe::assert(world(root) == root_local);
+    pe::assert(world(a) == root_local * a_local);
+    pe::assert(world(b) == root_local * a_local * b_local);
+    pe::assert(world(c) == root_local * a_local * b_local * c_local);
+    pe::assert(world(sibling) == root_local * sibling_local);
+
+    /* Only the dirty subtree must be recomputed. Clobber
+     * the world transform of a clean node to detect it
+     * being written.
+     */
+    auto clobbered = sibling.Get<pe::Transform>();
+    clobbered.m_world = pe::Mat4f::Zero();
+    clobbered.m_dirty = false;
+    sibling.Set<pe::Transform>(std::move(clobbered));
+
+    b_local = pe::Mat4f::Translate({0.0f, 5.0f, 0.0f});
+    set_local(b, b_local);
+    hierarchy.Update();
+    pe::assert(world(b) == root_local * a_local * b_local);
+    pe::assert(world(c) == root_local * a_local * b_local * c_local);
+    pe::assert(world(sibling) == pe::Mat4f::Zero());
+
+    /* Re-parenting requires invalidating the cached layout.
+     */
+    set_parent(c, root);
+    hierarchy.Invalidate();
+    hierarchy.Update();
+    pe::assert(hierarchy.Depth() == 3);
+    pe::assert(world(c) == root_local * c_local);
+    pe::assert(world(sibling) == root_local * sibling_local);
+
+    /* New entities are picked up automatically.
+     */
+    {
+        Node d{};
+        set_parent(d, c);
+        hierarchy.Update();
+        pe::assert(world(d) == root_local * c_local);
+    }
+
+    {
+        Node x{}, y{};
+        set_parent(x, y);
+        set_parent(y, x);
+
+        bool threw = false;
+        try{
+            hierarchy.Update();
+        }catch(std::logic_error&) {
+            threw = true;
+        }
+        pe::assert(threw, "Cyclic hierarchy was not rejected");
+    }
+    hierarchy.Update();
+    pe::assert(hierarchy.Size() == 5);
+}
+
+class Tester : public pe::Task<void, Tester>
+{
+    using Task<void, Tester>::Task;
+
+    virtual Tester::handle_type Run()
+    {
+        pe::ioprint(pe::TextColor::eYellow, "Testing parallel propagation...");
+
+        /* Every level holds the same number of nodes, each
+         * offset by one unit from its parent.
+         */
+        constexpr std::size_t level_size = kNumWideNodes / kNumWideLevels;
+        auto nodes = std::make_unique<Node[]>(kNumWideNodes);
+        for(std::size_t i = 0; i < kNumWideNodes; i++) {
+            if(i >= level_size)
+                set_parent(nodes[i], nodes[i - level_size]);
+            set_local(nodes[i], pe::Mat4f::Translate({1.0f, 0.0f, static_cast<float>(i % 7)}));
+        }
+
+        pe::TransformHierarchy<> hierarchy{};
+        co_await pe::PropagateTransforms<>::Create(Scheduler(), pe::Priority::eNormal,
+            pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, hierarchy);
+        pe::assert(hierarchy.Depth() == kNumWideLevels);
+
+        for(std::size_t i = 0; i < kNumWideNodes; i++) {
+            auto translation = pe::Vec3f{};
+            for(std::size_t j = i % level_size; j <= i; j += level_size) {
+                translation += pe::Vec3f{1.0f, 0.0f, static_cast<float>(j % 7)};
+            }
+            pe::assert(world(nodes[i]) == pe::Mat4f::Translate(translation),
+                "Parallel propagation mismatch");
+        }
+
+        /* Move one root and check that its whole chain follows */
+        set_local(nodes[0], pe::Mat4f::Translate({0.0f, 10.0f, 0.0f}));
+        co_await pe::PropagateTransforms<>::Create(Scheduler(), pe::Priority::eNormal,
+            pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, hierarchy);
+        for(std::size_t i = 0; i < kNumWideNodes; i += level_size) {
+            pe::Vec3f expected{static_cast<float>(i / level_size), 10.0f, 0.0f};
+            for(std::size_t j = level_size; j <= i; j += level_size) {
+                expected += pe::Vec3f{0.0f, 0.0f, static_cast<float>(j % 7)};
+            }
+            pe::assert(world(nodes[i]) == pe::Mat4f::Translate(expected),
+                "Dirty subtree was not propagated");
+        }
+
+        pe::ioprint(pe::TextColor::eYellow, "Testing parallel propagation finished");
+        Broadcast<pe::EventType::eQuit>();
+        co_return;
+    }
+};
+
+int main()
+{
+    int ret = EXIT_SUCCESS;
+    try{
+
+        pe::ioprint(pe::TextColor::eGreen, "Starting Transform test.");
+        test_hierarchy();
+        {
+            pe::Scheduler scheduler{};
+            auto tester = Tester::Create(scheduler);
+            scheduler.Run();
+        }
+        pe::ioprint(pe::TextColor::eGreen, "Finished Transform test.");
+
+    }catch(pe::TaskException &e) {
+
+        e.Print();
+        ret = EXIT_FAILURE;
+
+    }catch(std::exception &e){
+
+        pe::ioprint(pe::LogLevel::eError, "Unhandled std::exception:", e.what());
+        ret = EXIT_FAILURE;
+
+    }catch(...){
+
+        pe::ioprint(pe::LogLevel::eError, "Unknown unhandled exception.");
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
@@ -0,0 +1,193 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+import transform;
+import ecs;
+import sync;
+import nvector;
+import nmatrix;
+import logger;
+import event;
+import benchmark;
+
+import <cstdlib>;
+import <cstdint>;
+import <memory>;
+import <string>;
+import <array>;
+import <algorithm>;
+import <exception>;
+
+
+constexpr std::size_t kNumNodes = 1'000'000;
+constexpr std::array kDepths{std::size_t{2}, std::size_t{8}, std::size_t{32}, std::size_t{128}};
+
+struct Node
+    : public pe::Entity<Node, pe::World<>>
+    , public pe::WithComponent<Node, pe::Transform>
+    , public pe::WithComponent<Node, pe::Parent>
+{};
+
+struct XorShift
+{
+    uint64_t m_state;
+
+    XorShift(std::size_t seed)
+        : m_state{0x9E3779B97F4A7C15ull * (seed + 1)}
+    {}
+
+    uint64_t operator()()
+    {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+        return m_state;
+    }
+};
+
+/* Split the nodes into 'depth' equally-sized levels and
+ * attach every node to a random node of the previous level.
+ */
+void make_hierarchy(Node *nodes, std::size_t depth)
+{
+    XorShift rng{depth};
+    std::size_t level_size = kNumNodes / depth;
+    for(std::size_t i = 0; i < kNumNodes; i++) {
+        std::size_t level = std::min(i / level_size, depth - 1);
+        pe::entity_t parent = pe::Parent::kNone;
+        if(level > 0) {
+            std::size_t first = (level - 1) * level_size;
+            parent = nodes[first + rng() % level_size].m_id;
+        }
+        nodes[i].Set<pe::Parent>(pe::Parent{parent});
+    }
+}
+
+/* Mark every n-th root dirty, along with its whole subtree.
+ */
+void touch_roots(Node *nodes, std::size_t depth, std::size_t stride, float offset)
+{
+    std::size_t level_size = kNumNodes / depth;
+    for(std::size_t i = 0; i < level_size; i += stride) {
+        auto transform = nodes[i].Get<pe::Transform>();
+        transform.SetLocal(pe::Mat4f::Translate({offset, 0.0f, 0.0f}));
+        nodes[i].Set<pe::Transform>(std::move(transform));
+    }
+}
+
+class Tester : public pe::Task<void, Tester, pe::BenchmarkSuite&>
+{
+    using pe::Task<void, Tester, pe::BenchmarkSuite&>::Task;
+
+    struct DirtyMode
+    {
+        const char  *m_name;
+        std::size_t  m_stride;
+    };
+
+    static constexpr std::array kDirtyModes{
+        DirtyMode{"all",  1},
+        DirtyMode{"1%",   100},
+        DirtyMode{"none", 0}
+    };
+
+    virtual Tester::handle_type Run(pe::BenchmarkSuite& suite)
+    {
+        pe::ioprint(pe::TextColor::eYellow, "Creating", kNumNodes, "nodes...");
+        auto nodes = std::make_unique<Node[]>(kNumNodes);
+        for(std::size_t i = 0; i < kNumNodes; i++) {
+            auto transform = nodes[i].Get<pe::Transform>();
+            transform.SetLocal(pe::Mat4f::RotateXYZ({0.01f * (i % 100), 0.0f, 0.0f}));
+            nodes[i].Set<pe::Transform>(std::move(transform));
+        }
+
+        pe::TransformHierarchy<> hierarchy{};
+        for(auto depth : kDepths) {
+
+            pe::ioprint(pe::TextColor::eYellow, "Starting propagation benchmark with depth",
+                depth, pe::fmt::cat{}, "...");
+            make_hierarchy(nodes.get(), depth);
+            hierarchy.Invalidate();
+            hierarchy.Update();
+
+            for(const auto& dirty : kDirtyModes) {
+            for(bool parallel : {false, true}) {
+
+                auto bench = suite.Case("propagate", {
+                    {"depth", std::to_string(depth)},
+                    {"dirty", dirty.m_name},
+                    {"mode", parallel ? "parallel" : "serial"}
+                });
+                float offset = 0.0f;
+                while(bench.Next()) {
+                    if(dirty.m_stride > 0)
+                        touch_roots(nodes.get(), depth, dirty.m_stride, offset++);
+                    bench.Start();
+                    if(parallel) {
+                        co_await pe::PropagateTransforms<>::Create(Scheduler(),
+                            pe::Priority::eHigh, pe::CreateMode::eLaunchAsync,
+                            pe::Affinity::eAny, hierarchy);
+                    }else{
+                        hierarchy.Update();
+                    }
+                    bench.Stop(kNumNodes);
+                }
+            }}
+        }
+
+        Broadcast<pe::EventType::eQuit>();
+        co_return;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_SUCCESS;
+    try{
+
+        pe::ioprint(pe::TextColor::eGreen, "Starting Transform benchmark.");
+
+        pe::BenchmarkSuite suite{"transform", argc, argv};
+        {
+            pe::Scheduler scheduler{};
+            auto tester = Tester::Create(scheduler, pe::Priority::eNormal,
+                pe::CreateMode::eLaunchAsync, pe::Affinity::eAny, suite);
+            scheduler.Run();
+        }
+        suite.Finish();
+
+        pe::ioprint(pe::TextColor::eGreen, "Finished Transform benchmark.");
+
+    }catch(pe::TaskException &e){
+
+        e.Print();
+        ret = EXIT_FAILURE;
+
+    }catch(std::exception &e){
+
+        pe::ioprint(pe::LogLevel::eError, "Unhandled std::exception:", e.what());
+        ret = EXIT_FAILURE;
+
+    }catch(...){
+
+        pe::ioprint(pe::LogLevel::eError, "Unknown unhandled exception.");
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
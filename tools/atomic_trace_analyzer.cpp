@@ -0,0 +1,399 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Offline contention analysis of a binary atomic trace dump,
+ * as produced by 'pe::DumpAtomicTrace':
+ *
+ *  ./tools/bin/atomic_trace_analyzer trace.bin [top_n]
+ *
+ * The following is reported:
+ *
+ *  1. CAS success/failure counts per memory location and per
+ *     traced atomic type.
+ *  2. Time spent in traced functions (between FunctionEnter
+ *     and FunctionReturn records), and how much of it was
+ *     spent in calls that had to retry a failed CAS.
+ *  3. Cross-core cache line transfers. Every time a line is
+ *     accessed from a different core than the previous access,
+ *     with at least one of the two being a write, the line had
+ *     to migrate between the caches.
+ */
+
+import atomic_trace;
+import logger;
+
+import <cstdlib>;
+import <cstdint>;
+import <string>;
+import <vector>;
+import <unordered_map>;
+import <unordered_set>;
+import <algorithm>;
+import <ranges>;
+import <exception>;
+
+
+constexpr std::size_t kDefaultTopN = 20;
+constexpr uint64_t kCacheLineMask = ~uint64_t{63};
+
+/*****************************************************************************/
+/* CAS CONTENTION                                                            */
+/*****************************************************************************/
+
+struct CASStats
+{
+    uint64_t    m_addr;
+    std::string m_name;
+    std::string m_type_name;
+    uint64_t    m_successes;
+    uint64_t    m_failures;
+    uint64_t    m_cycles;
+
+    double FailureRate() const
+    {
+        uint64_t total = m_successes + m_failures;
+        return (total > 0) ? (static_cast<double>(m_failures) / total) : 0.0;
+    }
+};
+
+/*****************************************************************************/
+/* RETRY LOOPS                                                               */
+/*****************************************************************************/
+
+struct FunctionStats
+{
+    std::string m_name;
+    uint64_t    m_calls;
+    uint64_t    m_cycles;
+    uint64_t    m_retried_calls;
+    uint64_t    m_retried_cycles;
+    uint64_t    m_cas_failures;
+};
+
+struct OpenCall
+{
+    std::string m_name;
+    uint64_t    m_tsc_start;
+    uint64_t    m_cas_failures;
+};
+
+/*****************************************************************************/
+/* CACHE LINE PING-PONG                                                      */
+/*****************************************************************************/
+
+struct LineAccess
+{
+    uint64_t m_tsc;
+    uint64_t m_line;
+    uint32_t m_cpu;
+    bool     m_write;
+    uint32_t m_thread;
+};
+
+struct LineStats
+{
+    uint64_t                        m_line;
+    uint64_t                        m_accesses;
+    uint64_t                        m_transfers;
+    uint32_t                        m_last_cpu;
+    bool                            m_last_write;
+    std::unordered_set<uint32_t>    m_cpus;
+    std::unordered_set<uint32_t>    m_threads;
+    std::unordered_set<std::string> m_names;
+};
+
+/* A failed CAS still acquires the line in the exclusive state,
+ * so every operation except for a load counts as a write.
+ */
+bool is_write(pe::AtomicOp op)
+{
+    return (op != pe::AtomicOp::eLoad);
+}
+
+/*****************************************************************************/
+/* ANALYSIS                                                                  */
+/*****************************************************************************/
+
+class Analyzer
+{
+private:
+
+    const pe::AtomicTraceDump&                     m_dump;
+    std::unordered_map<uint64_t, CASStats>         m_cas_by_addr;
+    std::unordered_map<std::string, CASStats>      m_cas_by_type;
+    std::unordered_map<std::string, FunctionStats> m_functions;
+    std::unordered_map<uint64_t, LineStats>        m_lines;
+
+    double to_usec(uint64_t cycles) const
+    {
+        if(m_dump.m_tsc_mhz == 0)
+            return 0.0;
+        return static_cast<double>(cycles) / m_dump.m_tsc_mhz;
+    }
+
+    void analyze_cas(const pe::AtomicTraceRecord& record)
+    {
+        if(record.m_op != pe::AtomicOp::eCompareExchange)
+            return;
+
+        uint64_t cycles = record.m_tsc_end - record.m_tsc_start;
+        auto update = [&](CASStats& stats){
+            if(stats.m_name.empty()) {
+                stats.m_addr = record.m_addr;
+                stats.m_name = record.m_name;
+                stats.m_type_name = record.m_type_name;
+            }
+            if(record.m_cas_succeeded)
+                stats.m_successes++;
+            else
+                stats.m_failures++;
+            stats.m_cycles += cycles;
+        };
+        update(m_cas_by_addr[record.m_addr]);
+        update(m_cas_by_type[record.m_type_name]);
+    }
+
+    void analyze_calls(const pe::AtomicTraceThread& thread)
+    {
+        std::vector<OpenCall> stack;
+        for(const auto& record : thread.m_records) {
+            switch(record.m_op) {
+            case pe::AtomicOp::eFunctionEnter:
+                stack.push_back({record.m_name, record.m_tsc_start, 0});
+                break;
+            case pe::AtomicOp::eFunctionReturn: {
+                /* Unwind to the matching call. Entries without a
+                 * match have been overwritten in the ring.
+                 */
+                auto it = std::find_if(stack.rbegin(), stack.rend(), [&](const OpenCall& call){
+                    return call.m_name == record.m_name;
+                });
+                if(it == stack.rend())
+                    break;
+                OpenCall call = *it;
+                stack.erase(std::next(it).base(), stack.end());
+
+                auto& stats = m_functions[call.m_name];
+                stats.m_name = call.m_name;
+                uint64_t cycles = record.m_tsc_end - call.m_tsc_start;
+                stats.m_calls++;
+                stats.m_cycles += cycles;
+                stats.m_cas_failures += call.m_cas_failures;
+                if(call.m_cas_failures > 0) {
+                    stats.m_retried_calls++;
+                    stats.m_retried_cycles += cycles;
+                }
+                /* Failures are attributed to all enclosing calls */
+                for(auto& outer : stack) {
+                    outer.m_cas_failures += call.m_cas_failures;
+                }
+                break;
+            }
+            case pe::AtomicOp::eCompareExchange:
+                if(!record.m_cas_succeeded && !stack.empty())
+                    stack.back().m_cas_failures++;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    void analyze_lines()
+    {
+        std::vector<LineAccess> accesses;
+        for(uint32_t i = 0; i < std::size(m_dump.m_threads); i++) {
+            for(const auto& record : m_dump.m_threads[i].m_records) {
+                if(record.m_addr == 0)
+                    continue;
+                accesses.push_back({record.m_tsc_start, record.m_addr & kCacheLineMask,
+                    record.m_cpuid_start, is_write(record.m_op), i});
+            }
+        }
+        /* With an invariant TSC, timestamps are comparable across cores */
+        std::sort(std::begin(accesses), std::end(accesses), [](const auto& a, const auto& b){
+            return a.m_tsc < b.m_tsc;
+        });
+
+        for(const auto& access : accesses) {
+            auto [it, inserted] = m_lines.try_emplace(access.m_line);
+            auto& stats = it->second;
+            if(inserted) {
+                stats.m_line = access.m_line;
+            }else if(stats.m_last_cpu != access.m_cpu && (stats.m_last_write || access.m_write)) {
+                stats.m_transfers++;
+            }
+            stats.m_accesses++;
+            stats.m_last_cpu = access.m_cpu;
+            stats.m_last_write = access.m_write;
+            stats.m_cpus.insert(access.m_cpu);
+            stats.m_threads.insert(access.m_thread);
+        }
+
+        for(const auto& thread : m_dump.m_threads) {
+            for(const auto& record : thread.m_records) {
+                if(record.m_addr == 0)
+                    continue;
+                auto& names = m_lines[record.m_addr & kCacheLineMask].m_names;
+                if(std::size(names) < 4)
+                    names.insert(record.m_name);
+            }
+        }
+    }
+
+    template <typename T, typename Compare>
+    static std::vector<T> top(const auto& map, std::size_t n, Compare compare)
+    {
+        std::vector<T> ret;
+        for(const auto& [key, value] : map) {
+            ret.push_back(value);
+        }
+        std::sort(std::begin(ret), std::end(ret), compare);
+        if(std::size(ret) > n)
+            ret.resize(n);
+        return ret;
+    }
+
+    void print_header(const char *title) const
+    {
+        pe::ioprint_unlocked(pe::TextColor::eYellow, "", false, true);
+        pe::ioprint_unlocked(pe::TextColor::eYellow, "", false, true, title);
+    }
+
+public:
+
+    Analyzer(const pe::AtomicTraceDump& dump)
+        : m_dump{dump}
+    {}
+
+    void Run()
+    {
+        for(const auto& thread : m_dump.m_threads) {
+            for(const auto& record : thread.m_records) {
+                analyze_cas(record);
+            }
+            analyze_calls(thread);
+        }
+        analyze_lines();
+    }
+
+    void Report(std::size_t n) const
+    {
+        using pe::fmt::justified;
+        using pe::fmt::Justify;
+
+        std::size_t nrecords = 0;
+        for(const auto& thread : m_dump.m_threads) {
+            nrecords += std::size(thread.m_records);
+        }
+        pe::ioprint_unlocked(pe::TextColor::eGreen, " ", false, true,
+            "Loaded", nrecords, "records from", std::size(m_dump.m_threads), "threads",
+            "(TSC:", m_dump.m_tsc_mhz, "MHz, invariant:", m_dump.m_invariant_tsc, pe::fmt::cat{}, ")");
+        if(!m_dump.m_invariant_tsc) {
+            pe::ioprint_unlocked(pe::TextColor::eRed, " ", false, true,
+                "Warning: TSC is not invariant, cross-core ordering is unreliable.");
+        }
+
+        auto by_failures = [](const CASStats& a, const CASStats& b){
+            return a.m_failures > b.m_failures;
+        };
+
+        print_header("Top contended CAS locations:");
+        pe::ioprint_unlocked(pe::TextColor::eWhite, "", false, true,
+            justified{"address", 16}, justified{"name", 16}, justified{"success", 12},
+            justified{"failure", 12}, justified{"fail %", 10}, justified{"usec", 12});
+        for(const auto& stats : top<CASStats>(m_cas_by_addr, n, by_failures)) {
+            pe::ioprint_unlocked(pe::TextColor::eWhite, "", false, true,
+                justified{std::string{pe::fmt::hex{stats.m_addr}}, 16},
+                justified{stats.m_name, 16}, justified{stats.m_successes, 12},
+                justified{stats.m_failures, 12}, justified{stats.FailureRate() * 100.0, 10},
+                justified{to_usec(stats.m_cycles), 12});
+        }
+
+        print_header("CAS contention by atomic type:");
+        for(const auto& stats : top<CASStats>(m_cas_by_type, n, by_failures)) {
+            pe::ioprint_unlocked(pe::TextColor::eWhite, "", false, true,
+                justified{stats.m_successes, 12}, justified{stats.m_failures, 12},
+                justified{stats.FailureRate() * 100.0, 10}, "  ", stats.m_type_name);
+        }
+
+        print_header("Time in traced functions:");
+        pe::ioprint_unlocked(pe::TextColor::eWhite, "", false, true,
+            justified{"function", 24}, justified{"calls", 10}, justified{"usec", 12},
+            justified{"retried", 10}, justified{"retry usec", 12}, justified{"failed CAS", 12});
+        for(const auto& stats : top<FunctionStats>(m_functions, n,
+            [](const FunctionStats& a, const FunctionStats& b){
+                return a.m_retried_cycles > b.m_retried_cycles;
+            })) {
+            pe::ioprint_unlocked(pe::TextColor::eWhite, "", false, true,
+                justified{stats.m_name.substr(0, 23), 24}, justified{stats.m_calls, 10},
+                justified{to_usec(stats.m_cycles), 12}, justified{stats.m_retried_calls, 10},
+                justified{to_usec(stats.m_retried_cycles), 12},
+                justified{stats.m_cas_failures, 12});
+        }
+
+        print_header("Top cache lines by cross-core transfers:");
+        pe::ioprint_unlocked(pe::TextColor::eWhite, "", false, true,
+            justified{"line", 16}, justified{"accesses", 12}, justified{"transfers", 12},
+            justified{"cpus", 6}, justified{"threads", 8}, "  names");
+        for(const auto& stats : top<LineStats>(m_lines, n,
+            [](const LineStats& a, const LineStats& b){
+                return a.m_transfers > b.m_transfers;
+            })) {
+            std::string names;
+            for(const auto& name : stats.m_names) {
+                names += (names.empty() ? "" : ",") + name;
+            }
+            pe::ioprint_unlocked(pe::TextColor::eWhite, "", false, true,
+                justified{std::string{pe::fmt::hex{stats.m_line}}, 16},
+                justified{stats.m_accesses, 12}, justified{stats.m_transfers, 12},
+                justified{std::size(stats.m_cpus), 6}, justified{std::size(stats.m_threads), 8},
+                "  ", names);
+        }
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_SUCCESS;
+    try{
+
+        if(argc < 2) {
+            pe::ioprint(pe::LogLevel::eError, "Usage:", argv[0], "<trace file> [top_n]");
+            return EXIT_FAILURE;
+        }
+        std::size_t n = (argc > 2) ? std::stoul(argv[2]) : kDefaultTopN;
+
+        auto dump = pe::ReadAtomicTraceDump(argv[1]);
+        Analyzer analyzer{dump};
+        analyzer.Run();
+        analyzer.Report(n);
+
+    }catch(std::exception &e){
+
+        pe::ioprint(pe::LogLevel::eError, "Unhandled std::exception:", e.what());
+        ret = EXIT_FAILURE;
+
+    }catch(...){
+
+        pe::ioprint(pe::LogLevel::eError, "Unknown unhandled exception.");
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
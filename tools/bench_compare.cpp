@@ -0,0 +1,76 @@
+/*
+ *  This file is part of Peredvizhnikov Engine
+ *  Copyright (C) 2023 Eduard Permyakov 
+ *
+ *  Peredvizhnikov Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Peredvizhnikov Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Compare two benchmark result files, as written out by the
+ * benchmark suites with the '--json' option:
+ *
+ *  ./test/bin/sched_benchmark --json base.json
+ *  ... apply changes ...
+ *  ./test/bin/sched_benchmark --json new.json
+ *  ./tools/bin/bench_compare base.json new.json [threshold_pct]
+ *
+ * The median throughput (or run time) of every case is compared,
+ * and any case that got worse by more than the threshold (5% by
+ * default) is reported as a regression. The exit status is non-zero
+ * if there were any regressions, so that the tool can be used in
+ * scripts.
+ */
+
+import benchmark;
+import logger;
+
+import <cstdlib>;
+import <string>;
+import <exception>;
+
+
+constexpr double kDefaultThresholdPct = 5.0;
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_SUCCESS;
+    try{
+
+        if(argc < 3) {
+            pe::ioprint(pe::LogLevel::eError, "Usage:", argv[0],
+                "<base results> <new results> [threshold_pct]");
+            return EXIT_FAILURE;
+        }
+        double threshold = (argc > 3) ? std::stod(argv[3]) : kDefaultThresholdPct;
+
+        std::size_t nregressions = pe::CompareBenchmarkResults(argv[1], argv[2], threshold);
+        if(nregressions > 0) {
+            pe::ioprint(pe::TextColor::eRed, "Found", nregressions, "regression(s).");
+            ret = EXIT_FAILURE;
+        }else{
+            pe::ioprint(pe::TextColor::eGreen, "No regressions found.");
+        }
+
+    }catch(std::exception &e){
+
+        pe::ioprint(pe::LogLevel::eError, "Unhandled std::exception:", e.what());
+        ret = EXIT_FAILURE;
+
+    }catch(...){
+
+        pe::ioprint(pe::LogLevel::eError, "Unknown unhandled exception.");
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}